@@ -37,6 +37,7 @@
 #include <sysexits.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <time.h>
 
 #include "vmmapi.h"
 #include "sw_load.h"
@@ -87,12 +88,14 @@ char *mac_seed;
 bool stdio_in_use;
 bool lapic_pt;
 bool is_rtvm;
+bool hv_rtc;
 bool is_winvm;
 bool skip_pci_mem64bar_workaround = false;
 
 static int guest_ncpus;
 static int virtio_msix = 1;
 static bool debugexit_enabled;
+static bool warm;
 static char mac_seed_str[50];
 static int pm_notify_channel;
 
@@ -141,7 +144,7 @@ usage(int code)
 		"       %*s [--vtpm2 sock_path] [--virtio_poll interval] [--mac_seed seed_string]\n"
 		"       %*s [--vmcfg sub_options] [--dump vm_idx] [--debugexit] \n"
 		"       %*s [--logger-setting param_setting] [--pm_notify_channel]\n"
-		"       %*s [--pm_by_vuart vuart_node] <vm>\n"
+		"       %*s [--pm_by_vuart vuart_node] [--warm] <vm>\n"
 		"       -A: create ACPI tables\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
@@ -173,9 +176,12 @@ usage(int code)
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
 		"       --lapic_pt: enable local apic passthrough\n"
 		"       --rtvm: indicate that the guest is rtvm\n"
+		"       --hv_rtc: emulate the RTC in hypervisor instead of device model\n"
 		"       --logger_setting: params like console,level=4;kmsg,level=3\n"
 		"       --pm_notify_channel: define the channel used to notify guest about power event\n"
 		"       --pm_by_vuart:pty,/run/acrn/vuart_vmname or tty,/dev/ttySn\n"
+		"       --warm: get ready to boot, then wait for a DM_CONTINUE from the\n"
+		"            monitor, also set by ACRN_DM_WARM=1 in the environment\n"
 		"       --windows: support Oracle virtio-blk, virtio-net and virtio-input devices\n"
 		"            for windows guest with secure boot\n",
 		progname, (int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
@@ -456,9 +462,11 @@ vm_init_vdevs(struct vmctx *ctx)
 
 	guest_pm_notify_init(ctx);
 
-	ret = vrtc_init(ctx);
-	if (ret < 0)
-		goto vrtc_fail;
+	if (!hv_rtc) {
+		ret = vrtc_init(ctx);
+		if (ret < 0)
+			goto vrtc_fail;
+	}
 
 	ret = vpit_init(ctx);
 	if (ret < 0)
@@ -495,7 +503,8 @@ monitor_fail:
 vhpet_fail:
 	vpit_deinit(ctx);
 vpit_fail:
-	vrtc_deinit(ctx);
+	if (!hv_rtc)
+		vrtc_deinit(ctx);
 vrtc_fail:
 	guest_pm_notify_deinit(ctx);
 	atkbdc_deinit(ctx);
@@ -521,7 +530,8 @@ vm_deinit_vdevs(struct vmctx *ctx)
 
 	vhpet_deinit(ctx);
 	vpit_deinit(ctx);
-	vrtc_deinit(ctx);
+	if (!hv_rtc)
+		vrtc_deinit(ctx);
 	guest_pm_notify_deinit(ctx);
 	atkbdc_deinit(ctx);
 	pci_irq_deinit(ctx);
@@ -556,7 +566,8 @@ vm_reset_vdevs(struct vmctx *ctx)
 
 	vhpet_deinit(ctx);
 	vpit_deinit(ctx);
-	vrtc_deinit(ctx);
+	if (!hv_rtc)
+		vrtc_deinit(ctx);
 
 	deinit_pci(ctx);
 	pci_irq_deinit(ctx);
@@ -564,7 +575,8 @@ vm_reset_vdevs(struct vmctx *ctx)
 
 	pci_irq_init(ctx);
 	atkbdc_init(ctx);
-	vrtc_init(ctx);
+	if (!hv_rtc)
+		vrtc_init(ctx);
 	vpit_init(ctx);
 	vhpet_init(ctx);
 
@@ -707,6 +719,21 @@ num_vcpus_allowed(struct vmctx *ctx)
 	return VM_MAXCPU;
 }
 
+/* milliseconds since *ts, which is moved to now */
+static unsigned long
+lap_ms(struct timespec *ts)
+{
+	struct timespec now;
+	unsigned long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - ts->tv_sec) * 1000 +
+		(now.tv_nsec - ts->tv_nsec) / 1000000;
+	*ts = now;
+
+	return ms;
+}
+
 static void
 sig_handler_term(int signo)
 {
@@ -729,10 +756,12 @@ enum {
 	CMD_OPT_VTPM2,
 	CMD_OPT_LAPIC_PT,
 	CMD_OPT_RTVM,
+	CMD_OPT_HV_RTC,
 	CMD_OPT_LOGGER_SETTING,
 	CMD_OPT_PM_NOTIFY_CHANNEL,
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
+	CMD_OPT_WARM,
 };
 
 static struct option long_options[] = {
@@ -767,10 +796,12 @@ static struct option long_options[] = {
 	{"vtpm2",		required_argument,	0, CMD_OPT_VTPM2},
 	{"lapic_pt",		no_argument,		0, CMD_OPT_LAPIC_PT},
 	{"rtvm",		no_argument,		0, CMD_OPT_RTVM},
+	{"hv_rtc",		no_argument,		0, CMD_OPT_HV_RTC},
 	{"logger_setting",	required_argument,	0, CMD_OPT_LOGGER_SETTING},
 	{"pm_notify_channel",	required_argument,	0, CMD_OPT_PM_NOTIFY_CHANNEL},
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
+	{"warm",		no_argument,		0, CMD_OPT_WARM},
 	{0,			0,			0,  0  },
 };
 
@@ -784,6 +815,8 @@ main(int argc, char *argv[])
 	struct vmctx *ctx;
 	size_t memsize;
 	int option_idx = 0;
+	struct timespec lap;
+	unsigned long create_ms, mem_ms, dev_ms, load_ms, wait_ms;
 
 	progname = basename(argv[0]);
 	memsize = 256 * MB;
@@ -906,6 +939,9 @@ main(int argc, char *argv[])
 		case CMD_OPT_RTVM:
 			is_rtvm = true;
 			break;
+		case CMD_OPT_HV_RTC:
+			hv_rtc = true;
+			break;
 		case CMD_OPT_VTPM2:
 			if (acrn_parse_vtpm2(optarg) != 0)
 				errx(EX_USAGE, "invalid vtpm2 param %s", optarg);
@@ -934,6 +970,9 @@ main(int argc, char *argv[])
 		case CMD_OPT_WINDOWS:
 			is_winvm = true;
 			break;
+		case CMD_OPT_WARM:
+			warm = true;
+			break;
 		case 'h':
 			usage(0);
 		default:
@@ -952,12 +991,16 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (monitor_warm_requested())
+		warm = true;
+
 	if (!init_hugetlb()) {
 		pr_err("init_hugetlb failed\n");
 		exit(1);
 	}
 
 	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &lap);
 		pr_notice("vm_create: %s\n", vmname);
 		ctx = vm_create(vmname, (unsigned long)vhm_req_buf, &guest_ncpus);
 		if (!ctx) {
@@ -976,6 +1019,7 @@ main(int argc, char *argv[])
 				guest_ncpus, max_vcpus);
 			goto fail;
 		}
+		create_ms = lap_ms(&lap);
 
 		pr_notice("vm_setup_memory: size=0x%lx\n", memsize);
 		error = vm_setup_memory(ctx, memsize);
@@ -983,6 +1027,7 @@ main(int argc, char *argv[])
 			pr_err("Unable to setup memory (%d)\n", errno);
 			goto fail;
 		}
+		mem_ms = lap_ms(&lap);
 
 		error = mevent_init();
 		if (error) {
@@ -995,6 +1040,7 @@ main(int argc, char *argv[])
 			pr_err("Unable to init vdev (%d)\n", errno);
 			goto dev_fail;
 		}
+		dev_ms = lap_ms(&lap);
 
 		/*
 		 * build the guest tables, MP etc.
@@ -1020,6 +1066,21 @@ main(int argc, char *argv[])
 			pr_err("acrn_sw_load failed, error=%d\n", error);
 			goto vm_fail;
 		}
+		load_ms = lap_ms(&lap);
+
+		/*
+		 * A warm DM waits here until it is bound to a start request,
+		 * then boots as a cold one would. Only the first boot waits.
+		 */
+		wait_ms = 0;
+		if (warm) {
+			warm = false;
+			if (monitor_wait_start() < 0) {
+				ret = 0;
+				goto vm_fail;
+			}
+			wait_ms = lap_ms(&lap);
+		}
 
 		/*
 		 * Change the proc title to include the VM name.
@@ -1035,6 +1096,9 @@ main(int argc, char *argv[])
 			pr_err("add_cpu failed, error=%d\n", error);
 			goto vm_fail;
 		}
+		pr_notice("start time (ms): create %lu, memory %lu, devices %lu, "
+			"load %lu, warm wait %lu, vcpu %lu\n", create_ms, mem_ms,
+			dev_ms, load_ms, wait_ms, lap_ms(&lap));
 
 		/* Make a copy for ctx */
 		_ctx = ctx;
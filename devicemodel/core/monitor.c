@@ -10,11 +10,14 @@
  * Author: TaoYuhong <yuhong.tao@intel.com>
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <pthread.h>
 #include "dm.h"
@@ -22,6 +25,7 @@
 #include "monitor.h"
 #include "acrn_mngr.h"
 #include "pm.h"
+#include "precopy.h"
 #include "vmmapi.h"
 #include "log.h"
 
@@ -339,7 +343,117 @@ static void name(struct mngr_msg *msg, int client_fd, void *param)	\
 
 DEFINE_HANDLER(handle_suspend, suspend);
 DEFINE_HANDLER(handle_pause, pause);
-DEFINE_HANDLER(handle_continue, unpause);
+DEFINE_HANDLER(_handle_continue, unpause);
+
+/*
+ * Warm start: a DM launched with --warm, or with ACRN_DM_WARM_ENV set by
+ * acrnd, does everything up to running the first vCPU (guest memory
+ * reserved and touched, devices initialized, boot images loaded) and
+ * then waits in monitor_wait_start(), reporting DM_STATE_WARM. DM_CONTINUE
+ * binds it: the VM boots at once. DM_STOP makes it exit. The guest is not
+ * running yet, so the other vm_ops are left out.
+ */
+enum {
+	WARM_NONE,
+	WARM_WAITING,
+	WARM_GO,
+	WARM_STOP,
+};
+
+static pthread_mutex_t warm_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warm_cond = PTHREAD_COND_INITIALIZER;
+static int warm_state = WARM_NONE;
+
+static int monitor_warm_release(int how)
+{
+	int released = 0;
+
+	pthread_mutex_lock(&warm_mtx);
+	if (warm_state == WARM_WAITING) {
+		warm_state = how;
+		pthread_cond_signal(&warm_cond);
+		released = 1;
+	}
+	pthread_mutex_unlock(&warm_mtx);
+
+	return released;
+}
+
+int monitor_warm_requested(void)
+{
+	const char *env = getenv(ACRN_DM_WARM_ENV);
+
+	return env && strcmp(env, "0");
+}
+
+/* returns 0 to boot the VM, -1 to exit */
+int monitor_wait_start(void)
+{
+	struct timespec ts;
+	int how;
+
+	pthread_mutex_lock(&warm_mtx);
+	warm_state = WARM_WAITING;
+	pthread_mutex_unlock(&warm_mtx);
+	monitor_notify_state();
+
+	pr_notice("%s: warm, waiting to be started\n", vmname);
+	pthread_mutex_lock(&warm_mtx);
+	while (warm_state == WARM_WAITING) {
+		/* SIGINT/SIGHUP only set the suspend mode */
+		if (vm_get_suspend_mode() == VM_SUSPEND_POWEROFF) {
+			warm_state = WARM_STOP;
+			break;
+		}
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		pthread_cond_timedwait(&warm_cond, &warm_mtx, &ts);
+	}
+	how = warm_state;
+	warm_state = WARM_NONE;
+	pthread_mutex_unlock(&warm_mtx);
+	monitor_notify_state();
+
+	return how == WARM_GO ? 0 : -1;
+}
+
+static void handle_continue(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+
+	if (!monitor_warm_release(WARM_GO)) {
+		_handle_continue(msg, client_fd, param);
+		return;
+	}
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	ack.data.err = 0;
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static int monitor_query_state(void)
+{
+	struct vm_ops *ops;
+	int state = -1;
+
+	pthread_mutex_lock(&warm_mtx);
+	if (warm_state == WARM_WAITING)
+		state = DM_STATE_WARM;
+	pthread_mutex_unlock(&warm_mtx);
+	if (state == DM_STATE_WARM)
+		return state;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->query) {
+			state = ops->ops->query(ops->arg);
+			break;
+		}
+	}
+
+	return state;
+}
 
 static void handle_stop(struct mngr_msg *msg, int client_fd, void *param)
 {
@@ -352,7 +466,9 @@ static void handle_stop(struct mngr_msg *msg, int client_fd, void *param)
 	ack.msgid = msg->msgid;
 	ack.timestamp = msg->timestamp;
 
-	if (msg->data.acrnd_stop.force && !is_rtvm) {
+	if (monitor_warm_release(WARM_STOP)) {
+		ack.data.err = 0;
+	} else if (msg->data.acrnd_stop.force && !is_rtvm) {
 		vm_set_suspend_mode(VM_SUSPEND_POWEROFF);
 		ack.data.err = 0;
 	} else {
@@ -405,19 +521,11 @@ static void handle_resume(struct mngr_msg *msg, int client_fd, void *param)
 static void handle_query(struct mngr_msg *msg, int client_fd, void *param)
 {
 	struct mngr_msg ack;
-	struct vm_ops *ops;
 
 	ack.magic = MNGR_MSG_MAGIC;
 	ack.msgid = msg->msgid;
 	ack.timestamp = msg->timestamp;
-	ack.data.state = -1;
-
-	LIST_FOREACH(ops, &vm_ops_head, list) {
-		if (ops->ops->query) {
-			ack.data.state = ops->ops->query(ops->arg);
-			break;
-		}
-	}
+	ack.data.state = monitor_query_state();
 
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
@@ -451,6 +559,118 @@ static void handle_blkrescan(struct mngr_msg *msg, int client_fd, void *param)
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
 
+static void handle_precopy(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = -1;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	msg->data.devargs[PARAM_LEN - 1] = '\0';
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->precopy) {
+			ret = ops->ops->precopy(ops->arg, msg->data.devargs);
+			break;
+		}
+	}
+
+	ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+/*
+ * DM_NOTIFY subscribes the connection to the state changes: it is acked
+ * with the current state, as DM_QUERY, then a DM_NOTIFY carrying the new
+ * state is pushed on the same connection each time it changes. acrnd keeps
+ * such a connection to every DM instead of polling them. There is one
+ * subscriber, the last one; the connection belongs to the mngr server, so
+ * its peer pid is checked before each push in case the fd was reused.
+ */
+static pthread_mutex_t notify_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int notify_client_fd = -1;
+static pid_t notify_client_pid;
+static int notify_evfd = -1;
+static pthread_t notify_tid;
+
+static pid_t peer_pid(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return -1;
+	return cred.pid;
+}
+
+static void monitor_send_state(void)
+{
+	struct mngr_msg msg;
+
+	msg.magic = MNGR_MSG_MAGIC;
+	msg.msgid = DM_NOTIFY;
+	msg.timestamp = time(NULL);
+	msg.data.state = monitor_query_state();
+
+	pthread_mutex_lock(&notify_mtx);
+	if (notify_client_fd >= 0 &&
+	    (peer_pid(notify_client_fd) != notify_client_pid ||
+	     mngr_send_msg(notify_client_fd, &msg, NULL, ACK_TIMEOUT))) {
+		pr_notice("state subscriber %d is gone\n", notify_client_pid);
+		notify_client_fd = -1;
+	}
+	pthread_mutex_unlock(&notify_mtx);
+}
+
+static void *monitor_notify_thread(void *arg)
+{
+	uint64_t cnt;
+	int state;
+
+	while (1) {
+		if (read(notify_evfd, &cnt, sizeof(cnt)) != sizeof(cnt)) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			break;
+		}
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		monitor_send_state();
+		pthread_setcancelstate(state, NULL);
+	}
+
+	return NULL;
+}
+
+/* may be called from a signal handler */
+void monitor_notify_state(void)
+{
+	uint64_t one = 1;
+
+	if (notify_evfd >= 0 &&
+	    write(notify_evfd, &one, sizeof(one)) != sizeof(one))
+		return;
+}
+
+static void handle_notify(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	pthread_mutex_lock(&notify_mtx);
+	notify_client_fd = client_fd;
+	notify_client_pid = peer_pid(client_fd);
+	ack.data.state = monitor_query_state();
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+	pthread_mutex_unlock(&notify_mtx);
+}
+
 static struct monitor_vm_ops pmc_ops = {
 	.stop       = NULL,
 	.resume     = vm_monitor_resume,
@@ -458,6 +678,7 @@ static struct monitor_vm_ops pmc_ops = {
 	.pause      = NULL,
 	.unpause    = NULL,
 	.query      = vm_monitor_query,
+	.precopy    = vm_monitor_precopy,
 };
 
 int monitor_init(struct vmctx *ctx)
@@ -493,6 +714,8 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_CONTINUE, handle_continue, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_BLKRESCAN, handle_blkrescan, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_PRECOPY, handle_precopy, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_NOTIFY, handle_notify, NULL);
 
 	if (ret) {
 		pr_err("%s %d\r\n", __func__, __LINE__);
@@ -501,6 +724,18 @@ int monitor_init(struct vmctx *ctx)
 
 	monitor_register_vm_ops(&pmc_ops, ctx, "PMC_VM_OPs");
 
+	/* without it, the subscribers only get the state they asked for */
+	notify_evfd = eventfd(0, EFD_CLOEXEC);
+	if (notify_evfd >= 0 &&
+	    pthread_create(&notify_tid, NULL, monitor_notify_thread, NULL)) {
+		close(notify_evfd);
+		notify_evfd = -1;
+	}
+	if (notify_evfd < 0)
+		pr_err("%s: no state notification\n", __func__);
+	else
+		pthread_setname_np(notify_tid, "monitor_notify");
+
 	start_intr_storm_monitor(ctx);
 
 	return 0;
@@ -515,6 +750,13 @@ int monitor_init(struct vmctx *ctx)
 
 void monitor_close(void)
 {
+	if (notify_evfd >= 0) {
+		pthread_cancel(notify_tid);
+		pthread_join(notify_tid, NULL);
+		close(notify_evfd);
+		notify_evfd = -1;
+	}
+
 	if (monitor_fd >= 0)
 		mngr_close(monitor_fd);
 
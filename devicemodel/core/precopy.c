@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Iterative pre-copy of guest RAM driven by the hypervisor dirty page log.
+ *
+ * Round 0 copies all guest RAM while the dirty log is armed. Every later
+ * round fetches and clears the dirty bitmap and copies only the pages written
+ * since the previous round. Once a round gets small enough (or too many rounds
+ * have been done) the VM is paused and a last round makes the image
+ * consistent. The VM is left paused: the caller either stops it once the copy
+ * is in use elsewhere, or discards the image.
+ *
+ * The dirty log only sees writes from the guest. Virtio backends write guest
+ * RAM through the DM mapping, so they mark what they wrote in a DM side
+ * bitmap that every round merges into the fetched log, and they account for
+ * the chains they hold: the last round is only taken once no chain is held,
+ * and taken again if a backend picked one up meanwhile. Devices that write
+ * guest RAM some other way (kernel backends, DMA engines, passthrough)
+ * register themselves and pre-copy is refused while one exists.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "vmmapi.h"
+#include "precopy.h"
+#include "log.h"
+
+#define PRECOPY_PAGE_SHIFT	12U
+#define PRECOPY_PAGE_SIZE	(1UL << PRECOPY_PAGE_SHIFT)
+/* dirty log fetches must be 64 pages aligned */
+#define PRECOPY_LOG_ALIGN	(64UL * PRECOPY_PAGE_SIZE)
+
+/* stop iterating once a round copies no more than this many pages */
+#define PRECOPY_STOP_PAGES	1024UL
+#define PRECOPY_MAX_ROUNDS	30U
+
+/* how long backends get to release their chains once the VM is paused */
+#define PRECOPY_IDLE_WAIT_MS	5000U
+/* last rounds to retry when a backend keeps picking up chains */
+#define PRECOPY_MAX_LAST_ROUNDS	8U
+
+struct precopy_region {
+	vm_paddr_t gpa;
+	size_t size;
+	size_t log_size;	/* size rounded up to PRECOPY_LOG_ALIGN */
+	uint64_t *bitmap;
+	uint64_t *dm_bitmap;	/* pages written by the DM, see dm_regions */
+};
+
+/*
+ * Pages written by the DM while a pre-copy runs. Allocated by the first
+ * pre-copy and kept, the device models may still mark them after it ends.
+ */
+static struct precopy_region dm_regions[2];
+static int dm_nr_regions;
+static bool dm_tracking;
+
+/* chains held by the backends, and a count of every get/release */
+static int dma_inflight;
+static uint64_t dma_events;
+
+static const char *untracked_dma;
+
+void
+precopy_mark_dirty(uint64_t gpa, uint64_t len)
+{
+	struct precopy_region *r;
+	uint64_t start, end, pfn;
+	int i;
+
+	if (!__atomic_load_n(&dm_tracking, __ATOMIC_ACQUIRE) || (len == 0UL))
+		return;
+
+	for (i = 0; i < dm_nr_regions; i++) {
+		r = &dm_regions[i];
+		start = (gpa > r->gpa) ? gpa : r->gpa;
+		end = (gpa + len < r->gpa + r->size) ? gpa + len : r->gpa + r->size;
+		if (start >= end)
+			continue;
+
+		for (pfn = (start - r->gpa) >> PRECOPY_PAGE_SHIFT;
+				pfn <= ((end - 1UL - r->gpa) >> PRECOPY_PAGE_SHIFT);
+				pfn++)
+			__atomic_fetch_or(&r->bitmap[pfn >> 6U],
+					1UL << (pfn & 63UL), __ATOMIC_SEQ_CST);
+	}
+}
+
+bool
+precopy_dirty_tracking(void)
+{
+	return __atomic_load_n(&dm_tracking, __ATOMIC_RELAXED);
+}
+
+void
+precopy_dma_begin(void)
+{
+	__atomic_add_fetch(&dma_inflight, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&dma_events, 1UL, __ATOMIC_SEQ_CST);
+}
+
+void
+precopy_dma_end(void)
+{
+	__atomic_add_fetch(&dma_events, 1UL, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&dma_inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+void
+precopy_untracked_dma(const char *name)
+{
+	__atomic_store_n(&untracked_dma, name, __ATOMIC_SEQ_CST);
+}
+
+static int
+precopy_wait_dma_idle(void)
+{
+	uint32_t ms;
+
+	for (ms = 0U; ms < PRECOPY_IDLE_WAIT_MS; ms++) {
+		if (__atomic_load_n(&dma_inflight, __ATOMIC_SEQ_CST) == 0)
+			return 0;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+static int
+precopy_track_dm(struct precopy_region *regions, int nr)
+{
+	size_t len;
+	int i;
+
+	if (dm_nr_regions == 0) {
+		for (i = 0; i < nr; i++) {
+			len = regions[i].log_size >> (PRECOPY_PAGE_SHIFT + 3U);
+			dm_regions[i] = regions[i];
+			dm_regions[i].bitmap = calloc(len, 1);
+			if (dm_regions[i].bitmap == NULL) {
+				while (--i >= 0)
+					free(dm_regions[i].bitmap);
+				return -1;
+			}
+		}
+		dm_nr_regions = nr;
+	} else {
+		/* the DM never remaps guest RAM, no need to handle a change */
+		for (i = 0; i < nr; i++)
+			memset(dm_regions[i].bitmap, 0,
+				regions[i].log_size >> (PRECOPY_PAGE_SHIFT + 3U));
+	}
+
+	for (i = 0; i < nr; i++)
+		regions[i].dm_bitmap = dm_regions[i].bitmap;
+	__atomic_store_n(&dm_tracking, true, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static int
+precopy_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("%s: write failed, errno %d\n", __func__, errno);
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+static int
+precopy_open(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if ((stat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+		if (strnlen(path, sizeof(addr.sun_path)) >= sizeof(addr.sun_path))
+			return -1;
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	} else {
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	}
+
+	return fd;
+}
+
+static int
+precopy_send_run(int fd, struct vmctx *ctx, vm_paddr_t gpa, uint64_t npages)
+{
+	struct precopy_record rec;
+
+	rec.gpa = gpa;
+	rec.npages = npages;
+	if (precopy_write(fd, &rec, sizeof(rec)) < 0)
+		return -1;
+
+	return precopy_write(fd, ctx->baseaddr + gpa,
+			npages << PRECOPY_PAGE_SHIFT);
+}
+
+static int
+precopy_send_marker(int fd, uint64_t marker)
+{
+	struct precopy_record rec;
+
+	rec.gpa = marker;
+	rec.npages = 0UL;
+
+	return precopy_write(fd, &rec, sizeof(rec));
+}
+
+/* Send every page of the region written since the last fetch */
+static int
+precopy_send_dirty(int fd, struct vmctx *ctx, struct precopy_region *r,
+		uint64_t *count)
+{
+	uint64_t npages = r->size >> PRECOPY_PAGE_SHIFT;
+	uint64_t i, start;
+
+	if (vm_get_dirty_log(ctx, r->gpa, r->log_size, r->bitmap) < 0) {
+		pr_err("%s: failed to fetch dirty log, errno %d\n",
+				__func__, errno);
+		return -1;
+	}
+
+	/* a mark racing with this is sent now or in the next round */
+	for (i = 0UL; i < (r->log_size >> (PRECOPY_PAGE_SHIFT + 6U)); i++)
+		r->bitmap[i] |= __atomic_exchange_n(&r->dm_bitmap[i], 0UL,
+				__ATOMIC_SEQ_CST);
+
+	i = 0UL;
+	while (i < npages) {
+		if (r->bitmap[i >> 6U] == 0UL) {
+			i = (i | 63UL) + 1UL;
+			continue;
+		}
+		if ((r->bitmap[i >> 6U] & (1UL << (i & 63UL))) == 0UL) {
+			i++;
+			continue;
+		}
+
+		start = i;
+		while ((i < npages) &&
+			((r->bitmap[i >> 6U] & (1UL << (i & 63UL))) != 0UL))
+			i++;
+
+		if (precopy_send_run(fd, ctx,
+				r->gpa + (start << PRECOPY_PAGE_SHIFT),
+				i - start) < 0)
+			return -1;
+		*count += i - start;
+	}
+
+	return 0;
+}
+
+static int
+precopy_round(int fd, struct vmctx *ctx, struct precopy_region *regions,
+		int nr, uint64_t *count)
+{
+	int i;
+
+	*count = 0UL;
+	for (i = 0; i < nr; i++) {
+		if (precopy_send_dirty(fd, ctx, &regions[i], count) < 0)
+			return -1;
+	}
+
+	return precopy_send_marker(fd, PRECOPY_ROUND_END);
+}
+
+int
+vm_precopy_ram(struct vmctx *ctx, const char *path)
+{
+	struct precopy_region regions[2];
+	struct precopy_header hdr;
+	uint64_t count = 0UL, events;
+	uint32_t round;
+	int fd, i, nr = 0, ret = -1;
+	const char *untracked;
+
+	untracked = __atomic_load_n(&untracked_dma, __ATOMIC_SEQ_CST);
+	if (untracked != NULL) {
+		pr_err("%s: %s writes guest memory behind the dirty log\n",
+				__func__, untracked);
+		return -1;
+	}
+
+	memset(regions, 0, sizeof(regions));
+	regions[nr].gpa = 0UL;
+	regions[nr].size = ctx->lowmem;
+	nr++;
+	if (ctx->highmem > 0) {
+		regions[nr].gpa = ctx->highmem_gpa_base;
+		regions[nr].size = ctx->highmem;
+		nr++;
+	}
+
+	for (i = 0; i < nr; i++) {
+		regions[i].log_size = (regions[i].size + PRECOPY_LOG_ALIGN - 1UL)
+				& ~(PRECOPY_LOG_ALIGN - 1UL);
+		regions[i].bitmap = calloc(regions[i].log_size
+				>> (PRECOPY_PAGE_SHIFT + 3U), 1);
+		if (regions[i].bitmap == NULL)
+			goto free_bitmap;
+	}
+
+	fd = precopy_open(path);
+	if (fd < 0) {
+		pr_err("%s: failed to open %s, errno %d\n", __func__, path, errno);
+		goto free_bitmap;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PRECOPY_MAGIC;
+	hdr.version = PRECOPY_VERSION;
+	hdr.page_size = PRECOPY_PAGE_SIZE;
+	hdr.lowmem = ctx->lowmem;
+	hdr.highmem = ctx->highmem;
+	hdr.highmem_gpa_base = ctx->highmem_gpa_base;
+	if (precopy_write(fd, &hdr, sizeof(hdr)) < 0)
+		goto close_fd;
+
+	if (precopy_track_dm(regions, nr) < 0)
+		goto close_fd;
+
+	if (vm_enable_dirty_log(ctx) < 0) {
+		pr_err("%s: failed to enable dirty log, errno %d\n",
+				__func__, errno);
+		goto stop_track;
+	}
+
+	/* round 0: everything, writes racing with the copy are logged */
+	for (i = 0; i < nr; i++) {
+		if (precopy_send_run(fd, ctx, regions[i].gpa,
+				regions[i].size >> PRECOPY_PAGE_SHIFT) < 0)
+			goto disable_log;
+	}
+	if (precopy_send_marker(fd, PRECOPY_ROUND_END) < 0)
+		goto disable_log;
+
+	for (round = 1U; round < PRECOPY_MAX_ROUNDS; round++) {
+		if (precopy_round(fd, ctx, regions, nr, &count) < 0)
+			goto disable_log;
+		pr_info("%s: round %u, %lu dirty pages\n", __func__, round, count);
+		if (count <= PRECOPY_STOP_PAGES)
+			break;
+	}
+
+	/*
+	 * The vCPUs can't kick anymore, but backends still complete what they
+	 * hold and the rx side of some takes new chains at any time. A last
+	 * round only counts if no chain was held or touched while it ran.
+	 */
+	vm_pause(ctx);
+	for (round = 0U; ; round++) {
+		if (round == PRECOPY_MAX_LAST_ROUNDS) {
+			pr_err("%s: virtio backends keep writing guest memory\n",
+					__func__);
+			goto disable_log;
+		}
+		if (precopy_wait_dma_idle() < 0) {
+			pr_err("%s: virtio backends still hold %d chains\n",
+					__func__, __atomic_load_n(&dma_inflight,
+					__ATOMIC_SEQ_CST));
+			goto disable_log;
+		}
+		untracked = __atomic_load_n(&untracked_dma, __ATOMIC_SEQ_CST);
+		if (untracked != NULL) {
+			pr_err("%s: %s writes guest memory behind the dirty log\n",
+					__func__, untracked);
+			goto disable_log;
+		}
+		events = __atomic_load_n(&dma_events, __ATOMIC_SEQ_CST);
+		if (precopy_round(fd, ctx, regions, nr, &count) < 0)
+			goto disable_log;
+		pr_info("%s: final round, %lu dirty pages\n", __func__, count);
+		if (events == __atomic_load_n(&dma_events, __ATOMIC_SEQ_CST))
+			break;
+	}
+
+	if (precopy_send_marker(fd, PRECOPY_STREAM_END) < 0)
+		goto disable_log;
+
+	ret = 0;
+
+disable_log:
+	vm_disable_dirty_log(ctx);
+stop_track:
+	__atomic_store_n(&dm_tracking, false, __ATOMIC_RELEASE);
+close_fd:
+	close(fd);
+free_bitmap:
+	for (i = 0; i < nr; i++)
+		free(regions[i].bitmap);
+
+	return ret;
+}
+
+int
+vm_monitor_precopy(void *arg, char *path)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+
+	return vm_precopy_ram(ctx, path);
+}
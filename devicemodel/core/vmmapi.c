@@ -46,6 +46,7 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "log.h"
+#include "monitor.h"
 
 #define MAP_NOCORE 0
 #define MAP_ALIGNED_SUPER 0
@@ -155,6 +156,9 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 		create_vm.vm_flag |= GUEST_FLAG_IO_COMPLETION_POLLING;
 	}
 
+	if (hv_rtc)
+		create_vm.vm_flag |= GUEST_FLAG_HV_RTC;
+
 	create_vm.req_buf = req_buf;
 	while (retry > 0) {
 		error = ioctl(ctx->fd, IC_CREATE_VM, &create_vm);
@@ -422,6 +426,7 @@ vm_set_suspend_mode(enum vm_suspend_how how)
 {
 	pr_notice("vm mode changed from %d to %d\n", suspend_mode, how);
 	suspend_mode = how;
+	monitor_notify_state();
 }
 
 int
@@ -475,6 +480,47 @@ vm_deassign_pcidev(struct vmctx *ctx, struct acrn_assign_pcidev *pcidev)
 	return ioctl(ctx->fd, IC_DEASSIGN_PCIDEV, pcidev);
 }
 
+int
+vm_enable_dirty_log(struct vmctx *ctx)
+{
+	struct vm_dirty_log log;
+
+	bzero(&log, sizeof(struct vm_dirty_log));
+	log.cmd = VM_DIRTY_LOG_ENABLE;
+
+	return ioctl(ctx->fd, IC_VM_DIRTY_LOG, &log);
+}
+
+int
+vm_disable_dirty_log(struct vmctx *ctx)
+{
+	struct vm_dirty_log log;
+
+	bzero(&log, sizeof(struct vm_dirty_log));
+	log.cmd = VM_DIRTY_LOG_DISABLE;
+
+	return ioctl(ctx->fd, IC_VM_DIRTY_LOG, &log);
+}
+
+/*
+ * Fetch and clear the dirty bits of [gpa, gpa + size) into bitmap, one bit
+ * per 4KB page. gpa and size must be 256KB aligned.
+ */
+int
+vm_get_dirty_log(struct vmctx *ctx, vm_paddr_t gpa, size_t size,
+		uint64_t *bitmap)
+{
+	struct vm_dirty_log log;
+
+	bzero(&log, sizeof(struct vm_dirty_log));
+	log.cmd = VM_DIRTY_LOG_GET_AND_CLEAR;
+	log.gpa = gpa;
+	log.size = size;
+	log.bitmap = (uint64_t)bitmap;
+
+	return ioctl(ctx->fd, IC_VM_DIRTY_LOG, &log);
+}
+
 int
 vm_map_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
 		   vm_paddr_t gpa, size_t len, vm_paddr_t hpa)
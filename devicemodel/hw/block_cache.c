@@ -0,0 +1,1005 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * User space block cache for block_if.
+ *
+ * The disk is accessed with O_DIRECT and cached in 64KB blocks kept in LRU
+ * order, in memory backed by huge pages when the host has them. Writes are
+ * either written through to the disk and the cached copy updated, or, with
+ * the write cache enabled, only stored in the cache and written back in
+ * ascending disk order on flush or when the block is evicted.
+ *
+ * The cache of a read-only image can be shared by every acrn-dm serving the
+ * same image: it then lives in a named segment (hugetlbfs or POSIX shared
+ * memory) keyed by the image device, inode and modification time, and holds
+ * no pointers so that each process can map it anywhere. The metadata is
+ * protected by a process shared, robust mutex.
+ */
+
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "block_cache.h"
+#include "log.h"
+
+#define BLKCACHE_MAGIC		0x48434b42U	/* "BKCH" */
+#define BLKCACHE_BLOCK_SHIFT	16U
+#define BLKCACHE_BLOCK_SIZE	(1UL << BLKCACHE_BLOCK_SHIFT)
+#define BLKCACHE_DIO_ALIGN	4096UL
+#define BLKCACHE_HUGE_PAGE	(2UL << 20)
+#define BLKCACHE_MIN_SLOTS	64U
+#define BLKCACHE_NONE		UINT32_MAX
+#define BLKCACHE_MAX_FENCES	16U
+
+#define BLKCACHE_HUGETLBFS	"/dev/hugepages"
+#define BLKCACHE_SHM_PREFIX	"acrn-blkcache"
+
+enum blkcache_slot_state {
+	SLOT_FREE = 0,
+	SLOT_LOADING,		/* being read from the disk, lock not held */
+	SLOT_VALID,
+};
+
+struct blkcache_slot {
+	uint64_t block;
+	uint32_t state;
+	uint32_t dirty;
+	uint32_t pins;		/* users copying or writing it, not evictable */
+	uint32_t hnext;		/* hash chain */
+	uint32_t prev;		/* LRU list, head is the most recently used */
+	uint32_t next;
+	pid_t loader;		/* process reading it in while SLOT_LOADING */
+};
+
+/* Disk range being discarded or zeroed behind the cache, no block loads */
+struct blkcache_fence {
+	int64_t start;
+	int64_t end;
+	pid_t owner;		/* 0 if unused */
+};
+
+/* Start of the cache memory, followed by the hash, the slots and the data */
+struct blkcache_hdr {
+	uint32_t magic;
+	uint32_t ready;
+	uint64_t map_size;
+	uint64_t data_offset;
+	uint32_t nr_slots;
+	uint32_t hash_size;	/* power of 2 */
+	uint32_t users;
+	uint32_t waiters;	/* waiting for a slot to be unpinned */
+	uint32_t lru_head;
+	uint32_t lru_tail;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	struct blkcache_fence fences[BLKCACHE_MAX_FENCES];
+	struct blkcache_stats stats;
+};
+
+struct blkcache {
+	struct blkcache_hdr *hdr;
+	uint32_t *hash;
+	struct blkcache_slot *slots;
+	uint8_t *data;
+	int dfd;		/* O_DIRECT */
+	int fd;			/* buffered, owned by block_if */
+	off_t size;
+	bool ro;
+	bool shared;
+	char name[PATH_MAX];	/* shared segment, empty if private */
+	bool shm;		/* name is a POSIX shared memory object */
+};
+
+static inline uint8_t *
+blkcache_data(struct blkcache *c, uint32_t i)
+{
+	return c->data + ((size_t)i << BLKCACHE_BLOCK_SHIFT);
+}
+
+static inline size_t
+blkcache_block_len(struct blkcache *c, uint64_t block)
+{
+	return MIN(BLKCACHE_BLOCK_SIZE,
+		   c->size - (off_t)(block << BLKCACHE_BLOCK_SHIFT));
+}
+
+static void
+blkcache_lock(struct blkcache *c)
+{
+	/* a DM died holding it, the metadata is only updated in small steps */
+	if (pthread_mutex_lock(&c->hdr->mtx) == EOWNERDEAD)
+		pthread_mutex_consistent(&c->hdr->mtx);
+}
+
+static void
+blkcache_unlock(struct blkcache *c)
+{
+	pthread_mutex_unlock(&c->hdr->mtx);
+}
+
+static void
+blkcache_wait(struct blkcache *c)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 1;
+	if (pthread_cond_timedwait(&c->hdr->cond, &c->hdr->mtx, &ts) == EOWNERDEAD)
+		pthread_mutex_consistent(&c->hdr->mtx);
+}
+
+static inline uint32_t
+blkcache_hash(struct blkcache *c, uint64_t block)
+{
+	return (uint32_t)((block * 0x9e3779b97f4a7c15UL) >> 32) &
+		(c->hdr->hash_size - 1);
+}
+
+static uint32_t
+blkcache_find(struct blkcache *c, uint64_t block)
+{
+	uint32_t i;
+
+	for (i = c->hash[blkcache_hash(c, block)]; i != BLKCACHE_NONE;
+	     i = c->slots[i].hnext) {
+		if (c->slots[i].block == block)
+			return i;
+	}
+	return BLKCACHE_NONE;
+}
+
+static void
+blkcache_hash_insert(struct blkcache *c, uint32_t i)
+{
+	uint32_t *head = &c->hash[blkcache_hash(c, c->slots[i].block)];
+
+	c->slots[i].hnext = *head;
+	*head = i;
+}
+
+static void
+blkcache_hash_remove(struct blkcache *c, uint32_t i)
+{
+	uint32_t *p = &c->hash[blkcache_hash(c, c->slots[i].block)];
+
+	while (*p != BLKCACHE_NONE) {
+		if (*p == i) {
+			*p = c->slots[i].hnext;
+			break;
+		}
+		p = &c->slots[*p].hnext;
+	}
+}
+
+static void
+blkcache_lru_remove(struct blkcache *c, uint32_t i)
+{
+	struct blkcache_slot *s = &c->slots[i];
+
+	if (s->prev != BLKCACHE_NONE)
+		c->slots[s->prev].next = s->next;
+	else
+		c->hdr->lru_head = s->next;
+	if (s->next != BLKCACHE_NONE)
+		c->slots[s->next].prev = s->prev;
+	else
+		c->hdr->lru_tail = s->prev;
+}
+
+static void
+blkcache_lru_add(struct blkcache *c, uint32_t i, bool head)
+{
+	struct blkcache_slot *s = &c->slots[i];
+
+	if (head) {
+		s->prev = BLKCACHE_NONE;
+		s->next = c->hdr->lru_head;
+		if (s->next != BLKCACHE_NONE)
+			c->slots[s->next].prev = i;
+		else
+			c->hdr->lru_tail = i;
+		c->hdr->lru_head = i;
+	} else {
+		s->next = BLKCACHE_NONE;
+		s->prev = c->hdr->lru_tail;
+		if (s->prev != BLKCACHE_NONE)
+			c->slots[s->prev].next = i;
+		else
+			c->hdr->lru_head = i;
+		c->hdr->lru_tail = i;
+	}
+}
+
+/* Drop the block cached in slot @i and make it the next one reused */
+static void
+blkcache_drop(struct blkcache *c, uint32_t i)
+{
+	struct blkcache_slot *s = &c->slots[i];
+
+	blkcache_hash_remove(c, i);
+	s->state = SLOT_FREE;
+	s->dirty = 0;
+	s->pins = 0;
+	blkcache_lru_remove(c, i);
+	blkcache_lru_add(c, i, false);
+}
+
+static void
+blkcache_unpin(struct blkcache *c, uint32_t i)
+{
+	if (--c->slots[i].pins == 0 && c->hdr->waiters != 0)
+		pthread_cond_broadcast(&c->hdr->cond);
+}
+
+static int
+blkcache_io(struct blkcache *c, uint32_t i, bool write)
+{
+	uint64_t block = c->slots[i].block;
+	off_t offset = block << BLKCACHE_BLOCK_SHIFT;
+	size_t len = blkcache_block_len(c, block);
+	uint8_t *buf = blkcache_data(c, i);
+	ssize_t n;
+
+	/* O_DIRECT needs aligned sizes, the disk size is only sector aligned */
+	if (write)
+		n = pwrite(c->dfd, buf, len, offset);
+	else
+		n = pread(c->dfd, buf, roundup2(len, BLKCACHE_DIO_ALIGN), offset);
+	if (n < 0 && errno == EINVAL) {
+		if (write)
+			n = pwrite(c->fd, buf, len, offset);
+		else
+			n = pread(c->fd, buf, len, offset);
+	}
+	if (n < 0)
+		return -errno;
+
+	if (write) {
+		if ((size_t)n != len)
+			return -EIO;
+	} else if ((size_t)n < BLKCACHE_BLOCK_SIZE) {
+		memset(buf + n, 0, BLKCACHE_BLOCK_SIZE - n);
+	}
+	return 0;
+}
+
+/* Wait for another thread, maybe in another DM, to load slot @i */
+static void
+blkcache_wait_loading(struct blkcache *c, uint32_t i)
+{
+	struct blkcache_slot *s = &c->slots[i];
+
+	blkcache_wait(c);
+	if (s->state == SLOT_LOADING && kill(s->loader, 0) < 0 && errno == ESRCH)
+		blkcache_drop(c, i);
+}
+
+/* Whether @block is in a range being changed behind the cache */
+static bool
+blkcache_fenced(struct blkcache *c, uint64_t block)
+{
+	struct blkcache_fence *f;
+	int64_t start, end;
+	uint32_t k;
+
+	start = (int64_t)(block << BLKCACHE_BLOCK_SHIFT);
+	end = start + BLKCACHE_BLOCK_SIZE;
+	for (k = 0; k < BLKCACHE_MAX_FENCES; k++) {
+		f = &c->hdr->fences[k];
+		if (f->owner == 0)
+			continue;
+		if (kill(f->owner, 0) < 0 && errno == ESRCH) {
+			f->owner = 0;
+			continue;
+		}
+		if (f->start < end && start < f->end)
+			return true;
+	}
+	return false;
+}
+
+/* Least recently used slot that can be reused, BLKCACHE_NONE if all busy */
+static uint32_t
+blkcache_victim(struct blkcache *c)
+{
+	uint32_t i;
+
+	for (i = c->hdr->lru_tail; i != BLKCACHE_NONE; i = c->slots[i].prev) {
+		if (c->slots[i].state != SLOT_LOADING && c->slots[i].pins == 0)
+			return i;
+	}
+	return BLKCACHE_NONE;
+}
+
+/*
+ * Get the slot caching @block pinned, read from the disk on a miss unless
+ * @fill is false because the caller overwrites the whole block right away.
+ * Called and returns with the lock held.
+ */
+static uint32_t
+blkcache_get(struct blkcache *c, uint64_t block, bool fill, int *err)
+{
+	struct blkcache_slot *s;
+	uint32_t i;
+
+	for (;;) {
+		i = blkcache_find(c, block);
+		if (i != BLKCACHE_NONE) {
+			s = &c->slots[i];
+			if (s->state == SLOT_LOADING) {
+				blkcache_wait_loading(c, i);
+				continue;
+			}
+			s->pins++;
+			blkcache_lru_remove(c, i);
+			blkcache_lru_add(c, i, true);
+			c->hdr->stats.hits++;
+			return i;
+		}
+
+		/* a load now could read what the disk op is replacing */
+		if (blkcache_fenced(c, block)) {
+			c->hdr->waiters++;
+			blkcache_wait(c);
+			c->hdr->waiters--;
+			continue;
+		}
+
+		i = blkcache_victim(c);
+		if (i == BLKCACHE_NONE) {
+			c->hdr->waiters++;
+			blkcache_wait(c);
+			c->hdr->waiters--;
+			continue;
+		}
+
+		s = &c->slots[i];
+		if (s->state == SLOT_VALID) {
+			if (s->dirty) {
+				*err = blkcache_io(c, i, true);
+				if (*err < 0)
+					return BLKCACHE_NONE;
+				c->hdr->stats.writebacks++;
+			}
+			blkcache_hash_remove(c, i);
+			c->hdr->stats.evictions++;
+		}
+
+		s->block = block;
+		s->dirty = 0;
+		s->pins = 1;
+		blkcache_hash_insert(c, i);
+		blkcache_lru_remove(c, i);
+		blkcache_lru_add(c, i, true);
+		c->hdr->stats.misses++;
+
+		if (!fill) {
+			s->state = SLOT_VALID;
+			return i;
+		}
+
+		s->state = SLOT_LOADING;
+		s->loader = getpid();
+		blkcache_unlock(c);
+		*err = blkcache_io(c, i, false);
+		blkcache_lock(c);
+		pthread_cond_broadcast(&c->hdr->cond);
+		if (*err < 0) {
+			blkcache_drop(c, i);
+			return BLKCACHE_NONE;
+		}
+		s->state = SLOT_VALID;
+		return i;
+	}
+}
+
+/* Copy @len bytes between @buf and the bytes of @iov starting at @skip */
+static void
+blkcache_iov_copy(const struct iovec *iov, int iovcnt, size_t skip,
+		  uint8_t *buf, size_t len, bool to_iov)
+{
+	size_t n;
+	int i;
+
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		n = MIN(iov[i].iov_len - skip, len);
+		if (to_iov)
+			memcpy((uint8_t *)iov[i].iov_base + skip, buf, n);
+		else
+			memcpy(buf, (uint8_t *)iov[i].iov_base + skip, n);
+		buf += n;
+		len -= n;
+		skip = 0;
+	}
+}
+
+static size_t
+blkcache_iov_len(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	return len;
+}
+
+ssize_t
+blkcache_preadv(struct blkcache *c, const struct iovec *iov, int iovcnt,
+		off_t offset)
+{
+	size_t total, done, n, boff;
+	uint64_t block;
+	uint32_t i;
+	int err = 0;
+
+	total = blkcache_iov_len(iov, iovcnt);
+	if (offset < 0 || offset + total > c->size)
+		return -EINVAL;
+
+	blkcache_lock(c);
+	for (done = 0; done < total; done += n) {
+		block = (offset + done) >> BLKCACHE_BLOCK_SHIFT;
+		boff = (offset + done) & (BLKCACHE_BLOCK_SIZE - 1);
+		n = MIN(BLKCACHE_BLOCK_SIZE - boff, total - done);
+
+		i = blkcache_get(c, block, true, &err);
+		if (i == BLKCACHE_NONE)
+			break;
+		blkcache_iov_copy(iov, iovcnt, done, blkcache_data(c, i) + boff,
+				  n, true);
+		blkcache_unpin(c, i);
+	}
+	blkcache_unlock(c);
+
+	return (err < 0) ? err : (ssize_t)total;
+}
+
+/* Write through: disk first, then refresh the blocks that are cached */
+static ssize_t
+blkcache_write_through(struct blkcache *c, const struct iovec *iov,
+		       int iovcnt, off_t offset, size_t total)
+{
+	size_t done, n, boff;
+	uint64_t block;
+	ssize_t len;
+	uint32_t i;
+
+	len = pwritev(c->dfd, iov, iovcnt, offset);
+	if (len < 0 && errno == EINVAL)
+		len = pwritev(c->fd, iov, iovcnt, offset);
+	if (len < 0)
+		return -errno;
+	if ((size_t)len != total)
+		return -EIO;
+
+	blkcache_lock(c);
+	for (done = 0; done < total; done += n) {
+		block = (offset + done) >> BLKCACHE_BLOCK_SHIFT;
+		boff = (offset + done) & (BLKCACHE_BLOCK_SIZE - 1);
+		n = MIN(BLKCACHE_BLOCK_SIZE - boff, total - done);
+
+		/* a load racing with the write may have read the old data */
+		while ((i = blkcache_find(c, block)) != BLKCACHE_NONE &&
+		       c->slots[i].state == SLOT_LOADING)
+			blkcache_wait_loading(c, i);
+		if (i != BLKCACHE_NONE)
+			blkcache_iov_copy(iov, iovcnt, done,
+					  blkcache_data(c, i) + boff, n, false);
+	}
+	blkcache_unlock(c);
+
+	return total;
+}
+
+ssize_t
+blkcache_pwritev(struct blkcache *c, const struct iovec *iov, int iovcnt,
+		 off_t offset, bool writeback)
+{
+	size_t total, done, n, boff;
+	uint64_t block;
+	uint32_t i;
+	int err = 0;
+
+	if (c->ro)
+		return -EROFS;
+
+	total = blkcache_iov_len(iov, iovcnt);
+	if (offset < 0 || offset + total > c->size)
+		return -EINVAL;
+
+	if (!writeback)
+		return blkcache_write_through(c, iov, iovcnt, offset, total);
+
+	blkcache_lock(c);
+	for (done = 0; done < total; done += n) {
+		block = (offset + done) >> BLKCACHE_BLOCK_SHIFT;
+		boff = (offset + done) & (BLKCACHE_BLOCK_SIZE - 1);
+		n = MIN(BLKCACHE_BLOCK_SIZE - boff, total - done);
+
+		i = blkcache_get(c, block,
+				 boff != 0 || n != blkcache_block_len(c, block),
+				 &err);
+		if (i == BLKCACHE_NONE)
+			break;
+		blkcache_iov_copy(iov, iovcnt, done, blkcache_data(c, i) + boff,
+				  n, false);
+		c->slots[i].dirty = 1;
+		blkcache_unpin(c, i);
+	}
+	blkcache_unlock(c);
+
+	return (err < 0) ? err : (ssize_t)total;
+}
+
+static int
+blkcache_block_cmp(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/*
+ * Write every dirty block in ascending disk order, then make it durable.
+ * Writes completed before the call are on the disk when it returns.
+ */
+int
+blkcache_flush(struct blkcache *c)
+{
+	uint64_t *list;
+	uint32_t i, n = 0, k;
+	int err = 0, ret;
+
+	if (c->ro)
+		return 0;
+
+	/* (block << 32 | slot) sorts by block, slots are < 2^32 */
+	list = malloc(c->hdr->nr_slots * sizeof(*list));
+	if (list == NULL)
+		return -ENOMEM;
+
+	blkcache_lock(c);
+	for (i = 0; i < c->hdr->nr_slots; i++) {
+		if (c->slots[i].state == SLOT_VALID && c->slots[i].dirty) {
+			c->slots[i].dirty = 0;
+			c->slots[i].pins++;
+			list[n++] = (c->slots[i].block << 32) | i;
+		}
+	}
+	blkcache_unlock(c);
+
+	qsort(list, n, sizeof(*list), blkcache_block_cmp);
+	for (k = 0; k < n; k++) {
+		i = (uint32_t)list[k];
+		ret = blkcache_io(c, i, true);
+		if (ret < 0) {
+			err = ret;
+			/* keep it dirty for the next attempt */
+			c->slots[i].dirty = 1;
+		}
+	}
+
+	blkcache_lock(c);
+	for (k = 0; k < n; k++)
+		blkcache_unpin(c, (uint32_t)list[k]);
+	c->hdr->stats.writebacks += n;
+	c->hdr->stats.flushes++;
+	blkcache_unlock(c);
+	free(list);
+
+	if (err == 0 && fsync(c->dfd) < 0)
+		err = -errno;
+	return err;
+}
+
+/*
+ * The range is about to be discarded or zeroed behind the cache: drop the
+ * blocks it covers, writing back the dirty ones it only partly covers, and
+ * keep them from being loaded again until blkcache_invalidate_end().
+ */
+int
+blkcache_invalidate_begin(struct blkcache *c, off_t offset, off_t len)
+{
+	struct blkcache_fence *f = NULL;
+	struct blkcache_slot *s;
+	off_t start, end;
+	uint32_t i, k;
+	int err = 0;
+
+	blkcache_lock(c);
+	while (f == NULL) {
+		for (k = 0; k < BLKCACHE_MAX_FENCES; k++) {
+			if (c->hdr->fences[k].owner == 0) {
+				f = &c->hdr->fences[k];
+				break;
+			}
+		}
+		if (f == NULL) {
+			c->hdr->waiters++;
+			blkcache_wait(c);
+			c->hdr->waiters--;
+		}
+	}
+	f->start = offset;
+	f->end = offset + len;
+	f->owner = getpid();
+
+	for (i = 0; i < c->hdr->nr_slots; ) {
+		s = &c->slots[i];
+		if (s->state == SLOT_FREE) {
+			i++;
+			continue;
+		}
+		start = s->block << BLKCACHE_BLOCK_SHIFT;
+		end = start + blkcache_block_len(c, s->block);
+		if (end <= offset || start >= offset + len) {
+			i++;
+			continue;
+		}
+
+		/* the slot may cache another block after the wait, look again */
+		if (s->state == SLOT_LOADING) {
+			blkcache_wait_loading(c, i);
+			continue;
+		}
+		if (s->pins != 0) {
+			c->hdr->waiters++;
+			blkcache_wait(c);
+			c->hdr->waiters--;
+			continue;
+		}
+
+		if (s->dirty && (start < offset || end > offset + len)) {
+			err = blkcache_io(c, i, true);
+			if (err < 0)
+				break;
+			c->hdr->stats.writebacks++;
+		}
+		blkcache_drop(c, i);
+		i++;
+	}
+	if (err < 0) {
+		f->owner = 0;
+		pthread_cond_broadcast(&c->hdr->cond);
+	}
+	blkcache_unlock(c);
+
+	return err;
+}
+
+/* The disk op on a range passed to blkcache_invalidate_begin() is done */
+void
+blkcache_invalidate_end(struct blkcache *c, off_t offset, off_t len)
+{
+	struct blkcache_fence *f;
+	pid_t pid = getpid();
+	uint32_t k;
+
+	blkcache_lock(c);
+	for (k = 0; k < BLKCACHE_MAX_FENCES; k++) {
+		f = &c->hdr->fences[k];
+		if (f->owner == pid && f->start == offset &&
+		    f->end == offset + len) {
+			f->owner = 0;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&c->hdr->cond);
+	blkcache_unlock(c);
+}
+
+void
+blkcache_get_stats(struct blkcache *c, struct blkcache_stats *stats)
+{
+	blkcache_lock(c);
+	*stats = c->hdr->stats;
+	blkcache_unlock(c);
+}
+
+static size_t
+blkcache_layout(uint32_t nr_slots, uint32_t hash_size, uint64_t *data_offset)
+{
+	size_t off;
+
+	off = roundup2(sizeof(struct blkcache_hdr), 64UL);
+	off += roundup2(hash_size * sizeof(uint32_t), 64UL);
+	off += nr_slots * sizeof(struct blkcache_slot);
+	*data_offset = roundup2(off, BLKCACHE_HUGE_PAGE);
+
+	return *data_offset + roundup2((size_t)nr_slots * BLKCACHE_BLOCK_SIZE,
+				       BLKCACHE_HUGE_PAGE);
+}
+
+static void
+blkcache_setup(struct blkcache *c)
+{
+	uint8_t *base = (uint8_t *)c->hdr;
+
+	c->hash = (uint32_t *)(base + roundup2(sizeof(struct blkcache_hdr), 64UL));
+	c->slots = (struct blkcache_slot *)((uint8_t *)c->hash +
+			roundup2(c->hdr->hash_size * sizeof(uint32_t), 64UL));
+	c->data = base + c->hdr->data_offset;
+}
+
+static void
+blkcache_init_hdr(struct blkcache *c, size_t map_size, uint32_t nr_slots,
+		  uint32_t hash_size, uint64_t data_offset)
+{
+	struct blkcache_hdr *hdr = c->hdr;
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	uint32_t i;
+
+	hdr->magic = BLKCACHE_MAGIC;
+	hdr->map_size = map_size;
+	hdr->data_offset = data_offset;
+	hdr->nr_slots = nr_slots;
+	hdr->hash_size = hash_size;
+	hdr->lru_head = BLKCACHE_NONE;
+	hdr->lru_tail = BLKCACHE_NONE;
+
+	pthread_mutexattr_init(&mattr);
+	pthread_condattr_init(&cattr);
+	if (c->shared) {
+		pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+		pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	}
+	pthread_mutex_init(&hdr->mtx, &mattr);
+	pthread_cond_init(&hdr->cond, &cattr);
+	pthread_mutexattr_destroy(&mattr);
+	pthread_condattr_destroy(&cattr);
+
+	blkcache_setup(c);
+	for (i = 0; i < hash_size; i++)
+		c->hash[i] = BLKCACHE_NONE;
+	for (i = 0; i < nr_slots; i++) {
+		memset(&c->slots[i], 0, sizeof(c->slots[i]));
+		c->slots[i].hnext = BLKCACHE_NONE;
+		blkcache_lru_add(c, i, false);
+	}
+}
+
+static void *
+blkcache_map_private(size_t map_size)
+{
+	void *p;
+
+	p = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		return p;
+
+	p = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	madvise(p, map_size, MADV_HUGEPAGE);
+	return p;
+}
+
+static bool
+blkcache_has_hugetlbfs(void)
+{
+	struct statfs fs;
+
+	return statfs(BLKCACHE_HUGETLBFS, &fs) == 0 &&
+		fs.f_type == HUGETLBFS_MAGIC;
+}
+
+static int
+blkcache_open_segment(struct blkcache *c, bool shm, int flags)
+{
+	return shm ? shm_open(c->name, flags, 0600) :
+		open(c->name, flags, 0600);
+}
+
+static void
+blkcache_unlink_segment(struct blkcache *c)
+{
+	if (c->shm)
+		shm_unlink(c->name);
+	else
+		unlink(c->name);
+}
+
+/*
+ * Create or attach to the cache segment shared by all the DMs serving this
+ * image. Returns the mapping or NULL, in which case a private cache is used.
+ */
+static void *
+blkcache_map_shared(struct blkcache *c, int fd, size_t map_size)
+{
+	char key[96];
+	struct blkcache_hdr *hdr;
+	struct stat st;
+	void *p = MAP_FAILED;
+	int sfd, tries;
+	bool creator = true;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+	snprintf(key, sizeof(key), BLKCACHE_SHM_PREFIX "-%lx-%lx-%lx",
+		 (unsigned long)st.st_dev, (unsigned long)st.st_ino,
+		 (unsigned long)st.st_mtime);
+
+	/* hugetlbfs first, where the segment may already exist */
+	c->shm = !blkcache_has_hugetlbfs();
+	for (;;) {
+		if (c->shm)
+			snprintf(c->name, sizeof(c->name), "/%s", key);
+		else
+			snprintf(c->name, sizeof(c->name),
+				 BLKCACHE_HUGETLBFS "/%s", key);
+
+		sfd = blkcache_open_segment(c, c->shm, O_RDWR | O_CREAT | O_EXCL);
+		if (sfd < 0 && errno == EEXIST) {
+			sfd = blkcache_open_segment(c, c->shm, O_RDWR);
+			creator = false;
+		}
+		if (sfd >= 0 && creator) {
+			if (ftruncate(sfd, map_size) == 0)
+				p = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+					 MAP_SHARED, sfd, 0);
+			if (p == MAP_FAILED) {
+				/* e.g. not enough huge pages */
+				close(sfd);
+				sfd = -1;
+				blkcache_unlink_segment(c);
+			}
+		}
+		if (sfd >= 0 || c->shm)
+			break;
+		c->shm = true;
+	}
+	if (sfd < 0)
+		goto fail;
+
+	if (!creator) {
+		/* wait for the creator to set it up */
+		for (tries = 0; tries < 100; tries++) {
+			if (fstat(sfd, &st) == 0 && st.st_size >= sizeof(*hdr)) {
+				hdr = mmap(NULL, sizeof(*hdr), PROT_READ,
+					   MAP_SHARED, sfd, 0);
+				if (hdr != MAP_FAILED) {
+					map_size = __atomic_load_n(&hdr->ready,
+							__ATOMIC_ACQUIRE) ?
+						hdr->map_size : 0;
+					munmap(hdr, sizeof(*hdr));
+					if (map_size != 0)
+						break;
+				}
+			}
+			usleep(10000);
+		}
+		if (tries == 100)
+			goto fail_close;
+		p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 sfd, 0);
+		if (p == MAP_FAILED)
+			goto fail_close;
+	}
+	close(sfd);
+	return p;
+
+fail_close:
+	close(sfd);
+fail:
+	c->name[0] = '\0';
+	return NULL;
+}
+
+struct blkcache *
+blkcache_open(const char *path, int fd, off_t size, size_t cache_size,
+	      bool ro, bool shared)
+{
+	struct blkcache *c;
+	uint64_t data_offset;
+	uint32_t nr_slots, hash_size;
+	size_t map_size;
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return NULL;
+	c->fd = fd;
+	c->size = size;
+	c->ro = ro;
+	c->shared = shared && ro;
+
+	c->dfd = open(path, (ro ? O_RDONLY : O_RDWR) | O_DIRECT);
+	if (c->dfd < 0) {
+		pr_warn("%s: no O_DIRECT, caching on top of the page cache\n",
+			path);
+		c->dfd = dup(fd);
+		if (c->dfd < 0)
+			goto fail;
+	}
+
+	nr_slots = MAX(cache_size >> BLKCACHE_BLOCK_SHIFT, BLKCACHE_MIN_SLOTS);
+	nr_slots = MIN(nr_slots, MAX(howmany(size, BLKCACHE_BLOCK_SIZE), 1));
+	for (hash_size = 1U; hash_size < nr_slots; hash_size <<= 1)
+		;
+	map_size = blkcache_layout(nr_slots, hash_size, &data_offset);
+
+	if (c->shared) {
+		c->hdr = blkcache_map_shared(c, fd, map_size);
+		if (c->hdr == NULL) {
+			pr_warn("%s: can't share the cache, using a private one\n",
+				path);
+			c->shared = false;
+		}
+	}
+	if (c->hdr == NULL) {
+		c->hdr = blkcache_map_private(map_size);
+		if (c->hdr == NULL)
+			goto fail;
+	}
+
+	if (c->hdr->magic != BLKCACHE_MAGIC) {
+		blkcache_init_hdr(c, map_size, nr_slots, hash_size, data_offset);
+		__atomic_store_n(&c->hdr->ready, 1U, __ATOMIC_RELEASE);
+	} else {
+		blkcache_setup(c);
+	}
+
+	blkcache_lock(c);
+	c->hdr->users++;
+	blkcache_unlock(c);
+
+	pr_info("%s: %s block cache of %u x %luKB\n", path,
+		c->shared ? "shared" : "private", c->hdr->nr_slots,
+		BLKCACHE_BLOCK_SIZE >> 10);
+	return c;
+
+fail:
+	if (c->dfd >= 0)
+		close(c->dfd);
+	free(c);
+	return NULL;
+}
+
+void
+blkcache_close(struct blkcache *c)
+{
+	struct blkcache_stats st;
+	bool last;
+
+	blkcache_flush(c);
+	blkcache_get_stats(c, &st);
+	pr_info("block cache: %lu hits, %lu misses, %lu evictions, "
+		"%lu writebacks, %lu flushes\n", st.hits, st.misses,
+		st.evictions, st.writebacks, st.flushes);
+
+	blkcache_lock(c);
+	last = (--c->hdr->users == 0);
+	blkcache_unlock(c);
+
+	munmap(c->hdr, c->hdr->map_size);
+	if (last && c->name[0] != '\0')
+		blkcache_unlink_segment(c);
+	close(c->dfd);
+	free(c);
+}
@@ -0,0 +1,1017 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Copy-on-write disk image with an optional read-only backing file and
+ * internal snapshots.
+ *
+ * Layout, host (little) endian, offsets in bytes from the start of the file,
+ * everything but the header is cluster aligned:
+ *
+ *   0                 struct cow_header, then backing_len bytes of backing
+ *                     file path (no NUL), the rest of cluster 0 is unused
+ *   table_offset      active cluster table, one uint64_t per guest cluster
+ *   snapshot_offset   snapshot directory, nb_snapshots struct cow_snapshot
+ *   ...               data clusters, snapshot tables and directories,
+ *                     appended at the end of the file as needed
+ *
+ * A table entry is either
+ *   - 0: not allocated, read from the backing file at the same offset (or as
+ *     zeroes past its end or without a backing file);
+ *   - COW_ENTRY_ZERO: reads as zeroes;
+ *   - the file offset of the data cluster, ORed with COW_ENTRY_COPIED when the
+ *     cluster is only referenced by the active table. Clusters without it are
+ *     shared with a snapshot and are copied to a new cluster on first write.
+ *
+ * A snapshot is a copy of the active table, with COPIED cleared, and a name.
+ * Clusters are never freed: data overwritten after a snapshot, deleted
+ * snapshots and clusters set to zero stay in the file.
+ *
+ * The whole active table is held in memory: allocated clusters are read and
+ * written in place at raw speed, only the first write to a cluster takes the
+ * image lock to allocate and fill it. Snapshots are taken, reverted and
+ * deleted when the image is opened, with no guest I/O in flight.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "block_if.h"
+#include "block_cow.h"
+#include "log.h"
+
+#define COW_MAGIC		0x00574f434e524341UL	/* "ACRNCOW" */
+#define COW_VERSION		1U
+#define COW_CLUSTER_BITS	16U	/* 64KB */
+#define COW_MAX_BACKING_LEN	PATH_MAX
+#define COW_MAX_SNAPSHOTS	64U
+#define COW_MAX_CHAIN		16U	/* images in a backing chain */
+#define COW_SNAPSHOT_NAME_LEN	64U
+
+#define COW_MAX_COPYING		8U	/* clusters being copied at once */
+#define COW_NONE		UINT64_MAX
+
+#define COW_ENTRY_COPIED	1UL
+#define COW_ENTRY_ZERO		2UL
+
+/* clusters looked ahead of a sequential read */
+#define COW_READAHEAD_CLUSTERS	32U
+
+struct cow_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t cluster_bits;
+	uint64_t size;			/* guest visible size in bytes */
+	uint64_t table_offset;
+	uint64_t snapshot_offset;
+	uint32_t nb_snapshots;
+	uint32_t backing_len;
+};
+
+struct cow_snapshot {
+	char name[COW_SNAPSHOT_NAME_LEN];	/* NUL terminated */
+	uint64_t table_offset;
+	uint64_t date;				/* seconds since the Epoch */
+};
+
+struct cow_image {
+	int fd;				/* owned by block_if */
+	int rdonly;
+	struct cow_header hdr;
+	uint64_t cluster_size;
+	uint64_t nb_clusters;
+	uint64_t table_len;		/* bytes, cluster aligned */
+	uint64_t *table;
+	struct cow_snapshot *snapshots;
+
+	/* backing file: another image, a raw file or none (fd < 0) */
+	struct cow_image *backing;
+	int backing_fd;
+	off_t backing_size;
+
+	/* protects cluster allocation and the metadata on disk */
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;		/* a cluster copy was published */
+	uint64_t end;			/* next cluster to allocate */
+	uint8_t *buf;			/* one cluster, under mtx */
+	uint64_t copying[COW_MAX_COPYING];	/* syncing, COW_NONE if unused */
+
+	/* sequential read detection, hints only: races are harmless */
+	off_t last_read_end;
+	off_t ra_end;			/* readahead issued up to here */
+};
+
+static inline uint64_t
+cow_load_entry(struct cow_image *cow, uint64_t idx)
+{
+	return __atomic_load_n(&cow->table[idx], __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t
+cow_entry_offset(struct cow_image *cow, uint64_t entry)
+{
+	return entry & ~(cow->cluster_size - 1);
+}
+
+static inline bool
+cow_entry_allocated(uint64_t entry)
+{
+	return entry != 0 && entry != COW_ENTRY_ZERO;
+}
+
+static off_t
+cow_fd_size(int fd)
+{
+	struct stat sbuf;
+	uint64_t size;
+
+	if (fstat(fd, &sbuf) < 0)
+		return -errno;
+	if (S_ISBLK(sbuf.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size) < 0)
+			return -errno;
+		return size;
+	}
+	return sbuf.st_size;
+}
+
+static int
+cow_pread_full(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, len, offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0) {
+			/* past the end of file */
+			memset(buf, 0, len);
+			break;
+		}
+		buf = (uint8_t *)buf + n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int
+cow_pwrite_full(int fd, const void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf = (const uint8_t *)buf + n;
+		offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Describe in @out the bytes [skip, skip + len) of @iov, returns the count */
+static int
+cow_iov_slice(const struct iovec *iov, int iovcnt, size_t skip, size_t len,
+	      struct iovec *out)
+{
+	size_t n;
+	int i, cnt = 0;
+
+	for (i = 0; i < iovcnt && len > 0; i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		n = MIN(iov[i].iov_len - skip, len);
+		out[cnt].iov_base = (uint8_t *)iov[i].iov_base + skip;
+		out[cnt].iov_len = n;
+		cnt++;
+		len -= n;
+		skip = 0;
+	}
+	return cnt;
+}
+
+static void
+cow_iov_zero(const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		memset(iov[i].iov_base, 0, iov[i].iov_len);
+}
+
+static void
+cow_iov_to_buf(const struct iovec *iov, int iovcnt, uint8_t *buf)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(buf, iov[i].iov_base, iov[i].iov_len);
+		buf += iov[i].iov_len;
+	}
+}
+
+/* preadv() that returns zeroes past the end of the file */
+static int
+cow_preadv_full(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+		size_t len)
+{
+	struct iovec rest[BLOCKIF_IOV_MAX];
+	ssize_t n;
+	size_t done = 0;
+	int cnt;
+
+	n = preadv(fd, iov, iovcnt, offset);
+	while (n >= 0 || errno == EINTR) {
+		if (n > 0)
+			done += n;
+		if (done == len)
+			return 0;
+		cnt = cow_iov_slice(iov, iovcnt, done, len - done, rest);
+		if (n == 0) {
+			cow_iov_zero(rest, cnt);
+			return 0;
+		}
+		n = preadv(fd, rest, cnt, offset + done);
+	}
+	return -errno;
+}
+
+static int
+cow_pwritev_full(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+		 size_t len)
+{
+	struct iovec rest[BLOCKIF_IOV_MAX];
+	ssize_t n;
+	size_t done = 0;
+	int cnt;
+
+	n = pwritev(fd, iov, iovcnt, offset);
+	while (n >= 0 || errno == EINTR) {
+		if (n > 0)
+			done += n;
+		if (done == len)
+			return 0;
+		cnt = cow_iov_slice(iov, iovcnt, done, len - done, rest);
+		n = pwritev(fd, rest, cnt, offset + done);
+	}
+	return -errno;
+}
+
+/* Read guest bytes that are not allocated in this image */
+static int
+cow_read_backing(struct cow_image *cow, const struct iovec *iov, int iovcnt,
+		 off_t offset, size_t len)
+{
+	struct iovec part[BLOCKIF_IOV_MAX];
+	size_t avail;
+	ssize_t n;
+	int cnt;
+
+	if (cow->backing != NULL) {
+		avail = (offset < cow_size(cow->backing)) ?
+			MIN(len, cow_size(cow->backing) - offset) : 0;
+	} else if (cow->backing_fd >= 0) {
+		avail = (offset < cow->backing_size) ?
+			MIN(len, cow->backing_size - offset) : 0;
+	} else {
+		avail = 0;
+	}
+
+	if (avail > 0) {
+		cnt = cow_iov_slice(iov, iovcnt, 0, avail, part);
+		if (cow->backing != NULL) {
+			n = cow_preadv(cow->backing, part, cnt, offset);
+			if (n < 0)
+				return n;
+		} else {
+			n = cow_preadv_full(cow->backing_fd, part, cnt, offset,
+					    avail);
+			if (n < 0)
+				return n;
+		}
+	}
+
+	if (avail < len) {
+		cnt = cow_iov_slice(iov, iovcnt, avail, len - avail, part);
+		cow_iov_zero(part, cnt);
+	}
+	return 0;
+}
+
+/* Can the cluster @k clusters after one mapped by @first join its I/O? */
+static bool
+cow_entry_follows(struct cow_image *cow, uint64_t first, uint64_t next,
+		  uint64_t k)
+{
+	if (!cow_entry_allocated(first))
+		return next == first;
+
+	return cow_entry_allocated(next) &&
+		((first & COW_ENTRY_COPIED) == (next & COW_ENTRY_COPIED)) &&
+		(cow_entry_offset(cow, next) ==
+		 cow_entry_offset(cow, first) + k * cow->cluster_size);
+}
+
+/*
+ * Hint the kernel to read ahead the clusters following a sequential read,
+ * at their location in the image or in the backing file.
+ */
+static void
+cow_readahead(struct cow_image *cow, off_t offset, off_t len)
+{
+	uint64_t idx, last, entry, next, k;
+	off_t start;
+
+	if (offset >= cow->hdr.size)
+		return;
+
+	idx = offset >> cow->hdr.cluster_bits;
+	last = MIN(cow->nb_clusters,
+		   (offset + len + cow->cluster_size - 1) >> cow->hdr.cluster_bits);
+	while (idx < last) {
+		entry = cow_load_entry(cow, idx);
+		for (k = 1; idx + k < last; k++) {
+			next = cow_load_entry(cow, idx + k);
+			if (!cow_entry_follows(cow, entry, next, k))
+				break;
+		}
+
+		start = idx << cow->hdr.cluster_bits;
+		if (cow_entry_allocated(entry))
+			posix_fadvise(cow->fd, cow_entry_offset(cow, entry),
+				      k * cow->cluster_size, POSIX_FADV_WILLNEED);
+		else if (entry == 0 && cow->backing != NULL)
+			cow_readahead(cow->backing, start, k * cow->cluster_size);
+		else if (entry == 0 && cow->backing_fd >= 0)
+			posix_fadvise(cow->backing_fd, start,
+				      k * cow->cluster_size, POSIX_FADV_WILLNEED);
+		idx += k;
+	}
+}
+
+ssize_t
+cow_preadv(struct cow_image *cow, const struct iovec *iov, int iovcnt,
+	   off_t offset)
+{
+	struct iovec part[BLOCKIF_IOV_MAX];
+	uint64_t idx, entry, k, coff;
+	size_t total = 0, done, run;
+	off_t end, ra_end, start, window;
+	int i, cnt, err;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	if (offset < 0 || offset + total > cow->hdr.size)
+		return -EINVAL;
+
+	for (done = 0; done < total; done += run) {
+		idx = (offset + done) >> cow->hdr.cluster_bits;
+		coff = (offset + done) & (cow->cluster_size - 1);
+		entry = cow_load_entry(cow, idx);
+		run = MIN(cow->cluster_size - coff, total - done);
+
+		/* one I/O for all the clusters laid out like this one */
+		for (k = 1; done + run < total; k++) {
+			if (!cow_entry_follows(cow, entry,
+					       cow_load_entry(cow, idx + k), k))
+				break;
+			run += MIN(cow->cluster_size, total - done - run);
+		}
+
+		cnt = cow_iov_slice(iov, iovcnt, done, run, part);
+		if (entry == 0) {
+			err = cow_read_backing(cow, part, cnt, offset + done, run);
+		} else if (entry == COW_ENTRY_ZERO) {
+			cow_iov_zero(part, cnt);
+			err = 0;
+		} else {
+			err = cow_preadv_full(cow->fd, part, cnt,
+					      cow_entry_offset(cow, entry) + coff,
+					      run);
+		}
+		if (err < 0)
+			return err;
+	}
+
+	/* keep half a window of readahead ahead of a sequential reader */
+	window = COW_READAHEAD_CLUSTERS * cow->cluster_size;
+	end = offset + total;
+	if (__atomic_exchange_n(&cow->last_read_end, end, __ATOMIC_RELAXED) == offset) {
+		ra_end = __atomic_load_n(&cow->ra_end, __ATOMIC_RELAXED);
+		if (end + window / 2 > ra_end) {
+			start = MAX(ra_end, end);
+			__atomic_store_n(&cow->ra_end, end + window, __ATOMIC_RELAXED);
+			cow_readahead(cow, start, end + window - start);
+		}
+	}
+
+	return total;
+}
+
+/* Append @len bytes (cluster aligned) to the image, under mtx */
+static uint64_t
+cow_alloc(struct cow_image *cow, uint64_t len)
+{
+	uint64_t offset = cow->end;
+
+	cow->end += len;
+	return offset;
+}
+
+static int
+cow_set_entry(struct cow_image *cow, uint64_t idx, uint64_t entry)
+{
+	int err;
+
+	err = cow_pwrite_full(cow->fd, &entry, sizeof(entry),
+			      cow->hdr.table_offset + idx * sizeof(entry));
+	if (err == 0)
+		__atomic_store_n(&cow->table[idx], entry, __ATOMIC_RELEASE);
+	return err;
+}
+
+/*
+ * Wait until cluster @idx is not being copied and claim a copy slot for it
+ * if @claim, under mtx. Returns the slot, or COW_MAX_COPYING.
+ */
+static uint32_t
+cow_wait_copy(struct cow_image *cow, uint64_t idx, bool claim)
+{
+	uint32_t k, slot;
+
+	for (;;) {
+		slot = COW_MAX_COPYING;
+		for (k = 0; k < COW_MAX_COPYING; k++) {
+			if (cow->copying[k] == idx)
+				break;
+			if (cow->copying[k] == COW_NONE)
+				slot = k;
+		}
+		if (k == COW_MAX_COPYING && (!claim || slot != COW_MAX_COPYING))
+			break;
+		pthread_cond_wait(&cow->cond, &cow->mtx);
+	}
+	if (claim)
+		cow->copying[slot] = idx;
+	return slot;
+}
+
+/*
+ * First write to cluster @idx since it was created or snapshotted: copy it
+ * to a new cluster merged with the @len bytes of @iov written at @coff.
+ */
+static int
+cow_write_cluster(struct cow_image *cow, uint64_t idx, uint64_t coff,
+		  const struct iovec *iov, int iovcnt, size_t len)
+{
+	struct iovec whole;
+	uint64_t entry, offset;
+	uint32_t slot;
+	int err;
+
+	pthread_mutex_lock(&cow->mtx);
+
+	/* someone else may have copied it meanwhile */
+	slot = cow_wait_copy(cow, idx, true);
+	entry = cow_load_entry(cow, idx);
+	if (entry & COW_ENTRY_COPIED) {
+		cow->copying[slot] = COW_NONE;
+		pthread_cond_broadcast(&cow->cond);
+		pthread_mutex_unlock(&cow->mtx);
+		return cow_pwritev_full(cow->fd, iov, iovcnt,
+					cow_entry_offset(cow, entry) + coff, len);
+	}
+
+	if (len != cow->cluster_size) {
+		if (entry == 0) {
+			whole.iov_base = cow->buf;
+			whole.iov_len = cow->cluster_size;
+			/* the last cluster may extend past the disk end */
+			if ((idx + 1) * cow->cluster_size > cow->hdr.size) {
+				whole.iov_len = cow->hdr.size - idx * cow->cluster_size;
+				memset(cow->buf, 0, cow->cluster_size);
+			}
+			err = cow_read_backing(cow, &whole, 1,
+					       idx * cow->cluster_size,
+					       whole.iov_len);
+		} else if (entry == COW_ENTRY_ZERO) {
+			memset(cow->buf, 0, cow->cluster_size);
+			err = 0;
+		} else {
+			err = cow_pread_full(cow->fd, cow->buf, cow->cluster_size,
+					     cow_entry_offset(cow, entry));
+		}
+		if (err < 0)
+			goto out;
+	}
+	cow_iov_to_buf(iov, iovcnt, cow->buf + coff);
+
+	/*
+	 * Data first and synced, so that a crash never leaves the entry
+	 * pointing to junk. The sync runs unlocked: other writers of the
+	 * cluster wait on its copy slot, the other clusters go on.
+	 */
+	offset = cow_alloc(cow, cow->cluster_size);
+	err = cow_pwrite_full(cow->fd, cow->buf, cow->cluster_size, offset);
+	if (err < 0)
+		goto out;
+	pthread_mutex_unlock(&cow->mtx);
+
+	if (fdatasync(cow->fd) < 0)
+		err = -errno;
+
+	pthread_mutex_lock(&cow->mtx);
+	if (err == 0)
+		err = cow_set_entry(cow, idx, offset | COW_ENTRY_COPIED);
+
+out:
+	cow->copying[slot] = COW_NONE;
+	pthread_cond_broadcast(&cow->cond);
+	pthread_mutex_unlock(&cow->mtx);
+	return err;
+}
+
+ssize_t
+cow_pwritev(struct cow_image *cow, const struct iovec *iov, int iovcnt,
+	    off_t offset)
+{
+	struct iovec part[BLOCKIF_IOV_MAX];
+	uint64_t idx, entry, k, coff;
+	size_t total = 0, done, run;
+	int i, cnt, err;
+
+	if (cow->rdonly)
+		return -EROFS;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	if (offset < 0 || offset + total > cow->hdr.size)
+		return -EINVAL;
+
+	for (done = 0; done < total; done += run) {
+		idx = (offset + done) >> cow->hdr.cluster_bits;
+		coff = (offset + done) & (cow->cluster_size - 1);
+		entry = cow_load_entry(cow, idx);
+		run = MIN(cow->cluster_size - coff, total - done);
+
+		if (entry & COW_ENTRY_COPIED) {
+			for (k = 1; done + run < total; k++) {
+				if (!cow_entry_follows(cow, entry,
+						cow_load_entry(cow, idx + k), k))
+					break;
+				run += MIN(cow->cluster_size, total - done - run);
+			}
+		}
+
+		cnt = cow_iov_slice(iov, iovcnt, done, run, part);
+		if (entry & COW_ENTRY_COPIED)
+			err = cow_pwritev_full(cow->fd, part, cnt,
+					       cow_entry_offset(cow, entry) + coff,
+					       run);
+		else
+			err = cow_write_cluster(cow, idx, coff, part, cnt, run);
+		if (err < 0)
+			return err;
+	}
+
+	return total;
+}
+
+int
+cow_write_zeroes(struct cow_image *cow, off_t offset, off_t len)
+{
+	static const uint8_t zero_buf[1UL << COW_CLUSTER_BITS];
+	struct iovec iov;
+	uint64_t idx, coff, entry;
+	off_t run;
+	int err = 0;
+
+	if (cow->rdonly)
+		return -EROFS;
+	if (offset < 0 || len < 0 || offset + len > cow->hdr.size)
+		return -EINVAL;
+
+	while (len > 0 && err == 0) {
+		idx = offset >> cow->hdr.cluster_bits;
+		coff = offset & (cow->cluster_size - 1);
+		run = MIN(cow->cluster_size - coff, len);
+		entry = cow_load_entry(cow, idx);
+
+		if (entry == COW_ENTRY_ZERO || (entry == 0 && cow->backing == NULL &&
+						cow->backing_fd < 0)) {
+			/* reads as zeroes already */
+		} else if (run == cow->cluster_size) {
+			/* whole cluster: only the entry changes */
+			pthread_mutex_lock(&cow->mtx);
+			(void)cow_wait_copy(cow, idx, false);
+			err = cow_set_entry(cow, idx, COW_ENTRY_ZERO);
+			pthread_mutex_unlock(&cow->mtx);
+		} else {
+			iov.iov_base = (void *)zero_buf;
+			iov.iov_len = MIN(run, sizeof(zero_buf));
+			err = cow_pwritev(cow, &iov, 1, offset);
+			run = iov.iov_len;
+			if (err > 0)
+				err = 0;
+		}
+		offset += run;
+		len -= run;
+	}
+
+	return err;
+}
+
+off_t
+cow_size(struct cow_image *cow)
+{
+	return cow->hdr.size;
+}
+
+bool
+cow_probe(int fd)
+{
+	struct cow_header hdr;
+
+	return pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+		hdr.magic == COW_MAGIC;
+}
+
+/* Write the header and, if it changed, a new snapshot directory */
+static int
+cow_write_header(struct cow_image *cow, bool new_dir)
+{
+	uint64_t len;
+	int err;
+
+	if (new_dir) {
+		len = roundup2(cow->hdr.nb_snapshots * sizeof(struct cow_snapshot),
+			       cow->cluster_size);
+		cow->hdr.snapshot_offset = 0;
+		if (len != 0) {
+			cow->hdr.snapshot_offset = cow_alloc(cow, len);
+			err = cow_pwrite_full(cow->fd, cow->snapshots,
+				cow->hdr.nb_snapshots * sizeof(struct cow_snapshot),
+				cow->hdr.snapshot_offset);
+			if (err < 0)
+				return err;
+			if (fdatasync(cow->fd) < 0)
+				return -errno;
+		}
+	}
+
+	err = cow_pwrite_full(cow->fd, &cow->hdr, sizeof(cow->hdr), 0);
+	if (err == 0 && fdatasync(cow->fd) < 0)
+		err = -errno;
+	return err;
+}
+
+static int
+cow_find_snapshot(struct cow_image *cow, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < cow->hdr.nb_snapshots; i++) {
+		if (strncmp(cow->snapshots[i].name, name,
+			    COW_SNAPSHOT_NAME_LEN) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int
+cow_snapshot_create(struct cow_image *cow, const char *name)
+{
+	struct cow_snapshot *snap;
+	uint64_t *copy, idx;
+	int err;
+
+	if (cow->rdonly)
+		return -EROFS;
+	if (strnlen(name, COW_SNAPSHOT_NAME_LEN) >= COW_SNAPSHOT_NAME_LEN)
+		return -ENAMETOOLONG;
+	if (cow_find_snapshot(cow, name) >= 0)
+		return -EEXIST;
+	if (cow->hdr.nb_snapshots >= COW_MAX_SNAPSHOTS)
+		return -ENOSPC;
+
+	copy = calloc(1, cow->table_len);
+	if (copy == NULL)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&cow->mtx);
+
+	/*
+	 * Clear COPIED on disk before the snapshot refers to the clusters: a
+	 * crash in between costs extra copies, never a corrupted snapshot.
+	 */
+	for (idx = 0; idx < cow->nb_clusters; idx++) {
+		copy[idx] = cow->table[idx] & ~COW_ENTRY_COPIED;
+		__atomic_store_n(&cow->table[idx], copy[idx], __ATOMIC_RELEASE);
+	}
+	err = cow_pwrite_full(cow->fd, copy, cow->table_len,
+			      cow->hdr.table_offset);
+	if (err < 0)
+		goto out;
+
+	snap = &cow->snapshots[cow->hdr.nb_snapshots];
+	memset(snap, 0, sizeof(*snap));
+	strncpy(snap->name, name, COW_SNAPSHOT_NAME_LEN - 1);
+	snap->date = time(NULL);
+	snap->table_offset = cow_alloc(cow, cow->table_len);
+	err = cow_pwrite_full(cow->fd, copy, cow->table_len, snap->table_offset);
+	if (err < 0)
+		goto out;
+
+	cow->hdr.nb_snapshots++;
+	err = cow_write_header(cow, true);
+	if (err < 0)
+		cow->hdr.nb_snapshots--;
+
+out:
+	pthread_mutex_unlock(&cow->mtx);
+	free(copy);
+	return err;
+}
+
+int
+cow_snapshot_revert(struct cow_image *cow, const char *name)
+{
+	int err, i;
+
+	if (cow->rdonly)
+		return -EROFS;
+
+	i = cow_find_snapshot(cow, name);
+	if (i < 0)
+		return -ENOENT;
+
+	pthread_mutex_lock(&cow->mtx);
+	err = cow_pread_full(cow->fd, cow->table, cow->table_len,
+			     cow->snapshots[i].table_offset);
+	if (err == 0)
+		err = cow_pwrite_full(cow->fd, cow->table, cow->table_len,
+				      cow->hdr.table_offset);
+	if (err == 0 && fdatasync(cow->fd) < 0)
+		err = -errno;
+	pthread_mutex_unlock(&cow->mtx);
+
+	return err;
+}
+
+int
+cow_snapshot_delete(struct cow_image *cow, const char *name)
+{
+	int err, i;
+
+	if (cow->rdonly)
+		return -EROFS;
+
+	i = cow_find_snapshot(cow, name);
+	if (i < 0)
+		return -ENOENT;
+
+	pthread_mutex_lock(&cow->mtx);
+	memmove(&cow->snapshots[i], &cow->snapshots[i + 1],
+		(cow->hdr.nb_snapshots - i - 1) * sizeof(struct cow_snapshot));
+	cow->hdr.nb_snapshots--;
+	err = cow_write_header(cow, true);
+	pthread_mutex_unlock(&cow->mtx);
+
+	return err;
+}
+
+int
+cow_create(const char *path, const char *backing)
+{
+	struct cow_header hdr;
+	struct cow_image *bcow = NULL;
+	char real[PATH_MAX];
+	uint64_t cluster_size, table_len;
+	off_t size;
+	int fd, bfd, err;
+
+	if (realpath(backing, real) == NULL)
+		return -errno;
+
+	bfd = open(real, O_RDONLY);
+	if (bfd < 0)
+		return -errno;
+	if (cow_probe(bfd)) {
+		bcow = cow_open(bfd, real, 1);
+		size = (bcow != NULL) ? cow_size(bcow) : -EINVAL;
+		if (bcow != NULL)
+			cow_close(bcow);
+	} else {
+		size = cow_fd_size(bfd);
+	}
+	close(bfd);
+	if (size <= 0)
+		return (size < 0) ? size : -EINVAL;
+
+	cluster_size = 1UL << COW_CLUSTER_BITS;
+	table_len = roundup2(howmany(size, cluster_size) * sizeof(uint64_t),
+			     cluster_size);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = COW_MAGIC;
+	hdr.version = COW_VERSION;
+	hdr.cluster_bits = COW_CLUSTER_BITS;
+	hdr.size = size;
+	hdr.table_offset = cluster_size;
+	hdr.backing_len = strnlen(real, sizeof(real));
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return -errno;
+
+	/* the table is sparse: all clusters start unallocated */
+	err = cow_pwrite_full(fd, &hdr, sizeof(hdr), 0);
+	if (err == 0)
+		err = cow_pwrite_full(fd, real, hdr.backing_len, sizeof(hdr));
+	if (err == 0 && ftruncate(fd, cluster_size + table_len) < 0)
+		err = -errno;
+	if (err == 0 && fsync(fd) < 0)
+		err = -errno;
+	close(fd);
+
+	if (err < 0)
+		unlink(path);
+	return err;
+}
+
+/* The images opened so far down a backing chain, to catch a loop */
+struct cow_chain {
+	dev_t dev;
+	ino_t ino;
+	uint32_t depth;
+	const struct cow_chain *next;
+};
+
+static struct cow_image *
+cow_open_chain(int fd, const char *path, int ro, const struct cow_chain *up)
+{
+	struct cow_image *cow;
+	struct cow_chain link;
+	const struct cow_chain *c;
+	char backing[COW_MAX_BACKING_LEN + 1];
+	struct stat st;
+	off_t fsize;
+	uint32_t k;
+	int bfd;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+	link.dev = st.st_dev;
+	link.ino = st.st_ino;
+	link.depth = (up != NULL) ? up->depth + 1 : 1;
+	link.next = up;
+	if (link.depth > COW_MAX_CHAIN) {
+		pr_err("%s: backing chain longer than %u images\n", path,
+		       COW_MAX_CHAIN);
+		return NULL;
+	}
+	for (c = up; c != NULL; c = c->next) {
+		if (c->dev == link.dev && c->ino == link.ino) {
+			pr_err("%s: backing chain loops\n", path);
+			return NULL;
+		}
+	}
+
+	cow = calloc(1, sizeof(*cow));
+	if (cow == NULL)
+		return NULL;
+	cow->fd = fd;
+	cow->rdonly = ro;
+	cow->backing_fd = -1;
+	pthread_mutex_init(&cow->mtx, NULL);
+	pthread_cond_init(&cow->cond, NULL);
+	for (k = 0; k < COW_MAX_COPYING; k++)
+		cow->copying[k] = COW_NONE;
+
+	if (cow_pread_full(fd, &cow->hdr, sizeof(cow->hdr), 0) < 0 ||
+	    cow->hdr.magic != COW_MAGIC || cow->hdr.version != COW_VERSION ||
+	    cow->hdr.cluster_bits < 12U || cow->hdr.cluster_bits > 21U ||
+	    cow->hdr.backing_len > COW_MAX_BACKING_LEN ||
+	    cow->hdr.nb_snapshots > COW_MAX_SNAPSHOTS) {
+		pr_err("%s: not a valid cow image\n", path);
+		goto fail;
+	}
+
+	fsize = cow_fd_size(fd);
+	if (fsize < 0)
+		goto fail;
+
+	cow->cluster_size = 1UL << cow->hdr.cluster_bits;
+	cow->nb_clusters = howmany(cow->hdr.size, cow->cluster_size);
+	cow->table_len = roundup2(cow->nb_clusters * sizeof(uint64_t),
+				  cow->cluster_size);
+	/* the table created for hdr.size must be in the file */
+	if ((off_t)cow->hdr.size <= 0 ||
+	    cow->hdr.table_offset < cow->cluster_size ||
+	    (cow->hdr.table_offset & (cow->cluster_size - 1)) != 0 ||
+	    cow->table_len > (uint64_t)fsize ||
+	    cow->hdr.table_offset > (uint64_t)fsize - cow->table_len) {
+		pr_err("%s: size %lu does not fit the cluster table\n", path,
+		       cow->hdr.size);
+		goto fail;
+	}
+
+	cow->table = malloc(cow->table_len);
+	cow->snapshots = calloc(COW_MAX_SNAPSHOTS, sizeof(struct cow_snapshot));
+	cow->buf = malloc(cow->cluster_size);
+	if (cow->table == NULL || cow->snapshots == NULL || cow->buf == NULL)
+		goto fail;
+
+	if (cow_pread_full(fd, cow->table, cow->table_len,
+			   cow->hdr.table_offset) < 0 ||
+	    cow_pread_full(fd, cow->snapshots,
+			   cow->hdr.nb_snapshots * sizeof(struct cow_snapshot),
+			   cow->hdr.snapshot_offset) < 0) {
+		pr_err("%s: failed to read cow metadata\n", path);
+		goto fail;
+	}
+
+	cow->end = roundup2(fsize, cow->cluster_size);
+
+	if (cow->hdr.backing_len != 0) {
+		if (cow_pread_full(fd, backing, cow->hdr.backing_len,
+				   sizeof(cow->hdr)) < 0)
+			goto fail;
+		backing[cow->hdr.backing_len] = '\0';
+
+		bfd = open(backing, O_RDONLY);
+		if (bfd < 0) {
+			pr_err("%s: can't open backing file %s\n", path, backing);
+			goto fail;
+		}
+		if (cow_probe(bfd)) {
+			cow->backing = cow_open_chain(bfd, backing, 1, &link);
+			if (cow->backing == NULL) {
+				close(bfd);
+				goto fail;
+			}
+		} else {
+			cow->backing_fd = bfd;
+			cow->backing_size = cow_fd_size(bfd);
+		}
+	}
+
+	pr_info("%s: cow image, %lu bytes, %u snapshots, backing %s\n", path,
+		cow->hdr.size, cow->hdr.nb_snapshots,
+		cow->hdr.backing_len ? backing : "none");
+	return cow;
+
+fail:
+	cow_close(cow);
+	return NULL;
+}
+
+struct cow_image *
+cow_open(int fd, const char *path, int ro)
+{
+	return cow_open_chain(fd, path, ro, NULL);
+}
+
+void
+cow_close(struct cow_image *cow)
+{
+	if (cow->backing != NULL) {
+		/* a backing image owns its fd */
+		close(cow->backing->fd);
+		cow_close(cow->backing);
+	}
+	if (cow->backing_fd >= 0)
+		close(cow->backing_fd);
+	pthread_cond_destroy(&cow->cond);
+	pthread_mutex_destroy(&cow->mtx);
+	free(cow->buf);
+	free(cow->snapshots);
+	free(cow->table);
+	free(cow);
+}
@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <err.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +45,8 @@
 
 #include "dm.h"
 #include "block_if.h"
+#include "block_cow.h"
+#include "block_cache.h"
 #include "ahci.h"
 #include "dm_string.h"
 #include "log.h"
@@ -65,6 +68,10 @@
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 #define MAX_DISCARD_SEGMENT	256
+/* at most this many workers serve discard/write-zeroes at the same time */
+#define BLOCKIF_RANGE_THR	2
+/* chunk used to emulate write-zeroes when the backend can't do it natively */
+#define BLOCKIF_ZERO_BUF_SIZE	(64 * 1024)
 
 /*
  * Debug printf
@@ -77,7 +84,8 @@ enum blockop {
 	BOP_READ,
 	BOP_WRITE,
 	BOP_FLUSH,
-	BOP_DISCARD
+	BOP_DISCARD,
+	BOP_WRITE_ZEROES
 };
 
 enum blockstat {
@@ -88,6 +96,21 @@ enum blockstat {
 	BST_DONE
 };
 
+struct discard_range {
+	uint64_t sector;
+	uint32_t num_sectors;
+	uint32_t flags;
+};
+
+/* discard_range.flags for write-zeroes: the range may be deallocated */
+#define DISCARD_RANGE_F_UNMAP	(1U << 0)
+
+struct blockif_range {
+	off_t start;
+	off_t len;
+	uint32_t flags;
+};
+
 struct blockif_elem {
 	TAILQ_ENTRY(blockif_elem) link;
 	struct blockif_req  *req;
@@ -95,10 +118,17 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+	off_t		     start;	/* byte extent touched by the request */
+	off_t		     end;
+	/* discard/write-zeroes ranges copied from the request, or -errno */
+	int		     nr_ranges;
+	struct blockif_range ranges[MAX_DISCARD_SEGMENT];
 };
 
 struct blockif_ctxt {
 	int			fd;
+	struct cow_image	*cow;	/* copy-on-write image, NULL if raw */
+	struct blkcache		*cache;	/* user space cache, NULL if none */
 	int			isblk;
 	int			candiscard;
 	int			rdonly;
@@ -136,12 +166,6 @@ struct blockif_sig_elem {
 	struct blockif_sig_elem		*next;
 };
 
-struct discard_range {
-	uint64_t sector;
-	uint32_t num_sectors;
-	uint32_t flags;
-};
-
 static struct blockif_sig_elem *blockif_bse_head;
 
 static int
@@ -157,11 +181,180 @@ blockif_flush_cache(struct blockif_ctxt *bc)
 	return err;
 }
 
+static inline int
+blockif_is_range_op(enum blockop op)
+{
+	return (op == BOP_DISCARD || op == BOP_WRITE_ZEROES);
+}
+
+static int
+discard_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
+{
+	off_t start_sector = start / DEV_BSIZE;
+	off_t size_sector = size / DEV_BSIZE;
+
+	if (!size || (start + size) > (bc->size + bc->sub_file_start_lba))
+		return -1;
+
+	if ((size_sector > bc->max_discard_sectors) ||
+			(bc->discard_sector_alignment &&
+			start_sector % bc->discard_sector_alignment))
+		return -1;
+	return 0;
+}
+
+static int
+blockif_range_cmp(const void *a, const void *b)
+{
+	const struct blockif_range *ra = a, *rb = b;
+
+	if (ra->start < rb->start)
+		return -1;
+	return (ra->start > rb->start);
+}
+
+/*
+ * Sort the ranges and coalesce the adjacent and overlapping ones that carry
+ * the same flags. Returns the number of ranges left.
+ */
+static int
+blockif_merge_ranges(struct blockif_range *r, int n)
+{
+	int i, j;
+
+	if (n <= 1)
+		return n;
+
+	qsort(r, n, sizeof(*r), blockif_range_cmp);
+	for (i = 0, j = 1; j < n; j++) {
+		if (r[j].start <= r[i].start + r[i].len &&
+				r[j].flags == r[i].flags) {
+			if (r[j].start + r[j].len > r[i].start + r[i].len)
+				r[i].len = r[j].start + r[j].len - r[i].start;
+		} else {
+			r[++i] = r[j];
+		}
+	}
+
+	return i + 1;
+}
+
+/*
+ * Collect the ranges of a discard/write-zeroes request in backing file
+ * offsets. Returns the number of ranges or a negative errno.
+ */
+static int
+blockif_parse_ranges(struct blockif_ctxt *bc, struct blockif_req *br,
+		struct blockif_range *r, int is_discard)
+{
+	struct discard_range *range;
+	int n_range, i;
+
+	if (br->iovcnt != 1) {
+		/* ahci parse discard range to br->offset and br->reside */
+		r[0].start = br->offset + bc->sub_file_start_lba;
+		r[0].len = br->resid;
+		r[0].flags = 0;
+		return 1;
+	}
+
+	/* virtio-blk use iov to transfer discard range */
+	n_range = br->iov[0].iov_len / sizeof(*range);
+	range = br->iov[0].iov_base;
+	if (n_range > MAX_DISCARD_SEGMENT ||
+			(is_discard && n_range > bc->max_discard_seg)) {
+		WPRINTF(("segment > max_discard_seg\n"));
+		return -EINVAL;
+	}
+
+	for (i = 0; i < n_range; i++) {
+		r[i].start = range[i].sector * DEV_BSIZE + bc->sub_file_start_lba;
+		r[i].len = range[i].num_sectors * DEV_BSIZE;
+		r[i].flags = is_discard ? 0 : (range[i].flags & DISCARD_RANGE_F_UNMAP);
+		if (is_discard) {
+			if (discard_range_validate(bc, r[i].start, r[i].len)) {
+				WPRINTF(("range [%ld: %ld] is invalid\n", r[i].start, r[i].len));
+				return -EINVAL;
+			}
+		} else if (!r[i].len || (r[i].start + r[i].len) >
+				(bc->size + bc->sub_file_start_lba)) {
+			WPRINTF(("range [%ld: %ld] is invalid\n", r[i].start, r[i].len));
+			return -EINVAL;
+		}
+	}
+
+	return n_range;
+}
+
+/*
+ * Copy the ranges of a discard/write-zeroes request into @be once, so that
+ * the guest cannot change them between the conflict check and the disk op,
+ * and set the byte extent they cover.
+ */
+static void
+blockif_load_ranges(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	int i, n;
+
+	n = blockif_parse_ranges(bc, be->req, be->ranges,
+				 be->op == BOP_DISCARD);
+	if (n > 0)
+		n = blockif_merge_ranges(be->ranges, n);
+	be->nr_ranges = n;
+
+	be->start = be->end = 0;
+	for (i = 0; i < n; i++) {
+		if (i == 0 || be->ranges[i].start < be->start)
+			be->start = be->ranges[i].start;
+		if (be->ranges[i].start + be->ranges[i].len > be->end)
+			be->end = be->ranges[i].start + be->ranges[i].len;
+	}
+	/* the other requests are in disk offsets */
+	if (n > 0) {
+		be->start -= bc->sub_file_start_lba;
+		be->end -= bc->sub_file_start_lba;
+	}
+}
+
+/*
+ * Discard and write-zeroes must not run concurrently with an overlapping
+ * request queued before them, nor a request with one queued before it.
+ */
+static int
+blockif_conflict(struct blockif_elem *before, struct blockif_elem *be)
+{
+	if (!blockif_is_range_op(before->op) && !blockif_is_range_op(be->op))
+		return 0;
+	if (before->op == BOP_FLUSH || be->op == BOP_FLUSH)
+		return 0;
+
+	return (before->start < be->end && be->start < before->end);
+}
+
+static int
+blockif_is_blocked(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_elem *tbe;
+
+	TAILQ_FOREACH(tbe, &bc->busyq, link) {
+		if (tbe->block == be->req->offset || blockif_conflict(tbe, be))
+			return 1;
+	}
+	TAILQ_FOREACH(tbe, &bc->pendq, link) {
+		if (tbe == be)
+			break;
+		if (tbe->block == be->req->offset || blockif_conflict(tbe, be))
+			return 1;
+	}
+
+	return 0;
+}
+
 static int
 blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
-	struct blockif_elem *be, *tbe;
+	struct blockif_elem *be;
 	off_t off;
 	int i;
 
@@ -177,6 +370,7 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 	case BOP_READ:
 	case BOP_WRITE:
 	case BOP_DISCARD:
+	case BOP_WRITE_ZEROES:
 		off = breq->offset;
 		for (i = 0; i < breq->iovcnt; i++)
 			off += breq->iov[i].iov_len;
@@ -186,21 +380,17 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		off = 1 << (sizeof(off_t) - 1);
 	}
 	be->block = off;
-	TAILQ_FOREACH(tbe, &bc->pendq, link) {
-		if (tbe->block == breq->offset)
-			break;
-	}
-	if (tbe == NULL) {
-		TAILQ_FOREACH(tbe, &bc->busyq, link) {
-			if (tbe->block == breq->offset)
-				break;
-		}
+	if (blockif_is_range_op(op)) {
+		blockif_load_ranges(bc, be);
+	} else {
+		be->start = breq->offset;
+		be->end = off;
 	}
-	if (tbe == NULL)
-		be->status = BST_PEND;
-	else
-		be->status = BST_BLOCK;
 	TAILQ_INSERT_TAIL(&bc->pendq, be, link);
+	if (blockif_is_blocked(bc, be))
+		be->status = BST_BLOCK;
+	else
+		be->status = BST_PEND;
 	return (be->status == BST_PEND);
 }
 
@@ -208,9 +398,17 @@ static int
 blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
 {
 	struct blockif_elem *be;
+	int range_busy = 0;
+
+	/* keep workers available for reads and writes during a guest fstrim */
+	TAILQ_FOREACH(be, &bc->busyq, link) {
+		if (blockif_is_range_op(be->op))
+			range_busy++;
+	}
 
 	TAILQ_FOREACH(be, &bc->pendq, link) {
-		if (be->status == BST_PEND)
+		if (be->status == BST_PEND &&
+			(!blockif_is_range_op(be->op) || range_busy < BLOCKIF_RANGE_THR))
 			break;
 	}
 	if (be == NULL)
@@ -232,76 +430,46 @@ blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
 		TAILQ_REMOVE(&bc->busyq, be, link);
 	else
 		TAILQ_REMOVE(&bc->pendq, be, link);
-	TAILQ_FOREACH(tbe, &bc->pendq, link) {
-		if (tbe->req->offset == be->block)
-			tbe->status = BST_PEND;
-	}
 	be->tid = 0;
 	be->status = BST_FREE;
 	be->req = NULL;
 	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
+	TAILQ_FOREACH(tbe, &bc->pendq, link) {
+		if (tbe->status == BST_BLOCK && !blockif_is_blocked(bc, tbe))
+			tbe->status = BST_PEND;
+	}
 }
 
 static int
-discard_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
-{
-	off_t start_sector = start / DEV_BSIZE;
-	off_t size_sector = size / DEV_BSIZE;
-
-	if (!size || (start + size) > (bc->size + bc->sub_file_start_lba))
-		return -1;
-
-	if ((size_sector > bc->max_discard_sectors) ||
-			(bc->discard_sector_alignment &&
-			start_sector % bc->discard_sector_alignment))
-		return -1;
-	return 0;
-}
-
-static int
-blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+blockif_process_discard(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
-	int err;
-	struct discard_range *range;
-	int n_range, i, segment;
-	off_t arg[MAX_DISCARD_SEGMENT][2];
+	struct blockif_req *br = be->req;
+	struct blockif_range *r = be->ranges;
+	uint64_t arg[2];
+	int err, i, segment;
 
-	err = 0;
-	n_range = 0;
-	segment = 0;
 	if (!bc->candiscard)
 		return EOPNOTSUPP;
 
 	if (bc->rdonly)
 		return EROFS;
 
-	if (br->iovcnt == 1) {
-		/* virtio-blk use iov to transfer discard range */
-		n_range = br->iov[0].iov_len/sizeof(*range);
-		range = br->iov[0].iov_base;
-		for (i = 0; i < n_range; i++) {
-			arg[i][0] = range[i].sector * DEV_BSIZE +
-					bc->sub_file_start_lba;
-			arg[i][1] = range[i].num_sectors * DEV_BSIZE;
-			segment++;
-			if (segment > bc->max_discard_seg) {
-				WPRINTF(("segment > max_discard_seg\n"));
-				return EINVAL;
-			}
-			if (discard_range_validate(bc, arg[i][0], arg[i][1])) {
-				WPRINTF(("range [%ld: %ld] is invalid\n", arg[i][0], arg[i][1]));
-				return EINVAL;
-			}
-		}
-	} else {
-		/* ahci parse discard range to br->offset and br->reside */
-		arg[0][0] = br->offset + bc->sub_file_start_lba;
-		arg[0][1] = br->resid;
-		segment = 1;
-	}
+	segment = be->nr_ranges;
+	if (segment < 0)
+		return -segment;
+
+	err = 0;
 	for (i = 0; i < segment; i++) {
+		if (bc->cache) {
+			err = -blkcache_invalidate_begin(bc->cache, r[i].start,
+							 r[i].len);
+			if (err)
+				return err;
+		}
 		if (bc->isblk) {
-			err = ioctl(bc->fd, BLKDISCARD, arg[i]);
+			arg[0] = r[i].start;
+			arg[1] = r[i].len;
+			err = ioctl(bc->fd, BLKDISCARD, arg);
 		} else {
 			/* FALLOC_FL_PUNCH_HOLE:
 			 *	Deallocates space in the byte range starting at offset and
@@ -311,21 +479,118 @@ blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
 			 *	Do not modify the apparent length of the file.
 			 */
 			err = fallocate(bc->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
-				arg[i][0], arg[i][1]);
-			if (!err)
-				err = fdatasync(bc->fd);
+				r[i].start, r[i].len);
 		}
+		if (err)
+			err = errno;
+		if (bc->cache)
+			blkcache_invalidate_end(bc->cache, r[i].start, r[i].len);
 		if (err) {
 			WPRINTF(("Failed to discard offset=%ld nbytes=%ld err code: %d\n",
-				 arg[i][0], arg[i][1], err));
+				 r[i].start, r[i].len, err));
 			return err;
 		}
 	}
+
+	/* one sync for the whole request */
+	if (!bc->isblk && fdatasync(bc->fd))
+		return errno;
+
 	br->resid = 0;
 
 	return 0;
 }
 
+static int
+blockif_write_zero_buf(struct blockif_ctxt *bc, off_t start, off_t len)
+{
+	static const char zero_buf[BLOCKIF_ZERO_BUF_SIZE];
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(bc->fd, zero_buf, MIN(len, BLOCKIF_ZERO_BUF_SIZE), start);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		start += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+blockif_zero_range(struct blockif_ctxt *bc, struct blockif_range *r)
+{
+	uint64_t arg[2];
+	int err, mode;
+
+	if (bc->cow)
+		return -cow_write_zeroes(bc->cow, r->start, r->len);
+
+	if (bc->cache) {
+		err = -blkcache_invalidate_begin(bc->cache, r->start, r->len);
+		if (err)
+			return err;
+	}
+
+	if (bc->isblk) {
+		arg[0] = r->start;
+		arg[1] = r->len;
+		err = ioctl(bc->fd, BLKZEROOUT, arg);
+	} else {
+		/* a punched hole reads back as zeroes as well */
+		if ((r->flags & DISCARD_RANGE_F_UNMAP) && bc->candiscard)
+			mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+		else
+			mode = FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE;
+		err = fallocate(bc->fd, mode, r->start, r->len);
+	}
+
+	if (err) {
+		err = errno;
+		if (err == EOPNOTSUPP || err == ENOTTY)
+			err = blockif_write_zero_buf(bc, r->start, r->len);
+	}
+
+	if (bc->cache)
+		blkcache_invalidate_end(bc->cache, r->start, r->len);
+
+	return err;
+}
+
+static int
+blockif_process_write_zeroes(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_req *br = be->req;
+	struct blockif_range *r = be->ranges;
+	int err, i, segment;
+
+	if (bc->rdonly)
+		return EROFS;
+
+	segment = be->nr_ranges;
+	if (segment < 0)
+		return -segment;
+
+	for (i = 0; i < segment; i++) {
+		err = blockif_zero_range(bc, &r[i]);
+		if (err) {
+			WPRINTF(("Failed to write zeroes offset=%ld nbytes=%ld err code: %d\n",
+				 r[i].start, r[i].len, err));
+			return err;
+		}
+	}
+
+	err = blockif_flush_cache(bc);
+	if (!err)
+		br->resid = 0;
+
+	return err;
+}
+
 static void
 blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
@@ -337,8 +602,23 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 	err = 0;
 	switch (be->op) {
 	case BOP_READ:
-		len = preadv(bc->fd, br->iov, br->iovcnt,
-				 br->offset + bc->sub_file_start_lba);
+		if (bc->cow) {
+			len = cow_preadv(bc->cow, br->iov, br->iovcnt, br->offset);
+			if (len < 0) {
+				err = -len;
+				break;
+			}
+		} else if (bc->cache) {
+			len = blkcache_preadv(bc->cache, br->iov, br->iovcnt,
+					br->offset + bc->sub_file_start_lba);
+			if (len < 0) {
+				err = -len;
+				break;
+			}
+		} else {
+			len = preadv(bc->fd, br->iov, br->iovcnt,
+					 br->offset + bc->sub_file_start_lba);
+		}
 		if (len < 0)
 			err = errno;
 		else
@@ -350,8 +630,23 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 			break;
 		}
 
-		len = pwritev(bc->fd, br->iov, br->iovcnt,
-				  br->offset + bc->sub_file_start_lba);
+		if (bc->cow) {
+			len = cow_pwritev(bc->cow, br->iov, br->iovcnt, br->offset);
+			if (len < 0) {
+				err = -len;
+				break;
+			}
+		} else if (bc->cache) {
+			len = blkcache_pwritev(bc->cache, br->iov, br->iovcnt,
+					br->offset + bc->sub_file_start_lba, bc->wce);
+			if (len < 0) {
+				err = -len;
+				break;
+			}
+		} else {
+			len = pwritev(bc->fd, br->iov, br->iovcnt,
+					  br->offset + bc->sub_file_start_lba);
+		}
 		if (len < 0)
 			err = errno;
 		else {
@@ -360,11 +655,16 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 		}
 		break;
 	case BOP_FLUSH:
-		if (fsync(bc->fd))
+		if (bc->cache)
+			err = -blkcache_flush(bc->cache);
+		else if (fsync(bc->fd))
 			err = errno;
 		break;
 	case BOP_DISCARD:
-		err = blockif_process_discard(bc, br);
+		err = blockif_process_discard(bc, be);
+		break;
+	case BOP_WRITE_ZEROES:
+		err = blockif_process_write_zeroes(bc, be);
 		break;
 	default:
 		err = EINVAL;
@@ -486,6 +786,48 @@ sub_file_unlock(struct blockif_ctxt *bc)
 	}
 }
 
+/* Open a cow image and apply the snapshot operations asked for */
+static struct cow_image *
+blockif_open_cow(int fd, const char *path, int ro, int sub_file_assign,
+		 const char *revert, const char *delete, const char *create)
+{
+	struct cow_image *cow;
+	int err = 0;
+
+	if (sub_file_assign) {
+		pr_err("%s: range not supported on cow images\n", path);
+		return NULL;
+	}
+
+	cow = cow_open(fd, path, ro);
+	if (!cow)
+		return NULL;
+
+	if (revert) {
+		err = cow_snapshot_revert(cow, revert);
+		if (err)
+			pr_err("%s: revert to %s failed: %s\n", path, revert,
+				strerror(-err));
+	}
+	if (!err && delete) {
+		err = cow_snapshot_delete(cow, delete);
+		if (err)
+			pr_err("%s: delete snapshot %s failed: %s\n", path,
+				delete, strerror(-err));
+	}
+	if (!err && create) {
+		err = cow_snapshot_create(cow, create);
+		if (err)
+			pr_err("%s: snapshot %s failed: %s\n", path, create,
+				strerror(-err));
+	}
+
+	if (err) {
+		cow_close(cow);
+		return NULL;
+	}
+	return cow;
+}
 
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
@@ -506,10 +848,20 @@ blockif_open(const char *optstr, const char *ident)
 	int sub_file_assign;
 	int max_discard_sectors, max_discard_seg, discard_sector_alignment;
 	off_t probe_arg[] = {0, 0};
+	char *backing, *snap_create, *snap_revert, *snap_delete;
+	struct cow_image *cow;
+	struct blkcache *cache;
+	unsigned long cache_mb;
+	int shared_cache;
 
 	pthread_once(&blockif_once, blockif_init);
 
 	fd = -1;
+	cow = NULL;
+	cache = NULL;
+	cache_mb = 0;
+	shared_cache = 0;
+	backing = snap_create = snap_revert = snap_delete = NULL;
 	ssopt = 0;
 	pssopt = 0;
 	ro = 0;
@@ -579,6 +931,22 @@ blockif_open(const char *optstr, const char *ident)
 				sub_file_assign = 1;
 			else
 				goto err;
+		} else if (!strncmp(cp, "backing=", strlen("backing="))) {
+			/* create a cow image on top of this file if missing */
+			backing = cp + strlen("backing=");
+		} else if (!strncmp(cp, "snapshot=", strlen("snapshot="))) {
+			snap_create = cp + strlen("snapshot=");
+		} else if (!strncmp(cp, "revert=", strlen("revert="))) {
+			snap_revert = cp + strlen("revert=");
+		} else if (!strncmp(cp, "snapshot_del=", strlen("snapshot_del="))) {
+			snap_delete = cp + strlen("snapshot_del=");
+		} else if (!strncmp(cp, "cache=", strlen("cache="))) {
+			/* cache=<size in MB> */
+			if (dm_strtoul(cp + strlen("cache="), &cp, 10, &cache_mb) ||
+				*cp != '\0' || cache_mb == 0)
+				goto err;
+		} else if (!strcmp(cp, "shared_cache")) {
+			shared_cache = 1;
 		} else {
 			pr_err("Invalid device option \"%s\"\n", cp);
 			goto err;
@@ -592,6 +960,15 @@ blockif_open(const char *optstr, const char *ident)
 	 * operation to emulate it.
 	 */
 
+	if (backing && access(nopt, F_OK) != 0) {
+		err_code = cow_create(nopt, backing);
+		if (err_code < 0) {
+			pr_err("Could not create %s on top of %s: %s\n",
+				nopt, backing, strerror(-err_code));
+			goto err;
+		}
+	}
+
 	fd = open(nopt, ro ? O_RDONLY : O_RDWR);
 	if (fd < 0 && !ro) {
 		/* Attempt a r/w fail with a r/o open */
@@ -664,6 +1041,33 @@ blockif_open(const char *optstr, const char *ident)
 			goto err;
 		}
 		psectsz = sbuf.st_blksize;
+
+		if (cow_probe(fd)) {
+			cow = blockif_open_cow(fd, nopt, ro, sub_file_assign,
+					snap_revert, snap_delete, snap_create);
+			if (!cow)
+				goto err;
+			size = cow_size(cow);
+			if (candiscard) {
+				WPRINTF(("%s: discard not supported on cow images\n",
+					nopt));
+				candiscard = 0;
+			}
+		}
+	}
+
+	if (!cow && (snap_create || snap_revert || snap_delete)) {
+		pr_err("%s: snapshots need a cow image\n", nopt);
+		goto err;
+	}
+
+	if (shared_cache && (!cache_mb || !ro)) {
+		pr_err("%s: shared_cache needs cache=<MB> and ro\n", nopt);
+		goto err;
+	}
+	if (cache_mb && cow) {
+		pr_err("%s: cache not supported on cow images\n", nopt);
+		goto err;
 	}
 
 	if (ssopt != 0) {
@@ -719,7 +1123,20 @@ blockif_open(const char *optstr, const char *ident)
 		bc->sub_file_start_lba = 0;
 	}
 
+	if (cache_mb) {
+		/* the cache works on offsets in the file, range included */
+		cache = blkcache_open(nopt, fd, bc->sub_file_start_lba + size,
+				cache_mb << 20, ro, shared_cache);
+		if (!cache) {
+			pr_err("%s: could not set up the block cache\n", nopt);
+			free(bc);
+			goto err;
+		}
+	}
+
 	bc->fd = fd;
+	bc->cow = cow;
+	bc->cache = cache;
 	bc->isblk = S_ISBLK(sbuf.st_mode);
 	bc->candiscard = candiscard;
 	if (candiscard) {
@@ -768,6 +1185,8 @@ err:
 	if (nopt)
 		free(nopt);
 
+	if (cow)
+		cow_close(cow);
 	if (fd >= 0)
 		close(fd);
 	return NULL;
@@ -827,6 +1246,12 @@ blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq)
 	return blockif_request(bc, breq, BOP_DISCARD);
 }
 
+int
+blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq)
+{
+	return blockif_request(bc, breq, BOP_WRITE_ZEROES);
+}
+
 int
 blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -926,6 +1351,10 @@ blockif_close(struct blockif_ctxt *bc)
 	/*
 	 * Release resources
 	 */
+	if (bc->cow)
+		cow_close(bc->cow);
+	if (bc->cache)
+		blkcache_close(bc->cache);
 	close(bc->fd);
 	free(bc);
 
@@ -1019,6 +1448,19 @@ blockif_candiscard(struct blockif_ctxt *bc)
 	return bc->candiscard;
 }
 
+int
+blockif_max_write_zeroes_sectors(struct blockif_ctxt *bc)
+{
+	return (bc->size / DEV_BSIZE) > INT_MAX ?
+			INT_MAX : (bc->size / DEV_BSIZE);
+}
+
+int
+blockif_max_write_zeroes_seg(struct blockif_ctxt *bc)
+{
+	return MAX_DISCARD_SEGMENT;
+}
+
 int
 blockif_max_discard_sectors(struct blockif_ctxt *bc)
 {
@@ -1046,6 +1488,9 @@ blockif_get_wce(struct blockif_ctxt *bc)
 void
 blockif_set_wce(struct blockif_ctxt *bc, uint8_t wce)
 {
+	/* nothing may stay dirty in the cache once in writethru mode */
+	if (bc->cache && bc->wce && !wce)
+		blkcache_flush(bc->cache);
 	bc->wce = wce;
 }
 
@@ -1055,7 +1500,9 @@ blockif_flush_all(struct blockif_ctxt *bc)
 	int err;
 
 	err=0;
-	if (fsync(bc->fd))
+	if (bc->cache)
+		err = -blkcache_flush(bc->cache);
+	else if (fsync(bc->fd))
 		err = errno;
 	return err;
 }
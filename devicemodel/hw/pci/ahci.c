@@ -40,6 +40,7 @@
 #include "ahci.h"
 #include "block_if.h"
 #include "ata.h"
+#include "precopy.h"
 
 #define	DEF_PORTS	6	/* Intel ICH8 AHCI supports 6 ports */
 #define	MAX_PORTS	32	/* AHCI supports 32 ports */
@@ -867,6 +868,8 @@ next:
 	aior->more = (len != done);
 
 	breq = &aior->io_req;
+	/* the range is passed in offset/resid, not in the iov */
+	breq->iovcnt = 0;
 	breq->offset = elba * blockif_sectsz(p->bctx);
 	breq->resid = elen * blockif_sectsz(p->bctx);
 
@@ -2346,6 +2349,9 @@ pci_ahci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts, int atapi)
 	int ret, slots, rc;
 	uint8_t p;
 	MD5_CTX mdctx;
+
+	/* no dirty tracking for what the AHCI emulation DMAs to guest memory */
+	precopy_untracked_dma("ahci");
 	u_char digest[16];
 	char *next, *next2;
 
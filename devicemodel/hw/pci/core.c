@@ -835,6 +835,17 @@ pci_emul_alloc_pbar(struct pci_vdev *pdi, int idx, uint64_t hostbase,
 			return error;
 	}
 
+	/*
+	 * The BAR is aligned on its size, so is a whole host BAR: they have
+	 * the same offset in the large pages the BAR spans and the hypervisor
+	 * maps it with them. This is not the case when only a part of a host
+	 * BAR is given to the guest: say so, the BAR is mapped with 4KB pages.
+	 */
+	if (hostbase && type != PCIBAR_IO && size >= PCI_EMUL_LARGE_PAGE &&
+	    ((addr ^ hostbase) & (PCI_EMUL_LARGE_PAGE - 1)) != 0)
+		pr_warn("%s: bar %d gpa 0x%lx not congruent with hpa 0x%lx, "
+			"no large page mapping\n", pdi->name, idx, addr, hostbase);
+
 	pdi->bar[idx].type = type;
 	pdi->bar[idx].addr = addr;
 	pdi->bar[idx].size = size;
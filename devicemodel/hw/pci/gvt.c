@@ -15,6 +15,7 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "vmmapi.h"
+#include "precopy.h"
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -372,6 +373,9 @@ pci_gvt_init(struct vmctx *ctx, struct pci_vdev *pi, char *opts)
 		return -1;
 	}
 
+	/* the GPU renders into guest memory behind the dirty log */
+	precopy_untracked_dma("gvt");
+
 	gvt->instance_created = 0;
 	gvt->addr.domain = 0;
 	gvt->addr.bus = pi->bus;
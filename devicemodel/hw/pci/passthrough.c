@@ -46,6 +46,7 @@
 #include "pci_core.h"
 #include "acpi.h"
 #include "dm.h"
+#include "precopy.h"
 
 
 /* Some audio drivers get topology data from ACPI NHLT table.
@@ -406,6 +407,9 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	ptdev = NULL;
 	error = -EINVAL;
 
+	/* the physical device DMAs to guest memory behind the dirty log */
+	precopy_untracked_dma("passthrough");
+
 	if (opts == NULL) {
 		warnx("Empty passthru options\n");
 		return -EINVAL;
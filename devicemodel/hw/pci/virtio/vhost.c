@@ -24,6 +24,7 @@
 #include "irq.h"
 #include "vmmapi.h"
 #include "vhost.h"
+#include "precopy.h"
 
 static int vhost_debug;
 #define LOG_TAG "vhost: "
@@ -732,6 +733,8 @@ vhost_dev_start(struct vhost_dev *vdev)
 			goto fail_vq;
 	}
 
+	/* vhost writes guest memory from the kernel */
+	precopy_untracked_dma(vdev->base->vops->name);
 	vdev->started = true;
 	return 0;
 
@@ -32,9 +32,11 @@
 #include <stdlib.h>
 
 #include "dm.h"
+#include "vmmapi.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "timer.h"
+#include "precopy.h"
 #include <atomic.h>
 
 /*
@@ -532,8 +534,10 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 				}
 			}
 		}
-		if ((vdir->flags & VRING_DESC_F_NEXT) == 0)
+		if ((vdir->flags & VRING_DESC_F_NEXT) == 0) {
+			precopy_dma_begin();
 			return i;
+		}
 	}
 loopy:
 	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
@@ -551,6 +555,47 @@ void
 vq_retchain(struct virtio_vq_info *vq)
 {
 	vq->last_avail--;
+	precopy_dma_end();
+}
+
+/*
+ * Mark the device writable buffers of a chain and the used ring dirty for
+ * a pre-copy in progress, the hypervisor dirty log does not see the DM
+ * writing them.
+ */
+static void
+vq_mark_dirty(struct virtio_vq_info *vq, uint16_t idx)
+{
+	volatile struct vring_desc *vd, *vindir;
+	struct vmctx *ctx;
+	u_int i, j, next, n_indir;
+
+	ctx = vq->base->dev->vmctx;
+	next = idx;
+	for (i = 0; i < VQ_MAX_DESCRIPTORS && next < vq->qsize; i++) {
+		vd = &vq->desc[next];
+		if (vd->flags & VRING_DESC_F_INDIRECT) {
+			n_indir = vd->len / 16;
+			vindir = paddr_guest2host(ctx, vd->addr, vd->len);
+			for (j = 0, next = 0; vindir != NULL &&
+			    j < VQ_MAX_DESCRIPTORS && next < n_indir; j++) {
+				if (vindir[next].flags & VRING_DESC_F_WRITE)
+					precopy_mark_dirty(vindir[next].addr,
+					    vindir[next].len);
+				if ((vindir[next].flags & VRING_DESC_F_NEXT) == 0)
+					break;
+				next = vindir[next].next;
+			}
+		} else if (vd->flags & VRING_DESC_F_WRITE)
+			precopy_mark_dirty(vd->addr, vd->len);
+		if ((vd->flags & VRING_DESC_F_NEXT) == 0)
+			break;
+		next = vd->next;
+	}
+
+	precopy_mark_dirty((uint64_t)((volatile char *)vq->used - ctx->baseaddr),
+	    sizeof(struct vring_used) +
+	    vq->qsize * sizeof(struct vring_used_elem) + sizeof(uint16_t));
 }
 
 /*
@@ -585,6 +630,10 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vue->id = idx;
 	vue->len = iolen;
 	vuh->idx = uidx;
+
+	if (precopy_dirty_tracking())
+		vq_mark_dirty(vq, idx);
+	precopy_dma_end();
 }
 
 /*
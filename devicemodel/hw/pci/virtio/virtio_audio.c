@@ -25,7 +25,9 @@
 #include "pci_core.h"
 #include "virtio.h"
 #include "virtio_kernel.h"
+#include "virtio_stream.h"
 #include "vmmapi.h"			/* for vmctx */
+#include "dm_string.h"
 
 /*
  * Size of queue was chosen experimentaly in a way
@@ -41,6 +43,17 @@
  */
 #define VIRTIO_AUDIO_VQ_NUM  4 /*4 currently we use 4 vq, may change later*/
 
+/*
+ * Without VBS-K, the queues are served in user space: messages are
+ * returned as they come (there is no DSP to mediate), the notification
+ * queue is left alone, and each playback or capture chain is one period
+ * of PCM data written to the sink or read from the source.
+ */
+#define VIRTIO_AUDIO_VQ_MSG		0
+#define VIRTIO_AUDIO_VQ_EVENT		1
+#define VIRTIO_AUDIO_VQ_PLAYBACK	2
+#define VIRTIO_AUDIO_VQ_CAPTURE		3
+
 const char *vbs_k_audio_dev_path = "/dev/vbs_k_audio";
 
 static int virtio_audio_debug = 1;
@@ -51,6 +64,8 @@ struct virtio_audio {
 	struct virtio_base base;
 	struct virtio_vq_info vq[VIRTIO_AUDIO_VQ_NUM];
 	pthread_mutex_t mtx;
+	/* VBS-U variables */
+	struct vstream streams[VIRTIO_AUDIO_VQ_NUM];
 	/* VBS-K variables */
 	struct {
 		enum VBS_K_STATUS kstatus;
@@ -76,6 +91,19 @@ static int virtio_audio_kernel_vq_set(struct vbs_vqs_info *kvqs,
 static void virtio_audio_k_no_notify(void *base, struct virtio_vq_info *vq);
 static void virtio_audio_k_set_status(void *base, uint64_t status);
 static void virtio_audio_reset(void *base);
+static void virtio_audio_notify(void *base, struct virtio_vq_info *vq);
+
+static struct virtio_ops virtio_audio_ops = {
+	"virtio_audio",		/* our name */
+	VIRTIO_AUDIO_VQ_NUM,	/* we support 4 virtqueue */
+	0,			/* config reg size */
+	virtio_audio_reset,	/* reset */
+	virtio_audio_notify,	/* device-wide qnotify */
+	NULL,			/* read virtio config */
+	NULL,			/* write virtio config */
+	NULL,			/* apply negotiated features */
+	NULL,			/* called on guest set status */
+};
 
 static struct virtio_ops virtio_audio_ops_k = {
 	"virtio_audio",		/* our name */
@@ -186,9 +214,13 @@ virtio_audio_reset(void *base)
 {
 	struct virtio_audio *virt_audio;
 
+	int i;
+
 	virt_audio = (struct virtio_audio *)base;
 
 	DPRINTF(("virtio_audio: device reset requested !\n"));
+	for (i = 0; i < VIRTIO_AUDIO_VQ_NUM; i++)
+		vstream_reset(&virt_audio->streams[i]);
 	virtio_reset_dev(&virt_audio->base);
 	DPRINTF(("virtio_audio: kstatus %d\n", virt_audio->vbs_k.kstatus));
 	if (virt_audio->vbs_k.kstatus == VIRTIO_DEV_STARTED) {
@@ -199,6 +231,16 @@ virtio_audio_reset(void *base)
 	}
 }
 
+static void
+virtio_audio_notify(void *base, struct virtio_vq_info *vq)
+{
+	struct virtio_audio *virt_audio = base;
+	int i = vq - virt_audio->vq;
+
+	if (i != VIRTIO_AUDIO_VQ_EVENT && vq_has_descs(vq))
+		vstream_notify(&virt_audio->streams[i]);
+}
+
 /* VBS-K interface function implementations */
 static void
 virtio_audio_k_no_notify(void *base, struct virtio_vq_info *vq)
@@ -275,6 +317,47 @@ virtio_audio_k_set_status(void *base, uint64_t status)
 	}
 }
 
+static int
+virtio_audio_start_streams(struct virtio_audio *virt_audio,
+			   struct pci_vdev *dev, const char *sink,
+			   const char *source, uint32_t period, uint64_t rate)
+{
+	char tname[MAXCOMLEN + 1];
+	int rc;
+
+	snprintf(tname, sizeof(tname), "vtaud-%d:%d m", dev->slot, dev->func);
+	rc = vstream_init(&virt_audio->streams[VIRTIO_AUDIO_VQ_MSG],
+			  &virt_audio->vq[VIRTIO_AUDIO_VQ_MSG], VSTREAM_ACK,
+			  NULL, 0, 0, tname);
+	if (rc < 0)
+		goto fail;
+
+	snprintf(tname, sizeof(tname), "vtaud-%d:%d p", dev->slot, dev->func);
+	rc = vstream_init(&virt_audio->streams[VIRTIO_AUDIO_VQ_PLAYBACK],
+			  &virt_audio->vq[VIRTIO_AUDIO_VQ_PLAYBACK],
+			  VSTREAM_SINK, sink, period, rate, tname);
+	if (rc < 0)
+		goto fail;
+
+	snprintf(tname, sizeof(tname), "vtaud-%d:%d c", dev->slot, dev->func);
+	rc = vstream_init(&virt_audio->streams[VIRTIO_AUDIO_VQ_CAPTURE],
+			  &virt_audio->vq[VIRTIO_AUDIO_VQ_CAPTURE],
+			  VSTREAM_SOURCE, source, period, rate, tname);
+	if (rc < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	vstream_deinit(&virt_audio->streams[VIRTIO_AUDIO_VQ_PLAYBACK]);
+	vstream_deinit(&virt_audio->streams[VIRTIO_AUDIO_VQ_MSG]);
+	return -1;
+}
+
+/*
+ * Options, only used when VBS-K is not available:
+ * sink=<file>, source=<file>, period=<bytes>, rate=<bytes per second>
+ */
 static int
 virtio_audio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -282,6 +365,42 @@ virtio_audio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	pthread_mutexattr_t attr;
 	int rc;
+	char *opt;
+	char *key;
+	char *sink = NULL;
+	char *source = NULL;
+	unsigned long period = 0;
+	unsigned long rate = 0;
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		key = strsep(&opt, "=");
+		if (opt == NULL) {
+			WPRINTF(("virtio_audio: option %s needs a value\n",
+				 key));
+			return -1;
+		}
+		if (strcmp(key, "sink") == 0) {
+			sink = opt;
+		} else if (strcmp(key, "source") == 0) {
+			source = opt;
+		} else if (strcmp(key, "period") == 0) {
+			if (dm_strtoul(opt, NULL, 0, &period) < 0 ||
+			    period > UINT32_MAX) {
+				WPRINTF(("virtio_audio: invalid period %s\n",
+					 opt));
+				return -1;
+			}
+		} else if (strcmp(key, "rate") == 0) {
+			if (dm_strtoul(opt, NULL, 0, &rate) < 0) {
+				WPRINTF(("virtio_audio: invalid rate %s\n",
+					 opt));
+				return -1;
+			}
+		} else {
+			WPRINTF(("virtio_audio: unknown option %s\n", key));
+			return -1;
+		}
+	}
 
 	virt_audio = calloc(1, sizeof(struct virtio_audio));
 	if (!virt_audio) {
@@ -312,21 +431,26 @@ virtio_audio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (rc)
 		DPRINTF(("mutex init failed with error %d!\n", rc));
 
-	virtio_linkup(&virt_audio->base,
-		      &virtio_audio_ops_k,
-		      virt_audio,
-		      dev,
-		      virt_audio->vq,
-		      BACKEND_VBSK);
-
 	rc = virtio_audio_kernel_init(virt_audio);
 	if (rc < 0) {
-		WPRINTF(("virtio_audio: VBS-K init failed,error %d!\n", rc));
+		WPRINTF(("virtio_audio: VBS-K init failed,error %d, "
+			 "fallback to VBS-U\n", rc));
 		virt_audio->vbs_k.kstatus = VIRTIO_DEV_INIT_FAILED;
-		free(virt_audio);
-		return -1;
+		virtio_linkup(&virt_audio->base,
+			      &virtio_audio_ops,
+			      virt_audio,
+			      dev,
+			      virt_audio->vq,
+			      BACKEND_VBSU);
+	} else {
+		virt_audio->vbs_k.kstatus = VIRTIO_DEV_INIT_SUCCESS;
+		virtio_linkup(&virt_audio->base,
+			      &virtio_audio_ops_k,
+			      virt_audio,
+			      dev,
+			      virt_audio->vq,
+			      BACKEND_VBSK);
 	}
-	virt_audio->vbs_k.kstatus = VIRTIO_DEV_INIT_SUCCESS;
 	virt_audio->base.mtx = &virt_audio->mtx;
 
 	/* vq[0] and vq[1] are for interrupt and messages */
@@ -343,25 +467,38 @@ virtio_audio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_AUDIO);
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, INTEL_VENDOR_ID);
 
-	if (virtio_interrupt_init(&virt_audio->base, virtio_uses_msix())) {
-		free(virt_audio);
-		return -1;
-	}
+	if (virtio_interrupt_init(&virt_audio->base, virtio_uses_msix()))
+		goto fail;
 	virtio_set_io_bar(&virt_audio->base, 0);
 
+	if (virt_audio->vbs_k.kstatus != VIRTIO_DEV_INIT_SUCCESS &&
+	    virtio_audio_start_streams(virt_audio, dev, sink, source,
+				       period, rate) < 0)
+		goto fail;
+
 	return 0;
+
+fail:
+	if (virt_audio->vbs_k.audio_fd >= 0)
+		close(virt_audio->vbs_k.audio_fd);
+	pthread_mutex_destroy(&virt_audio->mtx);
+	free(virt_audio);
+	return -1;
 }
 
 static void
 virtio_audio_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_audio *virt_audio;
+	int i;
 
 	virt_audio = dev->arg;
 	if (!virt_audio) {
 		DPRINTF(("%s: virtio_audio is NULL!\n", __func__));
 		return;
 	}
+	for (i = 0; i < VIRTIO_AUDIO_VQ_NUM; i++)
+		vstream_deinit(&virt_audio->streams[i]);
 	if (virt_audio->vbs_k.kstatus == VIRTIO_DEV_STARTED) {
 		DPRINTF(("%s: deinit virtio_audio_k!\n", __func__));
 		virtio_audio_kernel_stop(virt_audio);
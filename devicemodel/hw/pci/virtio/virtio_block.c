@@ -60,6 +60,7 @@
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
 
 #define	VIRTIO_BLK_F_DISCARD	(1 << 13)
+#define	VIRTIO_BLK_F_WRITE_ZEROES	(1 << 14)
 
 /*
  * Basic device capabilities
@@ -106,6 +107,13 @@ struct virtio_blk_config {
 	uint32_t max_discard_seg;
 	/* Discard commands must be aligned to this number of sectors. */
 	uint32_t discard_sector_alignment;
+	/* The maximum write zeroes sectors (in 512-byte sectors) for one segment */
+	uint32_t max_write_zeroes_sectors;
+	/* The maximum number of write zeroes segments */
+	uint32_t max_write_zeroes_seg;
+	/* Write zeroes with the UNMAP flag may deallocate the range */
+	uint8_t write_zeroes_may_unmap;
+	uint8_t unused1[3];
 } __attribute__((packed));
 
 /*
@@ -118,6 +126,7 @@ struct virtio_blk_hdr {
 #define	VBH_OP_FLUSH_OUT	5
 #define	VBH_OP_IDENT		8
 #define	VBH_OP_DISCARD		11
+#define	VBH_OP_WRITE_ZEROES	13
 #define	VBH_FLAG_BARRIER	0x80000000	/* OR'ed into type */
 	uint32_t type;
 	uint32_t ioprio;
@@ -288,7 +297,8 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 */
 	type = vbh->type & ~VBH_FLAG_BARRIER;
 	writeop = ((type == VBH_OP_WRITE) ||
-			(type == VBH_OP_DISCARD));
+			(type == VBH_OP_DISCARD) ||
+			(type == VBH_OP_WRITE_ZEROES));
 
 	if (blk->dummy_bctxt) {
 		WPRINTF(("Block context invalid: Operation cannot be permitted!\n"));
@@ -350,7 +360,19 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 				(blk->bc, &io->req);
 		break;
 	case VBH_OP_DISCARD:
-		err = blockif_discard(blk->bc, &io->req);
+	case VBH_OP_WRITE_ZEROES:
+		/*
+		 * block_if takes the segments from a single iov, with more it
+		 * would use the ahci offset/resid, i.e. the header sector.
+		 */
+		if (io->req.iovcnt != 1) {
+			WPRINTF(("virtio_blk: %d iovs for the discard segments\n",
+				 io->req.iovcnt));
+			virtio_blk_done(&io->req, EINVAL);
+			return;
+		}
+		err = ((type == VBH_OP_DISCARD) ? blockif_discard :
+		       blockif_write_zeroes)(blk->bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
@@ -395,6 +417,8 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 
 	if (blockif_is_ro(blk->bc))
 		caps |= VIRTIO_BLK_F_RO;
+	else
+		caps |= VIRTIO_BLK_F_WRITE_ZEROES;
 
 	return caps;
 }
@@ -429,6 +453,11 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 		blk->cfg.max_discard_seg = blockif_max_discard_seg(blk->bc);
 		blk->cfg.discard_sector_alignment = blockif_discard_sector_alignment(blk->bc);
 	}
+	if (!blockif_is_ro(blk->bc)) {
+		blk->cfg.max_write_zeroes_sectors = blockif_max_write_zeroes_sectors(blk->bc);
+		blk->cfg.max_write_zeroes_seg = blockif_max_write_zeroes_seg(blk->bc);
+		blk->cfg.write_zeroes_may_unmap = blockif_candiscard(blk->bc) ? 1 : 0;
+	}
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
@@ -21,7 +21,10 @@
 #include "pci_core.h"
 #include "virtio.h"
 #include "virtio_kernel.h"
+#include "virtio_stream.h"
 #include "vmmapi.h"
+#include "dm_string.h"
+#include "log.h"
 
 /*
  * Size of queue was chosen experimentally in a way
@@ -38,6 +41,15 @@
  */
 #define VIRTIO_IPU_VQ_NUM 2
 
+/*
+ * Without VBS-K, VQ0 is served in user space as a capture stream: the
+ * frame buffers the guest queues are filled in place, straight in guest
+ * memory, from the source file; chains without device-writable buffers
+ * (configuration) are returned as they come. VQ1 is left alone.
+ */
+#define VIRTIO_IPU_VQ_BUF 0
+#define VIRTIO_IPU_VQ_MSG 1
+
 #define IPU_VBS_DEV_PATH "/dev/vbs_ipu"
 
 static int ipu_log_level;
@@ -52,6 +64,8 @@ struct virtio_ipu {
 	struct virtio_base base;
 	struct virtio_vq_info vq[VIRTIO_IPU_VQ_NUM];
 	pthread_mutex_t mtx;
+	/* VBS-U variables */
+	struct vstream capture;
 	/* VBS-K variables */
 	struct {
 		enum VBS_K_STATUS ipu_kstatus;
@@ -77,6 +91,7 @@ static int virtio_ipu_k_vq_set(struct vbs_vqs_info *ipu_kvqs,
 				uint32_t msix_data);
 
 static void virtio_ipu_no_notify(void *, struct virtio_vq_info *);
+static void virtio_ipu_notify(void *, struct virtio_vq_info *);
 static void virtio_ipu_set_status(void *, uint64_t);
 static void virtio_ipu_reset(void *);
 
@@ -92,6 +107,18 @@ static struct virtio_ops virtio_ipu_ops_k = {
 	virtio_ipu_set_status,		/* called on guest set status */
 };
 
+static struct virtio_ops virtio_ipu_ops = {
+	"virtio_ipu",			/* our name */
+	VIRTIO_IPU_VQ_NUM,		/* we support 2 virtqueue */
+	0,				/* config reg size */
+	virtio_ipu_reset,		/* reset */
+	virtio_ipu_notify,		/* device-wide qnotify */
+	NULL,				/* read virtio config */
+	NULL,				/* write virtio config */
+	NULL,				/* apply negotiated features */
+	NULL,				/* called on guest set status */
+};
+
 static int
 virtio_ipu_k_init(struct virtio_ipu *ipu)
 {
@@ -198,6 +225,7 @@ virtio_ipu_reset(void *base)
 	ipu = (struct virtio_ipu *)base;
 
 	IPRINTF(LDBG, "device reset requested !\n");
+	vstream_reset(&ipu->capture);
 	virtio_reset_dev(&ipu->base);
 	if (ipu->vbs_k.ipu_kstatus == VIRTIO_DEV_STARTED) {
 		virtio_ipu_k_stop(ipu);
@@ -206,6 +234,15 @@ virtio_ipu_reset(void *base)
 	}
 }
 
+static void
+virtio_ipu_notify(void *base, struct virtio_vq_info *vq)
+{
+	struct virtio_ipu *ipu = base;
+
+	if (vq == &ipu->vq[VIRTIO_IPU_VQ_BUF] && vq_has_descs(vq))
+		vstream_notify(&ipu->capture);
+}
+
 /* VBS-K interface function implementations */
 static void
 virtio_ipu_no_notify(void *base, struct virtio_vq_info *vq)
@@ -281,6 +318,10 @@ virtio_ipu_set_status(void *base, uint64_t status)
 	}
 }
 
+/*
+ * Options, only used when VBS-K is not available:
+ * source=<file>, frame=<bytes>, fps=<frames per second>
+ */
 static int
 virtio_ipu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -289,6 +330,42 @@ virtio_ipu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	pthread_mutexattr_t attr;
 	int rc;
+	char *opt;
+	char *key;
+	char *source = NULL;
+	unsigned long frame = 0;
+	unsigned long fps = 0;
+	char tname[MAXCOMLEN + 1];
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		key = strsep(&opt, "=");
+		if (opt == NULL) {
+			pr_err(TAG "option %s needs a value\n", key);
+			return -1;
+		}
+		if (strcmp(key, "source") == 0) {
+			source = opt;
+		} else if (strcmp(key, "frame") == 0) {
+			if (dm_strtoul(opt, NULL, 0, &frame) < 0 ||
+			    frame > UINT32_MAX) {
+				pr_err(TAG "invalid frame size %s\n", opt);
+				return -1;
+			}
+		} else if (strcmp(key, "fps") == 0) {
+			if (dm_strtoul(opt, NULL, 0, &fps) < 0 ||
+			    fps > 1000) {
+				pr_err(TAG "invalid fps %s\n", opt);
+				return -1;
+			}
+		} else {
+			pr_err(TAG "unknown option %s\n", key);
+			return -1;
+		}
+	}
+	if (fps != 0 && frame == 0) {
+		pr_err(TAG "fps needs a frame size\n");
+		return -1;
+	}
 
 	ipu = calloc(1, sizeof(struct virtio_ipu));
 	if (!ipu) {
@@ -315,23 +392,26 @@ virtio_ipu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (rc)
 		IPRINTF(LDBG, "mutex init failed with error %d!\n", rc);
 
-	virtio_linkup(&ipu->base,
-		      &virtio_ipu_ops_k,
-		      ipu,
-		      dev,
-		      ipu->vq,
-		      BACKEND_VBSK);
-
 	rc = virtio_ipu_k_init(ipu);
 	if (rc < 0) {
-		IPRINTF(LWRN, "VBS-K init failed with error %d!\n", rc);
+		IPRINTF(LWRN, "VBS-K init failed with error %d, "
+			"fallback to VBS-U\n", rc);
 		ipu->vbs_k.ipu_kstatus = VIRTIO_DEV_INIT_FAILED;
-		pthread_mutex_destroy(&ipu->mtx);
-		free(ipu);
-		return -1;
+		virtio_linkup(&ipu->base,
+			      &virtio_ipu_ops,
+			      ipu,
+			      dev,
+			      ipu->vq,
+			      BACKEND_VBSU);
+	} else {
+		ipu->vbs_k.ipu_kstatus = VIRTIO_DEV_INIT_SUCCESS;
+		virtio_linkup(&ipu->base,
+			      &virtio_ipu_ops_k,
+			      ipu,
+			      dev,
+			      ipu->vq,
+			      BACKEND_VBSK);
 	}
-
-	ipu->vbs_k.ipu_kstatus = VIRTIO_DEV_INIT_SUCCESS;
 	ipu->base.mtx = &ipu->mtx;
 
 	ipu->vq[0].qsize = VIRTIO_IPU_RINGSZ;
@@ -344,16 +424,28 @@ virtio_ipu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_IPU);
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, INTEL_VENDOR_ID);
 
-	if (virtio_interrupt_init(&ipu->base, virtio_uses_msix())) {
-		pthread_mutex_destroy(&ipu->mtx);
-		close(ipu->vbs_k.ipu_fd);
-		free(ipu);
-		return -1;
-	}
+	if (virtio_interrupt_init(&ipu->base, virtio_uses_msix()))
+		goto fail;
 
 	virtio_set_io_bar(&ipu->base, 0);
 
+	if (ipu->vbs_k.ipu_kstatus != VIRTIO_DEV_INIT_SUCCESS) {
+		snprintf(tname, sizeof(tname), "vtipu-%d:%d", dev->slot,
+			 dev->func);
+		if (vstream_init(&ipu->capture, &ipu->vq[VIRTIO_IPU_VQ_BUF],
+				 VSTREAM_SOURCE, source, frame, frame * fps,
+				 tname) < 0)
+			goto fail;
+	}
+
 	return 0;
+
+fail:
+	if (ipu->vbs_k.ipu_fd >= 0)
+		close(ipu->vbs_k.ipu_fd);
+	pthread_mutex_destroy(&ipu->mtx);
+	free(ipu);
+	return -1;
 }
 
 static void
@@ -368,6 +460,8 @@ virtio_ipu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return;
 	}
 
+	vstream_deinit(&ipu->capture);
+
 	if (ipu->vbs_k.ipu_kstatus == VIRTIO_DEV_STARTED) {
 		IPRINTF(LDBG, "deinitializing\n");
 		virtio_ipu_k_stop(ipu);
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <sys/ioctl.h>
 #include "virtio_kernel.h"
+#include "precopy.h"
 
 static int virtio_kernel_debug;
 #define DPRINTF(params) do { if (virtio_kernel_debug) printf params; } while (0)
@@ -77,6 +78,8 @@ vbs_kernel_start(int fd, struct vbs_dev_info *dev, struct vbs_vqs_info *vqs)
 		return ret;
 	}
 
+	/* the kernel backend writes guest memory on its own */
+	precopy_untracked_dma("virtio kernel backend");
 	return VIRTIO_SUCCESS;
 }
 
@@ -36,14 +36,61 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/random.h>
 
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "virtio_kernel.h"
 #include "vmmapi.h"			/* for vmctx */
+#include "dm_string.h"
 
 #define VIRTIO_RND_RINGSZ	64
+#define VIRTIO_RND_MAXSEGS	8
+
+/*
+ * Entropy is pulled from the source in blocks of this size and handed out
+ * to the guest from the pool, so a guest asking for a few bytes at a time
+ * does not cost a syscall (or a string of RDRAND) per request.
+ */
+#define VIRTIO_RND_POOL_SIZE	4096
+
+/* RDSEED may transiently run dry, retry a little before giving up */
+#define VIRTIO_RND_HW_RETRIES	16
+
+/* CPUID.01H:ECX and CPUID.(EAX=07H,ECX=0):EBX feature bits */
+#define VIRTIO_RND_CPUID_RDRAND	(1U << 30)
+#define VIRTIO_RND_CPUID_RDSEED	(1U << 18)
+
+/* back off this long (ms) when every source has run dry */
+#define VIRTIO_RND_WAIT_MS	10
+
+enum virtio_rnd_source {
+	RND_SRC_NONE = 0,
+	RND_SRC_GETRANDOM,
+	RND_SRC_RDSEED,
+	RND_SRC_RDRAND,
+	RND_SRC_DEV,		/* /dev/random */
+};
+
+static const char *const virtio_rnd_src_name[] = {
+	[RND_SRC_NONE]		= "none",
+	[RND_SRC_GETRANDOM]	= "getrandom",
+	[RND_SRC_RDSEED]	= "rdseed",
+	[RND_SRC_RDRAND]	= "rdrand",
+	[RND_SRC_DEV]		= "dev",
+};
+
+struct virtio_rnd_stats {
+	uint64_t bytes;		/* bytes handed to the guest */
+	uint64_t chains;	/* descriptor chains completed */
+	uint64_t refills;	/* pool refills */
+	uint64_t fallbacks;	/* refills served by the fallback source */
+	uint64_t waits;		/* times every source ran dry */
+	uint64_t throttled;	/* times the rate limit made us sleep */
+};
 
 /*
  * Per-device struct
@@ -59,6 +106,22 @@ struct virtio_rnd {
 	pthread_t rx_tid;
 	pthread_mutex_t	rx_mtx;
 	pthread_cond_t rx_cond;
+
+	/* entropy pool, only touched by the rx thread */
+	enum virtio_rnd_source source;
+	enum virtio_rnd_source fallback;
+	uint8_t pool[VIRTIO_RND_POOL_SIZE];
+	size_t pool_off;
+	size_t pool_len;
+
+	/* token bucket rate limit in bytes per second, 0 means unlimited */
+	uint64_t rate;
+	uint64_t tokens;
+	struct timespec rate_last;
+
+	struct virtio_rnd_stats stats;
+	struct timespec start;
+
 	/* VBS-K variables */
 	struct {
 		enum VBS_K_STATUS status;
@@ -297,14 +360,220 @@ virtio_rnd_reset(void *base)
 	}
 }
 
+static bool
+virtio_rnd_hw_supported(enum virtio_rnd_source src)
+{
+	u_int regs[4];
+
+	if (src == RND_SRC_RDRAND) {
+		do_cpuid(1, regs);
+		return (regs[2] & VIRTIO_RND_CPUID_RDRAND) != 0;
+	}
+
+	/* leaf 7 subleaf 0, do_cpuid() leaves ecx alone */
+	__asm __volatile("cpuid"
+		: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+		: "0" (7), "2" (0));
+	return (regs[1] & VIRTIO_RND_CPUID_RDSEED) != 0;
+}
+
+static inline bool
+rdrand64(uint64_t *val)
+{
+	uint8_t ok;
+
+	__asm __volatile("rdrand %0; setc %1" : "=r" (*val), "=qm" (ok));
+	return ok != 0;
+}
+
+static inline bool
+rdseed64(uint64_t *val)
+{
+	uint8_t ok;
+
+	__asm __volatile("rdseed %0; setc %1" : "=r" (*val), "=qm" (ok));
+	return ok != 0;
+}
+
+static ssize_t
+virtio_rnd_read_hw(enum virtio_rnd_source src, uint8_t *buf, size_t len)
+{
+	uint64_t val;
+	size_t off = 0, n;
+	int retries = 0;
+	bool ok;
+
+	while (off < len) {
+		ok = (src == RND_SRC_RDSEED) ? rdseed64(&val) : rdrand64(&val);
+		if (!ok) {
+			if (++retries < VIRTIO_RND_HW_RETRIES)
+				continue;
+			break;
+		}
+		retries = 0;
+		n = (len - off < sizeof(val)) ? (len - off) : sizeof(val);
+		memcpy(buf + off, &val, n);
+		off += n;
+	}
+
+	if (off == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return off;
+}
+
+static ssize_t
+virtio_rnd_read_source(struct virtio_rnd *rnd, enum virtio_rnd_source src,
+		       uint8_t *buf, size_t len)
+{
+	switch (src) {
+	case RND_SRC_GETRANDOM:
+		/* never block here, the pool refill falls back instead */
+		return getrandom(buf, len, GRND_NONBLOCK);
+	case RND_SRC_RDSEED:
+	case RND_SRC_RDRAND:
+		return virtio_rnd_read_hw(src, buf, len);
+	case RND_SRC_DEV:
+		return read(rnd->fd, buf, len);
+	default:
+		errno = ENODEV;
+		return -1;
+	}
+}
+
+/*
+ * Refill the pool from the configured source, then from the fallback one.
+ * Returns 0 if the pool holds some entropy afterwards, -1 otherwise.
+ */
+static int
+virtio_rnd_fill_pool(struct virtio_rnd *rnd)
+{
+	ssize_t len;
+
+	len = virtio_rnd_read_source(rnd, rnd->source, rnd->pool,
+				     sizeof(rnd->pool));
+	if (len <= 0 && rnd->fallback != RND_SRC_NONE) {
+		len = virtio_rnd_read_source(rnd, rnd->fallback, rnd->pool,
+					     sizeof(rnd->pool));
+		if (len > 0)
+			rnd->stats.fallbacks++;
+	}
+	if (len <= 0)
+		return -1;
+
+	rnd->pool_off = 0;
+	rnd->pool_len = len;
+	rnd->stats.refills++;
+	return 0;
+}
+
+/* Fill up to @limit bytes of the chain, returns the number of bytes written */
+static size_t
+virtio_rnd_fill_iov(struct virtio_rnd *rnd, struct iovec *iov, int n,
+		    size_t limit)
+{
+	size_t total = 0, off, chunk;
+	int i;
+
+	for (i = 0; i < n && total < limit; i++) {
+		off = 0;
+		while (off < iov[i].iov_len && total < limit) {
+			if (rnd->pool_off == rnd->pool_len &&
+			    virtio_rnd_fill_pool(rnd) < 0)
+				return total;
+
+			chunk = rnd->pool_len - rnd->pool_off;
+			if (chunk > iov[i].iov_len - off)
+				chunk = iov[i].iov_len - off;
+			if (chunk > limit - total)
+				chunk = limit - total;
+
+			memcpy((uint8_t *)iov[i].iov_base + off,
+			       rnd->pool + rnd->pool_off, chunk);
+			/* entropy handed out once must not linger */
+			memset(rnd->pool + rnd->pool_off, 0, chunk);
+			rnd->pool_off += chunk;
+			off += chunk;
+			total += chunk;
+		}
+	}
+
+	return total;
+}
+
+/*
+ * Token bucket: grant up to @want bytes, sleeping until at least one byte
+ * is allowed. The bucket holds at most one second worth of tokens.
+ */
+static size_t
+virtio_rnd_throttle(struct virtio_rnd *rnd, size_t want)
+{
+	struct timespec now, ts;
+	uint64_t ns, earned, need;
+
+	if (rnd->rate == 0)
+		return want;
+
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ns = (now.tv_sec - rnd->rate_last.tv_sec) * 1000000000UL +
+			now.tv_nsec - rnd->rate_last.tv_nsec;
+		if (ns > 1000000000UL)
+			ns = 1000000000UL;
+		/* keep the remainder accumulating until it is worth a byte */
+		earned = ns * rnd->rate / 1000000000UL;
+		if (earned > 0) {
+			rnd->tokens += earned;
+			if (rnd->tokens > rnd->rate)
+				rnd->tokens = rnd->rate;
+			rnd->rate_last = now;
+		}
+
+		if (rnd->tokens > 0) {
+			if (want > rnd->tokens)
+				want = rnd->tokens;
+			rnd->tokens -= want;
+			return want;
+		}
+
+		need = (want < rnd->rate) ? want : rnd->rate;
+		ns = need * 1000000000UL / rnd->rate;
+		ts.tv_sec = ns / 1000000000UL;
+		ts.tv_nsec = ns % 1000000000UL;
+		rnd->stats.throttled++;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* Every source ran dry: wait for entropy instead of giving up for good */
+static void
+virtio_rnd_wait_entropy(struct virtio_rnd *rnd)
+{
+	struct pollfd pfd;
+	struct timespec ts;
+
+	rnd->stats.waits++;
+	if (rnd->fd >= 0) {
+		pfd.fd = rnd->fd;
+		pfd.events = POLLIN;
+		poll(&pfd, 1, VIRTIO_RND_WAIT_MS);
+	} else {
+		ts.tv_sec = 0;
+		ts.tv_nsec = VIRTIO_RND_WAIT_MS * 1000000L;
+		nanosleep(&ts, NULL);
+	}
+}
+
 static void *
 virtio_rnd_get_entropy(void *param)
 {
 	struct virtio_rnd *rnd = param;
 	struct virtio_vq_info *vq = &rnd->vq;
-	struct iovec iov;
+	struct iovec iov[VIRTIO_RND_MAXSEGS];
+	size_t want, len;
 	uint16_t idx;
-	ssize_t len;
+	int i, n, used;
 
 	for (;;) {
 		pthread_mutex_lock(&rnd->rx_mtx);
@@ -321,26 +590,50 @@ virtio_rnd_get_entropy(void *param)
 		rnd->in_progress = 1;
 		pthread_mutex_unlock(&rnd->rx_mtx);
 
+		used = 0;
 		do {
-			vq_getchain(vq, &idx, &iov, 1, NULL);
-			len = read(rnd->fd, iov.iov_base, iov.iov_len);
-			if (len <= 0) {
-				vq_retchain(vq);
-				vq_endchains(vq, 0);
-
-				/* no data available */
-				if (len == -1 && errno == EAGAIN)
-					return NULL;
+			n = vq_getchain(vq, &idx, iov, VIRTIO_RND_MAXSEGS, NULL);
+			if (n <= 0)
 				break;
+			if (n > VIRTIO_RND_MAXSEGS)
+				n = VIRTIO_RND_MAXSEGS;
+
+			want = 0;
+			for (i = 0; i < n; i++)
+				want += iov[i].iov_len;
+
+			want = virtio_rnd_throttle(rnd, want);
+			len = virtio_rnd_fill_iov(rnd, iov, n, want);
+			if (rnd->rate != 0)
+				rnd->tokens += want - len;
+
+			if (len == 0) {
+				/*
+				 * No data available: hand back the chain,
+				 * push out what is done so far and retry.
+				 */
+				vq_retchain(vq);
+				if (used) {
+					vq_endchains(vq, 0);
+					used = 0;
+				}
+				virtio_rnd_wait_entropy(rnd);
+				continue;
 			}
 
 			/* release this chain and handle more */
 			vq_relchain(vq, idx, len);
+			rnd->stats.bytes += len;
+			rnd->stats.chains++;
+			used = 1;
 		} while (vq_has_descs(vq));
 
 		/* at least one avail ring element has been processed */
-		vq_endchains(vq, 1);
+		if (used)
+			vq_endchains(vq, 1);
 	}
+
+	return NULL;
 }
 
 static void
@@ -359,38 +652,105 @@ virtio_rnd_notify(void *base, struct virtio_vq_info *vq)
 	pthread_mutex_unlock(&rnd->rx_mtx);
 }
 
+static int
+virtio_rnd_parse_source(const char *name, enum virtio_rnd_source *src)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(virtio_rnd_src_name); i++) {
+		if (strcmp(name, virtio_rnd_src_name[i]) == 0) {
+			*src = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Options: kernel=on, source=<src>, fallback=<src>, rate=<bytes per second>
+ * with <src> one of getrandom, rdseed, rdrand, dev or none (fallback only).
+ */
 static int
 virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_rnd *rnd = NULL;
-	int fd;
+	int fd = -1;
 	pthread_mutexattr_t attr;
 	int rc;
 	char *opt;
-	char *vbs_k_opt = NULL;
+	char *key;
 	enum VBS_K_STATUS kstat = VIRTIO_DEV_INITIAL;
+	enum virtio_rnd_source source = RND_SRC_GETRANDOM;
+	enum virtio_rnd_source fallback = RND_SRC_DEV;
+	unsigned long rate = 0;
 	char tname[MAXCOMLEN + 1];
 
 	while ((opt = strsep(&opts, ",")) != NULL) {
-		/* vbs_k_opt should be kernel=on */
-		vbs_k_opt = strsep(&opt, "=");
-		DPRINTF(("vbs_k_opt is %s\n", vbs_k_opt));
-		if (opt != NULL) {
+		key = strsep(&opt, "=");
+		DPRINTF(("virtio_rnd: option %s\n", key));
+		if (opt == NULL) {
+			WPRINTF(("virtio_rnd: option %s needs a value\n", key));
+			return -1;
+		}
+		if (strcmp(key, "kernel") == 0) {
 			if (strncmp(opt, "on", 2) == 0)
 				kstat = VIRTIO_DEV_PRE_INIT;
 			WPRINTF(("virtio_rnd: VBS-K initializing..."));
+		} else if (strcmp(key, "source") == 0) {
+			if (virtio_rnd_parse_source(opt, &source) < 0 ||
+			    source == RND_SRC_NONE) {
+				WPRINTF(("virtio_rnd: invalid source %s\n", opt));
+				return -1;
+			}
+		} else if (strcmp(key, "fallback") == 0) {
+			if (virtio_rnd_parse_source(opt, &fallback) < 0) {
+				WPRINTF(("virtio_rnd: invalid fallback %s\n", opt));
+				return -1;
+			}
+		} else if (strcmp(key, "rate") == 0) {
+			if (dm_strtoul(opt, NULL, 0, &rate) < 0 ||
+			    rate > UINT32_MAX) {
+				WPRINTF(("virtio_rnd: invalid rate %s\n", opt));
+				return -1;
+			}
+		} else {
+			WPRINTF(("virtio_rnd: unknown option %s\n", key));
+			return -1;
 		}
 	}
 
-	/*
-	 * Should always be able to open /dev/random.
-	 */
-	fd = open("/dev/random", O_RDONLY);
-	if (fd < 0) {
-		WPRINTF(("virtio_rnd: open failed: /dev/random \n"));
+	if ((source == RND_SRC_RDSEED || source == RND_SRC_RDRAND) &&
+	    !virtio_rnd_hw_supported(source)) {
+		WPRINTF(("virtio_rnd: %s not supported, using %s\n",
+			 virtio_rnd_src_name[source],
+			 virtio_rnd_src_name[fallback]));
+		source = fallback;
+		fallback = RND_SRC_NONE;
+	}
+	if ((fallback == RND_SRC_RDSEED || fallback == RND_SRC_RDRAND) &&
+	    !virtio_rnd_hw_supported(fallback)) {
+		WPRINTF(("virtio_rnd: fallback %s not supported\n",
+			 virtio_rnd_src_name[fallback]));
+		fallback = RND_SRC_NONE;
+	}
+	if (fallback == source)
+		fallback = RND_SRC_NONE;
+	if (source == RND_SRC_NONE) {
+		WPRINTF(("virtio_rnd: no entropy source available\n"));
 		return -1;
 	}
 
+	if (source == RND_SRC_DEV || fallback == RND_SRC_DEV) {
+		/*
+		 * Should always be able to open /dev/random.
+		 */
+		fd = open("/dev/random", O_RDONLY);
+		if (fd < 0) {
+			WPRINTF(("virtio_rnd: open failed: /dev/random \n"));
+			return -1;
+		}
+	}
+
 	rnd = calloc(1, sizeof(struct virtio_rnd));
 	if (!rnd) {
 		WPRINTF(("virtio_rnd: calloc returns NULL\n"));
@@ -443,6 +803,15 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	/* keep /dev/random opened while emulating */
 	rnd->fd = fd;
+	rnd->source = source;
+	rnd->fallback = fallback;
+	rnd->rate = rate;
+	rnd->tokens = rate;
+	clock_gettime(CLOCK_MONOTONIC, &rnd->rate_last);
+	clock_gettime(CLOCK_MONOTONIC, &rnd->start);
+	DPRINTF(("virtio_rnd: source %s, fallback %s, rate %lu\n",
+		 virtio_rnd_src_name[source], virtio_rnd_src_name[fallback],
+		 rate));
 
 	/* initialize config space */
 	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_RANDOM);
@@ -469,7 +838,8 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	return 0;
 
 fail:
-	close(fd);
+	if (fd >= 0)
+		close(fd);
 	if (rnd) {
 		if (rnd->vbs_k.status == VIRTIO_DEV_INIT_SUCCESS) {
 			/* VBS-K is in use */
@@ -480,6 +850,26 @@ fail:
 	return -1;
 }
 
+static void
+virtio_rnd_dump_stats(struct virtio_rnd *rnd)
+{
+	struct timespec now;
+	uint64_t ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - rnd->start.tv_sec) * 1000UL +
+		(now.tv_nsec - rnd->start.tv_nsec) / 1000000L;
+	if (ms == 0)
+		ms = 1;
+
+	DPRINTF(("virtio_rnd: %lu bytes in %lu chains, %lu B/s\n",
+		 rnd->stats.bytes, rnd->stats.chains,
+		 rnd->stats.bytes * 1000UL / ms));
+	DPRINTF(("virtio_rnd: %lu refills, %lu fallbacks, %lu waits, "
+		 "%lu throttled\n", rnd->stats.refills, rnd->stats.fallbacks,
+		 rnd->stats.waits, rnd->stats.throttled));
+}
+
 static void
 virtio_rnd_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -495,6 +885,8 @@ virtio_rnd_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_cancel(rnd->rx_tid);
 	pthread_join(rnd->rx_tid, &jval);
 
+	virtio_rnd_dump_stats(rnd);
+
 	if (rnd->vbs_k.status == VIRTIO_DEV_STARTED) {
 		DPRINTF(("%s: deinit virtio_rnd_k!\n", __func__));
 		virtio_rnd_kernel_stop(rnd);
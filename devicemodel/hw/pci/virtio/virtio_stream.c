@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Virtqueue stream for the VBS-U mode of the mediator devices.
+ *
+ * A stream owns one virtqueue and one thread. Each chain the guest makes
+ * available is one buffer of the stream (an audio period, a camera frame):
+ * a sink writes the device-readable part of the chain to a file, a source
+ * fills the device-writable part from a file. The iovecs handed out by
+ * vq_getchain() point straight into the guest memory mapping, so the data
+ * goes between the guest pages and the file with a single readv/writev
+ * and no bounce buffer.
+ *
+ * Used ring entries are batched: the guest is interrupted once per pass
+ * over the available ring, or, for a paced stream, once before each sleep
+ * so that it can queue the next buffers while the current one "plays".
+ * A paced stream completes its buffers at the given byte rate, which lets
+ * a plain file stand in for the audio or camera hardware.
+ *
+ * The file is non-blocking and the thread polls it together with an
+ * eventfd, so that a FIFO whose other end is idle cannot hold a reset or
+ * the teardown of the device.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "pci_core.h"
+#include "virtio.h"
+#include "virtio_stream.h"
+#include "log.h"
+
+#define VSTREAM_MAXSEGS	64
+
+static bool
+vstream_stopping(struct vstream *s)
+{
+	bool stop;
+
+	pthread_mutex_lock(&s->mtx);
+	stop = s->resetting || s->closing;
+	pthread_mutex_unlock(&s->mtx);
+	return stop;
+}
+
+/*
+ * Wait for the file to become ready for events. Returns -1 when the wait
+ * was broken by a reset or the teardown of the stream.
+ */
+static int
+vstream_wait_fd(struct vstream *s, short events)
+{
+	struct pollfd fds[2];
+	uint64_t cnt;
+
+	fds[0].fd = s->fd;
+	fds[0].events = events;
+	fds[1].fd = s->wake_fd;
+	fds[1].events = POLLIN;
+	for (;;) {
+		if (vstream_stopping(s))
+			return -1;
+		fds[0].revents = 0;
+		fds[1].revents = 0;
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (fds[1].revents != 0) {
+			/* consume the wakeup, the flags say what it was for */
+			if (read(s->wake_fd, &cnt, sizeof(cnt)) < 0 &&
+			    errno != EAGAIN)
+				return -1;
+			continue;
+		}
+		if (fds[0].revents != 0)
+			return 0;
+	}
+}
+
+/* Break the thread out of vstream_wait_fd(), called with s->mtx held. */
+static void
+vstream_wake(struct vstream *s)
+{
+	uint64_t one = 1;
+
+	if (write(s->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		pr_err("%s: cannot wake thread: %s\n", s->name,
+		       strerror(errno));
+}
+
+static void
+vstream_iov_advance(struct iovec **iov, int *n, size_t len)
+{
+	while (*n > 0 && len >= (*iov)->iov_len) {
+		len -= (*iov)->iov_len;
+		(*iov)++;
+		(*n)--;
+	}
+	if (*n > 0) {
+		(*iov)->iov_base = (char *)(*iov)->iov_base + len;
+		(*iov)->iov_len -= len;
+	}
+}
+
+/*
+ * Keep the part of the chain the stream works on, capped to max_len bytes.
+ * Returns the number of entries put in buf, the byte count in *total.
+ */
+static int
+vstream_iov(struct vstream *s, struct iovec *iov, uint16_t *flags, int n,
+	    struct iovec *buf, size_t *total)
+{
+	uint16_t want = (s->dir == VSTREAM_SOURCE) ? VRING_DESC_F_WRITE : 0;
+	size_t len;
+	int i, m = 0;
+
+	*total = 0;
+	for (i = 0; i < n; i++) {
+		if ((flags[i] & VRING_DESC_F_WRITE) != want)
+			continue;
+		len = iov[i].iov_len;
+		if (s->max_len != 0 && *total + len > s->max_len)
+			len = s->max_len - *total;
+		if (len == 0)
+			break;
+		buf[m].iov_base = iov[i].iov_base;
+		buf[m].iov_len = len;
+		*total += len;
+		m++;
+	}
+	return m;
+}
+
+static void
+vstream_write(struct vstream *s, struct iovec *iov, int n)
+{
+	ssize_t rc;
+
+	while (s->fd >= 0 && n > 0) {
+		rc = writev(s->fd, iov, n);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				if (vstream_wait_fd(s, POLLOUT) < 0)
+					break;
+				continue;
+			}
+			if (s->stats.errors++ == 0)
+				pr_err("%s: write failed: %s\n", s->name,
+				       strerror(errno));
+			break;
+		}
+		vstream_iov_advance(&iov, &n, rc);
+	}
+}
+
+/*
+ * Fill the buffer from the file, rewinding a regular file at its end so
+ * that a short recording can feed a long capture. What cannot be read is
+ * zeroed: the guest always gets complete buffers.
+ */
+static void
+vstream_read(struct vstream *s, struct iovec *iov, int n)
+{
+	bool rewound = false;
+	ssize_t rc;
+	int i;
+
+	while (s->fd >= 0 && n > 0) {
+		rc = readv(s->fd, iov, n);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				if (vstream_wait_fd(s, POLLIN) < 0)
+					break;
+				continue;
+			}
+			if (s->stats.errors++ == 0)
+				pr_err("%s: read failed: %s\n", s->name,
+				       strerror(errno));
+			break;
+		}
+		if (rc == 0) {
+			if (!s->seekable || rewound ||
+			    lseek(s->fd, 0, SEEK_SET) != 0)
+				break;
+			rewound = true;
+			continue;
+		}
+		vstream_iov_advance(&iov, &n, rc);
+	}
+	for (i = 0; i < n; i++)
+		memset(iov[i].iov_base, 0, iov[i].iov_len);
+}
+
+static size_t
+vstream_xfer(struct vstream *s, struct iovec *iov, uint16_t *flags, int n)
+{
+	struct iovec buf[VSTREAM_MAXSEGS];
+	size_t total;
+	int m;
+
+	if (s->dir == VSTREAM_ACK)
+		return 0;
+
+	m = vstream_iov(s, iov, flags, n, buf, &total);
+	if (s->dir == VSTREAM_SINK)
+		vstream_write(s, buf, m);
+	else
+		vstream_read(s, buf, m);
+	s->stats.bytes += total;
+	return total;
+}
+
+/*
+ * Restart the stream clock when the thread picks up work. A deadline
+ * already passed means the guest let the ring run dry: the stream starts
+ * over from now instead of catching up.
+ */
+static void
+vstream_resync(struct vstream *s)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (s->next.tv_sec == 0 && s->next.tv_nsec == 0)
+		s->next = now;
+	else if (s->next.tv_sec < now.tv_sec ||
+		 (s->next.tv_sec == now.tv_sec &&
+		  s->next.tv_nsec < now.tv_nsec)) {
+		s->stats.xruns++;
+		s->next = now;
+	}
+}
+
+/*
+ * Hold the chain until its data would have been played or captured at
+ * the stream rate.
+ */
+static void
+vstream_pace(struct vstream *s, size_t len, int *used)
+{
+	uint64_t ns;
+
+	ns = s->next.tv_nsec + len * 1000000000UL / s->rate;
+	s->next.tv_sec += ns / 1000000000UL;
+	s->next.tv_nsec = ns % 1000000000UL;
+
+	/* let the guest refill while this buffer is in flight */
+	if (*used) {
+		vq_endchains(s->vq, 0);
+		s->stats.batches++;
+		*used = 0;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &s->next,
+			       NULL) == EINTR)
+		;
+}
+
+static void *
+vstream_thread(void *param)
+{
+	struct vstream *s = param;
+	struct virtio_vq_info *vq = s->vq;
+	struct iovec iov[VSTREAM_MAXSEGS];
+	uint16_t flags[VSTREAM_MAXSEGS];
+	uint16_t idx;
+	size_t len;
+	int n, used;
+
+	pthread_mutex_lock(&s->mtx);
+	for (;;) {
+		s->in_progress = false;
+		pthread_cond_broadcast(&s->idle);
+		while (!s->closing && (s->resetting || !vq_has_descs(vq)))
+			pthread_cond_wait(&s->cond, &s->mtx);
+		if (s->closing)
+			break;
+		s->in_progress = true;
+		pthread_mutex_unlock(&s->mtx);
+
+		if (s->rate != 0 && s->dir != VSTREAM_ACK)
+			vstream_resync(s);
+		used = 0;
+		do {
+			n = vq_getchain(vq, &idx, iov, VSTREAM_MAXSEGS, flags);
+			if (n <= 0) {
+				if (n < 0) {
+					/* wait for the guest to kick again */
+					pr_err("%s: bad chain\n", s->name);
+					pthread_mutex_lock(&s->mtx);
+					s->resetting = true;
+					pthread_mutex_unlock(&s->mtx);
+				}
+				break;
+			}
+			if (n > VSTREAM_MAXSEGS)
+				n = VSTREAM_MAXSEGS;
+
+			len = vstream_xfer(s, iov, flags, n);
+			if (s->rate != 0 && s->dir != VSTREAM_ACK)
+				vstream_pace(s, len, &used);
+
+			/* device-readable buffers are returned with 0 length */
+			vq_relchain(vq, idx, s->dir == VSTREAM_SOURCE ? len : 0);
+			s->stats.chains++;
+			used = 1;
+		} while (!vstream_stopping(s) && vq_has_descs(vq));
+
+		if (used) {
+			vq_endchains(vq, 1);
+			s->stats.batches++;
+		}
+		pthread_mutex_lock(&s->mtx);
+	}
+	pthread_mutex_unlock(&s->mtx);
+
+	return NULL;
+}
+
+/*
+ * Set up a stream on vq. path is opened for writing (sink) or reading
+ * (source); without a path a sink discards and a source produces zeroes.
+ */
+int
+vstream_init(struct vstream *s, struct virtio_vq_info *vq,
+	     enum vstream_dir dir, const char *path, uint32_t max_len,
+	     uint64_t rate, const char *name)
+{
+	struct stat st;
+	int flags;
+
+	memset(s, 0, sizeof(*s));
+	s->vq = vq;
+	s->dir = dir;
+	s->fd = -1;
+	s->wake_fd = -1;
+	s->max_len = max_len;
+	s->rate = rate;
+	snprintf(s->name, sizeof(s->name), "%s", name);
+
+	if (path != NULL && dir != VSTREAM_ACK) {
+		/*
+		 * A FIFO is opened read-write: the open does not wait for the
+		 * other end, and a source does not see EOF while no writer is
+		 * attached yet.
+		 */
+		if (stat(path, &st) == 0 && S_ISFIFO(st.st_mode))
+			flags = O_RDWR;
+		else if (dir == VSTREAM_SINK)
+			flags = O_WRONLY | O_CREAT | O_TRUNC;
+		else
+			flags = O_RDONLY;
+		s->fd = open(path, flags | O_NONBLOCK, 0644);
+		if (s->fd < 0) {
+			pr_err("%s: cannot open %s: %s\n", s->name, path,
+			       strerror(errno));
+			return -1;
+		}
+		s->seekable = fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode);
+	}
+
+	s->wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (s->wake_fd < 0) {
+		pr_err("%s: cannot create eventfd: %s\n", s->name,
+		       strerror(errno));
+		goto fail;
+	}
+
+	pthread_mutex_init(&s->mtx, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	pthread_cond_init(&s->idle, NULL);
+	if (pthread_create(&s->tid, NULL, vstream_thread, s) != 0) {
+		pr_err("%s: cannot create thread\n", s->name);
+		pthread_cond_destroy(&s->idle);
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->mtx);
+		goto fail;
+	}
+	pthread_setname_np(s->tid, s->name);
+	clock_gettime(CLOCK_MONOTONIC, &s->start);
+	s->started = true;
+
+	return 0;
+
+fail:
+	if (s->wake_fd >= 0)
+		close(s->wake_fd);
+	s->wake_fd = -1;
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = -1;
+	return -1;
+}
+
+void
+vstream_deinit(struct vstream *s)
+{
+	struct timespec now;
+	uint64_t ms;
+
+	if (!s->started)
+		return;
+
+	pthread_mutex_lock(&s->mtx);
+	s->closing = true;
+	pthread_cond_signal(&s->cond);
+	vstream_wake(s);
+	pthread_mutex_unlock(&s->mtx);
+	pthread_join(s->tid, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - s->start.tv_sec) * 1000UL +
+		(now.tv_nsec - s->start.tv_nsec) / 1000000L;
+	if (ms == 0)
+		ms = 1;
+	pr_info("%s: %lu bytes in %lu chains, %lu batches, %lu B/s, "
+		"%lu xruns, %lu errors\n", s->name, s->stats.bytes,
+		s->stats.chains, s->stats.batches, s->stats.bytes * 1000UL / ms,
+		s->stats.xruns, s->stats.errors);
+
+	pthread_cond_destroy(&s->idle);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->mtx);
+	close(s->wake_fd);
+	s->wake_fd = -1;
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = -1;
+	s->started = false;
+}
+
+void
+vstream_notify(struct vstream *s)
+{
+	if (!s->started)
+		return;
+
+	pthread_mutex_lock(&s->mtx);
+	s->resetting = false;
+	if (!s->in_progress)
+		pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->mtx);
+}
+
+/*
+ * Called before the rings are reset: wait for the thread to let go of the
+ * virtqueue. The stream stays idle until the guest kicks it again.
+ */
+void
+vstream_reset(struct vstream *s)
+{
+	if (!s->started)
+		return;
+
+	pthread_mutex_lock(&s->mtx);
+	s->resetting = true;
+	vstream_wake(s);
+	while (s->in_progress)
+		pthread_cond_wait(&s->idle, &s->mtx);
+	s->next.tv_sec = 0;
+	s->next.tv_nsec = 0;
+	if (s->seekable && s->dir == VSTREAM_SOURCE)
+		lseek(s->fd, 0, SEEK_SET);
+	pthread_mutex_unlock(&s->mtx);
+}
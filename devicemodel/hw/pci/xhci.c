@@ -95,6 +95,7 @@
 #include "vmmapi.h"
 #include "dm_string.h"
 #include "timer.h"
+#include "precopy.h"
 
 #undef LOG_TAG
 #define LOG_TAG			"xHCI: "
@@ -4249,6 +4250,9 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	dev->arg = xdev;
 	xdev->dev = dev;
 
+	/* no dirty tracking for what the xHCI emulation DMAs to guest memory */
+	precopy_untracked_dma("xhci");
+
 	xdev->usb2_port_start = (XHCI_MAX_DEVS/2) + 1;
 	xdev->usb3_port_start = 1;
 
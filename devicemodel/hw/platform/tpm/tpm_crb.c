@@ -275,7 +275,14 @@ static void tpm_crb_request_deliver(void *arg)
 			break;
 		}
 
+		/*
+		 * The command is left alone until ctrl_start is cleared: run it
+		 * unlocked, so that the vCPU thread polling the CRB registers
+		 * never waits for swtpm.
+		 */
+		pthread_mutex_unlock(&tpm_vdev->request_mutex);
 		ret = swtpm_handle_request(&tpm_vdev->cmd);
+		pthread_mutex_lock(&tpm_vdev->request_mutex);
 		tpm_crb_request_completed(tpm_vdev, ret);
 
 		ret = pthread_mutex_unlock(&tpm_vdev->request_mutex);
@@ -438,6 +445,9 @@ static int tpm_crb_reset(void *dev)
 		return -1;
 	}
 
+	/* cache the established flag now, not on the first LOC_STATE read */
+	(void)swtpm_get_tpm_established_flag();
+
 	return 0;
 }
 
@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "vmmapi.h"
 #include "tpm_internal.h"
@@ -125,6 +126,8 @@ typedef struct  {
  * provide TPM functionlity to UOS.
  *
  * ctrl_chan_fd: fd to communicate with SWTPM ctrl channel
+ * ctrl_chan_mtx: serializes the ctrl channel commands, a cancel is sent from
+ *    the vCPU thread while the CRB request thread may set the locality
  * cmd_chan_fd: fd to communicate with SWTPM cmd channel
  * cur_locty_number: to store the last set locality
  * established_flag & established_flag_cached: used in
@@ -132,6 +135,7 @@ typedef struct  {
  */
 typedef struct swtpm_context {
 	int ctrl_chan_fd;
+	pthread_mutex_t ctrl_chan_mtx;
 	int cmd_chan_fd;
 	uint8_t cur_locty_number; /* last set locality */
 	unsigned int established_flag:1;
@@ -160,7 +164,9 @@ enum {
 	CMD_GET_INFO,			/* 0x12 */
 };
 
-static swtpm_context tpm_context;
+static swtpm_context tpm_context = {
+	.ctrl_chan_mtx = PTHREAD_MUTEX_INITIALIZER,
+};
 
 
 static inline uint16_t tpm_cmd_get_tag(const void *b)
@@ -390,6 +396,48 @@ static int cmd_chan_read(int cmd_chan_fd, uint8_t *buf, int len)
 	return (len - nleft);
 }
 
+/*
+ * Read a TPM response. swtpm writes it at once and only one command is in
+ * flight, so a single read gets it whole most of the time: the header is
+ * only parsed to read what is missing, if anything.
+ *
+ * Returns the response size, or -1.
+ */
+static int cmd_chan_read_rsp(int cmd_chan_fd, uint8_t *out, uint32_t out_len)
+{
+	ssize_t nread;
+	uint32_t rsp_size;
+
+	do {
+		nread = read(cmd_chan_fd, out, out_len);
+	} while (nread < 0 && errno == EINTR);
+
+	if (nread <= 0) {
+		pr_err("cmd_chan_read_rsp: Error, read() %ld %s\n",
+			nread, (nread < 0) ? strerror(errno) : "EOF");
+		return -1;
+	}
+
+	if (nread < (ssize_t)sizeof(tpm_output_header)) {
+		if (cmd_chan_read(cmd_chan_fd, out + nread,
+				  sizeof(tpm_output_header) - nread) < 0)
+			return -1;
+		nread = sizeof(tpm_output_header);
+	}
+
+	rsp_size = tpm_cmd_get_size(out);
+	if (rsp_size > out_len || rsp_size < (uint32_t)nread) {
+		pr_err("%s error, bad response size %u\n", __func__, rsp_size);
+		return -1;
+	}
+
+	if (rsp_size > nread &&
+	    cmd_chan_read(cmd_chan_fd, out + nread, rsp_size - nread) < 0)
+		return -1;
+
+	return rsp_size;
+}
+
 /*
  * Send command to swtpm ctrl channel.
  * Note: Both msg_len_in & msg_len_out are valid and needed.
@@ -422,6 +470,7 @@ static int swtpm_ctrlcmd(int ctrl_chan_fd, unsigned long cmd, void *msg,
 	memcpy(buf, &cmd_no, sizeof(cmd_no));
 	memcpy(buf + sizeof(cmd_no), msg, msg_len_in);
 
+	pthread_mutex_lock(&tpm_context.ctrl_chan_mtx);
 	send_num = ctrl_chan_write(ctrl_chan_fd, buf, n, pdatafd, fd_num);
 	if ((send_num <= 0) || (send_num != n) ) {
 		pr_err("%s failed to write %d != %ld\n", __func__, send_num, n);
@@ -439,6 +488,7 @@ static int swtpm_ctrlcmd(int ctrl_chan_fd, unsigned long cmd, void *msg,
 	ret = 0;
 
 end:
+	pthread_mutex_unlock(&tpm_context.ctrl_chan_mtx);
 	free(buf);
 	return ret;
 }
@@ -475,23 +525,9 @@ static int swtpm_cmdcmd(int cmd_chan_fd,
 		return -1;
 	}
 
-	ret = cmd_chan_read(cmd_chan_fd, (uint8_t *)out,
-			  sizeof(tpm_output_header));
-	if (ret == -1) {
-		pr_err("%s failed to read size\n", __func__);
-		return -1;
-	}
-
-	if (tpm_cmd_get_size(out) > out_len) {
-		pr_err("%s error, get out size is larger than out_len\n", __func__);
-		return -1;
-	}
-
-	ret = cmd_chan_read(cmd_chan_fd,
-				(uint8_t *)out + sizeof(tpm_output_header),
-				tpm_cmd_get_size(out) - sizeof(tpm_output_header));
+	ret = cmd_chan_read_rsp(cmd_chan_fd, out, out_len);
 	if (ret == -1) {
-		pr_err("%s failed to read data\n", __func__);
+		pr_err("%s failed to read response\n", __func__);
 		return -1;
 	}
 
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * User space block cache for block_if, see hw/block_cache.c. Functions
+ * returning int return 0 or a negative errno.
+ */
+
+#ifndef _BLOCK_CACHE_H_
+#define _BLOCK_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct blkcache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t writebacks;	/* dirty blocks written to the disk */
+	uint64_t flushes;
+};
+
+struct blkcache;
+
+struct blkcache *blkcache_open(const char *path, int fd, off_t size,
+			       size_t cache_size, bool ro, bool shared);
+void	blkcache_close(struct blkcache *cache);
+ssize_t	blkcache_preadv(struct blkcache *cache, const struct iovec *iov,
+			int iovcnt, off_t offset);
+ssize_t	blkcache_pwritev(struct blkcache *cache, const struct iovec *iov,
+			 int iovcnt, off_t offset, bool writeback);
+int	blkcache_flush(struct blkcache *cache);
+int	blkcache_invalidate_begin(struct blkcache *cache, off_t offset,
+				  off_t len);
+void	blkcache_invalidate_end(struct blkcache *cache, off_t offset, off_t len);
+void	blkcache_get_stats(struct blkcache *cache, struct blkcache_stats *stats);
+
+#endif /* _BLOCK_CACHE_H_ */
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Copy-on-write disk image used by block_if, see hw/block_cow.c for the
+ * on-disk layout. Functions returning int return 0 or a negative errno.
+ */
+
+#ifndef _BLOCK_COW_H_
+#define _BLOCK_COW_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct cow_image;
+
+bool	cow_probe(int fd);
+int	cow_create(const char *path, const char *backing);
+struct cow_image *cow_open(int fd, const char *path, int ro);
+void	cow_close(struct cow_image *cow);
+off_t	cow_size(struct cow_image *cow);
+ssize_t	cow_preadv(struct cow_image *cow, const struct iovec *iov, int iovcnt,
+		   off_t offset);
+ssize_t	cow_pwritev(struct cow_image *cow, const struct iovec *iov, int iovcnt,
+		    off_t offset);
+int	cow_write_zeroes(struct cow_image *cow, off_t offset, off_t len);
+int	cow_snapshot_create(struct cow_image *cow, const char *name);
+int	cow_snapshot_revert(struct cow_image *cow, const char *name);
+int	cow_snapshot_delete(struct cow_image *cow, const char *name);
+
+#endif /* _BLOCK_COW_H_ */
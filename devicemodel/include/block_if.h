@@ -64,6 +64,7 @@ int	blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_write(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_flush(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq);
+int	blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_close(struct blockif_ctxt *bc);
 uint8_t	blockif_get_wce(struct blockif_ctxt *bc);
@@ -72,5 +73,7 @@ int	blockif_flush_all(struct blockif_ctxt *bc);
 int	blockif_max_discard_sectors(struct blockif_ctxt *bc);
 int	blockif_max_discard_seg(struct blockif_ctxt *bc);
 int	blockif_discard_sector_alignment(struct blockif_ctxt *bc);
+int	blockif_max_write_zeroes_sectors(struct blockif_ctxt *bc);
+int	blockif_max_write_zeroes_seg(struct blockif_ctxt *bc);
 
 #endif /* _BLOCK_IF_H_ */
@@ -26,6 +26,7 @@ struct logger_ops {
 	uint8_t (*get_log_level)(void);
 	int (*init)(bool enable, uint8_t log_level);
 	void (*deinit)(void);
+	int (*set_opt)(const char *opt);	/* optional "<key>=<value>" after the level */
 	void (*output)(const char *fmt, va_list args);
 };
 
@@ -17,6 +17,9 @@
 
 int monitor_init(struct vmctx *ctx);
 void monitor_close(void);
+void monitor_notify_state(void);
+int monitor_warm_requested(void);
+int monitor_wait_start(void);
 
 struct monitor_vm_ops {
 	int (*stop) (void *arg);
@@ -26,6 +29,7 @@ struct monitor_vm_ops {
 	int (*unpause) (void *arg);
 	int (*query) (void *arg);
 	int (*rescan)(void *arg, char *devargs);
+	int (*precopy)(void *arg, char *path);
 };
 
 int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
@@ -45,6 +45,8 @@
 #define	PCI_EMUL_MEMBASE64	0x100000000UL	/* 4GB */
 #define	PCI_EMUL_MEMLIMIT64	0x140000000UL	/* 5GB */
 
+#define	PCI_EMUL_LARGE_PAGE	0x200000UL	/* 2MB EPT page */
+
 /* Currently,only gvt need reserved bar regions,
  * so just hardcode REGION_NUMS=5 here
  */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _DM_INCLUDE_PRECOPY_
+#define _DM_INCLUDE_PRECOPY_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PRECOPY_MAGIC		0x59504f4352434141UL	/* "AACRCOPY" */
+#define PRECOPY_VERSION		1U
+
+/* precopy_record.gpa values with a special meaning, npages is unused */
+#define PRECOPY_ROUND_END	(~0UL)
+#define PRECOPY_STREAM_END	(~1UL)
+
+/*
+ * Stream layout: one precopy_header, then for every round a list of
+ * precopy_record each followed by npages * 4KB of page data, closed by a
+ * PRECOPY_ROUND_END record. A page may appear in several rounds, the last
+ * copy wins. The stream ends with a PRECOPY_STREAM_END record.
+ */
+struct precopy_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t page_size;
+	uint64_t lowmem;
+	uint64_t highmem;
+	uint64_t highmem_gpa_base;
+};
+
+struct precopy_record {
+	uint64_t gpa;
+	uint64_t npages;
+};
+
+struct vmctx;
+
+int vm_precopy_ram(struct vmctx *ctx, const char *path);
+int vm_monitor_precopy(void *arg, char *path);
+
+/* for the device models, see core/precopy.c */
+void precopy_mark_dirty(uint64_t gpa, uint64_t len);
+bool precopy_dirty_tracking(void);
+void precopy_dma_begin(void);
+void precopy_dma_end(void);
+void precopy_untracked_dma(const char *name);
+
+#endif
@@ -97,6 +97,7 @@
 #define IC_ALLOC_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x00)
 #define IC_SET_MEMSEG                   _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x01)
 #define IC_UNSET_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x02)
+#define IC_VM_DIRTY_LOG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x03)
 
 /* PCI assignment*/
 #define IC_ID_PCI_BASE                  0x50UL
@@ -149,6 +150,32 @@ struct vm_memmap {
 	uint32_t prot;	/* RWX */
 };
 
+#define VM_DIRTY_LOG_ENABLE		0U
+#define VM_DIRTY_LOG_DISABLE		1U
+#define VM_DIRTY_LOG_GET_AND_CLEAR	2U
+
+/**
+ * @brief Dirty page logging control for guest
+ */
+struct vm_dirty_log {
+	/** VM_DIRTY_LOG_ENABLE, VM_DIRTY_LOG_DISABLE or
+	 * VM_DIRTY_LOG_GET_AND_CLEAR
+	 */
+	uint32_t cmd;
+	/** reserved, must be 0 */
+	uint32_t reserved;
+	/** user OS guest physical start address of the range to fetch,
+	 * 256KB aligned
+	 */
+	uint64_t gpa;
+	/** size of the range to fetch, multiple of 256KB */
+	uint64_t size;
+	/** service OS user virtual address of the bitmap, one bit per
+	 * 4KB page of the range
+	 */
+	uint64_t bitmap;
+};
+
 /**
  * @brief Info to assign or deassign PCI for a VM
  *
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Virtqueue stream used by the VBS-U mode of the mediator devices
+ * (virtio-audio, virtio-ipu), see hw/pci/virtio/virtio_stream.c.
+ */
+
+#ifndef _VIRTIO_STREAM_H_
+#define _VIRTIO_STREAM_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "virtio.h"
+
+enum vstream_dir {
+	VSTREAM_SINK,		/* guest buffers are written to the file */
+	VSTREAM_SOURCE,		/* guest buffers are filled from the file */
+	VSTREAM_ACK,		/* chains are returned as they come */
+};
+
+struct vstream_stats {
+	uint64_t bytes;
+	uint64_t chains;
+	uint64_t batches;	/* used ring updates pushed to the guest */
+	uint64_t xruns;		/* paced stream starved by the guest */
+	uint64_t errors;
+};
+
+struct vstream {
+	struct virtio_vq_info *vq;
+	enum vstream_dir dir;
+	char name[16];
+	int fd;			/* -1: discard or fill with zeroes */
+	bool seekable;		/* rewind the source file at EOF */
+	uint32_t max_len;	/* bytes per chain, 0 for the whole chain */
+	uint64_t rate;		/* bytes per second, 0 for unpaced */
+	struct timespec next;	/* deadline of the next chain when paced */
+
+	pthread_t tid;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	pthread_cond_t idle;	/* signalled when in_progress drops */
+	int wake_fd;		/* eventfd breaking a wait on fd */
+	bool started;
+	bool in_progress;
+	bool resetting;
+	bool closing;
+
+	struct vstream_stats stats;
+	struct timespec start;
+};
+
+int	vstream_init(struct vstream *s, struct virtio_vq_info *vq,
+		     enum vstream_dir dir, const char *path,
+		     uint32_t max_len, uint64_t rate, const char *name);
+void	vstream_deinit(struct vstream *s);
+void	vstream_notify(struct vstream *s);
+void	vstream_reset(struct vstream *s);
+
+#endif /* _VIRTIO_STREAM_H_ */
@@ -17,6 +17,8 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #include "dm.h"
 #include "log.h"
@@ -33,12 +35,75 @@
 #define LOG_SIZE_LIMIT    0x200000 /* one log file size limit */
 #define LOG_FILES_COUNT   8
 
+/*
+ * Messages are not written from the logging thread. Each thread owns a ring
+ * it appends complete records to without any lock or syscall, a writer
+ * thread drains all rings with one writev() and takes care of the log file
+ * rotation. A record that does not fit in the ring is dropped and counted,
+ * the count is logged by the writer once there is room again. Records of
+ * different threads are grouped per flush, the timestamps give the order.
+ */
+#define DISK_LOG_RING_SIZE	0x10000U	/* per thread, power of 2 */
+#define DISK_LOG_MAX_RINGS	64
+#define DISK_LOG_FLUSH_MS	100
+
+#define DISK_LOG_RING_FREE	0
+#define DISK_LOG_RING_USED	1
+#define DISK_LOG_RING_ORPHAN	2	/* owner thread exited */
+
+struct disk_log_ring {
+	uint32_t head;		/* written by the owner thread */
+	uint32_t tail;		/* written by the writer thread */
+	uint64_t dropped;
+	int state;
+	uint8_t *data;
+};
+
+/*
+ * Binary format, "disk,level=<n>,format=bin": every file starts with a
+ * disk_log_bin_header, every record is a disk_log_bin_rec followed by the
+ * format string (NUL included) and the arguments, each one a type tag and
+ * its value, so formatting is left to the reader:
+ *   'i' int64_t, 'u' uint64_t, 'f' double, 's' uint32_t length + bytes.
+ */
+#define DISK_LOG_BIN_MAGIC	"ACRNDMLG"
+#define DISK_LOG_BIN_VERSION	1U
+
+struct disk_log_bin_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+struct disk_log_bin_rec {
+	uint32_t len;		/* whole record, this header included */
+	uint32_t fmt_len;
+	uint64_t timestamp;	/* CLOCK_MONOTONIC, ns */
+};
+
+#define DISK_LOG_REC_MAX	512
+
+static struct disk_log_ring disk_log_rings[DISK_LOG_MAX_RINGS];
+static __thread struct disk_log_ring *disk_log_my_ring;
+static pthread_key_t disk_log_key;
+
+static pthread_once_t disk_log_once = PTHREAD_ONCE_INIT;
+static pthread_t disk_log_tid;
+static bool disk_log_started;
+static bool disk_log_stop;
+static pthread_mutex_t disk_log_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t disk_log_cond = PTHREAD_COND_INITIALIZER;
+
+/* records dropped because no ring was left for the thread */
+static uint64_t disk_log_lost;
+
 static int disk_fd = -1;
 static uint32_t cur_log_size;
 static uint16_t cur_file_index;
 
 static uint8_t disk_log_level = LOG_DEBUG;
 static bool disk_log_enabled = false;
+static bool disk_log_binary = false;
 
 #define DISK_LOG_MAX_LEN    (MAX_ONE_LOG_SIZE + 32)
 #define INDEX_AFTER(a, b) ((short int)b - (short int)a < 0)
@@ -53,6 +118,23 @@ static uint8_t get_disk_log_level(void)
 	return disk_log_level;
 }
 
+static int write_disk_log_header(void)
+{
+	struct disk_log_bin_header hdr;
+
+	if (!disk_log_binary)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DISK_LOG_BIN_MAGIC, sizeof(hdr.magic));
+	hdr.version = DISK_LOG_BIN_VERSION;
+	if (write(disk_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+
+	cur_log_size += sizeof(hdr);
+	return 0;
+}
+
 static int probe_disk_log_file(void)
 {
 	char file_name[FILE_NAME_LENGTH];
@@ -104,15 +186,29 @@ static int probe_disk_log_file(void)
 		return -1;
 	}
 
-	if (write(disk_fd, LOG_DELIMITER, strlen(LOG_DELIMITER)) < 0) {
-		pr_err(DISK_PREFIX" write %s failed! Error: %s\n", file_name, strerror(errno));
-		return -1;
+	/* a binary file can't take a text delimiter, start a new one instead */
+	fstat(disk_fd, &st);
+	if (disk_log_binary && st.st_size != 0) {
+		close(disk_fd);
+		index++;
+		snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT, LOG_PATH_NODE, vmname, index);
+		disk_fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (disk_fd < 0) {
+			pr_err(DISK_PREFIX" open %s failed! Error: %s\n", file_name, strerror(errno));
+			return -1;
+		}
+		st.st_size = 0;
 	}
 
-	fstat(disk_fd, &st);
 	cur_log_size = st.st_size;
 	cur_file_index = index;
 
+	if ((disk_log_binary ? write_disk_log_header() :
+		write(disk_fd, LOG_DELIMITER, strlen(LOG_DELIMITER))) < 0) {
+		pr_err(DISK_PREFIX" write %s failed! Error: %s\n", file_name, strerror(errno));
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -124,83 +220,472 @@ static int init_disk_logger(bool enable, uint8_t log_level)
 	return 1;
 }
 
-static void deinit_disk_logger(void)
+static int set_disk_logger_opt(const char *opt)
 {
-	if (disk_fd > 0) {
-		disk_log_enabled = false;
+	if (strcmp(opt, "format=bin") == 0)
+		disk_log_binary = true;
+	else if (strcmp(opt, "format=text") == 0)
+		disk_log_binary = false;
+	else
+		return -1;
 
-		fsync(disk_fd);
-		close(disk_fd);
-		disk_fd = -1;
+	return 0;
+}
+
+static void rotate_disk_log_file(void)
+{
+	char file_name[FILE_NAME_LENGTH];
+
+	cur_file_index++;
+
+	/* remove the first old log file, to add a new one */
+	snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
+		LOG_PATH_NODE, vmname, (uint16_t)(cur_file_index - LOG_FILES_COUNT));
+	remove(file_name);
+
+	snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
+		LOG_PATH_NODE, vmname, cur_file_index);
+
+	close(disk_fd);
+	disk_fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (disk_fd < 0) {
+		pr_err(DISK_PREFIX" open %s failed! Error: %s\n", file_name, strerror(errno));
+		return;
 	}
+	cur_log_size = 0;
+	write_disk_log_header();
 }
 
-static void write_to_disk(const char *fmt, va_list args)
+static int put_bin_arg(uint8_t *buf, int off, char tag, const void *val, int len)
 {
-	char buffer[DISK_LOG_MAX_LEN];
-	char *file_name = buffer;
-	char *buf;
-	int len;
-	int write_cnt;
-	struct timespec times = {0, 0};
+	if (off < 0 || off + 1 + len > DISK_LOG_REC_MAX)
+		return -1;
 
-	if ((disk_fd < 0) && disk_log_enabled) {
-		/**
-		 * usually this probe just be called once in DM whole life; but we need use vmname in
-		 * probe_disk_log_file, it can't be called in init_disk_logger for vmname not inited then,
-		 * so call it here.
-		 */
-		if (probe_disk_log_file() < 0) {
-			disk_log_enabled = false;
-			return;
+	buf[off] = tag;
+	memcpy(buf + off + 1, val, len);
+	return off + 1 + len;
+}
+
+/*
+ * Serialize the format string and its arguments. Returns the record length,
+ * or -1 if the record does not fit or the format uses a conversion the
+ * reader does not handle.
+ */
+static int encode_bin_record(uint8_t *buf, uint64_t ts, const char *fmt, va_list args)
+{
+	struct disk_log_bin_rec *rec = (struct disk_log_bin_rec *)buf;
+	const char *p, *s;
+	int64_t ival;
+	uint64_t uval;
+	double dval;
+	uint32_t slen;
+	int off, lmod;
+
+	rec->fmt_len = strnlen(fmt, MAX_ONE_LOG_SIZE) + 1;
+	if (sizeof(*rec) + rec->fmt_len > DISK_LOG_REC_MAX)
+		return -1;
+	rec->timestamp = ts;
+	memcpy(buf + sizeof(*rec), fmt, rec->fmt_len - 1);
+	buf[sizeof(*rec) + rec->fmt_len - 1] = '\0';
+	off = sizeof(*rec) + rec->fmt_len;
+
+	for (p = fmt; (p = strchr(p, '%')) != NULL; p++) {
+		p++;
+		if (*p == '%')
+			continue;
+
+		while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+			p++;
+		if (*p == '*') {
+			ival = va_arg(args, int);
+			off = put_bin_arg(buf, off, 'i', &ival, sizeof(ival));
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				ival = va_arg(args, int);
+				off = put_bin_arg(buf, off, 'i', &ival, sizeof(ival));
+				p++;
+			}
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+
+		/* 0: int, 1: long, 2: long long, 'h'/'H': short/char, 'z': size_t */
+		lmod = 0;
+		if (*p == 'h') {
+			lmod = (p[1] == 'h') ? 'H' : 'h';
+			p += (p[1] == 'h') ? 2 : 1;
+		} else if (*p == 'l') {
+			lmod = (p[1] == 'l') ? 2 : 1;
+			p += (p[1] == 'l') ? 2 : 1;
+		} else if (*p == 'z' || *p == 'j' || *p == 't') {
+			lmod = 2;
+			p++;
+		}
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+			if (lmod == 2)
+				ival = va_arg(args, long long);
+			else if (lmod == 1)
+				ival = va_arg(args, long);
+			else
+				ival = va_arg(args, int);
+			if (lmod == 'h')
+				ival = (short)ival;
+			else if (lmod == 'H')
+				ival = (signed char)ival;
+			off = put_bin_arg(buf, off, 'i', &ival, sizeof(ival));
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+		case 'c':
+			if (lmod == 2)
+				uval = va_arg(args, unsigned long long);
+			else if (lmod == 1)
+				uval = va_arg(args, unsigned long);
+			else
+				uval = va_arg(args, unsigned int);
+			if (lmod == 'h')
+				uval = (unsigned short)uval;
+			else if (lmod == 'H' || *p == 'c')
+				uval = (unsigned char)uval;
+			off = put_bin_arg(buf, off, 'u', &uval, sizeof(uval));
+			break;
+		case 'p':
+			uval = (uintptr_t)va_arg(args, void *);
+			off = put_bin_arg(buf, off, 'u', &uval, sizeof(uval));
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			dval = va_arg(args, double);
+			off = put_bin_arg(buf, off, 'f', &dval, sizeof(dval));
+			break;
+		case 's':
+			s = va_arg(args, const char *);
+			if (s == NULL)
+				s = "(null)";
+			slen = strnlen(s, MAX_ONE_LOG_SIZE);
+			off = put_bin_arg(buf, off, 's', &slen, sizeof(slen));
+			if (off < 0 || off + slen > DISK_LOG_REC_MAX)
+				return -1;
+			memcpy(buf + off, s, slen);
+			off += slen;
+			break;
+		default:
+			return -1;
 		}
+
+		if (off < 0)
+			return -1;
 	}
 
-	len = vasprintf(&buf, fmt, args);
-	if (len < 0)
-		return;
+	rec->len = off;
+	return off;
+}
+
+/* Build the record for one message as it will land in the log file */
+static int encode_disk_log(uint8_t *buf, const char *fmt, va_list args)
+{
+	struct timespec times = {0, 0};
+	struct disk_log_bin_rec *rec;
+	char text[DISK_LOG_MAX_LEN];
+	uint32_t slen;
+	va_list copy;
+	int len;
 
 	clock_gettime(CLOCK_MONOTONIC, &times);
-	len = snprintf(buffer, DISK_LOG_MAX_LEN, "[%5lu.%06lu] ", times.tv_sec, times.tv_nsec / 1000);
-	if (len < 0 || len >= DISK_LOG_MAX_LEN) {
-		free(buf);
-		return;
+
+	if (!disk_log_binary) {
+		len = snprintf((char *)buf, DISK_LOG_MAX_LEN, "[%5lu.%06lu] ",
+			times.tv_sec, times.tv_nsec / 1000);
+		if (len < 0 || len >= DISK_LOG_MAX_LEN)
+			return -1;
+		vsnprintf((char *)buf + len, DISK_LOG_MAX_LEN - len, fmt, args);
+		return strnlen((char *)buf, DISK_LOG_MAX_LEN);
 	}
-	len = strnlen(buffer, DISK_LOG_MAX_LEN);
 
-	strncpy(buffer + len, buf, DISK_LOG_MAX_LEN - len);
-	buffer[DISK_LOG_MAX_LEN - 1] = '\0';
-	free(buf);
+	va_copy(copy, args);
+	len = encode_bin_record(buf, times.tv_sec * 1000000000UL + times.tv_nsec, fmt, copy);
+	va_end(copy);
+	if (len > 0)
+		return len;
+
+	/* format it here and store it as the argument of "%s" */
+	vsnprintf(text, sizeof(text), fmt, args);
+	slen = strnlen(text, sizeof(text));
+	rec = (struct disk_log_bin_rec *)buf;
+	rec->fmt_len = sizeof("%s");
+	rec->timestamp = times.tv_sec * 1000000000UL + times.tv_nsec;
+	memcpy(buf + sizeof(*rec), "%s", sizeof("%s"));
+	len = put_bin_arg(buf, sizeof(*rec) + sizeof("%s"), 's', &slen, sizeof(slen));
+	memcpy(buf + len, text, slen);
+	len += slen;
+	rec->len = len;
+
+	return len;
+}
 
-	write_cnt = write(disk_fd, buffer, strnlen(buffer, DISK_LOG_MAX_LEN));
-	if (write_cnt < 0) {
-		pr_err(DISK_PREFIX"write disk failed");
-		close(disk_fd);
-		disk_fd = -1;
+static void release_disk_log_ring(void *arg)
+{
+	struct disk_log_ring *ring = arg;
+
+	__atomic_store_n(&ring->state, DISK_LOG_RING_ORPHAN, __ATOMIC_RELEASE);
+}
+
+static struct disk_log_ring *get_disk_log_ring(void)
+{
+	struct disk_log_ring *ring;
+	uint8_t *data;
+	int i, expected;
+
+	if (disk_log_my_ring != NULL)
+		return disk_log_my_ring;
+
+	for (i = 0; i < DISK_LOG_MAX_RINGS; i++) {
+		ring = &disk_log_rings[i];
+		expected = DISK_LOG_RING_FREE;
+		if (!__atomic_compare_exchange_n(&ring->state, &expected, DISK_LOG_RING_USED,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			continue;
+
+		/* the buffer is kept when the ring is recycled */
+		if (ring->data == NULL) {
+			data = malloc(DISK_LOG_RING_SIZE);
+			if (data == NULL) {
+				__atomic_store_n(&ring->state, DISK_LOG_RING_FREE, __ATOMIC_RELEASE);
+				return NULL;
+			}
+			__atomic_store_n(&ring->data, data, __ATOMIC_RELEASE);
+		}
+
+		pthread_setspecific(disk_log_key, ring);
+		disk_log_my_ring = ring;
+		return ring;
+	}
+
+	return NULL;
+}
+
+static void put_disk_log_ring(struct disk_log_ring *ring, const uint8_t *rec, uint32_t len)
+{
+	uint32_t head = ring->head;
+	uint32_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	uint32_t off, first;
+
+	if (len > DISK_LOG_RING_SIZE - used) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
 		return;
 	}
 
-	cur_log_size += write_cnt;
-	if (cur_log_size > LOG_SIZE_LIMIT) {
+	off = head & (DISK_LOG_RING_SIZE - 1);
+	first = MIN(len, DISK_LOG_RING_SIZE - off);
+	memcpy(ring->data + off, rec, first);
+	memcpy(ring->data, rec + first, len - first);
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+
+	/*
+	 * Kick the writer once the ring gets half full, a lost wakeup only
+	 * delays the flush until the writer timeout.
+	 */
+	if (used < DISK_LOG_RING_SIZE / 2 && used + len >= DISK_LOG_RING_SIZE / 2)
+		pthread_cond_signal(&disk_log_cond);
+}
+
+static int note_dropped_disk_log(uint8_t *buf, ...)
+{
+	va_list args;
+	int len;
 
-		cur_file_index++;
+	va_start(args, buf);
+	len = encode_disk_log(buf, DISK_PREFIX"%lu messages dropped\n", args);
+	va_end(args);
 
-		/* remove the first old log file, to add a new one */
-		snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
-			LOG_PATH_NODE, vmname, (uint16_t)(cur_file_index - LOG_FILES_COUNT));
-		remove(file_name);
+	return len;
+}
 
-		snprintf(file_name, FILE_NAME_LENGTH - 1, LOG_NAME_FMT,
-			LOG_PATH_NODE, vmname, cur_file_index);
+/* Drain every ring into the log file with one writev() */
+static void flush_disk_log(void)
+{
+	struct iovec iov[DISK_LOG_MAX_RINGS * 2 + 1];
+	uint32_t heads[DISK_LOG_MAX_RINGS];
+	bool drained[DISK_LOG_MAX_RINGS];
+	uint8_t note[DISK_LOG_REC_MAX];
+	struct disk_log_ring *ring;
+	uint64_t dropped = 0;
+	uint32_t tail, off, len;
+	ssize_t written;
+	uint8_t *data;
+	int i, n = 0;
+
+	for (i = 0; i < DISK_LOG_MAX_RINGS; i++) {
+		ring = &disk_log_rings[i];
+		drained[i] = false;
+		if (__atomic_load_n(&ring->state, __ATOMIC_ACQUIRE) == DISK_LOG_RING_FREE)
+			continue;
+		data = __atomic_load_n(&ring->data, __ATOMIC_ACQUIRE);
+		if (data == NULL)
+			continue;
 
-		close(disk_fd);
-		disk_fd = open(file_name, O_RDWR | O_CREAT, 0644);
-		if (disk_fd < 0) {
-			pr_err(DISK_PREFIX" open %s failed! Error: %s\n", file_name, strerror(errno));
-			return;
+		heads[i] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+		drained[i] = true;
+		dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+		if (heads[i] == tail)
+			continue;
+
+		off = tail & (DISK_LOG_RING_SIZE - 1);
+		len = heads[i] - tail;
+		iov[n].iov_base = data + off;
+		iov[n].iov_len = MIN(len, DISK_LOG_RING_SIZE - off);
+		n++;
+		if (len > DISK_LOG_RING_SIZE - off) {
+			iov[n].iov_base = data;
+			iov[n].iov_len = len - (DISK_LOG_RING_SIZE - off);
+			n++;
+		}
+	}
+
+	dropped += __atomic_exchange_n(&disk_log_lost, 0, __ATOMIC_RELAXED);
+	if (dropped != 0) {
+		len = note_dropped_disk_log(note, dropped);
+		if ((int)len > 0) {
+			iov[n].iov_base = note;
+			iov[n].iov_len = len;
+			n++;
+		}
+	}
+
+	if (n != 0 && disk_fd >= 0) {
+		written = writev(disk_fd, iov, n);
+		if (written < 0) {
+			pr_err(DISK_PREFIX"write disk failed");
+			disk_log_enabled = false;
+			close(disk_fd);
+			disk_fd = -1;
+		} else {
+			cur_log_size += written;
+		}
+	}
+
+	/* hand the space back even if the write failed, the data is lost anyway */
+	for (i = 0; i < DISK_LOG_MAX_RINGS; i++) {
+		ring = &disk_log_rings[i];
+		if (drained[i])
+			__atomic_store_n(&ring->tail, heads[i], __ATOMIC_RELEASE);
+
+		if (__atomic_load_n(&ring->state, __ATOMIC_ACQUIRE) == DISK_LOG_RING_ORPHAN &&
+				__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail) {
+			ring->head = 0;
+			ring->tail = 0;
+			ring->dropped = 0;
+			__atomic_store_n(&ring->state, DISK_LOG_RING_FREE, __ATOMIC_RELEASE);
 		}
-		cur_log_size = 0;
 	}
+
+	if (disk_fd >= 0 && cur_log_size > LOG_SIZE_LIMIT)
+		rotate_disk_log_file();
+}
+
+static void *disk_log_writer(void *arg)
+{
+	struct timespec deadline;
+	bool stop = false;
+
+	/**
+	 * usually this probe just be called once in DM whole life; but we need use vmname in
+	 * probe_disk_log_file, it can't be called in init_disk_logger for vmname not inited then,
+	 * so call it when the first message is logged.
+	 */
+	if (probe_disk_log_file() < 0) {
+		disk_log_enabled = false;
+		return NULL;
+	}
+
+	while (!stop) {
+		pthread_mutex_lock(&disk_log_mtx);
+		if (!disk_log_stop) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += DISK_LOG_FLUSH_MS * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&disk_log_cond, &disk_log_mtx, &deadline);
+		}
+		stop = disk_log_stop;
+		pthread_mutex_unlock(&disk_log_mtx);
+
+		flush_disk_log();
+	}
+
+	return NULL;
+}
+
+static void start_disk_log_writer(void)
+{
+	if (pthread_key_create(&disk_log_key, release_disk_log_ring) != 0 ||
+			pthread_create(&disk_log_tid, NULL, disk_log_writer, NULL) != 0) {
+		disk_log_enabled = false;
+		return;
+	}
+
+	pthread_setname_np(disk_log_tid, "disk_log");
+	disk_log_started = true;
+}
+
+static void deinit_disk_logger(void)
+{
+	if (disk_log_started) {
+		disk_log_started = false;
+
+		/* the writer drains the rings once more before exiting */
+		pthread_mutex_lock(&disk_log_mtx);
+		disk_log_stop = true;
+		pthread_cond_signal(&disk_log_cond);
+		pthread_mutex_unlock(&disk_log_mtx);
+		pthread_join(disk_log_tid, NULL);
+	}
+
+	if (disk_fd > 0) {
+		disk_log_enabled = false;
+
+		fsync(disk_fd);
+		close(disk_fd);
+		disk_fd = -1;
+	}
+}
+
+static void write_to_disk(const char *fmt, va_list args)
+{
+	uint8_t rec[DISK_LOG_REC_MAX];
+	struct disk_log_ring *ring;
+	int len;
+
+	pthread_once(&disk_log_once, start_disk_log_writer);
+	if (!disk_log_enabled)
+		return;
+
+	ring = get_disk_log_ring();
+	if (ring == NULL) {
+		__atomic_add_fetch(&disk_log_lost, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	len = encode_disk_log(rec, fmt, args);
+	if (len > 0)
+		put_disk_log_ring(ring, rec, len);
 }
 
 static struct logger_ops logger_disk = {
@@ -209,6 +694,7 @@ static struct logger_ops logger_disk = {
 	.get_log_level = get_disk_log_level,
 	.init = init_disk_logger,
 	.deinit = deinit_disk_logger,
+	.set_opt = set_disk_logger_opt,
 	.output = write_to_disk,
 };
 
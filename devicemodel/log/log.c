@@ -23,12 +23,12 @@
 DECLARE_LOGGER_SECTION();
 
 /*
- * --logger_setting: console,level=4;disk,level=4;kmsg,level=3
+ * --logger_setting: console,level=4;disk,level=4,format=bin;kmsg,level=3
  * the setting param is from acrn-dm input, will be parsed here
  */
 int init_logger_setting(const char *opt)
 {
-	char *orig, *str, *elem, *name, *level;
+	char *orig, *str, *elem, *name, *level, *extra;
 	uint32_t lvl_val;
 	int error = 0;
 	struct logger_ops **pp_logger, *plogger;
@@ -59,6 +59,18 @@ int init_logger_setting(const char *opt)
 				if (plogger->init)
 					plogger->init(true, (uint8_t)lvl_val);
 
+				/* logger specific options follow the level */
+				if (*level == ',') {
+					level++;
+					while ((extra = strsep(&level, ",")) != NULL) {
+						if (!plogger->set_opt || plogger->set_opt(extra)) {
+							fprintf(stderr, "logger %s: invalid option %s\n",
+								name, extra);
+							error = -1;
+						}
+					}
+				}
+
 				break;
 			}
 		}
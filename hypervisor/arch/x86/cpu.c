@@ -185,6 +185,21 @@ void init_pcpu_pre(bool is_bsp)
 	pcpu_set_current_state(pcpu_id, PCPU_STATE_INITIALIZING);
 }
 
+static void init_pcpu_sched_and_prot(uint16_t pcpu_id)
+{
+	init_sched(pcpu_id);
+
+#ifdef CONFIG_RDT_ENABLED
+	if (!setup_clos(pcpu_id)) {
+		panic("CLOS resource MSRs setup incorrectly!");
+	}
+#endif
+
+	enable_smep();
+
+	enable_smap();
+}
+
 void init_pcpu_post(uint16_t pcpu_id)
 {
 #ifdef STACK_PROTECTOR
@@ -263,17 +278,31 @@ void init_pcpu_post(uint16_t pcpu_id)
 		wait_sync_change(&pcpu_sync, 0UL);
 	}
 
-	init_sched(pcpu_id);
+	init_pcpu_sched_and_prot(pcpu_id);
+}
 
-#ifdef CONFIG_RDT_ENABLED
-	if (!setup_clos(pcpu_id)) {
-		panic("CLOS resource MSRs setup incorrectly!");
-	}
+/*
+ * Bring an AP back after host S3. CPU capabilities, IRQ descriptors, softirqs
+ * and the passthrough state are global and survived the suspend; only the
+ * per-CPU registers are lost, so the boot-only steps are skipped.
+ */
+void resume_pcpu_post(uint16_t pcpu_id)
+{
+#ifdef STACK_PROTECTOR
+	set_fs_base();
 #endif
+	load_gdtr_and_tr();
 
-	enable_smep();
+	init_pcpu_xsave();
 
-	enable_smap();
+	init_interrupt(pcpu_id);
+
+	timer_init();
+
+	/* Wait for boot processor to signal all secondary cores to continue */
+	wait_sync_change(&pcpu_sync, 0UL);
+
+	init_pcpu_sched_and_prot(pcpu_id);
 }
 
 static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id)
@@ -291,9 +320,15 @@ static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id)
 	return pcpu_id;
 }
 
-static void start_pcpu(uint16_t pcpu_id)
+/*
+ * Kick one AP and wait only until it has loaded its stack from the trampoline,
+ * so that the trampoline stack slot can be reused for the next AP. The rest of
+ * the AP bring-up runs in parallel with the others.
+ */
+static bool start_pcpu(uint16_t pcpu_id)
 {
 	uint32_t timeout;
+	uint64_t stack;
 
 	/* Update the stack for pcpu */
 	stac();
@@ -302,23 +337,24 @@ static void start_pcpu(uint16_t pcpu_id)
 
 	send_startup_ipi(INTR_CPU_STARTUP_USE_DEST, pcpu_id, startup_paddr);
 
-	/* Wait until the pcpu with pcpu_id is running and set the active bitmap or
-	 * configured time-out has expired
-	 */
+	/* The AP clears the stack slot once it switched to its own stack */
 	timeout = CPU_UP_TIMEOUT * 1000U;
-	while (!is_pcpu_active(pcpu_id) && (timeout != 0U)) {
+	do {
+		stac();
+		stack = read_trampoline_sym(secondary_cpu_stack);
+		clac();
+		if ((stack == 0UL) || (timeout == 0U)) {
+			break;
+		}
+
 		/* Delay 10us */
 		udelay(10U);
 
 		/* Decrement timeout value */
 		timeout -= 10U;
-	}
+	} while (true);
 
-	/* Check to see if expected CPU is actually up */
-	if (!is_pcpu_active(pcpu_id)) {
-		pr_fatal("Secondary CPU%hu failed to come up", pcpu_id);
-		pcpu_set_current_state(pcpu_id, PCPU_STATE_DEAD);
-	}
+	return (stack == 0UL);
 }
 
 
@@ -335,6 +371,8 @@ bool start_pcpus(uint64_t mask)
 	uint16_t i;
 	uint16_t pcpu_id = get_pcpu_id();
 	uint64_t expected_start_mask = mask;
+	uint64_t kicked_mask = 0UL;
+	uint32_t timeout;
 
 	/* secondary cpu start up will wait for pcpu_sync -> 0UL */
 	pcpu_sync = 1UL;
@@ -348,10 +386,40 @@ bool start_pcpus(uint64_t mask)
 			continue; /* Avoid start itself */
 		}
 
-		start_pcpu(i);
+		if (start_pcpu(i)) {
+			bitmap_set_nolock(i, &kicked_mask);
+		} else {
+			pr_fatal("Secondary CPU%hu failed to come up", i);
+			pcpu_set_current_state(i, PCPU_STATE_DEAD);
+			/* the stack slot may still be in use, don't kick any more */
+			break;
+		}
 		i = ffs64(expected_start_mask);
 	}
 
+	/* Wait until all the kicked pcpus are running and set the active bitmap
+	 * or configured time-out has expired
+	 */
+	timeout = CPU_UP_TIMEOUT * 1000U;
+	while (((pcpu_active_bitmap & kicked_mask) != kicked_mask) && (timeout != 0U)) {
+		/* Delay 10us */
+		udelay(10U);
+
+		/* Decrement timeout value */
+		timeout -= 10U;
+	}
+
+	i = ffs64(kicked_mask);
+	while (i != INVALID_BIT_INDEX) {
+		bitmap_clear_nolock(i, &kicked_mask);
+		/* Check to see if expected CPU is actually up */
+		if (!is_pcpu_active(i)) {
+			pr_fatal("Secondary CPU%hu failed to come up", i);
+			pcpu_set_current_state(i, PCPU_STATE_DEAD);
+		}
+		i = ffs64(kicked_mask);
+	}
+
 	/* Trigger event to allow secondary CPUs to continue */
 	pcpu_sync = 0UL;
 
@@ -490,6 +558,9 @@ static void init_pcpu_xsave(void)
 	uint64_t xcr0, xss;
 	uint32_t eax, ecx, unused, xsave_area_size;
 
+	/* no vCPU state is left in the registers of a (re)started pCPU */
+	(void)memset((void *)&get_cpu_var(loaded_ext_ctx), 0U, sizeof(struct loaded_ext_context));
+
 	CPU_CR_READ(cr4, &val64);
 	val64 |= CR4_OSXSAVE;
 	CPU_CR_WRITE(cr4, val64);
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <bits.h>
+#include <util.h>
+#include <cpu.h>
+#include <cpu_caps.h>
+#include <irq.h>
+#include <vmx.h>
+#include <pgtable.h>
+#include <mmu.h>
+#include <ept.h>
+#include <vtd.h>
+#include <vm.h>
+#include <cache_flush.h>
+
+/*
+ * Above this, writing back the whole host cache is cheaper than flushing the
+ * pages line by line. Not applied with an RT VM, which a WBINVD would stall.
+ */
+#define CACHE_FLUSH_LINES_MAX	(32UL * MEM_1M)
+
+struct cache_flush_walk {
+	bool all;		/* every cacheable page, not only the accessed ones */
+	bool flush_lines;
+	uint64_t size;		/* bytes marked EPT_FLUSH_PENDING */
+};
+
+/**
+ * @pre vm != NULL
+ */
+void init_vm_cache_flush(struct acrn_vm *vm)
+{
+	struct vm_cache_flush *cf = &vm->arch_vm.cache_flush;
+
+#ifdef CONFIG_CACHE_FLUSH_TRACK_ACCESSED
+	/*
+	 * The secure world EPT isn't tracked, and the DM writes the memory of a
+	 * post-launched VM through the SOS EPT: those VMs get whole memory flushes.
+	 */
+	cf->track_accessed = !iommu_snoop_supported(vm->iommu) && pcpu_has_vmx_ept_cap(VMX_EPT_AD) &&
+			(vm->sworld_control.flag.supported == 0UL) && !is_postlaunched_vm(vm);
+#else
+	cf->track_accessed = false;
+#endif
+	cf->armed = false;
+}
+
+/**
+ * @brief Make the next guest cache flush cover a write of the hypervisor
+ *
+ * The hypervisor writes the guest memory through its own mapping, which
+ * doesn't set the EPT accessed flag.
+ *
+ * @pre vm != NULL
+ */
+void cache_flush_mark_written(struct acrn_vm *vm, uint64_t gpa)
+{
+	uint64_t *pgentry;
+	uint64_t pg_size;
+
+	if (vm->arch_vm.cache_flush.track_accessed) {
+		pgentry = (uint64_t *)lookup_address((uint64_t *)vm->arch_vm.nworld_eptp, gpa, &pg_size,
+				&vm->arch_vm.ept_mem_ops);
+		if (pgentry != NULL) {
+			bitmap_set_lock(EPT_ACCESSED_POS, pgentry);
+		}
+	}
+}
+
+/*
+ * The CPU may set the accessed and dirty flags of the entries meanwhile, they
+ * are only updated with locked instructions.
+ *
+ * A page still pending from a concurrent flush on another vCPU is flushed
+ * again rather than assumed done: it is only once EPT_FLUSH_PENDING is cleared.
+ */
+static void mark_leaf_page(uint64_t *pgentry, uint64_t size, void *data)
+{
+	struct cache_flush_walk *walk = (struct cache_flush_walk *)data;
+	bool accessed;
+
+	if ((*pgentry & EPT_MT_MASK) != EPT_UNCACHED) {
+		accessed = bitmap_test_and_clear_lock(EPT_ACCESSED_POS, pgentry);
+		if (accessed || walk->all || ((*pgentry & EPT_FLUSH_PENDING) != 0UL)) {
+			bitmap_set_lock(EPT_FLUSH_PENDING_POS, pgentry);
+			walk->size += size;
+		}
+	}
+}
+
+/*
+ * CLFLUSHOPT is ordered with the locked clear of EPT_FLUSH_PENDING, so the
+ * lines are flushed once another vCPU sees the bit cleared.
+ */
+static void flush_leaf_page(uint64_t *pgentry, uint64_t size, void *data)
+{
+	const struct cache_flush_walk *walk = (const struct cache_flush_walk *)data;
+	void *hva;
+
+	if ((*pgentry & EPT_FLUSH_PENDING) != 0UL) {
+		if (walk->flush_lines) {
+			hva = hpa2hva((*pgentry & ~EPT_PFN_HIGH_MASK) & ~(size - 1UL));
+			stac();
+			flush_address_space(hva, size);
+			clac();
+		}
+		bitmap_clear_lock(EPT_FLUSH_PENDING_POS, pgentry);
+	}
+}
+
+/*
+ * Make the other vCPUs drop the translations cached with the accessed flags
+ * set: until then their accesses are not seen by the next flush. The current
+ * vCPU does so on VM entry.
+ */
+static void flush_vcpus_ept(struct acrn_vm *vm)
+{
+	vcpu_make_request_and_wait(vm, ~0UL, ACRN_REQUEST_EPT_FLUSH);
+}
+
+/**
+ * @brief Write back and invalidate the CPU caches for the guest
+ *
+ * Emulates a guest WBINVD, or the flush due when the guest disables its
+ * caches with CR0.CD. Nothing is flushed if the DMA of the VM snoops the CPU
+ * caches. Otherwise the pages of the VM accessed since the previous flush are
+ * flushed with CLFLUSHOPT (CLWB would leave stale lines for the device writes
+ * to come), or the whole host cache with WBINVD when there are too many of
+ * them and no RT VM is affected.
+ *
+ * @param[out] size bytes of guest memory flushed, 0 if elided or not looked at
+ *
+ * @pre vcpu == current vCPU && size != NULL
+ */
+enum guest_cache_flush_method vcpu_flush_guest_cache(struct acrn_vcpu *vcpu,
+		enum guest_cache_flush_cause cause, uint64_t *size)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct vm_cache_flush *cf = &vm->arch_vm.cache_flush;
+	struct guest_cache_flush_stats *stats = &vcpu->arch.cache_flush_stats;
+	struct cache_flush_walk walk;
+	enum guest_cache_flush_method method;
+
+	if (cause == GUEST_CACHE_FLUSH_WBINVD) {
+		stats->wbinvd++;
+	} else {
+		stats->cr0_cd++;
+	}
+
+	walk.all = !cf->track_accessed || !cf->armed;
+	walk.size = 0UL;
+
+	if (iommu_snoop_supported(vm->iommu)) {
+		method = GUEST_CACHE_FLUSH_ELIDED;
+	} else if (!cf->track_accessed && !has_rt_vm()) {
+		method = GUEST_CACHE_FLUSH_HOST_WBINVD;
+		cache_flush_invalidate_all();
+	} else {
+		walk_ept_table(vm, mark_leaf_page, &walk);
+		if ((walk.size > CACHE_FLUSH_LINES_MAX) && !has_rt_vm()) {
+			method = GUEST_CACHE_FLUSH_HOST_WBINVD;
+		} else {
+			method = GUEST_CACHE_FLUSH_LINES;
+		}
+
+		if (walk.size != 0UL) {
+			if (cf->track_accessed) {
+				flush_vcpus_ept(vm);
+			}
+			walk.flush_lines = (method == GUEST_CACHE_FLUSH_LINES);
+			if (!walk.flush_lines) {
+				cache_flush_invalidate_all();
+			}
+			walk_ept_table(vm, flush_leaf_page, &walk);
+			cpu_write_memory_barrier();
+		}
+
+		if (cf->track_accessed && walk.all) {
+			cf->armed = true;
+		}
+	}
+
+	switch (method) {
+	case GUEST_CACHE_FLUSH_ELIDED:
+		stats->elided++;
+		break;
+	case GUEST_CACHE_FLUSH_LINES:
+		stats->line_flushes++;
+		stats->flushed_bytes += walk.size;
+		stats->max_bytes = max(stats->max_bytes, walk.size);
+		break;
+	default:
+		stats->host_wbinvd++;
+		break;
+	}
+
+	*size = walk.size;
+	return method;
+}
@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <errno.h>
+#include <bits.h>
+#include <atomic.h>
+#include <util.h>
+#include <cpu.h>
+#include <cpu_caps.h>
+#include <irq.h>
+#include <vmx.h>
+#include <pgtable.h>
+#include <mmu.h>
+#include <ept.h>
+#include <vtd.h>
+#include <vm.h>
+#include <guest_memory.h>
+#include <dirty_log.h>
+#include <logmsg.h>
+
+/* one bit per 4KB page of the guest physical address space of a post-launched VM */
+#define DIRTY_LOG_PAGE_NUM	(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE) >> PAGE_SHIFT)
+#define DIRTY_LOG_BITMAP_SIZE	INT_DIV_ROUNDUP(DIRTY_LOG_PAGE_NUM, 64UL)
+
+/* bitmap words copied to the SOS at a time */
+#define DIRTY_LOG_CHUNK_SIZE	64U
+
+#if (MAX_POST_VM_NUM > 0)
+static uint64_t dirty_bitmaps[MAX_POST_VM_NUM][DIRTY_LOG_BITMAP_SIZE];
+#endif
+
+/**
+ * @pre vm != NULL
+ */
+void init_vm_dirty_log(struct acrn_vm *vm)
+{
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+
+	spinlock_init(&log->lock);
+	log->enabled = false;
+	log->bitmap = NULL;
+	log->page_num = 0UL;
+#if (MAX_POST_VM_NUM > 0)
+	if (is_postlaunched_vm(vm)) {
+		uint16_t sos_vm_id = (get_sos_vm())->vm_id;
+
+		log->bitmap = dirty_bitmaps[vmid_2_rel_vmid(sos_vm_id, vm->vm_id) - 1U];
+		log->page_num = DIRTY_LOG_PAGE_NUM;
+	}
+#endif
+}
+
+static void mark_page_dirty(struct vm_dirty_log *log, uint64_t gpa, uint64_t size)
+{
+	uint64_t pfn = gpa >> PAGE_SHIFT;
+	uint64_t end = min(((gpa + size) >> PAGE_SHIFT), log->page_num);
+
+	while (pfn < end) {
+		if (((pfn & 0x3FUL) == 0UL) && ((end - pfn) >= 64UL)) {
+			/* whole word of a large page */
+			log->bitmap[pfn >> 6U] = ~0UL;
+			pfn += 64UL;
+		} else {
+			bitmap_set_lock((uint16_t)(pfn & 0x3FUL), &log->bitmap[pfn >> 6U]);
+			pfn++;
+		}
+	}
+}
+
+/*
+ * Put back bits fetched from the bitmap, the vCPUs may set others meanwhile.
+ */
+static void restore_dirty_bits(struct vm_dirty_log *log, uint64_t idx, uint64_t bits_arg)
+{
+	uint64_t bits = bits_arg;
+	uint16_t bit;
+
+	while (bits != 0UL) {
+		bit = ffs64(bits);
+		bits &= ~(1UL << bit);
+		bitmap_set_lock(bit, &log->bitmap[idx]);
+	}
+}
+
+/*
+ * Make every vCPU of the VM drop its cached EPT translations, and wait for
+ * those running in non-root mode to do so: until then they may keep writing
+ * through a translation the dirty logging has just re-armed.
+ *
+ * Called without log->lock held: a vCPU may be spinning on it in root mode,
+ * in dirty_log_handle_ept_violation().
+ */
+static void flush_vcpus_ept(struct acrn_vm *vm)
+{
+	vcpu_make_request_and_wait(vm, ~0UL, ACRN_REQUEST_EPT_FLUSH);
+}
+
+/*
+ * The callbacks below run on EPT leaf entries only. The EPT is shared with the
+ * IOMMU, so the entries are flushed from the cache once updated.
+ */
+static void ept_clear_dirty_flag(uint64_t *pgentry, __unused uint64_t size, __unused void *data)
+{
+	/* the accessed flag belongs to the guest cache flushing, see cache_flush.c */
+	bitmap_clear_lock(EPT_DIRTY_POS, pgentry);
+	iommu_flush_cache(pgentry, sizeof(uint64_t));
+}
+
+static void ept_write_protect(uint64_t *pgentry, __unused uint64_t size, __unused void *data)
+{
+	/* guest RAM is the only write-back memory of a post-launched VM */
+	if (((*pgentry & EPT_WR) != 0UL) && ((*pgentry & EPT_MT_MASK) == EPT_WB)) {
+		*pgentry = (*pgentry & ~EPT_WR) | EPT_DIRTY_LOG_WP;
+		iommu_flush_cache(pgentry, sizeof(uint64_t));
+	}
+}
+
+static void ept_write_unprotect(uint64_t *pgentry, __unused uint64_t size, __unused void *data)
+{
+	if ((*pgentry & EPT_DIRTY_LOG_WP) != 0UL) {
+		*pgentry = (*pgentry & ~EPT_DIRTY_LOG_WP) | EPT_WR;
+		iommu_flush_cache(pgentry, sizeof(uint64_t));
+	}
+}
+
+/*
+ * The PML and the EPT dirty flags only see CPU writes, and write protection
+ * in the shared EPT would fault device DMA, so VMs with passthrough devices
+ * can't be tracked.
+ */
+static bool is_dirty_log_supported(const struct acrn_vm *vm)
+{
+	bool ret = (vm->arch_vm.dirty_log.bitmap != NULL) && (vm->sworld_control.flag.supported == 0UL);
+	uint32_t i;
+
+	for (i = 0U; i < vm->vpci.pci_vdev_cnt; i++) {
+		if (vm->vpci.pci_vdevs[i].pdev != NULL) {
+			ret = false;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Start logging the pages written by the guest
+ *
+ * The bitmap is cleared, the DM is expected to copy the whole guest RAM once
+ * after the logging is enabled.
+ *
+ * @pre vm != NULL
+ */
+int32_t vm_enable_dirty_log(struct acrn_vm *vm)
+{
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+	bool flush = false;
+	int32_t ret = -ENODEV;
+
+	if (is_dirty_log_supported(vm)) {
+		spinlock_obtain(&log->lock);
+		if (!log->enabled) {
+			log->use_pml = pcpu_has_vmx_pml();
+			(void)memset(log->bitmap, 0U, DIRTY_LOG_BITMAP_SIZE * sizeof(uint64_t));
+
+			if (log->use_pml) {
+				walk_ept_table(vm, ept_clear_dirty_flag, NULL);
+			} else {
+				walk_ept_table(vm, ept_write_protect, NULL);
+			}
+			log->enabled = true;
+
+			foreach_vcpu(i, vm, vcpu) {
+				vcpu_make_request(vcpu, ACRN_REQUEST_DIRTY_LOG);
+			}
+			flush = true;
+		}
+		spinlock_release(&log->lock);
+
+		if (flush) {
+			flush_vcpus_ept(vm);
+		}
+		ret = 0;
+	} else {
+		pr_err("%s: dirty page logging isn't supported for VM%u", __func__, vm->vm_id);
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vm != NULL
+ */
+int32_t vm_disable_dirty_log(struct acrn_vm *vm)
+{
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+	bool flush = false;
+
+	spinlock_obtain(&log->lock);
+	if (log->enabled) {
+		log->enabled = false;
+		if (!log->use_pml) {
+			walk_ept_table(vm, ept_write_unprotect, NULL);
+		}
+
+		foreach_vcpu(i, vm, vcpu) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_DIRTY_LOG);
+		}
+		flush = true;
+	}
+	spinlock_release(&log->lock);
+
+	if (flush) {
+		flush_vcpus_ept(vm);
+	}
+
+	return 0;
+}
+
+/**
+ * @pre vm != NULL
+ */
+void deinit_vm_dirty_log(struct acrn_vm *vm)
+{
+	if (vm->arch_vm.dirty_log.bitmap != NULL) {
+		(void)vm_disable_dirty_log(vm);
+	}
+}
+
+/*
+ * Re-arm the logging of a page reported dirty, so that the next write to it
+ * is seen again.
+ */
+static void rearm_dirty_page(struct acrn_vm *vm, uint64_t gpa)
+{
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t *pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
+	uint64_t *pgentry;
+	uint64_t pg_size;
+
+	pgentry = (uint64_t *)lookup_address(pml4_page, gpa, &pg_size, mem_ops);
+	if (pgentry != NULL) {
+		if (vm->arch_vm.dirty_log.use_pml) {
+			if ((*pgentry & EPT_DIRTY) != 0UL) {
+				set_pgentry(pgentry, *pgentry & ~EPT_DIRTY, mem_ops);
+			}
+		} else if ((*pgentry & EPT_WR) != 0UL) {
+			/* splits the large page the write fault made writable as a whole */
+			mmu_modify_or_del(pml4_page, gpa, PAGE_SIZE, EPT_DIRTY_LOG_WP, EPT_WR, mem_ops, MR_MODIFY);
+		} else {
+			/* still write protected */
+		}
+	}
+}
+
+/**
+ * @brief Fetch and clear the dirty bitmap of [gpa, gpa + size)
+ *
+ * Bit n of the bitmap copied to bitmap_gpa of the SOS stands for the page at
+ * gpa + n * 4KB. Pages are re-armed before the bits are handed out and the
+ * vCPUs have dropped their stale translations when this returns, so a page
+ * copied after the call and written again is reported by the next call.
+ *
+ * @pre vm != NULL && sos_vm != NULL
+ */
+int32_t vm_get_dirty_log(struct acrn_vm *vm, struct acrn_vm *sos_vm, uint64_t gpa, uint64_t size, uint64_t bitmap_gpa)
+{
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	uint64_t chunk[DIRTY_LOG_CHUNK_SIZE];
+	uint64_t idx, first_idx, end_idx, pfn, bits;
+	uint32_t n = 0U, k;
+	uint16_t bit;
+	bool flush = false;
+	int32_t ret = -EINVAL;
+
+	/* the range is handed out in whole bitmap words */
+	if (((gpa & ((PAGE_SIZE * 64UL) - 1UL)) == 0UL) && ((size & ((PAGE_SIZE * 64UL) - 1UL)) == 0UL) &&
+			(((gpa + size) >> PAGE_SHIFT) <= log->page_num)) {
+		first_idx = gpa >> (PAGE_SHIFT + 6U);
+		end_idx = (gpa + size) >> (PAGE_SHIFT + 6U);
+
+		spinlock_obtain(&log->lock);
+		flush = log->enabled;
+		if (log->enabled) {
+			ret = 0;
+			for (idx = first_idx; idx < end_idx; idx++) {
+				bits = atomic_readandclear64(&log->bitmap[idx]);
+				chunk[n] = bits;
+				n++;
+
+				while (bits != 0UL) {
+					bit = ffs64(bits);
+					bits &= ~(1UL << bit);
+					pfn = (idx << 6U) + bit;
+					rearm_dirty_page(vm, pfn << PAGE_SHIFT);
+				}
+
+				if ((n == DIRTY_LOG_CHUNK_SIZE) || ((idx + 1UL) == end_idx)) {
+					if (copy_to_gpa(sos_vm, chunk, bitmap_gpa + ((idx + 1UL - n - first_idx) << 3U),
+							n * (uint32_t)sizeof(uint64_t)) != 0) {
+						pr_err("%s: unable to copy the bitmap to SOS", __func__);
+						/* the pages are still dirty, report them next time */
+						for (k = 0U; k < n; k++) {
+							restore_dirty_bits(log, idx + 1UL - n + k, chunk[k]);
+						}
+						ret = -EFAULT;
+						break;
+					}
+					n = 0U;
+				}
+			}
+		}
+		spinlock_release(&log->lock);
+
+		/* the pages re-armed before a failed copy too */
+		if (flush) {
+			flush_vcpus_ept(vm);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Handle a write to a page write protected for dirty logging
+ *
+ * @return true if the EPT violation was caused by the dirty logging
+ *
+ * @pre vcpu != NULL
+ */
+bool dirty_log_handle_ept_violation(struct acrn_vcpu *vcpu, uint64_t gpa)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t *pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
+	const uint64_t *pgentry;
+	uint64_t pg_size;
+	bool handled = false;
+
+	if ((log->bitmap != NULL) && (vcpu->arch.cur_context == NORMAL_WORLD)) {
+		spinlock_obtain(&log->lock);
+		pgentry = lookup_address(pml4_page, gpa, &pg_size, mem_ops);
+		if (pgentry != NULL) {
+			if ((*pgentry & EPT_DIRTY_LOG_WP) != 0UL) {
+				/* only the written 4KB page becomes writable, a large page is split */
+				mmu_modify_or_del(pml4_page, gpa & PAGE_MASK, PAGE_SIZE, EPT_WR, EPT_DIRTY_LOG_WP,
+						mem_ops, MR_MODIFY);
+				if (log->enabled) {
+					mark_page_dirty(log, gpa & PAGE_MASK, PAGE_SIZE);
+				}
+				handled = true;
+			} else if (((*pgentry & EPT_WR) != 0UL) && ((*pgentry & EPT_MT_MASK) == EPT_WB)) {
+				/* made writable by another vCPU meanwhile */
+				handled = true;
+			} else {
+				/* not ours, e.g. a write protected page of the DM */
+			}
+		}
+		spinlock_release(&log->lock);
+	}
+
+	if (handled) {
+		vcpu_retain_rip(vcpu);
+	}
+
+	return handled;
+}
+
+/**
+ * @brief Drain the PML buffer of the current vCPU into the dirty bitmap
+ *
+ * @pre vcpu == current vCPU && vcpu->arch.pml_enabled
+ */
+void vcpu_flush_pml(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	uint16_t pml_idx = exec_vmread16(VMX_GUEST_PML_INDEX);
+	uint64_t gpa, pg_size;
+	uint16_t i;
+
+	if (pml_idx != (PML_ENTITY_NUM - 1U)) {
+		/* the index wraps to 0xFFFF once the last entry is written */
+		i = (pml_idx >= PML_ENTITY_NUM) ? 0U : (pml_idx + 1U);
+		for (; i < PML_ENTITY_NUM; i++) {
+			gpa = vcpu->arch.pml_buf[i];
+			/* the dirty flag of a large page is set once for all of its 4KB pages */
+			if (lookup_address((uint64_t *)vm->arch_vm.nworld_eptp, gpa, &pg_size,
+					&vm->arch_vm.ept_mem_ops) == NULL) {
+				pg_size = PAGE_SIZE;
+			}
+			mark_page_dirty(log, gpa & ~(pg_size - 1UL), pg_size);
+		}
+		exec_vmwrite16(VMX_GUEST_PML_INDEX, PML_ENTITY_NUM - 1U);
+	}
+}
+
+/*
+ * The log is drained on every VM exit, nothing is left to do here.
+ */
+int32_t pml_full_vmexit_handler(__unused struct acrn_vcpu *vcpu)
+{
+	return 0;
+}
+
+/**
+ * @brief Apply the dirty logging state of the VM to the VMCS of the current vCPU
+ *
+ * The EPT accessed and dirty flags are also enabled for the targeted guest
+ * cache flushes of the VM, see cache_flush.c.
+ *
+ * @pre vcpu == current vCPU
+ */
+void vcpu_update_dirty_log(struct acrn_vcpu *vcpu)
+{
+	const struct acrn_vm *vm = vcpu->vm;
+	const struct vm_dirty_log *log = &vm->arch_vm.dirty_log;
+	bool enable = log->enabled && log->use_pml;
+	uint32_t ctrls2 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS2);
+	uint64_t eptp = exec_vmread64(VMX_EPT_POINTER_FULL);
+
+	if (enable) {
+		exec_vmwrite64(VMX_PML_ADDR_FULL, hva2hpa(vcpu->arch.pml_buf));
+		exec_vmwrite16(VMX_GUEST_PML_INDEX, PML_ENTITY_NUM - 1U);
+		ctrls2 |= VMX_PROCBASED_CTLS2_PML;
+	} else {
+		if (vcpu->arch.pml_enabled) {
+			vcpu_flush_pml(vcpu);
+		}
+		ctrls2 &= ~VMX_PROCBASED_CTLS2_PML;
+	}
+
+	if (enable || vm->arch_vm.cache_flush.track_accessed) {
+		eptp |= VMX_EPTP_AD_ENABLE;
+	} else {
+		eptp &= ~VMX_EPTP_AD_ENABLE;
+	}
+
+	vcpu->arch.pml_enabled = enable;
+	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, ctrls2);
+	exec_vmwrite64(VMX_EPT_POINTER_FULL, eptp);
+}
@@ -38,7 +38,8 @@ void destroy_ept(struct acrn_vm *vm)
 	}
 
 	if (vm->arch_vm.nworld_eptp != NULL) {
-		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
+		release_ept_pages(&vm->arch_vm.ept_mem_ops);
+		vm->arch_vm.nworld_eptp = NULL;
 	}
 }
 
@@ -106,11 +107,57 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
-void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
-	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+/*
+ * Page-table pages unlinked from the EPT may still be cached by the vCPUs and
+ * the IOMMU. They are reused once every vCPU of the VM has done the EPT flush
+ * requested after them, and the IOTLB of the VM is flushed.
+ */
+static void ept_reclaim_pages(struct acrn_vm *vm)
 {
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t flushed_gen = ept_flush_gen(mem_ops);
+	struct acrn_vcpu *vcpu;
 	uint16_t i;
+
+	foreach_vcpu(i, vm, vcpu) {
+		flushed_gen = min(flushed_gen, vcpu->arch.ept_flushed_gen);
+	}
+
+	if (ept_has_stale_pages(mem_ops, flushed_gen)) {
+		if (vm->iommu != NULL) {
+			iommu_flush_domain(vm->iommu);
+		}
+		reclaim_ept_pages(mem_ops, flushed_gen);
+	}
+}
+
+static void ept_flush_vcpus(struct acrn_vm *vm)
+{
 	struct acrn_vcpu *vcpu;
+	uint16_t i;
+
+	(void)ept_next_flush_gen(&vm->arch_vm.ept_mem_ops);
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	}
+}
+
+void vcpu_flush_ept(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	/* read once the request is cleared, it covers every flush requested so far */
+	uint64_t gen = ept_flush_gen(&vm->arch_vm.ept_mem_ops);
+
+	invept(vm->arch_vm.nworld_eptp);
+	if (vm->sworld_control.flag.active != 0UL) {
+		invept(vm->arch_vm.sworld_eptp);
+	}
+	vcpu->arch.ept_flushed_gen = gen;
+}
+
+void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+{
 	uint64_t prot = prot_orig;
 
 	dev_dbg(DBG_LEVEL_EPT, "%s, vm[%d] hpa: 0x%016lx gpa: 0x%016lx size: 0x%016lx prot: 0x%016x\n",
@@ -124,19 +171,15 @@ void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 		prot |= EPT_SNOOP_CTRL;
 	}
 
+	ept_reclaim_pages(vm);
 	mmu_add(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_mem_ops);
-
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	ept_flush_vcpus(vm);
 }
 
 void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 		uint64_t gpa, uint64_t size,
 		uint64_t prot_set, uint64_t prot_clr)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
 	uint64_t local_prot = prot_set;
 
 	dev_dbg(DBG_LEVEL_EPT, "%s,vm[%d] gpa 0x%lx size 0x%lx\n", __func__, vm->vm_id, gpa, size);
@@ -145,44 +188,20 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 		local_prot |= EPT_SNOOP_CTRL;
 	}
 
+	ept_reclaim_pages(vm);
 	mmu_modify_or_del(pml4_page, gpa, size, local_prot, prot_clr, &(vm->arch_vm.ept_mem_ops), MR_MODIFY);
-
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	ept_flush_vcpus(vm);
 }
 /**
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
 void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
-
 	dev_dbg(DBG_LEVEL_EPT, "%s,vm[%d] gpa 0x%lx size 0x%lx\n", __func__, vm->vm_id, gpa, size);
 
+	ept_reclaim_pages(vm);
 	mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
-
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
-}
-
-/**
- * @pre pge != NULL && size > 0.
- */
-void ept_flush_leaf_page(uint64_t *pge, uint64_t size)
-{
-	uint64_t hpa = INVALID_HPA;
-	void *hva = NULL;
-
-	if ((*pge & EPT_MT_MASK) != EPT_UNCACHED) {
-		hpa = (*pge & (~(size - 1UL)));
-		hva = hpa2hva(hpa);
-		stac();
-		flush_address_space(hva, size);
-		clac();
-	}
+	ept_flush_vcpus(vm);
 }
 
 /**
@@ -205,7 +224,7 @@ void *get_ept_entry(struct acrn_vm *vm)
 /**
  * @pre vm != NULL && cb != NULL.
  */
-void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
+void walk_ept_table(struct acrn_vm *vm, pge_handler cb, void *data)
 {
 	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
 	uint64_t *pml4e, *pdpte, *pde, *pte;
@@ -222,7 +241,7 @@ void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
 				continue;
 			}
 			if (pdpte_large(*pdpte) != 0UL) {
-				cb(pdpte, PDPTE_SIZE);
+				cb(pdpte, PDPTE_SIZE, data);
 				continue;
 			}
 			for (k = 0UL; k < PTRS_PER_PDE; k++) {
@@ -231,13 +250,13 @@ void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
 					continue;
 				}
 				if (pde_large(*pde) != 0UL) {
-					cb(pde, PDE_SIZE);
+					cb(pde, PDE_SIZE, data);
 					continue;
 				}
 				for (m = 0UL; m < PTRS_PER_PTE; m++) {
 					pte = pte_offset(pde, m << PTE_SHIFT);
 					if (mem_ops->pgentry_present(*pte) != 0UL) {
-						cb(pte, PTE_SIZE);
+						cb(pte, PTE_SIZE, data);
 					}
 				}
 			}
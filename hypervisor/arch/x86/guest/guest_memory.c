@@ -334,6 +334,10 @@ static inline uint32_t local_copy_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t
 			(void)memcpy_s(g_ptr, len, h_ptr, len);
 		}
 		clac();
+
+		if (!cp_from_vm) {
+			cache_flush_mark_written(vm, gpa);
+		}
 	}
 
 	return len;
@@ -8,21 +8,138 @@
  */
 
 #include <types.h>
+#include <bits.h>
 #include <vm.h>
+#include <irq.h>
+#include <errno.h>
 #include <logmsg.h>
 #include <vmx.h>
+#include <mmu.h>
+#include <vlapic.h>
+#include <guest_memory.h>
 #include <hyperv.h>
 
 #define DBG_LEVEL_HYPERV		6U
 
 /* Partition Reference Counter (HV_X64_MSR_TIME_REF_COUNT) */
 #define CPUID3A_TIME_REF_COUNT_MSR	(1U << 1U)
+/* Basic SynIC MSRs (HV_X64_MSR_SCONTROL through HV_X64_MSR_EOM and SINT0-15) */
+#define CPUID3A_SYNIC_MSRS		(1U << 2U)
+/* Synthetic Timer MSRs (HV_X64_MSR_STIMER0_CONFIG through HV_X64_MSR_STIMER3_COUNT) */
+#define CPUID3A_SYNTIMER_MSRS		(1U << 3U)
 /* Hypercall MSRs (HV_X64_MSR_GUEST_OS_ID and HV_X64_MSR_HYPERCALL) */
 #define CPUID3A_HYPERCALL_MSR		(1U << 5U)
 /* Access virtual processor index MSR (HV_X64_MSR_VP_INDEX) */
 #define CPUID3A_VP_INDEX_MSR		(1U << 6U)
 /* Partition reference TSC MSR (HV_X64_MSR_REFERENCE_TSC) */
 #define CPUID3A_REFERENCE_TSC_MSR	(1U << 9U)
+/* Synthetic timers can deliver their expiration through a LAPIC vector */
+#define CPUID3D_STIMER_DIRECT_MODE	(1U << 19U)
+
+/* Use hypercall for remote TLB flush instead of IPIs */
+#define CPUID4A_REMOTE_TLB_FLUSH	(1U << 2U)
+/* Don't use AutoEOI on the SINTs, it is not emulated */
+#define CPUID4A_DEPRECATING_AEOI	(1U << 9U)
+/* Use hypercall for sending IPIs instead of the local APIC ICR */
+#define CPUID4A_CLUSTER_IPI		(1U << 10U)
+/* Use the Ex variants of the TLB flush and IPI hypercalls (sparse VP sets) */
+#define CPUID4A_EX_PROCESSOR_MASKS	(1U << 11U)
+/* Never notify the hypervisor about long spinlock waits */
+#define CPUID4B_SPINLOCK_NEVER_RETRY	0xFFFFFFFFU
+
+/* Hypercall status codes */
+#define HV_STATUS_SUCCESS			0U
+#define HV_STATUS_INVALID_HYPERCALL_CODE	2U
+#define HV_STATUS_INVALID_HYPERCALL_INPUT	3U
+#define HV_STATUS_INVALID_ALIGNMENT		4U
+#define HV_STATUS_INVALID_PARAMETER		5U
+
+/* Hypercall call codes */
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE	0x0002U
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST	0x0003U
+#define HVCALL_SEND_IPI				0x000bU
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE_EX	0x0013U
+#define HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST_EX	0x0014U
+#define HVCALL_SEND_IPI_EX			0x0015U
+
+/* Flush all processors of the partition, the processor mask is ignored */
+#define HV_FLUSH_ALL_PROCESSORS		(1UL << 0U)
+
+/* Format of a generic processor set (struct hv_vpset) */
+#define HV_GENERIC_SET_SPARSE_4K	0UL
+#define HV_GENERIC_SET_ALL		1UL
+
+/* SynIC control and version */
+#define HV_SCONTROL_ENABLE		(1UL << 0U)
+#define HV_SYNIC_VERSION		1UL
+#define HV_SINT_DEFAULT			(1UL << 16U)	/* masked */
+
+/* SynIC message slots in the SIMP page */
+#define HV_MESSAGE_SIZE			256U
+#define HV_MESSAGE_TYPE_NONE		0x00000000U
+#define HV_MESSAGE_TIMER_EXPIRED	0x80000010U
+#define HV_MESSAGE_FLAG_PENDING		(1U << 0U)
+
+union hyperv_hypercall_input {
+	uint64_t val64;
+	struct {
+		uint64_t call_code:16;
+		uint64_t fast:1;
+		uint64_t var_hdr_size:10;
+		uint64_t rsvdp1:5;
+		uint64_t rep_count:12;
+		uint64_t rsvdp2:4;
+		uint64_t rep_start:12;
+		uint64_t rsvdp3:4;
+	};
+};
+
+/* Only bank 0 is ever used since a VM has no more than 64 vCPUs */
+struct hv_vpset {
+	uint64_t format;
+	uint64_t valid_bank_mask;
+	uint64_t bank_contents[1];
+};
+
+struct hv_flush_address_space {
+	uint64_t address_space;
+	uint64_t flags;
+	uint64_t processor_mask;
+};
+
+struct hv_flush_address_space_ex {
+	uint64_t address_space;
+	uint64_t flags;
+	struct hv_vpset vp_set;
+};
+
+struct hv_send_ipi {
+	uint32_t vector;
+	uint32_t reserved;
+	uint64_t cpu_mask;
+};
+
+struct hv_send_ipi_ex {
+	uint32_t vector;
+	uint32_t reserved;
+	struct hv_vpset vp_set;
+};
+
+struct hv_message_header {
+	uint32_t message_type;
+	uint8_t payload_size;
+	uint8_t message_flags;
+	uint8_t reserved[2];
+	uint64_t origination_id;
+};
+
+struct hv_timer_message {
+	struct hv_message_header header;
+	uint32_t timer_index;
+	uint32_t reserved;
+	uint64_t expiration_time;
+	uint64_t delivery_time;
+};
 
 struct HV_REFERENCE_TSC_PAGE {
 	uint32_t tsc_sequence;
@@ -129,6 +246,310 @@ hyperv_get_ref_count(struct acrn_vm *vm)
 	return ret;
 }
 
+/* convert an interval in 100ns units of the reference counter to TSC cycles */
+static inline uint64_t
+hyperv_ref_to_cycles(uint64_t ref)
+{
+	uint64_t khz = get_tsc_khz();
+
+	return ((ref / 10000UL) * khz) + (((ref % 10000UL) * khz) / 10000UL);
+}
+
+static bool
+hyperv_stimer_send_msg(struct hyperv_stimer *stimer)
+{
+	struct acrn_vcpu *vcpu = stimer->vcpu;
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	uint32_t sintx = (uint32_t)stimer->config.sintx;
+	const union hyperv_sint_msr *sint = &hv->sint[sintx];
+	struct hv_timer_message *msg;
+	bool sent = false;
+
+	if (((hv->scontrol & HV_SCONTROL_ENABLE) != 0UL) && (hv->simp.enabled == 1U) && (sint->masked == 0U)) {
+		msg = (struct hv_timer_message *)gpa2hva(vcpu->vm,
+			(hv->simp.gpfn << PAGE_SHIFT) + (sintx * HV_MESSAGE_SIZE));
+		if (msg != NULL) {
+			stac();
+			if (msg->header.message_type == HV_MESSAGE_TYPE_NONE) {
+				msg->header.payload_size = (uint8_t)(sizeof(struct hv_timer_message) -
+					sizeof(struct hv_message_header));
+				msg->header.message_flags = 0U;
+				msg->header.origination_id = 0UL;
+				msg->timer_index = stimer->index;
+				msg->reserved = 0U;
+				msg->expiration_time = stimer->exp_time;
+				msg->delivery_time = stimer->exp_time;
+				/* the message type is what the guest polls, publish it last */
+				cpu_write_memory_barrier();
+				msg->header.message_type = HV_MESSAGE_TIMER_EXPIRED;
+				sent = true;
+			} else {
+				/* the slot is busy, ask the guest to write EOM once it is drained */
+				msg->header.message_flags |= HV_MESSAGE_FLAG_PENDING;
+			}
+			clac();
+
+			if (sent) {
+				vlapic_set_intr(vcpu, (uint32_t)sint->vector, LAPIC_TRIG_EDGE);
+			}
+		}
+	}
+
+	return sent;
+}
+
+/*
+ * Deliver a pending expiration, either directly as a LAPIC interrupt or as a
+ * SynIC message. A message that can't be posted stays pending and is retried
+ * on the next EOM or SynIC reconfiguration.
+ */
+static void
+hyperv_stimer_deliver(struct hyperv_stimer *stimer)
+{
+	bool delivered;
+
+	if (stimer->config.direct_mode == 1U) {
+		if (stimer->config.apic_vector >= 16U) {
+			vlapic_set_intr(stimer->vcpu, (uint32_t)stimer->config.apic_vector, LAPIC_TRIG_EDGE);
+		}
+		delivered = true;
+	} else {
+		delivered = hyperv_stimer_send_msg(stimer);
+	}
+
+	if (delivered) {
+		stimer->msg_pending = false;
+		if (stimer->config.periodic == 0U) {
+			stimer->config.enabled = 0U;
+		}
+	}
+}
+
+static void
+hyperv_stimer_expired(void *data)
+{
+	struct hyperv_stimer *stimer = (struct hyperv_stimer *)data;
+
+	/* expirations are coalesced while the previous one is still pending */
+	if (!stimer->msg_pending) {
+		stimer->msg_pending = true;
+		hyperv_stimer_deliver(stimer);
+	}
+
+	if (stimer->config.periodic == 1U) {
+		stimer->exp_time += stimer->count;
+	}
+}
+
+static void
+hyperv_stimer_stop(struct hyperv_stimer *stimer)
+{
+	struct hv_timer *timer = &stimer->timer;
+
+	del_timer(timer);
+	timer->fire_tsc = 0UL;
+	stimer->msg_pending = false;
+}
+
+/*
+ * @pre the stimer belongs to the vCPU running on the current pCPU
+ */
+static void
+hyperv_stimer_start(struct hyperv_stimer *stimer)
+{
+	struct hv_timer *timer = &stimer->timer;
+	uint64_t now = hyperv_get_ref_count(stimer->vcpu->vm);
+
+	del_timer(timer);
+
+	if (stimer->config.periodic == 1U) {
+		stimer->exp_time = now + stimer->count;
+		timer->mode = TICK_MODE_PERIODIC;
+		timer->period_in_cycle = hyperv_ref_to_cycles(stimer->count);
+		timer->fire_tsc = rdtsc() + timer->period_in_cycle;
+	} else {
+		/* the count of a one-shot timer is an absolute reference time */
+		stimer->exp_time = stimer->count;
+		timer->mode = TICK_MODE_ONESHOT;
+		timer->period_in_cycle = 0UL;
+		timer->fire_tsc = rdtsc();
+		if (stimer->count > now) {
+			timer->fire_tsc += hyperv_ref_to_cycles(stimer->count - now);
+		}
+	}
+
+	/* fire_tsc is not 0 here, add_timer should not return error */
+	(void)add_timer(timer);
+}
+
+static void
+hyperv_stimer_write_config(struct hyperv_stimer *stimer, uint64_t val)
+{
+	hyperv_stimer_stop(stimer);
+
+	stimer->config.val64 = val;
+	stimer->config.rsvdp1 = 0U;
+	stimer->config.rsvdp2 = 0U;
+
+	/* SINT0 is reserved for messages, only direct mode may use it */
+	if ((stimer->config.direct_mode == 0U) && (stimer->config.sintx == 0U)) {
+		stimer->config.enabled = 0U;
+	}
+
+	if ((stimer->config.enabled == 1U) && (stimer->count != 0UL)) {
+		hyperv_stimer_start(stimer);
+	}
+}
+
+static void
+hyperv_stimer_write_count(struct hyperv_stimer *stimer, uint64_t val)
+{
+	hyperv_stimer_stop(stimer);
+
+	stimer->count = val;
+	if (val == 0UL) {
+		stimer->config.enabled = 0U;
+	} else if (stimer->config.auto_enable == 1U) {
+		stimer->config.enabled = 1U;
+	} else {
+		/* keep the enable bit as is */
+	}
+
+	if (stimer->config.enabled == 1U) {
+		hyperv_stimer_start(stimer);
+	}
+}
+
+static void
+hyperv_synic_retry_pending(struct acrn_vcpu *vcpu)
+{
+	uint32_t i;
+	struct hyperv_stimer *stimer;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &vcpu->arch.hyperv.stimer[i];
+		if (stimer->msg_pending) {
+			hyperv_stimer_deliver(stimer);
+		}
+	}
+}
+
+static void
+hyperv_synic_setup_page(struct acrn_vcpu *vcpu, union hyperv_synic_page_msr *page, uint64_t val)
+{
+	void *hva;
+
+	page->val64 = val;
+	page->rsvdp = 0U;
+
+	/* a freshly enabled page carries no message or event flag */
+	if (page->enabled == 1U) {
+		hva = gpa2hva(vcpu->vm, page->gpfn << PAGE_SHIFT);
+		if (hva != NULL) {
+			stac();
+			(void)memset(hva, 0U, PAGE_SIZE);
+			clac();
+		}
+	}
+}
+
+static int32_t
+hyperv_synic_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	struct hyperv_stimer *stimer;
+	union hyperv_sint_msr sint;
+	int32_t ret = 0;
+
+	if ((msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT)) {
+		stimer = &hv->stimer[(msr - HV_X64_MSR_STIMER0_CONFIG) >> 1U];
+		if (((msr - HV_X64_MSR_STIMER0_CONFIG) & 1U) == 0U) {
+			hyperv_stimer_write_config(stimer, wval);
+		} else {
+			hyperv_stimer_write_count(stimer, wval);
+		}
+	} else if ((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15)) {
+		sint.val64 = wval;
+		if (sint.auto_eoi != 0U) {
+			/* without an EOI the ISR bit would block the vector, see CPUID4A_DEPRECATING_AEOI */
+			pr_warn("hv: %s: AutoEOI on SINT%u is not supported", __func__, msr - HV_X64_MSR_SINT0);
+			ret = -EACCES;
+		} else {
+			sint.rsvdp1 = 0U;
+			sint.rsvdp2 = 0U;
+			hv->sint[msr - HV_X64_MSR_SINT0] = sint;
+			hyperv_synic_retry_pending(vcpu);
+		}
+	} else {
+		switch (msr) {
+		case HV_X64_MSR_SCONTROL:
+			hv->scontrol = wval & HV_SCONTROL_ENABLE;
+			hyperv_synic_retry_pending(vcpu);
+			break;
+		case HV_X64_MSR_SIEFP:
+			hyperv_synic_setup_page(vcpu, &hv->siefp, wval);
+			break;
+		case HV_X64_MSR_SIMP:
+			hyperv_synic_setup_page(vcpu, &hv->simp, wval);
+			hyperv_synic_retry_pending(vcpu);
+			break;
+		case HV_X64_MSR_EOM:
+			hyperv_synic_retry_pending(vcpu);
+			break;
+		case HV_X64_MSR_SVERSION:
+			/* read only */
+			break;
+		default:
+			ret = -1;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+static int32_t
+hyperv_synic_rdmsr(const struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
+{
+	const struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	const struct hyperv_stimer *stimer;
+	int32_t ret = 0;
+
+	if ((msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT)) {
+		stimer = &hv->stimer[(msr - HV_X64_MSR_STIMER0_CONFIG) >> 1U];
+		if (((msr - HV_X64_MSR_STIMER0_CONFIG) & 1U) == 0U) {
+			*rval = stimer->config.val64;
+		} else {
+			*rval = stimer->count;
+		}
+	} else if ((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15)) {
+		*rval = hv->sint[msr - HV_X64_MSR_SINT0].val64;
+	} else {
+		switch (msr) {
+		case HV_X64_MSR_SCONTROL:
+			*rval = hv->scontrol;
+			break;
+		case HV_X64_MSR_SVERSION:
+			*rval = HV_SYNIC_VERSION;
+			break;
+		case HV_X64_MSR_SIEFP:
+			*rval = hv->siefp.val64;
+			break;
+		case HV_X64_MSR_SIMP:
+			*rval = hv->simp.val64;
+			break;
+		case HV_X64_MSR_EOM:
+			*rval = 0UL;
+			break;
+		default:
+			ret = -1;
+			break;
+		}
+	}
+
+	return ret;
+}
+
 static void
 hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 {
@@ -136,8 +557,8 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 	uint64_t page_gpa;
 	void *page_hva;
 
-	/* asm volatile ("mov $2,%%eax; mov $0,%%edx; ret":::"eax","edx"); */
-	const uint8_t inst[11] = {0xb8U, 0x02U, 0x0U, 0x0U, 0x0U, 0xbaU, 0x0U, 0x0U, 0x0U, 0x0U, 0xc3U};
+	/* asm volatile ("vmcall; ret"); */
+	const uint8_t inst[4] = {0x0fU, 0x01U, 0xc1U, 0xc3U};
 
 	hypercall.val64 = val;
 
@@ -147,7 +568,7 @@ hyperv_setup_hypercall_page(const struct acrn_vcpu *vcpu, uint64_t val)
 		if (page_hva != NULL) {
 			stac();
 			(void)memset(page_hva, 0U, PAGE_SIZE);
-			(void)memcpy_s(page_hva, 11U, inst, 11U);
+			(void)memcpy_s(page_hva, sizeof(inst), inst, sizeof(inst));
 			clac();
 		}
 	}
@@ -183,8 +604,12 @@ hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval)
 		hyperv_setup_tsc_page(vcpu, wval);
 		break;
 	default:
-		pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
-		ret = -1;
+		if (is_hyperv_synic_msr(msr)) {
+			ret = hyperv_synic_wrmsr(vcpu, msr, wval);
+		} else {
+			pr_err("hv: %s: unexpected MSR[0x%x] write", __func__, msr);
+			ret = -1;
+		}
 		break;
 	}
 
@@ -216,8 +641,12 @@ hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 		*rval = vcpu->vm->arch_vm.hyperv.ref_tsc_page.val64;
 		break;
 	default:
-		pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
-		ret = -1;
+		if (is_hyperv_synic_msr(msr)) {
+			ret = hyperv_synic_rdmsr(vcpu, msr, rval);
+		} else {
+			pr_err("hv: %s: unexpected MSR[0x%x] read", __func__, msr);
+			ret = -1;
+		}
 		break;
 	}
 
@@ -227,6 +656,249 @@ hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval)
 	return ret;
 }
 
+/*
+ * Translate a generic processor set into a vCPU bitmap.
+ */
+static uint16_t
+hyperv_get_vpset_mask(const struct hv_vpset *vpset, uint64_t *vcpu_mask)
+{
+	uint16_t status = HV_STATUS_SUCCESS;
+
+	if (vpset->format == HV_GENERIC_SET_ALL) {
+		*vcpu_mask = ~0UL;
+	} else if (vpset->format == HV_GENERIC_SET_SPARSE_4K) {
+		/* VP index equals vCPU id, any bank but the first one is empty */
+		*vcpu_mask = ((vpset->valid_bank_mask & 1UL) != 0UL) ? vpset->bank_contents[0] : 0UL;
+	} else {
+		status = HV_STATUS_INVALID_PARAMETER;
+	}
+
+	return status;
+}
+
+/*
+ * Flush the guest TLB of the vCPUs in vcpu_mask. The hypercall has to return
+ * only after the flush is done.
+ */
+static void
+hyperv_flush_tlb(struct acrn_vcpu *vcpu, uint64_t vcpu_mask)
+{
+	vcpu_make_request_and_wait(vcpu->vm, vcpu_mask, ACRN_REQUEST_VPID_FLUSH);
+}
+
+static uint16_t
+hyperv_hcall_flush(struct acrn_vcpu *vcpu, const union hyperv_hypercall_input *input, uint64_t input_gpa)
+{
+	struct hv_flush_address_space flush;
+	struct hv_flush_address_space_ex flush_ex;
+	uint64_t vcpu_mask = 0UL, flags = 0UL;
+	uint16_t status = HV_STATUS_SUCCESS;
+	bool is_ex = (input->call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE_EX) ||
+		(input->call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST_EX);
+
+	/* no XMM fast input is advertised, all the flush inputs are in memory */
+	if (input->fast == 1U) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if (is_ex) {
+		if (copy_from_gpa(vcpu->vm, &flush_ex, input_gpa, (uint32_t)sizeof(flush_ex)) != 0) {
+			status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+		} else {
+			flags = flush_ex.flags;
+			status = hyperv_get_vpset_mask(&flush_ex.vp_set, &vcpu_mask);
+		}
+	} else {
+		if (copy_from_gpa(vcpu->vm, &flush, input_gpa, (uint32_t)sizeof(flush)) != 0) {
+			status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+		} else {
+			flags = flush.flags;
+			vcpu_mask = flush.processor_mask;
+		}
+	}
+
+	if (status == HV_STATUS_SUCCESS) {
+		if ((flags & HV_FLUSH_ALL_PROCESSORS) != 0UL) {
+			vcpu_mask = ~0UL;
+		}
+
+		/*
+		 * A single-context INVVPID covers any address space and GVA list,
+		 * so the list variants flush the whole VPID as well.
+		 */
+		hyperv_flush_tlb(vcpu, vcpu_mask);
+	}
+
+	return status;
+}
+
+static uint16_t
+hyperv_hcall_send_ipi(struct acrn_vcpu *vcpu, const union hyperv_hypercall_input *input,
+		uint64_t input_param, uint64_t output_param)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vcpu *target;
+	struct hv_send_ipi ipi;
+	struct hv_send_ipi_ex ipi_ex;
+	uint64_t vcpu_mask = 0UL;
+	uint32_t vector = 0U;
+	uint16_t status = HV_STATUS_SUCCESS;
+	uint16_t i;
+
+	if (input->call_code == HVCALL_SEND_IPI) {
+		if (input->fast == 1U) {
+			vector = (uint32_t)input_param;
+			vcpu_mask = output_param;
+		} else if (copy_from_gpa(vm, &ipi, input_param, (uint32_t)sizeof(ipi)) != 0) {
+			status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+		} else {
+			vector = ipi.vector;
+			vcpu_mask = ipi.cpu_mask;
+		}
+	} else {
+		if ((input->fast == 1U) ||
+			(copy_from_gpa(vm, &ipi_ex, input_param, (uint32_t)sizeof(ipi_ex)) != 0)) {
+			status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+		} else {
+			vector = ipi_ex.vector;
+			status = hyperv_get_vpset_mask(&ipi_ex.vp_set, &vcpu_mask);
+		}
+	}
+
+	if ((status == HV_STATUS_SUCCESS) && ((vector < 16U) || (vector > 255U))) {
+		status = HV_STATUS_INVALID_PARAMETER;
+	}
+
+	if (status == HV_STATUS_SUCCESS) {
+		foreach_vcpu(i, vm, target) {
+			if (bitmap_test(i, &vcpu_mask)) {
+				vlapic_set_intr(target, vector, LAPIC_TRIG_EDGE);
+			}
+		}
+	}
+
+	return status;
+}
+
+/*
+ * A VMCALL is a Hyper-V hypercall only when it is issued from the hypercall
+ * page; any other VMCALL, e.g. a trusty world switch, stays an ACRN one.
+ */
+bool
+is_hyperv_hypercall(struct acrn_vcpu *vcpu)
+{
+	const struct acrn_hyperv *hyperv = &vcpu->vm->arch_vm.hyperv;
+	uint32_t err_code = PAGE_FAULT_ID_FLAG;
+	uint64_t gpa;
+
+	return ((hyperv->guest_os_id.val64 != 0UL) && (hyperv->hypercall_page.enabled == 1UL) &&
+		(gva2gpa(vcpu, vcpu_get_rip(vcpu), &gpa, &err_code) == 0) &&
+		((gpa >> PAGE_SHIFT) == hyperv->hypercall_page.gpfn));
+}
+
+/*
+ * Handle a hypercall issued through the hypercall page, see TLFS chapter
+ * "Hypercall Interface". Only the 64-bit calling convention is supported:
+ * RCX holds the input value, RDX and R8 the input and output GPAs (or the
+ * parameters of a fast hypercall). The returned value goes into RAX.
+ *
+ * @pre is_hyperv_hypercall(vcpu) == true
+ */
+uint64_t
+hyperv_hypercall(struct acrn_vcpu *vcpu)
+{
+	union hyperv_hypercall_input input;
+	uint64_t input_param = vcpu_get_gpreg(vcpu, CPU_REG_RDX);
+	uint64_t output_param = vcpu_get_gpreg(vcpu, CPU_REG_R8);
+	uint64_t reps_done = 0UL;
+	uint16_t status;
+	bool is_rep;
+
+	input.val64 = vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	is_rep = (input.call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST) ||
+		(input.call_code == HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST_EX);
+
+	if (get_vcpu_mode(vcpu) != CPU_MODE_64BIT) {
+		status = HV_STATUS_INVALID_HYPERCALL_CODE;
+	} else if ((input.rsvdp1 != 0U) || (input.rsvdp2 != 0U) || (input.rsvdp3 != 0U) ||
+			(is_rep != (input.rep_count != 0U))) {
+		status = HV_STATUS_INVALID_HYPERCALL_INPUT;
+	} else if ((input.fast == 0U) && ((input_param & 7UL) != 0UL)) {
+		status = HV_STATUS_INVALID_ALIGNMENT;
+	} else {
+		switch (input.call_code) {
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE:
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST:
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_SPACE_EX:
+		case HVCALL_FLUSH_VIRTUAL_ADDRESS_LIST_EX:
+			status = hyperv_hcall_flush(vcpu, &input, input_param);
+			break;
+		case HVCALL_SEND_IPI:
+		case HVCALL_SEND_IPI_EX:
+			status = hyperv_hcall_send_ipi(vcpu, &input, input_param, output_param);
+			break;
+		default:
+			status = HV_STATUS_INVALID_HYPERCALL_CODE;
+			break;
+		}
+
+		if (is_rep && (status == HV_STATUS_SUCCESS)) {
+			reps_done = input.rep_count;
+		}
+	}
+
+	dev_dbg(DBG_LEVEL_HYPERV, "hv: %s: input=0x%lx status=0x%x vcpuid=%d vmid=%d",
+		__func__, input.val64, status, vcpu->vcpu_id, vcpu->vm->vm_id);
+
+	return ((reps_done << 32U) | status);
+}
+
+void
+hyperv_init_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct hyperv_stimer *stimer;
+	uint32_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &vcpu->arch.hyperv.stimer[i];
+		stimer->vcpu = vcpu;
+		stimer->index = i;
+		initialize_timer(&stimer->timer, hyperv_stimer_expired, stimer,
+			0UL, TICK_MODE_ONESHOT, 0UL);
+	}
+}
+
+void
+hyperv_reset_vcpu(struct acrn_vcpu *vcpu)
+{
+	struct acrn_hyperv_vcpu *hv = &vcpu->arch.hyperv;
+	struct hyperv_stimer *stimer;
+	uint32_t i;
+
+	hv->scontrol = 0UL;
+	hv->siefp.val64 = 0UL;
+	hv->simp.val64 = 0UL;
+	for (i = 0U; i < HV_SYNIC_SINT_COUNT; i++) {
+		hv->sint[i].val64 = HV_SINT_DEFAULT;
+	}
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		stimer = &hv->stimer[i];
+		hyperv_stimer_stop(stimer);
+		stimer->config.val64 = 0UL;
+		stimer->count = 0UL;
+		stimer->exp_time = 0UL;
+	}
+}
+
+void
+hyperv_free_vcpu(struct acrn_vcpu *vcpu)
+{
+	uint32_t i;
+
+	for (i = 0U; i < HV_SYNIC_STIMER_COUNT; i++) {
+		del_timer(&vcpu->arch.hyperv.stimer[i].timer);
+	}
+}
+
 void
 hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 			 struct vcpuid_entry *entry)
@@ -250,14 +922,16 @@ hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 		break;
 	case 0x40000003U: /* HV supported feature */
 		entry->eax = CPUID3A_HYPERCALL_MSR | CPUID3A_VP_INDEX_MSR |
-			CPUID3A_TIME_REF_COUNT_MSR | CPUID3A_REFERENCE_TSC_MSR;
+			CPUID3A_TIME_REF_COUNT_MSR | CPUID3A_REFERENCE_TSC_MSR |
+			CPUID3A_SYNIC_MSRS | CPUID3A_SYNTIMER_MSRS;
 		entry->ebx = 0U;
 		entry->ecx = 0U;
-		entry->edx = 0U;
+		entry->edx = CPUID3D_STIMER_DIRECT_MODE;
 		break;
 	case 0x40000004U: /* HV Recommended hypercall usage */
-		entry->eax = 0U;
-		entry->ebx = 0U;
+		entry->eax = CPUID4A_REMOTE_TLB_FLUSH | CPUID4A_DEPRECATING_AEOI |
+			CPUID4A_CLUSTER_IPI | CPUID4A_EX_PROCESSOR_MASKS;
+		entry->ebx = CPUID4B_SPINLOCK_NEVER_RETRY;
 		entry->ecx = 0U;
 		entry->edx = 0U;
 		break;
@@ -76,17 +76,14 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 	 * Normal World.PD/PT are shared in both Secure world's EPT
 	 * and Normal World's EPT
 	 */
-	pml4_base = vm->arch_vm.ept_mem_ops.info->ept.sworld_pgtable_base;
-	(void)memset(pml4_base, 0U, PAGE_SIZE);
+	pml4_base = vm->arch_vm.ept_mem_ops.alloc_page(vm->arch_vm.ept_mem_ops.info);
 	vm->arch_vm.sworld_eptp = pml4_base;
 	sanitize_pte((uint64_t *)vm->arch_vm.sworld_eptp, &vm->arch_vm.ept_mem_ops);
 
 	/* The trusty memory is remapped to guest physical address
 	 * of gpa_rebased to gpa_rebased + size
 	 */
-	sub_table_addr = vm->arch_vm.ept_mem_ops.info->ept.sworld_pgtable_base +
-									TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA);
-	(void)memset(sub_table_addr, 0U, PAGE_SIZE);
+	sub_table_addr = vm->arch_vm.ept_mem_ops.alloc_page(vm->arch_vm.ept_mem_ops.info);
 	sworld_pml4e = hva2hpa(sub_table_addr) | table_present;
 	set_pgentry((uint64_t *)pml4_base, sworld_pml4e, &vm->arch_vm.ept_mem_ops);
 
@@ -117,6 +114,24 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 	vm->sworld_control.sworld_memory.length = size;
 }
 
+/*
+ * Give back the secure world PML4 and PDPT pages, and the PD page of the
+ * rebased trusty memory. The other PD pages are shared with the normal world.
+ */
+static void free_secure_world_ept(struct acrn_vm *vm)
+{
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t *pml4_base = (uint64_t *)vm->arch_vm.sworld_eptp;
+	uint64_t *pdpt_base = pml4e_page_vaddr(get_pgentry(pml4_base));
+	uint64_t pdpte = get_pgentry(pdpt_base + pdpte_index(TRUSTY_EPT_REBASE_GPA));
+
+	if ((mem_ops->pgentry_present(pdpte) != 0UL) && (pdpte_large(pdpte) == 0UL)) {
+		mem_ops->free_page(mem_ops->info, (struct page *)pdpte_page_vaddr(pdpte));
+	}
+	mem_ops->free_page(mem_ops->info, (struct page *)pdpt_base);
+	mem_ops->free_page(mem_ops->info, (struct page *)pml4_base);
+}
+
 void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem)
 {
 	uint64_t hpa = vm->sworld_control.sworld_memory.base_hpa;
@@ -132,8 +147,7 @@ void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem)
 		}
 
 		ept_del_mr(vm, vm->arch_vm.sworld_eptp, gpa_uos, size);
-		/* sanitize trusty ept page-structures */
-		sanitize_pte((uint64_t *)vm->arch_vm.sworld_eptp, &vm->arch_vm.ept_mem_ops);
+		free_secure_world_ept(vm);
 		vm->arch_vm.sworld_eptp = NULL;
 
 		/* Restore memory to guest normal world */
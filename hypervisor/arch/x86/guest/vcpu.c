@@ -219,6 +219,10 @@ static void vcpu_reset_internal(struct acrn_vcpu *vcpu, enum reset_mode mode)
 	vlapic = vcpu_vlapic(vcpu);
 	vlapic_reset(vlapic, apicv_ops, mode);
 
+#ifdef CONFIG_HYPERV_ENABLED
+	hyperv_reset_vcpu(vcpu);
+#endif
+
 	reset_vcpu_regs(vcpu);
 
 	for (i = 0; i < VCPU_EVENT_NUM; i++) {
@@ -260,10 +264,19 @@ static void set_vcpu_mode(struct acrn_vcpu *vcpu, uint32_t cs_attr, uint64_t ia3
 	}
 }
 
-static void init_xsave(struct acrn_vcpu *vcpu)
+static void init_xsave(struct acrn_vcpu *vcpu, uint16_t pcpu_id)
 {
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
 	struct xsave_area *area = &ectx->xs_area;
+	struct loaded_ext_context *loaded = &per_cpu(loaded_ext_ctx, pcpu_id);
+	int32_t i;
+
+	/* a previous vCPU at this address may have left its state loaded */
+	for (i = 0; i < NR_WORLD; i++) {
+		if (loaded->xs_owner == &(vcpu->arch.contexts[i].ext_ctx)) {
+			loaded->xs_owner = NULL;
+		}
+	}
 
 	ectx->xcr0 = XSAVE_FPU;
 	ectx->xss = 0U;
@@ -475,6 +488,10 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		/* Create per vcpu vlapic */
 		vlapic_create(vcpu);
 
+#ifdef CONFIG_HYPERV_ENABLED
+		hyperv_init_vcpu(vcpu);
+#endif
+
 		if (!vm_hide_mtrr(vm)) {
 			init_vmtrr(vcpu);
 		}
@@ -483,7 +500,7 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 		*rtn_vcpu_handle = vcpu;
 		vcpu->state = VCPU_INIT;
 
-		init_xsave(vcpu);
+		init_xsave(vcpu, pcpu_id);
 		vcpu_reset_internal(vcpu, POWER_ON_RESET);
 		(void)memset((void *)&vcpu->req, 0U, sizeof(struct io_request));
 		vm->hw.created_vcpus++;
@@ -633,6 +650,9 @@ void offline_vcpu(struct acrn_vcpu *vcpu)
 {
 	if (vcpu->state == VCPU_ZOMBIE) {
 		vlapic_free(vcpu);
+#ifdef CONFIG_HYPERV_ENABLED
+		hyperv_free_vcpu(vcpu);
+#endif
 		per_cpu(ever_run_vcpu, pcpuid_from_vcpu(vcpu)) = NULL;
 		vcpu->state = VCPU_OFFLINE;
 	}
@@ -739,15 +759,31 @@ void rstore_xsave_area(const struct ext_context *ectx)
 	xrstors(&ectx->xs_area, UINT64_MAX);
 }
 
-/* TODO:
- * Now we have switch_out and switch_in callbacks for each thread_object, and schedule
- * will call them every thread switch. We can implement lazy context swtich , which
- * only do context swtich when really need.
+/*
+ * The syscall MSRs and the XSAVE state of a vCPU are saved when it is switched
+ * out, and left in the registers: the hypervisor doesn't use them. Switching
+ * a vCPU in only writes the values that differ from the loaded ones, and
+ * restores the XSAVE state only if another one was loaded meanwhile, so a
+ * vCPU coming back after the idle thread has nothing to restore. XSAVES only
+ * writes the components modified since the XRSTORS of the same area, which
+ * the skipped restores preserve.
  */
+static inline void load_ext_msr(uint32_t msr, uint64_t val, uint64_t loaded_val, bool loaded,
+		struct vcpu_switch_stats *stats)
+{
+	if (loaded && (val == loaded_val)) {
+		stats->writes_skipped++;
+	} else {
+		msr_write(msr, val);
+	}
+}
+
 static void context_switch_out(struct thread_object *prev)
 {
 	struct acrn_vcpu *vcpu = list_entry(prev, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct loaded_ext_context *loaded = &get_cpu_var(loaded_ext_ctx);
+	uint64_t start = rdtsc();
 
 	/* We don't flush TLB as we assume each vcpu has different vpid */
 	ectx->ia32_star = msr_read(MSR_IA32_STAR);
@@ -757,24 +793,56 @@ static void context_switch_out(struct thread_object *prev)
 
 	save_xsave_area(ectx);
 
+	loaded->xs_owner = ectx;
+	loaded->valid = true;
+	loaded->ia32_star = ectx->ia32_star;
+	loaded->ia32_lstar = ectx->ia32_lstar;
+	loaded->ia32_fmask = ectx->ia32_fmask;
+	loaded->ia32_kernel_gs_base = ectx->ia32_kernel_gs_base;
+	loaded->xcr0 = ectx->xcr0;
+	loaded->xss = ectx->xss;
+
 	vcpu->running = false;
+	vcpu->switch_stats.cycles += rdtsc() - start;
 }
 
 static void context_switch_in(struct thread_object *next)
 {
 	struct acrn_vcpu *vcpu = list_entry(next, struct acrn_vcpu, thread_obj);
 	struct ext_context *ectx = &(vcpu->arch.contexts[vcpu->arch.cur_context].ext_ctx);
+	struct loaded_ext_context *loaded = &get_cpu_var(loaded_ext_ctx);
+	struct vcpu_switch_stats *stats = &vcpu->switch_stats;
+	uint64_t start = rdtsc();
 
 	load_vmcs(vcpu);
 
-	msr_write(MSR_IA32_STAR, ectx->ia32_star);
-	msr_write(MSR_IA32_LSTAR, ectx->ia32_lstar);
-	msr_write(MSR_IA32_FMASK, ectx->ia32_fmask);
-	msr_write(MSR_IA32_KERNEL_GS_BASE, ectx->ia32_kernel_gs_base);
+	load_ext_msr(MSR_IA32_STAR, ectx->ia32_star, loaded->ia32_star, loaded->valid, stats);
+	load_ext_msr(MSR_IA32_LSTAR, ectx->ia32_lstar, loaded->ia32_lstar, loaded->valid, stats);
+	load_ext_msr(MSR_IA32_FMASK, ectx->ia32_fmask, loaded->ia32_fmask, loaded->valid, stats);
+	load_ext_msr(MSR_IA32_KERNEL_GS_BASE, ectx->ia32_kernel_gs_base, loaded->ia32_kernel_gs_base,
+			loaded->valid, stats);
+
+	/* XRSTORS needs the XCR0 and IA32_XSS of the state it loads */
+	if (loaded->valid && (ectx->xcr0 == loaded->xcr0)) {
+		stats->writes_skipped++;
+	} else {
+		write_xcr(0, ectx->xcr0);
+	}
+	load_ext_msr(MSR_IA32_XSS, ectx->xss, loaded->xss, loaded->valid, stats);
+
+	if (loaded->xs_owner == ectx) {
+		stats->xrstors_skipped++;
+	} else {
+		xrstors(&ectx->xs_area, UINT64_MAX);
+	}
 
-	rstore_xsave_area(ectx);
+	/* the guest may change them from now on */
+	loaded->valid = false;
+	loaded->xs_owner = NULL;
 
 	vcpu->running = true;
+	stats->switches++;
+	stats->cycles += rdtsc() - start;
 }
 
 void launch_vcpu(struct acrn_vcpu *vcpu)
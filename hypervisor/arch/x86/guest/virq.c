@@ -10,6 +10,7 @@
 #include <irq.h>
 #include <lapic.h>
 #include <mmu.h>
+#include <ept.h>
 #include <vmx.h>
 #include <vcpu.h>
 #include <vmcs.h>
@@ -111,6 +112,41 @@ void vcpu_make_request(struct acrn_vcpu *vcpu, uint16_t eventid)
 	kick_vcpu(vcpu);
 }
 
+static void vcpu_serve_flush_requests(struct acrn_vcpu *vcpu)
+{
+	if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH, &vcpu->arch.pending_req)) {
+		vcpu_flush_ept(vcpu);
+	}
+
+	if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH, &vcpu->arch.pending_req)) {
+		flush_vpid_single(vcpu->arch.vpid);
+	}
+}
+
+void vcpu_make_request_and_wait(struct acrn_vm *vm, uint64_t vcpu_mask, uint16_t eventid)
+{
+	struct acrn_vcpu *curr = get_running_vcpu(get_pcpu_id());
+	struct acrn_vcpu *target;
+	uint16_t i;
+
+	foreach_vcpu(i, vm, target) {
+		if (bitmap_test(i, &vcpu_mask)) {
+			vcpu_make_request(target, eventid);
+		}
+	}
+
+	foreach_vcpu(i, vm, target) {
+		if ((target != curr) && bitmap_test(i, &vcpu_mask)) {
+			while (target->running && bitmap_test(eventid, &target->arch.pending_req)) {
+				if (curr != NULL) {
+					vcpu_serve_flush_requests(curr);
+				}
+				asm_pause();
+			}
+		}
+	}
+}
+
 /*
  * @retval true when INT is injected to guest.
  * @retval false when otherwise
@@ -382,10 +418,11 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 	} else {
 
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH, pending_req_bits)) {
-			invept(vcpu->vm->arch_vm.nworld_eptp);
-			if (vcpu->vm->sworld_control.flag.active != 0UL) {
-				invept(vcpu->vm->arch_vm.sworld_eptp);
-			}
+			vcpu_flush_ept(vcpu);
+		}
+
+		if (bitmap_test_and_clear_lock(ACRN_REQUEST_DIRTY_LOG, pending_req_bits)) {
+			vcpu_update_dirty_log(vcpu);
 		}
 
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH,	pending_req_bits)) {
@@ -163,6 +163,7 @@ static void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t cr0)
 		bool old_paging_enabled = is_paging_enabled(vcpu);
 		uint64_t cr0_changed_bits = vcpu_get_cr0(vcpu) ^ cr0;
 		uint64_t cr0_mask = cr0;
+		uint64_t flushed;
 
 		/* SDM 2.5
 		 * When loading a control register, reserved bit should always set
@@ -215,9 +216,7 @@ static void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t cr0)
 						 * disabled behavior
 						 */
 						exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL, PAT_ALL_UC_VALUE);
-						if (!iommu_snoop_supported(vcpu->vm->iommu)) {
-							cache_flush_invalidate_all();
-						}
+						(void)vcpu_flush_guest_cache(vcpu, GUEST_CACHE_FLUSH_CR0_CD, &flushed);
 					} else {
 						/* Restore IA32_PAT to enable cache again */
 						exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL,
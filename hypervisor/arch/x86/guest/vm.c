@@ -390,7 +390,8 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 	vm->hw.created_vcpus = 0U;
 
 	init_ept_mem_ops(&vm->arch_vm.ept_mem_ops, vm->vm_id);
-	vm->arch_vm.nworld_eptp = vm->arch_vm.ept_mem_ops.get_pml4_page(vm->arch_vm.ept_mem_ops.info);
+	init_vm_dirty_log(vm);
+	vm->arch_vm.nworld_eptp = vm->arch_vm.ept_mem_ops.alloc_page(vm->arch_vm.ept_mem_ops.info);
 	sanitize_pte((uint64_t *)vm->arch_vm.nworld_eptp, &vm->arch_vm.ept_mem_ops);
 
 	(void)memcpy_s(&vm->uuid[0], sizeof(vm->uuid),
@@ -449,12 +450,14 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 		/* Create virtual uart;*/
 		init_vuart(vm, vm_config->vuart);
 
-		if (is_rt_vm(vm) || !is_postlaunched_vm(vm)) {
+		if (is_rt_vm(vm) || !is_postlaunched_vm(vm) ||
+				((vm_config->guest_flags & GUEST_FLAG_HV_RTC) != 0UL)) {
 			vrtc_init(vm);
 		}
 
 		vpci_init(vm);
 		enable_iommu();
+		init_vm_cache_flush(vm);
 
 		register_reset_port_handler(vm);
 
@@ -494,7 +497,8 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 	}
 
 	if ((status != 0) && (vm->arch_vm.nworld_eptp != NULL)) {
-		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
+		release_ept_pages(&vm->arch_vm.ept_mem_ops);
+		vm->arch_vm.nworld_eptp = NULL;
 	}
 
 	return status;
@@ -596,11 +600,15 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 
 		deinit_vuart(vm);
 
+		vrtc_deinit(vm);
+
 		ptdev_release_all_entries(vm);
 
 		/* Free iommu */
 		destroy_iommu_domain(vm->iommu);
 
+		deinit_vm_dirty_log(vm);
+
 		/* Free EPT allocated resources assigned to VM */
 		destroy_ept(vm);
 	} else {
@@ -662,6 +670,10 @@ int32_t reset_vm(struct acrn_vm *vm)
 
 		reset_vm_ioreqs(vm);
 		vioapic_reset(vm);
+		vrtc_reset(vm);
+		deinit_vm_dirty_log(vm);
+		/* the DM may reload the guest images */
+		init_vm_cache_flush(vm);
 		destroy_secure_world(vm, false);
 		vm->sworld_control.flag.active = 0UL;
 		vm->state = VM_CREATED;
@@ -160,6 +160,13 @@ static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
 		ret = 0;
 		break;
 
+	case HC_VM_DIRTY_LOG:
+		/* param1: relative vmid to sos, vm_id: absolute vmid */
+		if (vmid_is_valid) {
+			ret = hcall_vm_dirty_log(sos_vm, vm_id, param2);
+		}
+		break;
+
 	case HC_VM_GPA2HPA:
 		/* param1: relative vmid to sos, vm_id: absolute vmid */
 		if (vmid_is_valid) {
@@ -221,15 +228,28 @@ static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
  */
 int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 {
-	int32_t ret;
+	int32_t ret = 0;
+	bool is_hyperv_hcall = false;
 	struct acrn_vm *vm = vcpu->vm;
 	/* hypercall ID from guest*/
 	uint64_t hypcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);
 
+#ifdef CONFIG_HYPERV_ENABLED
+	is_hyperv_hcall = is_hyperv_hypercall(vcpu);
+#endif
+
 	if (!is_hypercall_from_ring0()) {
 		pr_err("hypercall 0x%lx is only allowed from RING-0!\n", hypcall_id);
-		vcpu_inject_gp(vcpu, 0U);
+		if (is_hyperv_hcall) {
+			/* TLFS: a hypercall from CPL > 0 raises #UD */
+			vcpu_inject_ud(vcpu);
+		} else {
+			vcpu_inject_gp(vcpu, 0U);
+		}
 		ret = -EACCES;
+	} else if (is_hyperv_hcall) {
+		/* RAX carries the TLFS status */
+		vcpu_set_gpreg(vcpu, CPU_REG_RAX, hyperv_hypercall(vcpu));
 	} else if (hypcall_id == HC_WORLD_SWITCH) {
 		ret = hcall_world_switch(vcpu);
 	} else if (hypcall_id == HC_INITIALIZE_TRUSTY) {
@@ -248,7 +268,7 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		ret = -ENODEV;
 	}
 
-	if ((ret != -EACCES) && (ret != -ENODEV)) {
+	if ((ret != -EACCES) && (ret != -ENODEV) && !is_hyperv_hcall) {
 		vcpu_set_gpreg(vcpu, CPU_REG_RAX, (uint64_t)ret);
 	}
 	TRACE_2L(TRACE_VMEXIT_VMCALL, vm->vm_id, hypcall_id);
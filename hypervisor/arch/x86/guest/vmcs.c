@@ -364,6 +364,10 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	exec_vmwrite64(VMX_EPT_POINTER_FULL, value64);
 	pr_dbg("VMX_EPT_POINTER: 0x%016lx ", value64);
 
+	/* PML while the VM's dirty pages are logged, EPT A/D flags for it or the cache flushes */
+	vcpu->arch.pml_enabled = false;
+	vcpu_update_dirty_log(vcpu);
+
 	/* Set up guest exception mask bitmap setting a bit * causes a VM exit
 	 * on corresponding guest * exception - pg 2902 24.6.3
 	 * enable VM exit on MC only
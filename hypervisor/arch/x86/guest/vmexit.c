@@ -162,7 +162,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_RDSEED] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_PAGE_MODIFICATION_LOG_FULL] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = pml_full_vmexit_handler},
 	[VMX_EXIT_REASON_XSAVES] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_XRSTORS] = {
@@ -179,6 +179,10 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 		pr_fatal("vcpu is not running on its pcpu!");
 		ret = -EINVAL;
 	} else {
+		if (vcpu->arch.pml_enabled) {
+			vcpu_flush_pml(vcpu);
+		}
+
 		/* Obtain interrupt info */
 		vcpu->arch.idt_vectoring_info = exec_vmread32(VMX_IDT_VEC_INFO_FIELD);
 		/* Filter out HW exception & NMI */
@@ -379,11 +383,11 @@ static int32_t xsetbv_vmexit_handler(struct acrn_vcpu *vcpu)
 
 static int32_t wbinvd_vmexit_handler(struct acrn_vcpu *vcpu)
 {
-	if (has_rt_vm() == false) {
-		cache_flush_invalidate_all();
-	} else {
-		walk_ept_table(vcpu->vm, ept_flush_leaf_page);
-	}
+	enum guest_cache_flush_method method;
+	uint64_t size;
+
+	method = vcpu_flush_guest_cache(vcpu, GUEST_CACHE_FLUSH_WBINVD, &size);
+	TRACE_2L(TRACE_VMEXIT_WBINVD, size, (uint64_t)method);
 
 	return 0;
 }
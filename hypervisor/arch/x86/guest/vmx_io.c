@@ -122,6 +122,9 @@ int32_t ept_violation_vmexit_handler(struct acrn_vcpu *vcpu)
 		}
 		vcpu_retain_rip(vcpu);
 		status = 0;
+	} else if (((exit_qual & 0xAUL) == 0xAUL) && dirty_log_handle_ept_violation(vcpu, gpa)) {
+		/* write to a readable page write protected for dirty page logging */
+		status = 0;
 	} else {
 
 		io_req->io_type = REQ_MMIO;
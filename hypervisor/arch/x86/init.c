@@ -107,3 +107,21 @@ void init_secondary_pcpu(void)
 
 	run_idle_thread();
 }
+
+/* AP entry on resume from host S3, the VMs are already there */
+void resume_secondary_pcpu(void)
+{
+	uint16_t pcpu_id;
+
+	init_pcpu_pre(false);
+
+	pcpu_id = get_pcpu_id();
+
+	resume_pcpu_post(pcpu_id);
+
+	init_debug_post(pcpu_id);
+
+	vmx_on();
+
+	run_idle_thread();
+}
@@ -5,6 +5,8 @@
  */
 #include <types.h>
 #include <rtl.h>
+#include <bits.h>
+#include <util.h>
 #include <pgtable.h>
 #include <page.h>
 #include <mmu.h>
@@ -12,53 +14,162 @@
 #include <vtd.h>
 #include <security.h>
 #include <vm.h>
+#include <logmsg.h>
 
-static struct page ppt_pml4_pages[PML4_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE)];
-static struct page ppt_pdpt_pages[PDPT_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE)];
-static struct page ppt_pd_pages[PD_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE)];
+#define PPT_PAGE_NUM	(PML4_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE) +	\
+			PDPT_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE) +	\
+			PD_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE))
+
+static struct page ppt_pages[PPT_PAGE_NUM];
+static uint64_t ppt_page_bitmap[INT_DIV_ROUNDUP(PPT_PAGE_NUM, 64UL)];
+static uint16_t ppt_page_owner[PPT_PAGE_NUM];
+
+static struct page_pool ppt_page_pool = {
+	.start_page = ppt_pages,
+	.lock = { .head = 0U, .tail = 0U },
+	.page_num = PPT_PAGE_NUM,
+	.bitmap = ppt_page_bitmap,
+	.owner = ppt_page_owner,
+};
+
+static struct pgtable_quota ppt_quota = {
+	.pool = &ppt_page_pool,
+	.lock = { .head = 0U, .tail = 0U },
+	.id = ACRN_INVALID_VMID,
+	.limit = PPT_PAGE_NUM,
+};
 
 /* ppt: pripary page table */
 static union pgtable_pages_info ppt_pages_info = {
 	.ppt = {
-		.pml4_base = ppt_pml4_pages,
-		.pdpt_base = ppt_pdpt_pages,
-		.pd_base = ppt_pd_pages,
+		.quota = &ppt_quota,
 	}
 };
 
-static inline uint64_t ppt_get_default_access_right(void)
+struct free_page_node {
+	struct page *next;
+};
+
+static struct page *pool_alloc_page(struct page_pool *pool, uint16_t owner)
 {
-	return (PAGE_PRESENT | PAGE_RW | PAGE_USER);
+	struct page *page = NULL;
+	uint64_t bitmap_size = INT_DIV_ROUNDUP(pool->page_num, 64UL);
+	uint64_t loop_idx, idx, page_idx;
+	uint16_t bit;
+
+	spinlock_obtain(&pool->lock);
+	for (loop_idx = pool->last_hint_id; loop_idx < (pool->last_hint_id + bitmap_size); loop_idx++) {
+		idx = loop_idx % bitmap_size;
+		if (pool->bitmap[idx] != ~0UL) {
+			bit = ffz64(pool->bitmap[idx]);
+			page_idx = (idx << 6U) + bit;
+			if (page_idx < pool->page_num) {
+				bitmap_set_nolock(bit, &pool->bitmap[idx]);
+				pool->owner[page_idx] = owner;
+				pool->last_hint_id = idx;
+				pool->used++;
+				pool->high_watermark = max(pool->high_watermark, pool->used);
+				page = pool->start_page + page_idx;
+				break;
+			}
+		}
+	}
+	spinlock_release(&pool->lock);
+
+	return page;
 }
 
-static inline void ppt_clflush_pagewalk(const void* entry __attribute__((unused)))
+/*
+ * Return every page charged to the quota to its pool.
+ */
+static void quota_release_all(struct pgtable_quota *quota)
 {
+	struct page_pool *pool = quota->pool;
+	uint64_t i;
+
+	spinlock_obtain(&quota->lock);
+	if (quota->held != 0UL) {
+		spinlock_obtain(&pool->lock);
+		for (i = 0UL; i < pool->page_num; i++) {
+			if (bitmap_test((uint16_t)(i & 0x3FUL), &pool->bitmap[i >> 6U]) &&
+					(pool->owner[i] == quota->id)) {
+				bitmap_clear_nolock((uint16_t)(i & 0x3FUL), &pool->bitmap[i >> 6U]);
+				pool->used--;
+			}
+		}
+		spinlock_release(&pool->lock);
+	}
+	quota->free_list = NULL;
+	quota->stale_list = NULL;
+	quota->stale_gen = 0UL;
+	quota->flush_gen = 0UL;
+	quota->held = 0UL;
+	quota->used = 0UL;
+	spinlock_release(&quota->lock);
 }
 
-static inline uint64_t ppt_pgentry_present(uint64_t pte)
+static struct page *quota_alloc_page(struct pgtable_quota *quota)
 {
-	return pte & PAGE_PRESENT;
+	struct page *page;
+
+	spinlock_obtain(&quota->lock);
+	page = quota->free_list;
+	if (page != NULL) {
+		quota->free_list = ((struct free_page_node *)page)->next;
+	} else if (quota->held < quota->limit) {
+		page = pool_alloc_page(quota->pool, quota->id);
+		if (page != NULL) {
+			quota->held++;
+		}
+	} else {
+		/* quota exhausted */
+	}
+
+	if (page != NULL) {
+		quota->used++;
+		quota->high_watermark = max(quota->high_watermark, quota->used);
+	}
+	spinlock_release(&quota->lock);
+
+	if (page == NULL) {
+		/* a partially built mapping can't be backed out, the pool is sized so this can't happen */
+		panic("no page table page left for VM%hu, %lu of %lu pages held", quota->id, quota->held, quota->limit);
+	}
+
+	(void)memset(page, 0U, PAGE_SIZE);
+	return page;
 }
 
-static inline struct page *ppt_get_pml4_page(const union pgtable_pages_info *info)
+/*
+ * The page is already unlinked from the page table, so the next flush covers it.
+ */
+static void quota_free_page(struct pgtable_quota *quota, struct page *page)
 {
-	struct page *pml4_page = info->ppt.pml4_base;
-	(void)memset(pml4_page, 0U, PAGE_SIZE);
-	return pml4_page;
+	spinlock_obtain(&quota->lock);
+	((struct free_page_node *)page)->next = quota->stale_list;
+	quota->stale_list = page;
+	quota->stale_gen = quota->flush_gen + 1UL;
+	quota->used--;
+	spinlock_release(&quota->lock);
 }
 
-static inline struct page *ppt_get_pdpt_page(const union pgtable_pages_info *info, uint64_t gpa)
+static inline uint64_t ppt_get_default_access_right(void)
 {
-	struct page *pdpt_page = info->ppt.pdpt_base + (gpa >> PML4E_SHIFT);
-	(void)memset(pdpt_page, 0U, PAGE_SIZE);
-	return pdpt_page;
+	return (PAGE_PRESENT | PAGE_RW | PAGE_USER);
 }
 
-static inline struct page *ppt_get_pd_page(const union pgtable_pages_info *info, uint64_t gpa)
+static inline void ppt_clflush_pagewalk(const void* entry __attribute__((unused)))
 {
-	struct page *pd_page = info->ppt.pd_base + (gpa >> PDPTE_SHIFT);
-	(void)memset(pd_page, 0U, PAGE_SIZE);
-	return pd_page;
+}
+
+static inline uint64_t ppt_pgentry_present(uint64_t pte)
+{
+	return pte & PAGE_PRESENT;
+}
+
+static struct page *ppt_alloc_page(const union pgtable_pages_info *info)
+{
+	return quota_alloc_page(info->ppt.quota);
 }
 
 static inline void nop_tweak_exe_right(uint64_t *entry __attribute__((unused))) {}
@@ -69,33 +180,52 @@ const struct memory_ops ppt_mem_ops = {
 	.large_page_enabled = true,
 	.get_default_access_right = ppt_get_default_access_right,
 	.pgentry_present = ppt_pgentry_present,
-	.get_pml4_page = ppt_get_pml4_page,
-	.get_pdpt_page = ppt_get_pdpt_page,
-	.get_pd_page = ppt_get_pd_page,
+	.alloc_page = ppt_alloc_page,
+	.free_page = NULL,
 	.clflush_pagewalk = ppt_clflush_pagewalk,
 	.tweak_exe_right = nop_tweak_exe_right,
 	.recover_exe_right = nop_recover_exe_right,
 };
 
-static struct page sos_vm_pml4_pages[SOS_VM_NUM][PML4_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-static struct page sos_vm_pdpt_pages[SOS_VM_NUM][PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-static struct page sos_vm_pd_pages[SOS_VM_NUM][PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-static struct page sos_vm_pt_pages[SOS_VM_NUM][PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
-
-/* pre_uos_nworld_pml4_pages */
-static struct page pre_uos_nworld_pml4_pages[PRE_VM_NUM][PML4_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page pre_uos_nworld_pdpt_pages[PRE_VM_NUM][PDPT_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page pre_uos_nworld_pd_pages[PRE_VM_NUM][PD_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page pre_uos_nworld_pt_pages[PRE_VM_NUM][PT_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-
-/* post_uos_nworld_pml4_pages */
-static struct page post_uos_nworld_pml4_pages[MAX_POST_VM_NUM][PML4_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page post_uos_nworld_pdpt_pages[MAX_POST_VM_NUM][PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page post_uos_nworld_pd_pages[MAX_POST_VM_NUM][PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page post_uos_nworld_pt_pages[MAX_POST_VM_NUM][PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-
-static struct page post_uos_sworld_pgtable_pages[MAX_POST_VM_NUM][TRUSTY_PGTABLE_PAGE_NUM(TRUSTY_RAM_SIZE)];
-/* pre-assumption: TRUSTY_RAM_SIZE is 2M aligned */
+/* worst case: the whole EPT address space of a VM mapped with 4K pages */
+#define SOS_VM_EPT_PAGE_NUM	PGTABLE_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))
+#define PRE_VM_EPT_PAGE_NUM	PGTABLE_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))
+#define POST_VM_EPT_PAGE_NUM	(PGTABLE_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE)) +	\
+				TRUSTY_PGTABLE_PAGE_NUM(TRUSTY_RAM_SIZE))
+
+#define EPT_QUOTA_PAGE_NUM	((SOS_VM_NUM * SOS_VM_EPT_PAGE_NUM) + (PRE_VM_NUM * PRE_VM_EPT_PAGE_NUM) +	\
+				(MAX_POST_VM_NUM * POST_VM_EPT_PAGE_NUM))
+
+/*
+ * The PT pages dominate the worst case of each VM, but the RAM of all pre- and
+ * post-launched VMs is carved out of the platform RAM and only passthrough
+ * MMIO is mapped for them. So besides the upper levels of every VM, the pool
+ * only needs the PT pages of the SOS plus one 4K mapping of the platform
+ * address space shared by all the other VMs.
+ */
+#define EPT_SHARED_PAGE_NUM	((SOS_VM_NUM * (UPPER_PGTABLE_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE)) +	\
+					PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE)))) +			\
+				(PRE_VM_NUM * UPPER_PGTABLE_PAGE_NUM(PRE_VM_EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))) +	\
+				(MAX_POST_VM_NUM * (UPPER_PGTABLE_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE)) +	\
+					TRUSTY_PGTABLE_PAGE_NUM(TRUSTY_RAM_SIZE))) +				\
+				PT_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE + PLATFORM_HI_MMIO_SIZE))
+
+#define EPT_PAGE_POOL_NUM	((EPT_SHARED_PAGE_NUM < EPT_QUOTA_PAGE_NUM) ? EPT_SHARED_PAGE_NUM : EPT_QUOTA_PAGE_NUM)
+
+static struct page ept_pages[EPT_PAGE_POOL_NUM];
+static uint64_t ept_page_bitmap[INT_DIV_ROUNDUP(EPT_PAGE_POOL_NUM, 64UL)];
+static uint16_t ept_page_owner[EPT_PAGE_POOL_NUM];
+
+static struct page_pool ept_page_pool = {
+	.start_page = ept_pages,
+	.lock = { .head = 0U, .tail = 0U },
+	.page_num = EPT_PAGE_POOL_NUM,
+	.bitmap = ept_page_bitmap,
+	.owner = ept_page_owner,
+};
+
+static struct pgtable_quota ept_quota[CONFIG_MAX_VM_NUM];
+
 static struct page post_uos_sworld_memory[MAX_POST_VM_NUM][TRUSTY_RAM_SIZE >> PAGE_SHIFT] __aligned(MEM_2M);
 
 /* ept: extended page table*/
@@ -121,45 +251,14 @@ static inline void ept_clflush_pagewalk(const void* etry)
 	iommu_flush_cache(etry, sizeof(uint64_t));
 }
 
-static inline struct page *ept_get_pml4_page(const union pgtable_pages_info *info)
+static struct page *ept_alloc_page(const union pgtable_pages_info *info)
 {
-	struct page *pml4_page = info->ept.nworld_pml4_base;
-	(void)memset(pml4_page, 0U, PAGE_SIZE);
-	return pml4_page;
+	return quota_alloc_page(info->ept.quota);
 }
 
-static inline struct page *ept_get_pdpt_page(const union pgtable_pages_info *info, uint64_t gpa)
+static void ept_free_page(const union pgtable_pages_info *info, struct page *page)
 {
-	struct page *pdpt_page = info->ept.nworld_pdpt_base + (gpa >> PML4E_SHIFT);
-	(void)memset(pdpt_page, 0U, PAGE_SIZE);
-	return pdpt_page;
-}
-
-static inline struct page *ept_get_pd_page(const union pgtable_pages_info *info, uint64_t gpa)
-{
-	struct page *pd_page;
-	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pd_page = info->ept.nworld_pd_base + (gpa >> PDPTE_SHIFT);
-	} else {
-		pd_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
-			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + ((gpa - TRUSTY_EPT_REBASE_GPA) >> PDPTE_SHIFT);
-	}
-	(void)memset(pd_page, 0U, PAGE_SIZE);
-	return pd_page;
-}
-
-static inline struct page *ept_get_pt_page(const union pgtable_pages_info *info, uint64_t gpa)
-{
-	struct page *pt_page;
-	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pt_page = info->ept.nworld_pt_base + (gpa >> PDE_SHIFT);
-	} else {
-		pt_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
-			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + TRUSTY_PD_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
-			((gpa - TRUSTY_EPT_REBASE_GPA) >> PDE_SHIFT);
-	}
-	(void)memset(pt_page, 0U, PAGE_SIZE);
-	return pt_page;
+	quota_free_page(info->ept.quota, page);
 }
 
 static inline void *ept_get_sworld_memory_base(const union pgtable_pages_info *info)
@@ -184,39 +283,35 @@ static inline void ept_recover_exe_right(uint64_t *entry)
 void init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id)
 {
 	struct acrn_vm *vm = get_vm_from_vmid(vm_id);
+	struct pgtable_quota *quota = &ept_quota[vm_id];
+
+	quota->pool = &ept_page_pool;
+	quota->id = vm_id;
+	/* pages left behind by a previous instance of this VM */
+	quota_release_all(quota);
+	quota->high_watermark = 0UL;
+	ept_pages_info[vm_id].ept.quota = quota;
 
 	if (is_sos_vm(vm)) {
 		ept_pages_info[vm_id].ept.top_address_space = EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE);
-		ept_pages_info[vm_id].ept.nworld_pml4_base = sos_vm_pml4_pages[0U];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = sos_vm_pdpt_pages[0U];
-		ept_pages_info[vm_id].ept.nworld_pd_base = sos_vm_pd_pages[0U];
-		ept_pages_info[vm_id].ept.nworld_pt_base = sos_vm_pt_pages[0U];
+		quota->limit = SOS_VM_EPT_PAGE_NUM;
 	} else if (is_prelaunched_vm(vm)) {
 		ept_pages_info[vm_id].ept.top_address_space = EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE);
-		ept_pages_info[vm_id].ept.nworld_pml4_base = pre_uos_nworld_pml4_pages[vm_id];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = pre_uos_nworld_pdpt_pages[vm_id];
-		ept_pages_info[vm_id].ept.nworld_pd_base = pre_uos_nworld_pd_pages[vm_id];
-		ept_pages_info[vm_id].ept.nworld_pt_base = pre_uos_nworld_pt_pages[vm_id];
+		quota->limit = PRE_VM_EPT_PAGE_NUM;
 	} else {
 		uint16_t sos_vm_id = (get_sos_vm())->vm_id;
 		uint16_t page_idx = vmid_2_rel_vmid(sos_vm_id, vm_id) - 1U;
 
 		ept_pages_info[vm_id].ept.top_address_space = EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE);
-		ept_pages_info[vm_id].ept.nworld_pml4_base = post_uos_nworld_pml4_pages[page_idx];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = post_uos_nworld_pdpt_pages[page_idx];
-		ept_pages_info[vm_id].ept.nworld_pd_base = post_uos_nworld_pd_pages[page_idx];
-		ept_pages_info[vm_id].ept.nworld_pt_base = post_uos_nworld_pt_pages[page_idx];
-		ept_pages_info[vm_id].ept.sworld_pgtable_base = post_uos_sworld_pgtable_pages[page_idx];
 		ept_pages_info[vm_id].ept.sworld_memory_base = post_uos_sworld_memory[page_idx];
+		quota->limit = POST_VM_EPT_PAGE_NUM;
 		mem_ops->get_sworld_memory_base = ept_get_sworld_memory_base;
 	}
 	mem_ops->info = &ept_pages_info[vm_id];
 	mem_ops->get_default_access_right = ept_get_default_access_right;
 	mem_ops->pgentry_present = ept_pgentry_present;
-	mem_ops->get_pml4_page = ept_get_pml4_page;
-	mem_ops->get_pdpt_page = ept_get_pdpt_page;
-	mem_ops->get_pd_page = ept_get_pd_page;
-	mem_ops->get_pt_page = ept_get_pt_page;
+	mem_ops->alloc_page = ept_alloc_page;
+	mem_ops->free_page = ept_free_page;
 	mem_ops->clflush_pagewalk = ept_clflush_pagewalk;
 	mem_ops->large_page_enabled = true;
 
@@ -233,3 +328,95 @@ void init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id)
 		mem_ops->recover_exe_right = nop_recover_exe_right;
 	}
 }
+
+/**
+ * @brief Return all page-table pages of a VM's EPT to the shared pool.
+ *
+ * @pre the EPT is no longer referenced by any vCPU or IOMMU domain
+ */
+void release_ept_pages(const struct memory_ops *mem_ops)
+{
+	quota_release_all(mem_ops->info->ept.quota);
+}
+
+/**
+ * @brief Number of the last EPT flush requested for the page table.
+ */
+uint64_t ept_flush_gen(const struct memory_ops *mem_ops)
+{
+	return mem_ops->info->ept.quota->flush_gen;
+}
+
+/**
+ * @brief Number the EPT flush about to be requested for the page table.
+ *
+ * The flush covers every page freed before, it must be requested after.
+ */
+uint64_t ept_next_flush_gen(const struct memory_ops *mem_ops)
+{
+	struct pgtable_quota *quota = mem_ops->info->ept.quota;
+	uint64_t gen;
+
+	spinlock_obtain(&quota->lock);
+	quota->flush_gen++;
+	gen = quota->flush_gen;
+	spinlock_release(&quota->lock);
+
+	return gen;
+}
+
+/**
+ * @brief Check whether freed pages wait for EPT flushes up to flushed_gen only.
+ */
+bool ept_has_stale_pages(const struct memory_ops *mem_ops, uint64_t flushed_gen)
+{
+	const struct pgtable_quota *quota = mem_ops->info->ept.quota;
+
+	return (quota->stale_list != NULL) && (quota->stale_gen <= flushed_gen);
+}
+
+/**
+ * @brief Make the freed pages available again.
+ *
+ * @pre every vCPU has done the EPT flush flushed_gen and the IOMMU has been
+ *	flushed since
+ */
+void reclaim_ept_pages(const struct memory_ops *mem_ops, uint64_t flushed_gen)
+{
+	struct pgtable_quota *quota = mem_ops->info->ept.quota;
+	struct page *page;
+
+	spinlock_obtain(&quota->lock);
+	/* pages freed meanwhile have a later stale_gen and hold back the others */
+	if (quota->stale_gen <= flushed_gen) {
+		while (quota->stale_list != NULL) {
+			page = quota->stale_list;
+			quota->stale_list = ((struct free_page_node *)page)->next;
+			((struct free_page_node *)page)->next = quota->free_list;
+			quota->free_list = page;
+		}
+	}
+	spinlock_release(&quota->lock);
+}
+
+void get_ept_page_pool_stats(struct page_stats *stats)
+{
+	spinlock_obtain(&ept_page_pool.lock);
+	stats->total = ept_page_pool.page_num;
+	stats->held = ept_page_pool.used;
+	stats->used = ept_page_pool.used;
+	stats->high_watermark = ept_page_pool.high_watermark;
+	spinlock_release(&ept_page_pool.lock);
+}
+
+void get_ept_page_stats(uint16_t vm_id, struct page_stats *stats)
+{
+	struct pgtable_quota *quota = &ept_quota[vm_id];
+
+	spinlock_obtain(&quota->lock);
+	stats->total = quota->limit;
+	stats->held = quota->held;
+	stats->used = quota->used;
+	stats->high_watermark = quota->high_watermark;
+	spinlock_release(&quota->lock);
+}
@@ -19,7 +19,7 @@
  * @pre: level could only IA32E_PDPT or IA32E_PD
  */
 static void split_large_page(uint64_t *pte, enum _page_table_level level,
-		uint64_t vaddr, const struct memory_ops *mem_ops)
+		const struct memory_ops *mem_ops)
 {
 	uint64_t *pbase;
 	uint64_t ref_paddr, paddr, paddrinc;
@@ -30,7 +30,7 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 		ref_paddr = (*pte) & PDPTE_PFN_MASK;
 		paddrinc = PDE_SIZE;
 		ref_prot = (*pte) & ~PDPTE_PFN_MASK;
-		pbase = (uint64_t *)mem_ops->get_pd_page(mem_ops->info, vaddr);
+		pbase = (uint64_t *)mem_ops->alloc_page(mem_ops->info);
 		break;
 	default:	/* IA32E_PD */
 		ref_paddr = (*pte) & PDE_PFN_MASK;
@@ -38,7 +38,7 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 		ref_prot = (*pte) & ~PDE_PFN_MASK;
 		ref_prot &= ~PAGE_PSE;
 		mem_ops->recover_exe_right(&ref_prot);
-		pbase = (uint64_t *)mem_ops->get_pt_page(mem_ops->info, vaddr);
+		pbase = (uint64_t *)mem_ops->alloc_page(mem_ops->info);
 		break;
 	}
 
@@ -79,6 +79,30 @@ static inline void construct_pgentry(uint64_t *pde, void *pd_page, uint64_t prot
 	set_pgentry(pde, hva2hpa(pd_page) | prot, mem_ops);
 }
 
+/*
+ * Give the PT page referenced by the pde back to mem_ops once none of its
+ * entries is present any more.
+ *
+ * Only PT pages are reclaimed: the secure world of a trusty VM copies the
+ * PDPTEs of the normal world, so the PD pages may be referenced twice.
+ */
+static void try_to_free_pt(uint64_t *pde, const struct memory_ops *mem_ops)
+{
+	uint64_t *pt_page = pde_page_vaddr(*pde);
+	uint64_t index;
+
+	for (index = 0UL; index < PTRS_PER_PTE; index++) {
+		if (mem_ops->pgentry_present(pt_page[index]) != 0UL) {
+			break;
+		}
+	}
+
+	if (index == PTRS_PER_PTE) {
+		sanitize_pte_entry(pde, mem_ops);
+		mem_ops->free_page(mem_ops->info, (struct page *)pt_page);
+	}
+}
+
 /*
  * In PT level,
  * type: MR_MODIFY
@@ -142,7 +166,7 @@ static void modify_or_del_pde(const uint64_t *pdpte, uint64_t vaddr_start, uint6
 		} else {
 			if (pde_large(*pde) != 0UL) {
 				if ((vaddr_next > vaddr_end) || (!mem_aligned_check(vaddr, PDE_SIZE))) {
-					split_large_page(pde, IA32E_PD, vaddr, mem_ops);
+					split_large_page(pde, IA32E_PD, mem_ops);
 				} else {
 					local_modify_or_del_pte(pde, prot_set, prot_clr, type, mem_ops);
 					if (vaddr_next < vaddr_end) {
@@ -153,6 +177,9 @@ static void modify_or_del_pde(const uint64_t *pdpte, uint64_t vaddr_start, uint6
 				}
 			}
 			modify_or_del_pte(pde, vaddr, vaddr_end, prot_set, prot_clr, mem_ops, type);
+			if ((type == MR_DEL) && (mem_ops->free_page != NULL)) {
+				try_to_free_pt(pde, mem_ops);
+			}
 		}
 		if (vaddr_next >= vaddr_end) {
 			break;	/* done */
@@ -188,7 +215,7 @@ static void modify_or_del_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, uin
 			if (pdpte_large(*pdpte) != 0UL) {
 				if ((vaddr_next > vaddr_end) ||
 						(!mem_aligned_check(vaddr, PDPTE_SIZE))) {
-					split_large_page(pdpte, IA32E_PDPT, vaddr, mem_ops);
+					split_large_page(pdpte, IA32E_PDPT, mem_ops);
 				} else {
 					local_modify_or_del_pte(pdpte, prot_set, prot_clr, type, mem_ops);
 					if (vaddr_next < vaddr_end) {
@@ -309,7 +336,7 @@ static void add_pde(const uint64_t *pdpte, uint64_t paddr_start, uint64_t vaddr_
 					}
 					break;	/* done */
 				} else {
-					void *pt_page = mem_ops->get_pt_page(mem_ops->info, vaddr);
+					void *pt_page = mem_ops->alloc_page(mem_ops->info);
 					construct_pgentry(pde, pt_page, mem_ops->get_default_access_right(), mem_ops);
 				}
 			}
@@ -357,7 +384,7 @@ static void add_pdpte(const uint64_t *pml4e, uint64_t paddr_start, uint64_t vadd
 					}
 					break;	/* done */
 				} else {
-					void *pd_page = mem_ops->get_pd_page(mem_ops->info, vaddr);
+					void *pd_page = mem_ops->alloc_page(mem_ops->info);
 					construct_pgentry(pdpte, pd_page, mem_ops->get_default_access_right(), mem_ops);
 				}
 			}
@@ -394,7 +421,7 @@ void mmu_add(uint64_t *pml4_page, uint64_t paddr_base, uint64_t vaddr_base, uint
 		vaddr_next = (vaddr & PML4E_MASK) + PML4E_SIZE;
 		pml4e = pml4e_offset(pml4_page, vaddr);
 		if (mem_ops->pgentry_present(*pml4e) == 0UL) {
-			void *pdpt_page = mem_ops->get_pdpt_page(mem_ops->info, vaddr);
+			void *pdpt_page = mem_ops->alloc_page(mem_ops->info);
 			construct_pgentry(pml4e, pdpt_page, mem_ops->get_default_access_right(), mem_ops);
 		}
 		add_pdpte(pml4e, paddr, vaddr, vaddr_end, prot, mem_ops);
@@ -17,9 +17,14 @@
 #include <ioapic.h>
 #include <vtd.h>
 #include <lapic.h>
+#include <vrtc.h>
+#include <init.h>
 
 struct cpu_context cpu_ctx;
 
+static struct host_s3_stats host_s3_stats;
+static uint64_t s3_stage_start;
+
 /* The values in this structure should come from host ACPI table */
 static struct pm_s_state_data host_pm_s_state = {
 	.pm1a_evt = {
@@ -161,6 +166,24 @@ void shutdown_system(void)
 	do_acpi_sx(sx_data, system_pm1a_cnt_val, system_pm1b_cnt_val);
 }
 
+const struct host_s3_stats *get_host_s3_stats(void)
+{
+	return &host_s3_stats;
+}
+
+static void s3_stage_begin(void)
+{
+	s3_stage_start = rdtsc();
+}
+
+static void s3_stage_end(enum host_s3_stage stage)
+{
+	uint64_t now = rdtsc();
+
+	host_s3_stats.stage_ticks[stage] = now - s3_stage_start;
+	s3_stage_start = now;
+}
+
 static void suspend_tsc(__unused void *data)
 {
 	per_cpu(tsc_suspend, get_pcpu_id()) = rdtsc();
@@ -175,6 +198,8 @@ void host_enter_s3(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_
 {
 	uint64_t pmain_entry_saved;
 
+	s3_stage_begin();
+
 	stac();
 
 	/* set ACRN wakeup vec instead */
@@ -207,18 +232,27 @@ void host_enter_s3(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_
 	suspend_iommu();
 	suspend_lapic();
 
+	s3_stage_end(HOST_S3_STAGE_SUSPEND);
+
 	asm_enter_s3(sstate_data, pm1a_cnt_val, pm1b_cnt_val);
 
+	/* TSC was reset by the firmware, time the resume stages from here */
+	s3_stage_begin();
+
 	resume_lapic();
+	s3_stage_end(HOST_S3_STAGE_LAPIC);
 	resume_iommu();
+	s3_stage_end(HOST_S3_STAGE_IOMMU);
 	resume_ioapic();
+	s3_stage_end(HOST_S3_STAGE_IOAPIC);
 
 	vmx_on();
 	CPU_IRQ_ENABLE();
+	s3_stage_end(HOST_S3_STAGE_VMX);
 
-	/* restore the default main entry */
+	/* APs only need the per-CPU part of the boot flow */
 	stac();
-	write_trampoline_sym(main_entry, pmain_entry_saved);
+	write_trampoline_sym(main_entry, (uint64_t)resume_secondary_pcpu);
 	clac();
 
 	/* online all APs again */
@@ -226,13 +260,26 @@ void host_enter_s3(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_
 		panic("Failed to start all APs!");
 	}
 
+	/* restore the default main entry */
+	stac();
+	write_trampoline_sym(main_entry, pmain_entry_saved);
+	clac();
+	s3_stage_end(HOST_S3_STAGE_APS);
+
 	/* Restore TSC on all PCPU
 	 * Caution: There should no timer setup before TSC resumed.
 	 */
 	smp_call_function(get_active_pcpu_bitmap(), resume_tsc, NULL);
+	s3_stage_begin();
 
 	/* console must be resumed after TSC restored since it will setup timer base on TSC */
 	resume_console();
+
+	/* the restored TSC stood still during S3, take a new wall clock snapshot */
+	vrtc_sync_host_time();
+	s3_stage_end(HOST_S3_STAGE_CONSOLE);
+
+	host_s3_stats.count++;
 }
 
 void reset_host(void)
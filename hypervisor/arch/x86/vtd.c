@@ -583,19 +583,25 @@ static struct dmar_drhd_rt *device_to_dmaru(uint8_t bus, uint8_t devfun)
 	return dmaru;
 }
 
-static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+/*
+ * Queue num invalidation descriptors followed by a single wait descriptor,
+ * then wait for the hardware to process all of them.
+ */
+static void dmar_issue_qi_requests(struct dmar_drhd_rt *dmar_unit, const struct dmar_entry *invalidate_desc,
+		uint32_t num)
 {
 	struct dmar_entry *invalidate_desc_ptr;
 	__unused uint64_t start;
+	uint32_t i;
 
-	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
-
-	invalidate_desc_ptr->hi_64 = invalidate_desc.hi_64;
-	invalidate_desc_ptr->lo_64 = invalidate_desc.lo_64;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
-
-	invalidate_desc_ptr++;
+	for (i = 0U; i < num; i++) {
+		invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+		invalidate_desc_ptr->hi_64 = invalidate_desc[i].hi_64;
+		invalidate_desc_ptr->lo_64 = invalidate_desc[i].lo_64;
+		dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+	}
 
+	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
 	invalidate_desc_ptr->hi_64 = hva2hpa(&qi_status);
 	invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
 	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
@@ -615,6 +621,11 @@ static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_en
 	}
 }
 
+static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+{
+	dmar_issue_qi_requests(dmar_unit, &invalidate_desc, 1U);
+}
+
 /*
  * did: domain id
  * sid: source id
@@ -653,11 +664,6 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 	}
 }
 
-static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
-}
-
 static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t address, uint8_t am,
 			       bool hint, enum dmar_iirg_type iirg)
 {
@@ -700,16 +706,6 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 	}
 }
 
-/* Invalidate IOTLB globally,
- * all iotlb entries are invalidated,
- * all PASID-cache entries are invalidated,
- * all paging-structure-cache entries are invalidated.
- */
-static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
-}
-
 static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 {
 	uint64_t address;
@@ -760,9 +756,23 @@ static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index
 	}
 }
 
-static void dmar_invalid_iec_global(struct dmar_drhd_rt *dmar_unit)
+/* Invalidate context-cache, IOTLB (including PASID and paging-structure
+ * caches) and interrupt entry cache globally, in one queue submission.
+ */
+static void dmar_invalid_all_global(struct dmar_drhd_rt *dmar_unit)
 {
-	dmar_invalid_iec(dmar_unit, 0U, 0U, true);
+	struct dmar_entry invalidate_desc[3];
+
+	invalidate_desc[0].hi_64 = 0UL;
+	invalidate_desc[0].lo_64 = DMAR_INV_CONTEXT_CACHE_DESC | DMA_CONTEXT_GLOBAL_INVL;
+	invalidate_desc[1].hi_64 = 0UL;
+	invalidate_desc[1].lo_64 = DMA_IOTLB_DR | DMA_IOTLB_DW | DMAR_INV_IOTLB_DESC | DMA_IOTLB_GLOBAL_INVL;
+	invalidate_desc[2].hi_64 = 0UL;
+	invalidate_desc[2].lo_64 = DMAR_INV_IEC_DESC | DMAR_IEC_GLOBAL_INVL;
+
+	spinlock_obtain(&(dmar_unit->lock));
+	dmar_issue_qi_requests(dmar_unit, invalidate_desc, 3U);
+	spinlock_release(&(dmar_unit->lock));
 }
 
 static void dmar_set_root_table(struct dmar_drhd_rt *dmar_unit)
@@ -965,6 +975,7 @@ static void dmar_enable_qi(struct dmar_drhd_rt *dmar_unit)
 	dmar_unit->qi_queue = hva2hpa(get_qi_queue(dmar_unit->index));
 	iommu_write64(dmar_unit, DMAR_IQA_REG, dmar_unit->qi_queue);
 
+	dmar_unit->qi_tail = 0U;
 	iommu_write32(dmar_unit, DMAR_IQT_REG, 0U);
 
 	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == 0U) {
@@ -1003,9 +1014,7 @@ static void dmar_prepare(struct dmar_drhd_rt *dmar_unit)
 static void dmar_enable(struct dmar_drhd_rt *dmar_unit)
 {
 	dev_dbg(DBG_LEVEL_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_all_global(dmar_unit);
 	dmar_enable_translation(dmar_unit);
 }
 
@@ -1021,9 +1030,7 @@ static void dmar_suspend(struct dmar_drhd_rt *dmar_unit)
 {
 	uint32_t i;
 
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
-	dmar_invalid_iec_global(dmar_unit);
+	dmar_invalid_all_global(dmar_unit);
 
 	dmar_disable(dmar_unit);
 
@@ -1037,11 +1044,18 @@ static void dmar_resume(struct dmar_drhd_rt *dmar_unit)
 {
 	uint32_t i;
 
-	/* restore IOMMU fault register state */
+	/*
+	 * The fault event MSI is restored from the saved registers and the
+	 * root, invalidation queue and interrupt remapping table addresses are
+	 * cached in dmar_unit, so only the table pointers are latched again.
+	 */
 	for (i = 0U; i < IOMMU_FAULT_REGISTER_STATE_NUM; i++) {
 		iommu_write32(dmar_unit, DMAR_FECTL_REG + (i * IOMMU_FAULT_REGISTER_SIZE), dmar_unit->fault_state[i]);
 	}
-	dmar_prepare(dmar_unit);
+	dmar_fault_event_unmask(dmar_unit);
+	dmar_set_root_table(dmar_unit);
+	dmar_enable_qi(dmar_unit);
+	dmar_set_intr_remap_table(dmar_unit);
 	dmar_enable(dmar_unit);
 	dmar_enable_intr_remapping(dmar_unit);
 }
@@ -1282,6 +1296,22 @@ struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_ta
 	return domain;
 }
 
+/**
+ * @pre domain != NULL
+ */
+void iommu_flush_domain(const struct iommu_domain *domain)
+{
+	struct dmar_drhd_rt *dmar_unit;
+	uint32_t i;
+
+	for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+		dmar_unit = &dmar_drhd_units[i];
+		if (!dmar_unit->drhd->ignore) {
+			dmar_invalid_iotlb(dmar_unit, vmid_to_domainid(domain->vm_id), 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+		}
+	}
+}
+
 /**
  * @pre domain != NULL
  */
@@ -610,6 +610,9 @@ static int32_t add_vm_memory_region(struct acrn_vm *vm, struct acrn_vm *target_v
 			/* create gpa to hpa EPT mapping */
 			ept_add_mr(target_vm, pml4_page, hpa,
 					region->gpa, region->size, prot);
+			if ((region->prot & MEM_TYPE_WB) != 0U) {
+				vrtc_add_memory_region(target_vm, region->gpa, region->size);
+			}
 			ret = 0;
 		}
 	}
@@ -776,6 +779,50 @@ int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_
 	return ret;
 }
 
+/**
+ * @brief control the dirty page logging of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_dirty_log dirty_log;
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &dirty_log, param, sizeof(dirty_log)) != 0) {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+		} else {
+			switch (dirty_log.cmd) {
+			case DIRTY_LOG_ENABLE:
+				ret = vm_enable_dirty_log(target_vm);
+				break;
+			case DIRTY_LOG_DISABLE:
+				ret = vm_disable_dirty_log(target_vm);
+				break;
+			case DIRTY_LOG_GET_AND_CLEAR:
+				ret = vm_get_dirty_log(target_vm, vm, dirty_log.gpa, dirty_log.size,
+						dirty_log.bitmap_gpa);
+				break;
+			default:
+				pr_err("%s: invalid command %u", __func__, dirty_log.cmd);
+				break;
+			}
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -21,6 +21,7 @@
 #include <version.h>
 #include <shell.h>
 #include <vmcs.h>
+#include <host_pm.h>
 
 #define TEMP_STR_SIZE		60U
 #define MAX_STR_SIZE		256U
@@ -44,6 +45,11 @@ static int32_t shell_dump_guest_mem(int32_t argc, char **argv);
 static int32_t shell_to_vm_console(int32_t argc, char **argv);
 static int32_t shell_show_cpu_int(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_msix_stats(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_pgtable_info(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_s3_latency(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_cache_flush_stats(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_ctx_switch_stats(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_vioapic_info(int32_t argc, char **argv);
 static int32_t shell_show_ioapic_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_loglevel(int32_t argc, char **argv);
@@ -113,6 +119,36 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_PTDEV_HELP,
 		.fcn		= shell_show_ptdev_info,
 	},
+	{
+		.str		= SHELL_CMD_MSIX,
+		.cmd_param	= SHELL_CMD_MSIX_PARAM,
+		.help_str	= SHELL_CMD_MSIX_HELP,
+		.fcn		= shell_show_msix_stats,
+	},
+	{
+		.str		= SHELL_CMD_PGTABLE,
+		.cmd_param	= SHELL_CMD_PGTABLE_PARAM,
+		.help_str	= SHELL_CMD_PGTABLE_HELP,
+		.fcn		= shell_show_pgtable_info,
+	},
+	{
+		.str		= SHELL_CMD_S3_LATENCY,
+		.cmd_param	= SHELL_CMD_S3_LATENCY_PARAM,
+		.help_str	= SHELL_CMD_S3_LATENCY_HELP,
+		.fcn		= shell_show_s3_latency,
+	},
+	{
+		.str		= SHELL_CMD_CACHE_FLUSH,
+		.cmd_param	= SHELL_CMD_CACHE_FLUSH_PARAM,
+		.help_str	= SHELL_CMD_CACHE_FLUSH_HELP,
+		.fcn		= shell_show_cache_flush_stats,
+	},
+	{
+		.str		= SHELL_CMD_CTX_SWITCH,
+		.cmd_param	= SHELL_CMD_CTX_SWITCH_PARAM,
+		.help_str	= SHELL_CMD_CTX_SWITCH_HELP,
+		.fcn		= shell_show_ctx_switch_stats,
+	},
 	{
 		.str		= SHELL_CMD_VIOAPIC,
 		.cmd_param	= SHELL_CMD_VIOAPIC_PARAM,
@@ -1165,6 +1201,156 @@ static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv
 	return 0;
 }
 
+static int32_t shell_show_msix_stats(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	const struct pci_vdev *vdev;
+	const struct msix_trap_stats *stats;
+	uint16_t vm_id;
+	uint32_t i;
+
+	shell_puts("\r\nVM ID    VBDF        READS       WRITES      FAST        DEFERRED    REMAPS      OTHER"
+		"\r\n=====    ========    ========    ========    ========    ========    ========    ========\r\n");
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			for (i = 0U; i < vm->vpci.pci_vdev_cnt; i++) {
+				vdev = &vm->vpci.pci_vdevs[i];
+				if ((vdev->pdev != NULL) && (vdev->msix.table_count != 0U)) {
+					stats = &vdev->msix.stats;
+					snprintf(temp_str, MAX_STR_SIZE,
+						"  %-3d    %02x:%02x.%x     %-8lu    %-8lu    %-8lu    %-8lu    %-8lu    %-8lu\r\n",
+						vm_id, vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f,
+						stats->table_reads, stats->table_writes, stats->fast_writes,
+						stats->deferred, stats->remaps, stats->other);
+					shell_puts(temp_str);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_pgtable_info(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct page_stats stats;
+	uint16_t vm_id;
+
+	get_ept_page_pool_stats(&stats);
+	snprintf(temp_str, MAX_STR_SIZE, "\r\nEPT page pool: %lu pages, %lu used, high watermark %lu\r\n",
+		stats.total, stats.used, stats.high_watermark);
+	shell_puts(temp_str);
+
+	shell_puts("\r\nVM ID    QUOTA       HELD        USED        HIGH WATERMARK"
+		"\r\n=====    ========    ========    ========    ==============\r\n");
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		if (!is_poweroff_vm(get_vm_from_vmid(vm_id))) {
+			get_ept_page_stats(vm_id, &stats);
+			snprintf(temp_str, MAX_STR_SIZE, "  %-3d    %-8lu    %-8lu    %-8lu    %-8lu\r\n",
+				vm_id, stats.total, stats.held, stats.used, stats.high_watermark);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_s3_latency(__unused int32_t argc, __unused char **argv)
+{
+	static const char *const stage_names[HOST_S3_STAGE_NUM] = {
+		[HOST_S3_STAGE_SUSPEND] = "suspend",
+		[HOST_S3_STAGE_LAPIC] = "lapic",
+		[HOST_S3_STAGE_IOMMU] = "iommu",
+		[HOST_S3_STAGE_IOAPIC] = "ioapic",
+		[HOST_S3_STAGE_VMX] = "vmx",
+		[HOST_S3_STAGE_APS] = "aps",
+		[HOST_S3_STAGE_CONSOLE] = "console",
+	};
+	char temp_str[MAX_STR_SIZE];
+	const struct host_s3_stats *stats = get_host_s3_stats();
+	uint64_t resume_us = 0UL, us;
+	uint32_t i;
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\nS3 cycles: %u\r\n", stats->count);
+	shell_puts(temp_str);
+
+	if (stats->count != 0U) {
+		shell_puts("\r\nSTAGE       TIME(us)"
+			"\r\n========    ========\r\n");
+		for (i = 0U; i < HOST_S3_STAGE_NUM; i++) {
+			us = ticks_to_us(stats->stage_ticks[i]);
+			if (i != HOST_S3_STAGE_SUSPEND) {
+				resume_us += us;
+			}
+			snprintf(temp_str, MAX_STR_SIZE, "%-8s    %-8lu\r\n", stage_names[i], us);
+			shell_puts(temp_str);
+		}
+		snprintf(temp_str, MAX_STR_SIZE, "\r\nresume total (excluding firmware): %lu us\r\n", resume_us);
+		shell_puts(temp_str);
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_cache_flush_stats(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	const struct guest_cache_flush_stats *stats;
+	uint16_t vm_id, i;
+
+	shell_puts("\r\nVM ID    VCPU ID    WBINVD      CR0.CD      ELIDED      LINES       HOST WBINVD    FLUSHED(KB)    MAX(KB)"
+		"\r\n=====    =======    ========    ========    ========    ========    ===========    ===========    ========\r\n");
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			foreach_vcpu(i, vm, vcpu) {
+				stats = &vcpu->arch.cache_flush_stats;
+				snprintf(temp_str, MAX_STR_SIZE,
+					"  %-3d    %-3d        %-8lu    %-8lu    %-8lu    %-8lu    %-11lu    %-11lu    %-8lu\r\n",
+					vm_id, vcpu->vcpu_id, stats->wbinvd, stats->cr0_cd, stats->elided,
+					stats->line_flushes, stats->host_wbinvd, stats->flushed_bytes >> 10U,
+					stats->max_bytes >> 10U);
+				shell_puts(temp_str);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_ctx_switch_stats(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	const struct vcpu_switch_stats *stats;
+	uint16_t vm_id, i;
+
+	shell_puts("\r\nVM ID    VCPU ID    PCPU ID    SWITCHES    XRSTORS SKIPPED    WRITES SKIPPED    CYCLES/SWITCH"
+		"\r\n=====    =======    =======    ========    ===============    ==============    =============\r\n");
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			foreach_vcpu(i, vm, vcpu) {
+				stats = &vcpu->switch_stats;
+				snprintf(temp_str, MAX_STR_SIZE,
+					"  %-3d    %-3d        %-3d        %-8lu    %-15lu    %-14lu    %-8lu\r\n",
+					vm_id, vcpu->vcpu_id, pcpuid_from_vcpu(vcpu), stats->switches,
+					stats->xrstors_skipped, stats->writes_skipped,
+					(stats->switches != 0UL) ? (stats->cycles / stats->switches) : 0UL);
+				shell_puts(temp_str);
+			}
+		}
+	}
+
+	return 0;
+}
+
 static void get_vioapic_info(char *str_arg, size_t str_max, uint16_t vmid)
 {
 	char *str = str_arg;
@@ -77,6 +77,26 @@ struct shell {
 #define SHELL_CMD_PTDEV_PARAM		NULL
 #define SHELL_CMD_PTDEV_HELP		"Show pass-through device information"
 
+#define SHELL_CMD_MSIX			"msix"
+#define SHELL_CMD_MSIX_PARAM		NULL
+#define SHELL_CMD_MSIX_HELP		"Show MSI-X table trap counters of pass-through devices"
+
+#define SHELL_CMD_PGTABLE		"pgtable"
+#define SHELL_CMD_PGTABLE_PARAM		NULL
+#define SHELL_CMD_PGTABLE_HELP		"Show EPT page-table page usage of the shared pool and of each VM"
+
+#define SHELL_CMD_S3_LATENCY		"s3lat"
+#define SHELL_CMD_S3_LATENCY_PARAM	NULL
+#define SHELL_CMD_S3_LATENCY_HELP	"Show the time spent in each stage of the last host S3 suspend and resume"
+
+#define SHELL_CMD_CACHE_FLUSH		"cacheflush"
+#define SHELL_CMD_CACHE_FLUSH_PARAM	NULL
+#define SHELL_CMD_CACHE_FLUSH_HELP	"Show the guest cache flushes (WBINVD, CR0.CD) of each vCPU and how they were done"
+
+#define SHELL_CMD_CTX_SWITCH		"ctxsw"
+#define SHELL_CMD_CTX_SWITCH_PARAM	NULL
+#define SHELL_CMD_CTX_SWITCH_HELP	"Show the context switches of each vCPU, the restores skipped and their average cost"
+
 #define SHELL_CMD_REBOOT		"reboot"
 #define SHELL_CMD_REBOOT_PARAM		NULL
 #define SHELL_CMD_REBOOT_HELP		"Trigger a system reboot (immediately)"
@@ -49,6 +49,7 @@ static void vdev_pt_unmap_msix(struct pci_vdev *vdev)
 		msix->table_entries[i].vector_control = PCIM_MSIX_VCTRL_MASK;
 		msix->table_entries[i].addr = 0U;
 		msix->table_entries[i].data = 0U;
+		msix->remapped[i] = false;
 	}
 
 	if (msix->mmio_gpa != 0UL) {
@@ -109,6 +110,55 @@ static void vdev_pt_unmap_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
 	}
 }
 
+/*
+ * Largest EPT page size a mapping of [gpa, gpa + size) to hpa can use: the
+ * GPA and HPA must have the same offset in the page and the range must hold
+ * at least one whole page.
+ */
+static uint64_t mr_max_page_size(uint64_t hpa, uint64_t gpa, uint64_t size, bool large_page)
+{
+	uint64_t page_size = PAGE_SIZE;
+	uint64_t end = gpa + size;
+
+	if (large_page) {
+		if ((((hpa ^ gpa) & (PDPTE_SIZE - 1UL)) == 0UL) &&
+				(((((gpa + PDPTE_SIZE) - 1UL) & PDPTE_MASK) + PDPTE_SIZE) <= end)) {
+			page_size = PDPTE_SIZE;
+		} else if ((((hpa ^ gpa) & (PDE_SIZE - 1UL)) == 0UL) && ((round_pde_up(gpa) + PDE_SIZE) <= end)) {
+			page_size = PDE_SIZE;
+		} else {
+			/* No action required, 4K pages only */
+		}
+	}
+
+	return page_size;
+}
+
+/*
+ * Report the EPT page size used by the mapping of a vbar, and complain when
+ * the GPA chosen by the guest or the DM is not congruent with the HPA for the
+ * large pages the BAR could use: the BAR then costs page table pages and TLB
+ * misses.
+ */
+static void vdev_pt_check_vbar_page_size(const struct pci_vdev *vdev, const struct pci_vbar *vbar)
+{
+	bool large_page = vdev->vpci->vm->arch_vm.ept_mem_ops.large_page_enabled;
+	uint64_t page_size, best;
+
+	page_size = mr_max_page_size(vbar->base_hpa, vbar->base_gpa, vbar->size, large_page);
+	best = mr_max_page_size(vbar->base_hpa, vbar->base_hpa, vbar->size, large_page);
+
+	if (page_size < best) {
+		pr_warn("vm%u %x:%x.%x: BAR gpa 0x%lx hpa 0x%lx size 0x%lx mapped with %luK pages instead of %luK",
+			vdev->vpci->vm->vm_id, vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f,
+			vbar->base_gpa, vbar->base_hpa, vbar->size, page_size >> 10U, best >> 10U);
+	} else {
+		pr_info("vm%u %x:%x.%x: BAR gpa 0x%lx hpa 0x%lx size 0x%lx mapped with %luK pages",
+			vdev->vpci->vm->vm_id, vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f,
+			vbar->base_gpa, vbar->base_hpa, vbar->size, page_size >> 10U);
+	}
+}
+
 /**
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
@@ -127,6 +177,7 @@ static void vdev_pt_map_mem_vbar(struct pci_vdev *vdev, uint32_t idx)
 			vbar->base_gpa, /* GPA (new vbar) */
 			vbar->size,
 			EPT_WR | EPT_RD | EPT_UNCACHED);
+		vdev_pt_check_vbar_page_size(vdev, vbar);
 	}
 
 	if (has_msix_cap(vdev) && (idx == vdev->msix.table_bar)) {
@@ -73,21 +73,24 @@ void pci_vdev_write_vcfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes,
 }
 
 /**
+ * Return the first vdev of vbdf in pci_vdevs order. A bucket is not kept in
+ * that order (a vdev moves to the tail of a bucket when its BDF changes), so
+ * the whole bucket is walked.
+ *
  * @pre vpci != NULL
  * @pre vpci->pci_vdev_cnt <= CONFIG_MAX_PCI_DEV_NUM
  */
 struct pci_vdev *pci_find_vdev(struct acrn_vpci *vpci, union pci_bdf vbdf)
 {
 	struct pci_vdev *vdev, *tmp;
-	uint32_t i;
+	struct list_head *pos;
 
 	vdev = NULL;
-	for (i = 0U; i < vpci->pci_vdev_cnt; i++) {
-		tmp = &(vpci->pci_vdevs[i]);
+	list_for_each(pos, &vpci->vdevs_hlist_heads[vdev_hash_idx(vbdf)]) {
+		tmp = list_entry(pos, struct pci_vdev, hlist);
 
-		if (bdf_is_equal(tmp->bdf, vbdf)) {
+		if (bdf_is_equal(tmp->bdf, vbdf) && ((vdev == NULL) || (tmp < vdev))) {
 			vdev = tmp;
-			break;
 		}
 	}
 
@@ -69,13 +69,25 @@ static void mask_one_msix_vector(const struct pci_vdev *vdev, uint32_t index)
 	clac();
 }
 
+/**
+ * @pre vdev != NULL
+ */
+static void unmask_one_msix_vector(const struct pci_vdev *vdev, uint32_t index)
+{
+	struct msix_table_entry *pentry = get_msix_table_entry(vdev, index);
+
+	stac();
+	mmio_write32(vdev->msix.table_entries[index].vector_control, (void *)&(pentry->vector_control));
+	clac();
+}
+
 /**
  * @pre vdev != NULL
  * @pre vdev->vpci != NULL
  * @pre vdev->vpci->vm != NULL
  * @pre vdev->pdev != NULL
  */
-static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
+static void remap_one_vmsix_entry(struct pci_vdev *vdev, uint32_t index)
 {
 	const struct msix_table_entry *ventry;
 	struct msix_table_entry *pentry;
@@ -105,11 +117,73 @@ static void remap_one_vmsix_entry(const struct pci_vdev *vdev, uint32_t index)
 			mmio_write32(info.pmsi_data.full, (void *)&(pentry->data));
 			mmio_write32(vdev->msix.table_entries[index].vector_control, (void *)&(pentry->vector_control));
 			clac();
+
+			vdev->msix.remapped[index] = true;
+			vdev->msix.remapped_addr[index] = info.pmsi_addr.full;
+			vdev->msix.remapped_data[index] = info.pmsi_data.full;
+			vdev->msix.stats.remaps++;
 		}
 	}
 
 }
 
+/*
+ * A reset of the device the hypervisor doesn't see (FLR, D3hot to D0, reset
+ * by the DM through the SOS) clears the physical table.
+ */
+static bool is_physical_entry_remapped(const struct pci_vdev *vdev, uint32_t index)
+{
+	const struct msix_table_entry *pentry = get_msix_table_entry(vdev, index);
+	uint64_t addr;
+	uint32_t data;
+
+	stac();
+	addr = (uint64_t)mmio_read32((const void *)&(pentry->addr));
+	addr |= (uint64_t)mmio_read32((const void *)((const char *)&(pentry->addr) + 4U)) << 32U;
+	data = mmio_read32((const void *)&(pentry->data));
+	clac();
+
+	return (addr == vdev->msix.remapped_addr[index]) && (data == vdev->msix.remapped_data[index]);
+}
+
+/**
+ * @brief Propagate a guest write of one MSI-X table entry
+ *
+ * Only an unmasked vector needs a valid IRTE. Writes to a masked vector just
+ * keep the physical vector masked; the remap is done on unmask and skipped
+ * when address and data are unchanged since the last one, and the physical
+ * entry still holds what the last remap wrote.
+ *
+ * @pre vdev != NULL
+ */
+static void write_vmsix_table_entry(struct pci_vdev *vdev, uint32_t index, uint64_t old_addr, uint32_t old_data)
+{
+	const struct msix_table_entry *ventry = &vdev->msix.table_entries[index];
+
+	if ((ventry->addr != old_addr) || (ventry->data != old_data)) {
+		vdev->msix.remapped[index] = false;
+	}
+
+	if (((ventry->vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) && vdev->msix.remapped[index] &&
+			!is_physical_entry_remapped(vdev, index)) {
+		vdev->msix.remapped[index] = false;
+	}
+
+	if ((ventry->vector_control & PCIM_MSIX_VCTRL_MASK) != 0U) {
+		mask_one_msix_vector(vdev, index);
+		if (vdev->msix.remapped[index]) {
+			vdev->msix.stats.fast_writes++;
+		} else {
+			vdev->msix.stats.deferred++;
+		}
+	} else if (vdev->msix.remapped[index]) {
+		unmask_one_msix_vector(vdev, index);
+		vdev->msix.stats.fast_writes++;
+	} else {
+		remap_one_vmsix_entry(vdev, index);
+	}
+}
+
 /**
  * @pre vdev != NULL
  */
@@ -135,6 +209,9 @@ void write_vmsix_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uin
 	msgctrl = pci_vdev_read_vcfg(vdev, vdev->msix.capoff + PCIR_MSIX_CTRL, 2U);
 
 	if (((old_msgctrl ^ msgctrl) & (PCIM_MSIXCTRL_MSIX_ENABLE | PCIM_MSIXCTRL_FUNCTION_MASK)) != 0U) {
+		/* the guest may be reinitializing the device, don't trust the physical table */
+		(void)memset((void *)vdev->msix.remapped, 0U, sizeof(vdev->msix.remapped));
+
 		/* If MSI Enable is being set, make sure INTxDIS bit is set */
 		if ((msgctrl & PCIM_MSIXCTRL_MSIX_ENABLE) != 0U) {
 			enable_disable_pci_intx(vdev->pdev->bdf, false);
@@ -151,6 +228,8 @@ static void rw_vmsix_table(struct pci_vdev *vdev, struct mmio_request *mmio, uin
 {
 	struct msix_table_entry *entry;
 	uint32_t entry_offset, table_offset, index;
+	uint64_t old_addr;
+	uint32_t old_data;
 
 	/* Find out which entry it's accessing */
 	table_offset = offset - vdev->msix.table_offset;
@@ -161,15 +240,19 @@ static void rw_vmsix_table(struct pci_vdev *vdev, struct mmio_request *mmio, uin
 		entry_offset = table_offset % MSIX_TABLE_ENTRY_SIZE;
 
 		if (mmio->direction == REQUEST_READ) {
+			vdev->msix.stats.table_reads++;
 			(void)memcpy_s(&mmio->value, (size_t)mmio->size,
 					(void *)entry + entry_offset, (size_t)mmio->size);
 		} else {
+			vdev->msix.stats.table_writes++;
 			/* Only DWORD and QWORD are permitted */
 			if ((mmio->size == 4U) || (mmio->size == 8U)) {
+				old_addr = entry->addr;
+				old_data = entry->data;
 				/* Write to pci_vdev */
 				(void)memcpy_s((void *)entry + entry_offset, (size_t)mmio->size,
 						&mmio->value, (size_t)mmio->size);
-				remap_one_vmsix_entry(vdev, index);
+				write_vmsix_table_entry(vdev, index, old_addr, old_data);
 			} else {
 				pr_err("%s, Only DWORD and QWORD are permitted", __func__);
 			}
@@ -201,6 +284,7 @@ int32_t vmsix_handle_table_mmio_access(struct io_request *io_req, void *handler_
 		if (msixtable_access(vdev, (uint32_t)offset)) {
 			rw_vmsix_table(vdev, mmio, (uint32_t)offset);
 		} else {
+			vdev->msix.stats.other++;
 			hva = hpa2hva(vdev->msix.mmio_hpa + offset);
 
 			/* Only DWORD and QWORD are permitted */
@@ -250,6 +334,8 @@ void init_vmsix(struct pci_vdev *vdev)
 	vdev->msix.table_bar = pdev->msix.table_bar;
 	vdev->msix.table_offset = pdev->msix.table_offset;
 	vdev->msix.table_count = pdev->msix.table_count;
+	(void)memset((void *)vdev->msix.remapped, 0U, sizeof(vdev->msix.remapped));
+	(void)memset((void *)&vdev->msix.stats, 0U, sizeof(vdev->msix.stats));
 
 	if (has_msix_cap(vdev)) {
 		(void)memcpy_s((void *)&vdev->cfgdata.data_8[pdev->msix.capoff], pdev->msix.caplen,
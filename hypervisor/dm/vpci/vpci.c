@@ -237,9 +237,13 @@ void vpci_init(struct acrn_vm *vm)
 
 	struct acrn_vm_config *vm_config;
 	uint64_t pci_mmcfg_base;
+	uint32_t i;
 
 	vm->vpci.vm = vm;
 	vm->iommu = create_iommu_domain(vm->vm_id, hva2hpa(vm->arch_vm.nworld_eptp), 48U);
+	for (i = 0U; i < VDEV_LIST_HASHSIZE; i++) {
+		INIT_LIST_HEAD(&vm->vpci.vdevs_hlist_heads[i]);
+	}
 	/* Build up vdev list for vm */
 	vpci_init_vdevs(vm);
 
@@ -597,6 +601,7 @@ struct pci_vdev *vpci_init_vdev(struct acrn_vpci *vpci, struct acrn_vm_pci_dev_c
 	vpci->pci_vdev_cnt++;
 	vdev->vpci = vpci;
 	vdev->bdf.value = dev_config->vbdf.value;
+	list_add_tail(&vdev->hlist, &vpci->vdevs_hlist_heads[vdev_hash_idx(vdev->bdf)]);
 	vdev->pdev = dev_config->pdev;
 	vdev->pci_dev_config = dev_config;
 	vdev->phyfun = parent_pf_vdev;
@@ -768,7 +773,9 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_assign_pcidev *pc
 				pci_vdev_write_vcfg(vdev, PCIR_ASLS_CTL, 4U, pcidev->rsvd2[1U]);
 			}
 
+			list_del(&vdev->hlist);
 			vdev->bdf.value = pcidev->virt_bdf;
+			list_add_tail(&vdev->hlist, &vpci->vdevs_hlist_heads[vdev_hash_idx(vdev->bdf)]);
 			spinlock_release(&tgt_vm->vpci.lock);
 			vdev_in_sos->new_owner = vdev;
 		}
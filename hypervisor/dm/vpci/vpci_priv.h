@@ -37,6 +37,15 @@ static inline bool in_range(uint32_t value, uint32_t lower, uint32_t len)
 	return ((value >= lower) && (value < (lower + len)));
 }
 
+/*
+ * Bucket of a vdev in vpci->vdevs_hlist_heads. The VFs of a PF have
+ * consecutive device/functions on the same bus, spread them first.
+ */
+static inline uint32_t vdev_hash_idx(union pci_bdf bdf)
+{
+	return (((uint32_t)bdf.fields.devfun ^ ((uint32_t)bdf.fields.bus << 3U)) & (VDEV_LIST_HASHSIZE - 1U));
+}
+
 /**
  * @pre vdev != NULL
  */
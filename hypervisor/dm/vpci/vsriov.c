@@ -79,9 +79,20 @@ static void init_sriov_vf_bar(struct pci_vdev *pf_vdev)
 }
 
 /**
+ * @brief Create the pdev/vdev of a VF
+ *
+ * @param pf_vdev     PF vdev
+ * @param vf_bdf      BDF of the VF
+ * @param vf_id       index of the VF
+ * @param sibling     pdev of another VF of this PF to copy the capabilities from,
+ *                    NULL to read them from configuration space
+ *
  * @pre pf_vdev != NULL
+ *
+ * @return the new VF vdev, NULL on failure
  */
-static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t vf_id)
+static struct pci_vdev *create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t vf_id,
+		const struct pci_pdev *sibling)
 {
 	struct pci_pdev *vf_pdev;
 	struct pci_vdev *vf_vdev = NULL;
@@ -90,7 +101,11 @@ static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t v
 	 * Per VT-d 8.3.3, the VFs are under the scope of the same
 	 * remapping unit as the associated PF when SRIOV is enabled.
 	 */
-	vf_pdev = init_pdev(vf_bdf.value, pf_vdev->pdev->drhd_index);
+	if (sibling != NULL) {
+		vf_pdev = init_vf_pdev(vf_bdf.value, sibling);
+	} else {
+		vf_pdev = init_pdev(vf_bdf.value, pf_vdev->pdev->drhd_index);
+	}
 	if (vf_pdev != NULL) {
 		struct acrn_vm_pci_dev_config *dev_cfg;
 
@@ -138,6 +153,8 @@ static void create_vf(struct pci_vdev *pf_vdev, union pci_bdf vf_bdf, uint16_t v
 			vdev_pt_map_msix(vf_vdev, false);
 		}
 	}
+
+	return vf_vdev;
 }
 
 /**
@@ -190,7 +207,12 @@ static void enable_vfs(struct pci_vdev *pf_vdev)
 	sub_vid = (uint16_t) pci_pdev_read_cfg(vf_bdf, PCIV_SUB_VENDOR_ID, 2U);
 	if ((sub_vid != 0xFFFFU) && (sub_vid != 0U)) {
 		struct pci_vdev *vf_vdev;
+		const struct pci_pdev *sibling = NULL;
 
+		/*
+		 * Only the first VF created has its capabilities enumerated in configuration
+		 * space, the other ones copy them from it.
+		 */
 		num_vfs = read_sriov_reg(pf_vdev, PCIR_SRIOV_NUMVFS);
 		for (idx = 0U; idx < num_vfs; idx++) {
 			vf_bdf.fields.bus = get_vf_bus(pf_vdev, fst_off, stride, idx);
@@ -204,7 +226,11 @@ static void enable_vfs(struct pci_vdev *pf_vdev)
 			 */
 			vf_vdev = pci_find_vdev(&pf_vdev->vpci->vm->vpci, vf_bdf);
 			if (vf_vdev == NULL) {
-				create_vf(pf_vdev, vf_bdf, idx);
+				vf_vdev = create_vf(pf_vdev, vf_bdf, idx, sibling);
+				if (vf_vdev == NULL) {
+					break;
+				}
+				sibling = vf_vdev->pdev;
 			} else {
 				/* Re-activate a zombie VF */
 				if (is_zombie_vf(vf_vdev)) {
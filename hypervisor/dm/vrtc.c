@@ -6,15 +6,85 @@
 
 #include <vm.h>
 #include <io.h>
+#include <mmu.h>
+#include <timer.h>
+#include <irq.h>
+#include <vrtc.h>
 
 #define CMOS_ADDR_PORT		0x70U
 #define CMOS_DATA_PORT		0x71U
 
+#define RTC_IRQ			8U
+
+#define RTC_SEC			0x00U	/* seconds */
+#define RTC_SEC_ALARM		0x01U	/* alarm seconds */
+#define RTC_MIN			0x02U	/* minutes */
+#define RTC_MIN_ALARM		0x03U	/* alarm minutes */
+#define RTC_HRS			0x04U	/* hours */
+#define RTC_HRS_ALARM		0x05U	/* alarm hours */
+#define RTC_WDAY		0x06U	/* week day */
+#define RTC_DAY			0x07U	/* day of month */
+#define RTC_MONTH		0x08U	/* month of year */
+#define RTC_YEAR		0x09U	/* year in century */
+#define RTC_CENTURY		0x32U	/* century */
+
 #define RTC_STATUSA		0x0AU   /* status register A */
 #define RTCSA_TUP		0x80U   /* time update, don't look now */
+#define RTCSA_DIVIDER		0x70U	/* divider control */
+#define RTCSA_DIV_NORMAL	0x20U	/* 32.768KHz time base, clock running */
+#define RTCSA_RATE		0x0FU	/* periodic interrupt rate select */
+
+#define RTC_STATUSB		0x0BU	/* status register B */
+#define RTCSB_HALT		0x80U	/* stop clock updates */
+#define RTCSB_PINTR		0x40U	/* periodic interrupt enable */
+#define RTCSB_AINTR		0x20U	/* alarm interrupt enable */
+#define RTCSB_UINTR		0x10U	/* update-ended interrupt enable */
+#define RTCSB_BIN		0x04U	/* binary, not BCD, mode */
+#define RTCSB_24HR		0x02U	/* 24 hour mode */
+
+#define RTC_INTR		0x0CU	/* status register C, read to clear */
+#define RTCIR_INT		0x80U	/* interrupt output signal */
+#define RTCIR_PERIOD		0x40U	/* periodic interrupt flag */
+#define RTCIR_ALARM		0x20U	/* alarm interrupt flag */
+#define RTCIR_UPDATE		0x10U	/* update-ended interrupt flag */
+#define RTCIR_MASK		(RTCIR_PERIOD | RTCIR_ALARM | RTCIR_UPDATE)
+
+#define RTC_STATUSD		0x0DU	/* status register D */
+#define RTCSD_PWR		0x80U	/* valid RAM and time */
+
+/* NVRAM memory size cells in 64KB units, as consumed by UEFI */
+#define RTC_LMEM_LSB		0x34U	/* RAM above 16MB, below 4GB */
+#define RTC_LMEM_MSB		0x35U
+#define RTC_HMEM_LSB		0x5BU	/* RAM above 4GB */
+#define RTC_HMEM_SB		0x5CU
+#define RTC_HMEM_MSB		0x5DU
+
+#define RTC_ALARM_DONT_CARE	0xC0U
+
+/* hv_timer refuses periods shorter than this, see MIN_TIMER_PERIOD_US */
+#define VRTC_MIN_PERIOD_US	500U
+
+struct rtc_time {
+	uint32_t year;
+	uint8_t mon;
+	uint8_t day;
+	uint8_t wday;
+	uint8_t hour;
+	uint8_t min;
+	uint8_t sec;
+};
 
 static spinlock_t cmos_lock = { .head = 0U, .tail = 0U };
 
+/*
+ * Host wall clock snapshot: the physical RTC is read once under cmos_lock and
+ * the elapsed time since then is derived from the TSC, so guest accesses never
+ * touch the legacy CMOS ports.
+ */
+static uint64_t host_base_sec;
+static uint64_t host_base_tsc;
+static bool host_time_valid = false;
+
 static uint8_t cmos_read(uint8_t addr)
 {
 	pio_write8(addr, CMOS_ADDR_PORT);
@@ -26,22 +96,462 @@ static bool cmos_update_in_progress(void)
 	return (cmos_read(RTC_STATUSA) & RTCSA_TUP)?1:0;
 }
 
-static uint8_t cmos_get_reg_val(uint8_t addr)
+static inline uint8_t bcd2bin(uint8_t val)
+{
+	return (((val >> 4U) * 10U) + (val & 0x0FU));
+}
+
+static inline uint8_t bin2bcd(uint8_t val)
+{
+	return (((val / 10U) << 4U) | (val % 10U));
+}
+
+static uint8_t rtc_reg_to_bin(uint8_t val, uint8_t reg_b)
+{
+	return ((reg_b & RTCSB_BIN) != 0U) ? val : bcd2bin(val);
+}
+
+static uint8_t rtc_bin_to_reg(uint8_t val, uint8_t reg_b)
+{
+	return ((reg_b & RTCSB_BIN) != 0U) ? val : bin2bcd(val);
+}
+
+static uint8_t rtc_reg_to_hour(uint8_t val, uint8_t reg_b)
+{
+	uint8_t hour;
+
+	if ((reg_b & RTCSB_24HR) != 0U) {
+		hour = rtc_reg_to_bin(val, reg_b);
+	} else {
+		/* 12 hour mode: 1-12 with bit 7 set for PM */
+		hour = rtc_reg_to_bin(val & 0x7FU, reg_b) % 12U;
+		if ((val & 0x80U) != 0U) {
+			hour += 12U;
+		}
+	}
+
+	return hour;
+}
+
+static uint8_t rtc_hour_to_reg(uint8_t hour, uint8_t reg_b)
+{
+	uint8_t val, hour12;
+
+	if ((reg_b & RTCSB_24HR) != 0U) {
+		val = rtc_bin_to_reg(hour, reg_b);
+	} else {
+		hour12 = hour % 12U;
+		val = rtc_bin_to_reg((hour12 == 0U) ? 12U : hour12, reg_b);
+		if (hour >= 12U) {
+			val |= 0x80U;
+		}
+	}
+
+	return val;
+}
+
+/*
+ * Convert a calendar date to seconds since 1970-01-01 00:00:00, counting
+ * from March so that the leap day is the last day of the year.
+ */
+static uint64_t rtc_time_to_secs(const struct rtc_time *tm)
+{
+	uint64_t year = max((uint64_t)tm->year, 1970UL);
+	uint64_t mon = ((tm->mon >= 1U) && (tm->mon <= 12U)) ? (uint64_t)tm->mon : 1UL;
+	uint64_t day = ((tm->day >= 1U) && (tm->day <= 31U)) ? (uint64_t)tm->day : 1UL;
+	uint64_t era, yoe, doy, doe, days;
+
+	if (mon <= 2UL) {
+		year -= 1UL;
+		mon += 9UL;
+	} else {
+		mon -= 3UL;
+	}
+
+	era = year / 400UL;
+	yoe = year - (era * 400UL);
+	doy = (((153UL * mon) + 2UL) / 5UL) + day - 1UL;
+	doe = (yoe * 365UL) + (yoe / 4UL) - (yoe / 100UL) + doy;
+	days = (era * 146097UL) + doe - 719468UL;
+
+	return (days * 86400UL) + ((uint64_t)tm->hour * 3600UL) + ((uint64_t)tm->min * 60UL) + (uint64_t)tm->sec;
+}
+
+static void secs_to_rtc_time(uint64_t secs, struct rtc_time *tm)
+{
+	uint64_t days = secs / 86400UL;
+	uint64_t rem = secs % 86400UL;
+	uint64_t z, era, doe, yoe, doy, mp, year;
+
+	tm->hour = (uint8_t)(rem / 3600UL);
+	tm->min = (uint8_t)((rem % 3600UL) / 60UL);
+	tm->sec = (uint8_t)(rem % 60UL);
+	/* 1970-01-01 was a Thursday, RTC counts Sunday as 1 */
+	tm->wday = (uint8_t)(((days + 4UL) % 7UL) + 1UL);
+
+	z = days + 719468UL;
+	era = z / 146097UL;
+	doe = z - (era * 146097UL);
+	yoe = (doe - (doe / 1460UL) + (doe / 36524UL) - (doe / 146096UL)) / 365UL;
+	doy = doe - ((365UL * yoe) + (yoe / 4UL) - (yoe / 100UL));
+	mp = ((5UL * doy) + 2UL) / 153UL;
+	year = yoe + (era * 400UL);
+
+	tm->day = (uint8_t)(doy - (((153UL * mp) + 2UL) / 5UL) + 1UL);
+	tm->mon = (uint8_t)((mp < 10UL) ? (mp + 3UL) : (mp - 9UL));
+	tm->year = (uint32_t)((tm->mon <= 2U) ? (year + 1UL) : year);
+}
+
+/*
+ * @pre cmos_lock is held
+ */
+static uint64_t cmos_get_host_secs(void)
 {
-	uint8_t reg;
+	struct rtc_time tm;
+	uint8_t reg_b, sec;
 	int32_t tries = 2000;
+	uint32_t retry = 3U;
+
+	do {
+		/* Make sure an update isn't in progress */
+		while (cmos_update_in_progress() && (tries != 0)) {
+			tries -= 1;
+		}
+
+		reg_b = cmos_read(RTC_STATUSB);
+		sec = cmos_read(RTC_SEC);
+		tm.sec = rtc_reg_to_bin(sec, reg_b);
+		tm.min = rtc_reg_to_bin(cmos_read(RTC_MIN), reg_b);
+		tm.hour = rtc_reg_to_hour(cmos_read(RTC_HRS), reg_b);
+		tm.day = rtc_reg_to_bin(cmos_read(RTC_DAY), reg_b);
+		tm.mon = rtc_reg_to_bin(cmos_read(RTC_MONTH), reg_b);
+		tm.year = ((uint32_t)rtc_reg_to_bin(cmos_read(RTC_CENTURY), reg_b) * 100U) +
+			rtc_reg_to_bin(cmos_read(RTC_YEAR), reg_b);
+		retry--;
+		/* an update between the reads moves the seconds, read again */
+	} while ((sec != cmos_read(RTC_SEC)) && (retry != 0U));
 
+	return rtc_time_to_secs(&tm);
+}
+
+/**
+ * @brief Take a new host wall clock snapshot from the physical RTC.
+ *
+ * Called on the first vRTC initialization and after S3 resume, where the
+ * TSC is restored to its pre-suspend value and no longer tracks wall time.
+ */
+void vrtc_sync_host_time(void)
+{
 	spinlock_obtain(&cmos_lock);
+	host_base_sec = cmos_get_host_secs();
+	host_base_tsc = rdtsc();
+	host_time_valid = true;
+	spinlock_release(&cmos_lock);
+}
+
+static inline uint64_t tsc_hz(void)
+{
+	return (uint64_t)get_tsc_khz() * 1000UL;
+}
+
+static uint64_t vrtc_get_host_secs(void)
+{
+	return host_base_sec + ((rdtsc() - host_base_tsc) / tsc_hz());
+}
+
+static inline bool vrtc_halted(const struct acrn_vrtc *vrtc)
+{
+	return ((vrtc->nvram[RTC_STATUSB] & RTCSB_HALT) != 0U);
+}
+
+static uint64_t vrtc_load_time(const struct acrn_vrtc *vrtc)
+{
+	struct rtc_time tm;
+	uint8_t reg_b = vrtc->nvram[RTC_STATUSB];
+
+	tm.sec = rtc_reg_to_bin(vrtc->nvram[RTC_SEC], reg_b);
+	tm.min = rtc_reg_to_bin(vrtc->nvram[RTC_MIN], reg_b);
+	tm.hour = rtc_reg_to_hour(vrtc->nvram[RTC_HRS], reg_b);
+	tm.day = rtc_reg_to_bin(vrtc->nvram[RTC_DAY], reg_b);
+	tm.mon = rtc_reg_to_bin(vrtc->nvram[RTC_MONTH], reg_b);
+	tm.year = ((uint32_t)rtc_reg_to_bin(vrtc->nvram[RTC_CENTURY], reg_b) * 100U) +
+		rtc_reg_to_bin(vrtc->nvram[RTC_YEAR], reg_b);
+
+	return rtc_time_to_secs(&tm);
+}
+
+static void vrtc_store_time(struct acrn_vrtc *vrtc, uint64_t secs)
+{
+	struct rtc_time tm;
+	uint8_t reg_b = vrtc->nvram[RTC_STATUSB];
+
+	secs_to_rtc_time(secs, &tm);
+	vrtc->nvram[RTC_SEC] = rtc_bin_to_reg(tm.sec, reg_b);
+	vrtc->nvram[RTC_MIN] = rtc_bin_to_reg(tm.min, reg_b);
+	vrtc->nvram[RTC_HRS] = rtc_hour_to_reg(tm.hour, reg_b);
+	vrtc->nvram[RTC_WDAY] = rtc_bin_to_reg(tm.wday, reg_b);
+	vrtc->nvram[RTC_DAY] = rtc_bin_to_reg(tm.day, reg_b);
+	vrtc->nvram[RTC_MONTH] = rtc_bin_to_reg(tm.mon, reg_b);
+	vrtc->nvram[RTC_YEAR] = rtc_bin_to_reg((uint8_t)(tm.year % 100U), reg_b);
+	vrtc->nvram[RTC_CENTURY] = rtc_bin_to_reg((uint8_t)(tm.year / 100U), reg_b);
+}
 
-	/* Make sure an update isn't in progress */
-	while (cmos_update_in_progress() && (tries != 0)) {
-		tries -= 1;
+/*
+ * Refresh the time registers in nvram from the guest clock unless the guest
+ * has stopped updates with RTCSB_HALT.
+ */
+static void vrtc_latch_time(struct acrn_vrtc *vrtc)
+{
+	if (!vrtc_halted(vrtc)) {
+		vrtc_store_time(vrtc, (uint64_t)((int64_t)vrtc_get_host_secs() + vrtc->offset_sec));
 	}
+}
 
-	reg = cmos_read(addr);
+static void vrtc_update_offset(struct acrn_vrtc *vrtc)
+{
+	vrtc->offset_sec = (int64_t)vrtc_load_time(vrtc) - (int64_t)vrtc_get_host_secs();
+}
 
-	spinlock_release(&cmos_lock);
-	return reg;
+static void vrtc_set_irqline(const struct acrn_vrtc *vrtc, uint32_t operation)
+{
+	struct acrn_vm *vm = vrtc->vm;
+
+	/* no vPIC/vIOAPIC interrupt can be delivered with LAPIC passthrough */
+	if (!is_lapic_pt_configured(vm)) {
+		vpic_set_irqline(vm_pic(vm), RTC_IRQ, operation);
+		vioapic_set_irqline_lock(vm, RTC_IRQ, operation);
+	}
+}
+
+/*
+ * Update register C and drive IRQ8 on the IRQF transitions; the flag bits
+ * of register C line up with the enable bits of register B.
+ */
+static void vrtc_set_reg_c(struct acrn_vrtc *vrtc, uint8_t val)
+{
+	uint8_t flags = val & RTCIR_MASK;
+	bool old_irqf = ((vrtc->nvram[RTC_INTR] & RTCIR_INT) != 0U);
+	bool new_irqf = ((flags & vrtc->nvram[RTC_STATUSB]) != 0U);
+
+	vrtc->nvram[RTC_INTR] = new_irqf ? (flags | RTCIR_INT) : flags;
+
+	if (!old_irqf && new_irqf) {
+		vrtc_set_irqline(vrtc, GSI_SET_HIGH);
+	} else if (old_irqf && !new_irqf) {
+		vrtc_set_irqline(vrtc, GSI_SET_LOW);
+	} else {
+		/* no IRQF transition */
+	}
+}
+
+static inline bool vrtc_divider_running(const struct acrn_vrtc *vrtc)
+{
+	return ((vrtc->nvram[RTC_STATUSA] & RTCSA_DIVIDER) == RTCSA_DIV_NORMAL);
+}
+
+/*
+ * @return the periodic interrupt period in TSC cycles, 0 if disabled
+ */
+static uint64_t vrtc_periodic_cycles(const struct acrn_vrtc *vrtc)
+{
+	uint32_t rate = (uint32_t)vrtc->nvram[RTC_STATUSA] & RTCSA_RATE;
+	uint32_t freq, period_us;
+	uint64_t cycles = 0UL;
+
+	if (vrtc_divider_running(vrtc) && (rate != 0U) &&
+			((vrtc->nvram[RTC_STATUSB] & RTCSB_PINTR) != 0U)) {
+		/* rate 1 and 2 alias to 256Hz and 128Hz with a 32.768KHz time base */
+		freq = (rate <= 2U) ? (256U >> (rate - 1U)) : (32768U >> (rate - 1U));
+		period_us = max(1000000U / freq, VRTC_MIN_PERIOD_US);
+		cycles = us_to_ticks(period_us);
+	}
+
+	return cycles;
+}
+
+static inline bool vrtc_update_needed(const struct acrn_vrtc *vrtc)
+{
+	return (vrtc_divider_running(vrtc) && !vrtc_halted(vrtc) &&
+		((vrtc->nvram[RTC_STATUSB] & (RTCSB_AINTR | RTCSB_UINTR)) != 0U));
+}
+
+static bool vrtc_alarm_match(const struct acrn_vrtc *vrtc)
+{
+	const uint8_t regs[3] = { RTC_SEC, RTC_MIN, RTC_HRS };
+	uint8_t alarm;
+	uint32_t i;
+	bool match = true;
+
+	for (i = 0U; i < 3U; i++) {
+		/* each alarm register sits right after its time register */
+		alarm = vrtc->nvram[regs[i] + 1U];
+		if (((alarm & RTC_ALARM_DONT_CARE) != RTC_ALARM_DONT_CARE) &&
+				(alarm != vrtc->nvram[regs[i]])) {
+			match = false;
+			break;
+		}
+	}
+
+	return match;
+}
+
+/*
+ * The interrupt timers are one-shot and re-armed by their own callback, so
+ * only an idle timer is ever added to a list. This keeps a vCPU on another
+ * pCPU from touching the timer list of the pCPU the timer was armed on; a
+ * timer that is no longer needed simply isn't re-armed on its next expiry.
+ */
+static void vrtc_periodic_timer_expired(void *data)
+{
+	struct acrn_vrtc *vrtc = (struct acrn_vrtc *)data;
+	struct hv_timer *timer = &vrtc->periodic_timer;
+	uint64_t cycles, now;
+
+	spinlock_obtain(&vrtc->lock);
+	cycles = vrtc_periodic_cycles(vrtc);
+	if (cycles == 0UL) {
+		vrtc->periodic_armed = false;
+	} else {
+		vrtc_set_reg_c(vrtc, vrtc->nvram[RTC_INTR] | RTCIR_PERIOD);
+
+		now = rdtsc();
+		timer->fire_tsc += cycles;
+		if (timer->fire_tsc <= now) {
+			timer->fire_tsc = now + cycles;
+		}
+		(void)add_timer(timer);
+	}
+	spinlock_release(&vrtc->lock);
+}
+
+static void vrtc_update_timer_expired(void *data)
+{
+	struct acrn_vrtc *vrtc = (struct acrn_vrtc *)data;
+	struct hv_timer *timer = &vrtc->update_timer;
+	uint8_t flags;
+
+	spinlock_obtain(&vrtc->lock);
+	if (!vrtc_update_needed(vrtc)) {
+		vrtc->update_armed = false;
+	} else {
+		vrtc_latch_time(vrtc);
+
+		flags = vrtc->nvram[RTC_INTR] | RTCIR_UPDATE;
+		if (vrtc_alarm_match(vrtc)) {
+			flags |= RTCIR_ALARM;
+		}
+		vrtc_set_reg_c(vrtc, flags);
+
+		timer->fire_tsc += tsc_hz();
+		(void)add_timer(timer);
+	}
+	spinlock_release(&vrtc->lock);
+}
+
+/*
+ * @pre vrtc->lock is held
+ */
+static void vrtc_arm_timers(struct acrn_vrtc *vrtc)
+{
+	uint64_t cycles, hz, now;
+
+	cycles = vrtc_periodic_cycles(vrtc);
+	if (!vrtc->periodic_armed && (cycles != 0UL)) {
+		vrtc->periodic_timer.fire_tsc = rdtsc() + cycles;
+		(void)add_timer(&vrtc->periodic_timer);
+		vrtc->periodic_armed = true;
+		vrtc->periodic_pcpu_id = get_pcpu_id();
+	}
+
+	if (!vrtc->update_armed && vrtc_update_needed(vrtc)) {
+		/* guest seconds tick with the host snapshot, fire on that boundary */
+		hz = tsc_hz();
+		now = rdtsc();
+		vrtc->update_timer.fire_tsc = host_base_tsc + ((((now - host_base_tsc) / hz) + 1UL) * hz);
+		(void)add_timer(&vrtc->update_timer);
+		vrtc->update_armed = true;
+		vrtc->update_pcpu_id = get_pcpu_id();
+	}
+}
+
+static uint8_t vrtc_read_reg(struct acrn_vrtc *vrtc, uint8_t offset)
+{
+	uint8_t val;
+
+	switch (offset) {
+	case RTC_SEC:
+	case RTC_MIN:
+	case RTC_HRS:
+	case RTC_WDAY:
+	case RTC_DAY:
+	case RTC_MONTH:
+	case RTC_YEAR:
+	case RTC_CENTURY:
+		vrtc_latch_time(vrtc);
+		val = vrtc->nvram[offset];
+		break;
+	case RTC_INTR:
+		val = vrtc->nvram[RTC_INTR];
+		vrtc_set_reg_c(vrtc, 0U);
+		break;
+	default:
+		/* the update cycle is instantaneous, RTCSA_TUP always reads 0 */
+		val = vrtc->nvram[offset];
+		break;
+	}
+
+	return val;
+}
+
+static void vrtc_write_reg(struct acrn_vrtc *vrtc, uint8_t offset, uint8_t val)
+{
+	uint8_t old;
+
+	switch (offset) {
+	case RTC_SEC:
+	case RTC_MIN:
+	case RTC_HRS:
+	case RTC_WDAY:
+	case RTC_DAY:
+	case RTC_MONTH:
+	case RTC_YEAR:
+	case RTC_CENTURY:
+		if (vrtc_halted(vrtc)) {
+			vrtc->nvram[offset] = val;
+		} else {
+			/* setting a single field of a running clock shifts the VM offset */
+			vrtc_latch_time(vrtc);
+			vrtc->nvram[offset] = val;
+			vrtc_update_offset(vrtc);
+		}
+		break;
+	case RTC_STATUSA:
+		vrtc->nvram[RTC_STATUSA] = val & (uint8_t)~RTCSA_TUP;
+		vrtc_arm_timers(vrtc);
+		break;
+	case RTC_STATUSB:
+		old = vrtc->nvram[RTC_STATUSB];
+		if ((val & RTCSB_HALT) != 0U) {
+			/* freeze the current guest time in nvram, updates stop */
+			vrtc_latch_time(vrtc);
+			val &= (uint8_t)~RTCSB_UINTR;
+		}
+		vrtc->nvram[RTC_STATUSB] = val;
+		if (((old & RTCSB_HALT) != 0U) && ((val & RTCSB_HALT) == 0U)) {
+			vrtc_update_offset(vrtc);
+		}
+		/* new enable bits may raise or drop IRQF for pending flags */
+		vrtc_set_reg_c(vrtc, vrtc->nvram[RTC_INTR]);
+		vrtc_arm_timers(vrtc);
+		break;
+	case RTC_INTR:
+	case RTC_STATUSD:
+		/* read-only */
+		break;
+	default:
+		vrtc->nvram[offset] = val;
+		break;
+	}
 }
 
 /**
@@ -50,17 +560,16 @@ static uint8_t cmos_get_reg_val(uint8_t addr)
  */
 static bool vrtc_read(struct acrn_vcpu *vcpu, uint16_t addr, __unused size_t width)
 {
-	uint8_t offset;
 	struct pio_request *pio_req = &vcpu->req.reqs.pio;
-	struct acrn_vm *vm = vcpu->vm;
-
-	offset = vm->vrtc_offset;
+	struct acrn_vrtc *vrtc = &vcpu->vm->vrtc;
 
+	spinlock_obtain(&vrtc->lock);
 	if (addr == CMOS_ADDR_PORT) {
-		pio_req->value = vm->vrtc_offset;
+		pio_req->value = vrtc->addr;
 	} else {
-		pio_req->value = cmos_get_reg_val(offset);
+		pio_req->value = vrtc_read_reg(vrtc, vrtc->addr);
 	}
+	spinlock_release(&vrtc->lock);
 
 	return true;
 }
@@ -72,20 +581,191 @@ static bool vrtc_read(struct acrn_vcpu *vcpu, uint16_t addr, __unused size_t wid
 static bool vrtc_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t width,
 			uint32_t value)
 {
-	if ((width == 1U) && (addr == CMOS_ADDR_PORT)) {
-		vcpu->vm->vrtc_offset = (uint8_t)value & 0x7FU;
+	struct acrn_vrtc *vrtc = &vcpu->vm->vrtc;
+
+	if (width == 1U) {
+		spinlock_obtain(&vrtc->lock);
+		if (addr == CMOS_ADDR_PORT) {
+			/* bit 7 is the NMI mask, not part of the index */
+			vrtc->addr = (uint8_t)value & 0x7FU;
+		} else {
+			vrtc_write_reg(vrtc, vrtc->addr, (uint8_t)value);
+		}
+		spinlock_release(&vrtc->lock);
 	}
 
 	return true;
 }
 
+static void vrtc_set_memsize(struct acrn_vrtc *vrtc)
+{
+	uint64_t lomem = 0UL, himem;
+
+	if (vrtc->lowmem_top > (16UL * MEM_1M)) {
+		lomem = (vrtc->lowmem_top - (16UL * MEM_1M)) >> 16U;
+	}
+	himem = (vrtc->highmem_top - vrtc->highmem_base) >> 16U;
+
+	vrtc->nvram[RTC_LMEM_LSB] = (uint8_t)lomem;
+	vrtc->nvram[RTC_LMEM_MSB] = (uint8_t)(lomem >> 8U);
+	vrtc->nvram[RTC_HMEM_LSB] = (uint8_t)himem;
+	vrtc->nvram[RTC_HMEM_SB] = (uint8_t)(himem >> 8U);
+	vrtc->nvram[RTC_HMEM_MSB] = (uint8_t)(himem >> 16U);
+}
+
+/**
+ * @brief Account guest RAM mapped by the DM in the NVRAM memory size cells.
+ *
+ * Post-launched VM memory is only known through HC_VM_SET_MEMORY_REGIONS.
+ * Guest RAM is mapped as WB from GPA 0 and from the high memory base upward,
+ * so only regions contiguous with RAM already seen are counted; this keeps
+ * MMIO BARs mapped later out of the reported size.
+ *
+ * @pre vm != NULL
+ */
+void vrtc_add_memory_region(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	struct acrn_vrtc *vrtc = &vm->vrtc;
+
+	/* the DM emulates the RTC when the vRTC is not initialized */
+	if (vrtc->vm != NULL) {
+		spinlock_obtain(&vrtc->lock);
+		if (gpa < MEM_4G) {
+			if ((gpa <= vrtc->lowmem_top) && ((gpa + size) > vrtc->lowmem_top)) {
+				vrtc->lowmem_top = min(gpa + size, MEM_4G);
+			}
+		} else if (vrtc->highmem_top == 0UL) {
+			vrtc->highmem_base = gpa;
+			vrtc->highmem_top = gpa + size;
+		} else if ((gpa <= vrtc->highmem_top) && ((gpa + size) > vrtc->highmem_top)) {
+			vrtc->highmem_top = gpa + size;
+		} else {
+			/* not contiguous with guest RAM */
+		}
+		vrtc_set_memsize(vrtc);
+		spinlock_release(&vrtc->lock);
+	}
+}
+
+static void vrtc_init_memsize(struct acrn_vm *vm)
+{
+	struct acrn_vrtc *vrtc = &vm->vrtc;
+	const struct e820_entry *entry;
+	uint64_t end;
+	uint32_t i;
+
+	vrtc->highmem_base = MEM_4G;
+	vrtc->highmem_top = MEM_4G;
+	for (i = 0U; i < vm->e820_entry_num; i++) {
+		entry = &vm->e820_entries[i];
+		if (entry->type == E820_TYPE_RAM) {
+			end = entry->baseaddr + entry->length;
+			if (entry->baseaddr < MEM_4G) {
+				vrtc->lowmem_top = max(vrtc->lowmem_top, min(end, MEM_4G));
+			} else {
+				vrtc->highmem_top += entry->length;
+			}
+		}
+	}
+	vrtc_set_memsize(vrtc);
+}
+
 void vrtc_init(struct acrn_vm *vm)
 {
+	struct acrn_vrtc *vrtc = &vm->vrtc;
 	struct vm_io_range range = {
 	.base = CMOS_ADDR_PORT, .len = 2U};
 
-	/* Initializing the CMOS RAM offset to 0U */
-	vm->vrtc_offset = 0U;
+	if (!host_time_valid) {
+		vrtc_sync_host_time();
+	}
+
+	(void)memset(vrtc, 0U, sizeof(struct acrn_vrtc));
+	vrtc->vm = vm;
+	spinlock_init(&vrtc->lock);
+	initialize_timer(&vrtc->periodic_timer, vrtc_periodic_timer_expired, vrtc,
+			0UL, TICK_MODE_ONESHOT, 0UL);
+	initialize_timer(&vrtc->update_timer, vrtc_update_timer_expired, vrtc,
+			0UL, TICK_MODE_ONESHOT, 0UL);
+
+	/* 32.768KHz time base with 1024Hz rate, 24 hour BCD, as left by firmware */
+	vrtc->nvram[RTC_STATUSA] = RTCSA_DIV_NORMAL | 0x06U;
+	vrtc->nvram[RTC_STATUSB] = RTCSB_24HR;
+	vrtc->nvram[RTC_STATUSD] = RTCSD_PWR;
+	vrtc->offset_sec = 0L;
+
+	/* memory of post-launched VMs is reported by vrtc_add_memory_region */
+	if (!is_postlaunched_vm(vm)) {
+		vrtc_init_memsize(vm);
+	}
 
 	register_pio_emulation_handler(vm, RTC_PIO_IDX, &range, vrtc_read, vrtc_write);
 }
+
+/**
+ * @brief Reset the vRTC as the RESET pin does on a VM reset.
+ *
+ * Time, offset and CMOS RAM survive a reset; interrupt enables and pending
+ * flags are cleared, which also lets the interrupt timers lapse.
+ *
+ * @pre vm != NULL
+ */
+void vrtc_reset(struct acrn_vm *vm)
+{
+	struct acrn_vrtc *vrtc = &vm->vrtc;
+
+	if (vrtc->vm != NULL) {
+		spinlock_obtain(&vrtc->lock);
+		vrtc->nvram[RTC_STATUSB] &= (uint8_t)~(RTCSB_PINTR | RTCSB_AINTR | RTCSB_UINTR);
+		vrtc_set_reg_c(vrtc, 0U);
+		spinlock_release(&vrtc->lock);
+	}
+}
+
+static void vrtc_del_timer(void *data)
+{
+	del_timer((struct hv_timer *)data);
+}
+
+/*
+ * The timer lists are per pCPU and only guarded by disabling local IRQs, so
+ * an armed timer is deleted on the pCPU it was added on.
+ */
+static void vrtc_del_timer_on(struct hv_timer *timer, uint16_t pcpu_id)
+{
+	if (pcpu_id == get_pcpu_id()) {
+		vrtc_del_timer(timer);
+	} else {
+		smp_call_function(1UL << pcpu_id, vrtc_del_timer, timer);
+	}
+}
+
+/*
+ * @pre vm != NULL
+ */
+void vrtc_deinit(struct acrn_vm *vm)
+{
+	struct acrn_vrtc *vrtc = &vm->vrtc;
+	bool periodic_armed, update_armed;
+
+	if (vrtc->vm != NULL) {
+		/* with the enables cleared an expiring callback no longer re-arms its timer */
+		spinlock_obtain(&vrtc->lock);
+		vrtc->nvram[RTC_STATUSB] &= (uint8_t)~(RTCSB_PINTR | RTCSB_AINTR | RTCSB_UINTR);
+		periodic_armed = vrtc->periodic_armed;
+		update_armed = vrtc->update_armed;
+		spinlock_release(&vrtc->lock);
+
+		if (periodic_armed) {
+			vrtc_del_timer_on(&vrtc->periodic_timer, vrtc->periodic_pcpu_id);
+		}
+		if (update_armed) {
+			vrtc_del_timer_on(&vrtc->update_timer, vrtc->update_pcpu_id);
+		}
+
+		spinlock_obtain(&vrtc->lock);
+		vrtc->periodic_armed = false;
+		vrtc->update_armed = false;
+		spinlock_release(&vrtc->lock);
+	}
+}
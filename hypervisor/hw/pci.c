@@ -778,3 +778,34 @@ struct pci_pdev *init_pdev(uint16_t pbdf, uint32_t drhd_index)
 
 	return pdev;
 }
+
+/*
+ * @brief Initialize the pdev data structure of a SRIOV VF from the pdev of another VF of the same PF.
+ *
+ * All the VFs of a PF have the same Device ID (PCI Express Base 4.0 9.3.3.11), hence the same
+ * capabilities and read only zero BARs: only the BDF differs. This saves enumerating the capabilities
+ * of every VF in configuration space when a PF enables many VFs.
+ * The caller of the function init_vf_pdev should guarantee execution atomically.
+ *
+ * @param pbdf        Physical device BDF of the VF
+ * @param vf_pdev     pdev of a VF of the same PF
+ *
+ * @pre vf_pdev != NULL
+ *
+ * @return If there's a successfully initialized pdev return it, otherwise return NULL;
+ */
+struct pci_pdev *init_vf_pdev(uint16_t pbdf, const struct pci_pdev *vf_pdev)
+{
+	struct pci_pdev *pdev = NULL;
+
+	if (num_pci_pdev < CONFIG_MAX_PCI_DEV_NUM) {
+		pdev = &pci_pdev_array[num_pci_pdev];
+		*pdev = *vf_pdev;
+		pdev->bdf.value = pbdf;
+		num_pci_pdev++;
+	} else {
+		pr_err("%s, failed to alloc pci_pdev!\n", __func__);
+	}
+
+	return pdev;
+}
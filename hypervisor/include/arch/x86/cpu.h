@@ -404,6 +404,21 @@ struct ext_context {
 	uint64_t xss;
 };
 
+/*
+ * Extended context of the vCPU last switched out of a pCPU, which stays in
+ * the registers as the hypervisor doesn't use them.
+ */
+struct loaded_ext_context {
+	const struct ext_context *xs_owner;	/* whose XSAVE state is loaded, NULL if unknown */
+	bool valid;				/* the values below are loaded */
+	uint64_t ia32_star;
+	uint64_t ia32_lstar;
+	uint64_t ia32_fmask;
+	uint64_t ia32_kernel_gs_base;
+	uint64_t xcr0;
+	uint64_t xss;
+};
+
 struct cpu_context {
 	struct run_context run_ctx;
 	struct ext_context ext_ctx;
@@ -419,6 +434,7 @@ void init_pcpu_pre(bool is_bsp);
  * hereby, pcpu_id is actually the current physcial cpu id.
  */
 void init_pcpu_post(uint16_t pcpu_id);
+void resume_pcpu_post(uint16_t pcpu_id);
 bool start_pcpus(uint64_t mask);
 void wait_pcpus_offline(uint64_t mask);
 void stop_pcpus(void);
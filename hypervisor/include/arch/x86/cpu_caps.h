@@ -48,6 +48,7 @@ bool is_apicv_advanced_feature_supported(void);
 bool pcpu_has_cap(uint32_t bit);
 bool pcpu_has_vmx_ept_cap(uint32_t bit_mask);
 bool pcpu_has_vmx_vpid_cap(uint32_t bit_mask);
+bool pcpu_has_vmx_pml(void);
 bool is_apl_platform(void);
 void init_pcpu_capabilities(void);
 void init_pcpu_model_name(void);
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef CACHE_FLUSH_H
+#define CACHE_FLUSH_H
+
+#include <types.h>
+
+struct acrn_vm;
+struct acrn_vcpu;
+
+/*
+ * Per-VM state of the guest cache flushes (WBINVD, CR0.CD).
+ *
+ * With CONFIG_CACHE_FLUSH_TRACK_ACCESSED, and where the CPU supports them, the
+ * EPT accessed flags are enabled for a pre-launched VM or the SOS whose DMA
+ * doesn't snoop the CPU caches. A flush then covers only the pages accessed
+ * through the EPT, or written by copy_to_gpa(), since the previous one; the
+ * first flush covers the whole memory of the VM, which may have been cached
+ * before the flags were cleared. Lines cached by any other write to the VM
+ * memory are no longer written back by the flush.
+ */
+struct vm_cache_flush {
+	bool track_accessed;
+	bool armed;		/* a whole memory flush has cleared the accessed flags */
+};
+
+enum guest_cache_flush_cause {
+	GUEST_CACHE_FLUSH_WBINVD,
+	GUEST_CACHE_FLUSH_CR0_CD,
+};
+
+enum guest_cache_flush_method {
+	GUEST_CACHE_FLUSH_ELIDED,	/* the VM's DMA snoops the CPU caches */
+	GUEST_CACHE_FLUSH_LINES,	/* pages of the VM flushed line by line */
+	GUEST_CACHE_FLUSH_HOST_WBINVD,	/* host caches written back as a whole */
+};
+
+/* per vCPU, shown by the "cacheflush" shell command */
+struct guest_cache_flush_stats {
+	uint64_t wbinvd;		/* WBINVD exits */
+	uint64_t cr0_cd;		/* CR0.CD set by the guest */
+	uint64_t elided;
+	uint64_t line_flushes;
+	uint64_t host_wbinvd;
+	uint64_t flushed_bytes;		/* by the line flushes */
+	uint64_t max_bytes;		/* largest line flush */
+};
+
+void init_vm_cache_flush(struct acrn_vm *vm);
+void cache_flush_mark_written(struct acrn_vm *vm, uint64_t gpa);
+enum guest_cache_flush_method vcpu_flush_guest_cache(struct acrn_vcpu *vcpu,
+		enum guest_cache_flush_cause cause, uint64_t *size);
+
+#endif /* CACHE_FLUSH_H */
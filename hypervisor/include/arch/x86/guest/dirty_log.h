@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef DIRTY_LOG_H
+#define DIRTY_LOG_H
+
+#include <types.h>
+#include <spinlock.h>
+
+struct acrn_vm;
+struct acrn_vcpu;
+
+/*
+ * Per-VM dirty page logging state.
+ *
+ * With Page-Modification Logging the CPU records the GPA of every page whose
+ * EPT dirty flag goes from 0 to 1 in the per-vCPU PML buffer, which is drained
+ * into the bitmap on each VM exit. Without PML the guest RAM is write protected
+ * in the EPT and the first write to a page is caught by an EPT violation; large
+ * pages are split on demand so that only the written 4KB page is made writable.
+ */
+struct vm_dirty_log {
+	spinlock_t lock;
+	bool enabled;
+	bool use_pml;
+	uint64_t page_num;	/* number of 4KB pages covered by bitmap */
+	uint64_t *bitmap;
+};
+
+void init_vm_dirty_log(struct acrn_vm *vm);
+void deinit_vm_dirty_log(struct acrn_vm *vm);
+void vcpu_update_dirty_log(struct acrn_vcpu *vcpu);
+void vcpu_flush_pml(struct acrn_vcpu *vcpu);
+bool dirty_log_handle_ept_violation(struct acrn_vcpu *vcpu, uint64_t gpa);
+int32_t pml_full_vmexit_handler(struct acrn_vcpu *vcpu);
+
+int32_t vm_enable_dirty_log(struct acrn_vm *vm);
+int32_t vm_disable_dirty_log(struct acrn_vm *vm);
+int32_t vm_get_dirty_log(struct acrn_vm *vm, struct acrn_vm *sos_vm, uint64_t gpa, uint64_t size, uint64_t bitmap_gpa);
+
+#endif /* DIRTY_LOG_H */
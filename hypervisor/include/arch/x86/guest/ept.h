@@ -8,7 +8,7 @@
 #define EPT_H
 #include <types.h>
 
-typedef void (*pge_handler)(uint64_t *pgentry, uint64_t size);
+typedef void (*pge_handler)(uint64_t *pgentry, uint64_t size, void *data);
 
 /**
  * Invalid HPA is defined for error checking,
@@ -118,15 +118,15 @@ void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
 
 /**
- * @brief Flush address space from the page entry
+ * @brief Flush the EPT translations cached for the vcpu
  *
- * @param[in] pge the pointer that points to the page entry
+ * Serve an ACRN_REQUEST_EPT_FLUSH of the vcpu, already cleared by the caller.
  *
- * @param[in] size the size of the page
+ * @param[in] vcpu the pointer that points to the current vcpu
  *
  * @return None
  */
-void ept_flush_leaf_page(uint64_t *pge, uint64_t size);
+void vcpu_flush_ept(struct acrn_vcpu *vcpu);
 
 /**
  * @brief Get EPT pointer of the vm
@@ -145,10 +145,11 @@ void *get_ept_entry(struct acrn_vm *vm);
  * @param[in] cb the pointer that points to walk_ept_table callback, the callback
  * 		will be invoked when getting a present page entry from EPT, and
  *		the callback could get the page entry and page size parameters.
+ * @param[in] data passed as is to the callback
  *
  * @return None
  */
-void walk_ept_table(struct acrn_vm *vm, pge_handler cb);
+void walk_ept_table(struct acrn_vm *vm, pge_handler cb, void *data);
 
 /**
  * @brief EPT misconfiguration handling
@@ -8,6 +8,7 @@
 #define HYPERV_H
 
 #include <vcpuid.h>
+#include <timer.h>
 
 /* Hyper-V MSR numbers */
 #define HV_X64_MSR_GUEST_OS_ID		0x40000000U
@@ -17,6 +18,22 @@
 #define HV_X64_MSR_TIME_REF_COUNT	0x40000020U
 #define HV_X64_MSR_REFERENCE_TSC	0x40000021U
 
+/* Synthetic interrupt controller (SynIC) MSRs */
+#define HV_X64_MSR_SCONTROL		0x40000080U
+#define HV_X64_MSR_SVERSION		0x40000081U
+#define HV_X64_MSR_SIEFP		0x40000082U
+#define HV_X64_MSR_SIMP			0x40000083U
+#define HV_X64_MSR_EOM			0x40000084U
+#define HV_X64_MSR_SINT0		0x40000090U
+#define HV_X64_MSR_SINT15		0x4000009FU
+
+/* Synthetic timer MSRs, STIMERn_CONFIG is at 0x400000B0 + 2n, STIMERn_COUNT follows it */
+#define HV_X64_MSR_STIMER0_CONFIG	0x400000B0U
+#define HV_X64_MSR_STIMER3_COUNT	0x400000B7U
+
+#define HV_SYNIC_SINT_COUNT		16U
+#define HV_SYNIC_STIMER_COUNT		4U
+
 union hyperv_ref_tsc_page_msr {
 	uint64_t val64;
 	struct {
@@ -49,6 +66,65 @@ union hyperv_guest_os_id_msr {
 	};
 };
 
+union hyperv_synic_page_msr {
+	uint64_t val64;
+	struct {
+		uint64_t enabled:1;
+		uint64_t rsvdp:11;
+		uint64_t gpfn:52;
+	};
+};
+
+union hyperv_sint_msr {
+	uint64_t val64;
+	struct {
+		uint64_t vector:8;
+		uint64_t rsvdp1:8;
+		uint64_t masked:1;
+		uint64_t auto_eoi:1;
+		uint64_t polling:1;
+		uint64_t rsvdp2:45;
+	};
+};
+
+union hyperv_stimer_config_msr {
+	uint64_t val64;
+	struct {
+		uint64_t enabled:1;
+		uint64_t periodic:1;
+		uint64_t lazy:1;
+		uint64_t auto_enable:1;
+		uint64_t apic_vector:8;
+		uint64_t direct_mode:1;
+		uint64_t rsvdp1:3;
+		uint64_t sintx:4;
+		uint64_t rsvdp2:44;
+	};
+};
+
+struct acrn_vcpu;
+
+struct hyperv_stimer {
+	struct hv_timer			timer;
+	struct acrn_vcpu		*vcpu;
+	uint32_t			index;
+	union hyperv_stimer_config_msr	config;
+	/* period for periodic timer or absolute expiration time for one-shot, in 100ns */
+	uint64_t			count;
+	/* reference time of the next expiration, in 100ns */
+	uint64_t			exp_time;
+	/* the expiration message could not be posted and waits for an EOM */
+	bool				msg_pending;
+};
+
+struct acrn_hyperv_vcpu {
+	uint64_t			scontrol;
+	union hyperv_synic_page_msr	siefp;
+	union hyperv_synic_page_msr	simp;
+	union hyperv_sint_msr		sint[HV_SYNIC_SINT_COUNT];
+	struct hyperv_stimer		stimer[HV_SYNIC_STIMER_COUNT];
+};
+
 struct acrn_hyperv {
 	union hyperv_hypercall_msr	hypercall_page;
 	union hyperv_guest_os_id_msr	guest_os_id;
@@ -57,9 +133,21 @@ struct acrn_hyperv {
 	uint64_t			tsc_offset;
 };
 
+static inline bool is_hyperv_synic_msr(uint32_t msr)
+{
+	return (((msr >= HV_X64_MSR_SCONTROL) && (msr <= HV_X64_MSR_EOM)) ||
+		((msr >= HV_X64_MSR_SINT0) && (msr <= HV_X64_MSR_SINT15)) ||
+		((msr >= HV_X64_MSR_STIMER0_CONFIG) && (msr <= HV_X64_MSR_STIMER3_COUNT)));
+}
+
 int32_t hyperv_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t wval);
 int32_t hyperv_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *rval);
 void hyperv_init_vcpuid_entry(uint32_t leaf, uint32_t subleaf, uint32_t flags,
 	struct vcpuid_entry *entry);
+bool is_hyperv_hypercall(struct acrn_vcpu *vcpu);
+uint64_t hyperv_hypercall(struct acrn_vcpu *vcpu);
+void hyperv_init_vcpu(struct acrn_vcpu *vcpu);
+void hyperv_reset_vcpu(struct acrn_vcpu *vcpu);
+void hyperv_free_vcpu(struct acrn_vcpu *vcpu);
 
 #endif
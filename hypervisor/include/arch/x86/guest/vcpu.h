@@ -27,6 +27,9 @@
 #include <msr.h>
 #include <cpu.h>
 #include <instr_emul.h>
+#include <hyperv.h>
+#include <vmx.h>
+#include <cache_flush.h>
 
 /**
  * @brief vcpu
@@ -92,6 +95,11 @@
  */
 #define ACRN_REQUEST_INIT_VMCS			8U
 
+/**
+ * @brief Request for dirty page logging state update
+ */
+#define ACRN_REQUEST_DIRTY_LOG			9U
+
 /**
  * @}
  */
@@ -190,6 +198,14 @@ struct msr_store_area {
 	uint32_t count;	/* actual count of entries to be loaded/restored during VMEntry/VMExit */
 };
 
+/* per vCPU, shown by the "ctxsw" shell command */
+struct vcpu_switch_stats {
+	uint64_t switches;		/* times switched in */
+	uint64_t xrstors_skipped;	/* XSAVE state still loaded */
+	uint64_t writes_skipped;	/* MSR or XCR0 writes of unchanged values */
+	uint64_t cycles;		/* TSC cycles spent switching the vCPU in and out */
+};
+
 struct acrn_vcpu_arch {
 	/* vmcs region for this vcpu, MUST be 4KB-aligned */
 	uint8_t vmcs[PAGE_SIZE];
@@ -197,11 +213,20 @@ struct acrn_vcpu_arch {
 	/* MSR bitmap region for this vcpu, MUST be 4-Kbyte aligned */
 	uint8_t msr_bitmap[PAGE_SIZE];
 
+	/* Page-Modification Log of this vcpu, MUST be 4-Kbyte aligned */
+	uint64_t pml_buf[PML_ENTITY_NUM];
+	bool pml_enabled;
+
 	/* per vcpu lapic */
 	struct acrn_vlapic vlapic;
 
 	struct acrn_vmtrr vmtrr;
 
+	/* per vcpu Hyper-V SynIC and synthetic timers */
+	struct acrn_hyperv_vcpu hyperv;
+
+	struct guest_cache_flush_stats cache_flush_stats;
+
 	int32_t cur_context;
 	struct guest_cpu_context contexts[NR_WORLD];
 
@@ -236,6 +261,9 @@ struct acrn_vcpu_arch {
 	/* interrupt injection information */
 	uint64_t pending_req;
 
+	/* last EPT flush of the VM done, see ept_reclaim_pages() */
+	uint64_t ept_flushed_gen;
+
 	/* List of MSRS to be stored and loaded on VM exits or VM entries */
 	struct msr_store_area msr_area;
 
@@ -259,6 +287,7 @@ struct acrn_vcpu {
 	struct thread_object thread_obj;
 	bool launched; /* Whether the vcpu is launched on target pcpu */
 	volatile bool running; /* vcpu is picked up and run? */
+	struct vcpu_switch_stats switch_stats;
 
 	struct instr_emul_ctxt inst_ctxt;
 	struct io_request req; /* used by io/ept emulation */
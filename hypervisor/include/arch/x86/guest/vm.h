@@ -20,6 +20,9 @@
 #include <vpic.h>
 #include <vmx_io.h>
 #include <vuart.h>
+#include <vrtc.h>
+#include <dirty_log.h>
+#include <cache_flush.h>
 #include <trusty.h>
 #include <vcpuid.h>
 #include <vpci.h>
@@ -106,6 +109,8 @@ struct vm_arch {
 	 */
 	void *sworld_eptp;
 	struct memory_ops ept_mem_ops;
+	struct vm_dirty_log dirty_log;
+	struct vm_cache_flush cache_flush;
 
 	struct acrn_vioapic vioapic;	/* Virtual IOAPIC base address */
 	struct acrn_vpic vpic;      /* Virtual PIC */
@@ -151,7 +156,7 @@ struct acrn_vm {
 	struct vcpuid_entry vcpuid_entries[MAX_VM_VCPUID_ENTRIES];
 	struct acrn_vpci vpci;
 
-	uint8_t vrtc_offset;
+	struct acrn_vrtc vrtc;
 
 	uint64_t intr_inject_delay_delta; /* delay of intr injection */
 } __aligned(PAGE_SIZE);
@@ -258,8 +263,6 @@ int32_t direct_boot_sw_loader(struct acrn_vm *vm);
 typedef int32_t (*vm_sw_loader_t)(struct acrn_vm *vm);
 extern vm_sw_loader_t vm_sw_loader;
 
-void vrtc_init(struct acrn_vm *vm);
-
 bool is_lapic_pt_configured(const struct acrn_vm *vm);
 bool is_rt_vm(const struct acrn_vm *vm);
 bool has_rt_vm(void);
@@ -29,6 +29,23 @@ struct acpi_reset_reg {
 	uint8_t val;
 };
 
+enum host_s3_stage {
+	HOST_S3_STAGE_SUSPEND = 0,	/* from S3 request to entering firmware */
+	HOST_S3_STAGE_LAPIC,		/* resume: local APIC */
+	HOST_S3_STAGE_IOMMU,		/* resume: DMAR units */
+	HOST_S3_STAGE_IOAPIC,		/* resume: IOAPIC */
+	HOST_S3_STAGE_VMX,		/* resume: VMXON on BSP */
+	HOST_S3_STAGE_APS,		/* resume: bring all APs online */
+	HOST_S3_STAGE_CONSOLE,		/* resume: console and wall clock, after TSC restore */
+	HOST_S3_STAGE_NUM,
+};
+
+/* TSC ticks spent in each stage of the last host S3 cycle */
+struct host_s3_stats {
+	uint32_t count;		/* number of completed S3 cycles */
+	uint64_t stage_ticks[HOST_S3_STAGE_NUM];
+};
+
 struct pm_s_state_data *get_host_sstate_data(void);
 void host_enter_s3(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_val, uint32_t pm1b_cnt_val);
 void shutdown_system(void);
@@ -39,5 +56,6 @@ extern void restore_s3_context(void);
 struct cpu_state_info *get_cpu_pm_state_info(void);
 struct acpi_reset_reg *get_host_reset_reg_data(void);
 void reset_host(void);
+const struct host_s3_stats *get_host_s3_stats(void);
 
 #endif	/* HOST_PM_H */
@@ -11,5 +11,6 @@
 
 void init_primary_pcpu(void);
 void init_secondary_pcpu(void);
+void resume_secondary_pcpu(void);
 
 #endif /* INIT_H*/
@@ -205,6 +205,25 @@ void vcpu_inject_ud(struct acrn_vcpu *vcpu);
 void vcpu_inject_ss(struct acrn_vcpu *vcpu);
 void vcpu_make_request(struct acrn_vcpu *vcpu, uint16_t eventid);
 
+/**
+ * @brief Make a flush request to vCPUs and wait until they have served it.
+ *
+ * Only the targets running are waited for, the others serve the request
+ * before their next VM entry, as does the current vCPU. While waiting, the
+ * flush requests made to the current vCPU are served, since a target may
+ * itself be waiting for them.
+ *
+ * @param[in] vm Pointer to the VM of the vCPUs.
+ * @param[in] vcpu_mask Bitmap of the target vCPU IDs.
+ * @param[in] eventid ACRN_REQUEST_EPT_FLUSH or ACRN_REQUEST_VPID_FLUSH.
+ *
+ * @return None
+ *
+ * @pre vm != NULL
+ * @pre The caller holds no lock a target may take in root mode.
+ */
+void vcpu_make_request_and_wait(struct acrn_vm *vm, uint64_t vcpu_mask, uint16_t eventid);
+
 /*
  * @pre vcpu != NULL
  */
@@ -8,6 +8,7 @@
 #define PAGE_H
 
 #include <pci_devices.h>
+#include <spinlock.h>
 
 #define PAGE_SHIFT	12U
 #define PAGE_SIZE	(1U << PAGE_SHIFT)
@@ -23,6 +24,8 @@
 #define PDPT_PAGE_NUM(size)	(((size) + PML4E_SIZE - 1UL) >> PML4E_SHIFT)
 #define PD_PAGE_NUM(size)	(((size) + PDPTE_SIZE - 1UL) >> PDPTE_SHIFT)
 #define PT_PAGE_NUM(size)	(((size) + PDE_SIZE - 1UL) >> PDE_SHIFT)
+#define UPPER_PGTABLE_PAGE_NUM(size)	(PML4_PAGE_NUM(size) + PDPT_PAGE_NUM(size) + PD_PAGE_NUM(size))
+#define PGTABLE_PAGE_NUM(size)	(UPPER_PGTABLE_PAGE_NUM(size) + PT_PAGE_NUM(size))
 
 /*
  * The size of the guest physical address space, covered by the EPT page table of a VM.
@@ -53,20 +56,57 @@ struct page {
 	uint8_t contents[PAGE_SIZE];
 } __aligned(PAGE_SIZE);
 
+/*
+ * Page-table pages are handed out on demand from a page_pool; the bitmap
+ * tracks allocated pages and owner[] the quota each page is charged to.
+ */
+struct page_pool {
+	struct page *start_page;
+	spinlock_t lock;
+	uint64_t page_num;
+	uint64_t *bitmap;
+	uint16_t *owner;
+	uint64_t last_hint_id;
+	uint64_t used;			/* pages allocated from the pool */
+	uint64_t high_watermark;	/* max of used */
+};
+
+/*
+ * The share of a page_pool one page table may hold. Pages a VM gives back are
+ * reused by the same VM only, and return to the pool when the whole page table
+ * is released. The vCPUs and the IOMMU may still cache a page unlinked from the
+ * table: it waits on stale_list until the EPT flush numbered stale_gen is done
+ * by every vCPU, then moves to free_list.
+ */
+struct pgtable_quota {
+	struct page_pool *pool;
+	spinlock_t lock;
+	uint16_t id;
+	struct page *free_list;
+	struct page *stale_list;
+	uint64_t stale_gen;
+	uint64_t flush_gen;		/* EPT flushes requested */
+	uint64_t limit;			/* max pages held, the 4K-mapped worst case */
+	uint64_t held;			/* pages taken from the pool */
+	uint64_t used;			/* pages linked in the page table */
+	uint64_t high_watermark;	/* max of used */
+};
+
+/* usage snapshot of a page_pool or pgtable_quota */
+struct page_stats {
+	uint64_t total;			/* pool size or quota limit */
+	uint64_t held;			/* pages taken from the pool */
+	uint64_t used;			/* pages in use */
+	uint64_t high_watermark;
+};
+
 union pgtable_pages_info {
 	struct {
-		struct page *pml4_base;
-		struct page *pdpt_base;
-		struct page *pd_base;
-		struct page *pt_base;
+		struct pgtable_quota *quota;
 	} ppt;
 	struct {
 		uint64_t top_address_space;
-		struct page *nworld_pml4_base;
-		struct page *nworld_pdpt_base;
-		struct page *nworld_pd_base;
-		struct page *nworld_pt_base;
-		struct page *sworld_pgtable_base;
+		struct pgtable_quota *quota;
 		struct page *sworld_memory_base;
 	} ept;
 };
@@ -76,10 +116,9 @@ struct memory_ops {
 	bool large_page_enabled;
 	uint64_t (*get_default_access_right)(void);
 	uint64_t (*pgentry_present)(uint64_t pte);
-	struct page *(*get_pml4_page)(const union pgtable_pages_info *info);
-	struct page *(*get_pdpt_page)(const union pgtable_pages_info *info, uint64_t gpa);
-	struct page *(*get_pd_page)(const union pgtable_pages_info *info, uint64_t gpa);
-	struct page *(*get_pt_page)(const union pgtable_pages_info *info, uint64_t gpa);
+	struct page *(*alloc_page)(const union pgtable_pages_info *info);
+	/* NULL if the page table is never reclaimed */
+	void (*free_page)(const union pgtable_pages_info *info, struct page *page);
 	void *(*get_sworld_memory_base)(const union pgtable_pages_info *info);
 	void (*clflush_pagewalk)(const void *p);
 	void (*tweak_exe_right)(uint64_t *entry);
@@ -89,5 +128,12 @@ struct memory_ops {
 extern const struct memory_ops ppt_mem_ops;
 void init_ept_mem_ops(struct memory_ops *mem_ops, uint16_t vm_id);
 void *get_reserve_sworld_memory_base(void);
+void release_ept_pages(const struct memory_ops *mem_ops);
+uint64_t ept_flush_gen(const struct memory_ops *mem_ops);
+uint64_t ept_next_flush_gen(const struct memory_ops *mem_ops);
+bool ept_has_stale_pages(const struct memory_ops *mem_ops, uint64_t flushed_gen);
+void reclaim_ept_pages(const struct memory_ops *mem_ops, uint64_t flushed_gen);
+void get_ept_page_pool_stats(struct page_stats *stats);
+void get_ept_page_stats(uint16_t vm_id, struct page_stats *stats);
 
 #endif /* PAGE_H */
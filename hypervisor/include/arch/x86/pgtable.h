@@ -110,6 +110,16 @@
 #define EPT_MT_MASK		(7UL << EPT_MT_SHIFT)
 /* VTD: Second-Level Paging Entries: Snoop Control */
 #define EPT_SNOOP_CTRL		(1UL << 11U)
+/* EPT accessed and dirty flags, only updated by the CPU if enabled in the EPTP */
+#define EPT_ACCESSED_POS	8U
+#define EPT_ACCESSED		(1UL << EPT_ACCESSED_POS)
+#define EPT_DIRTY_POS		9U
+#define EPT_DIRTY		(1UL << EPT_DIRTY_POS)
+/* Software available (ignored) bit: write protected for dirty page logging */
+#define EPT_DIRTY_LOG_WP	(1UL << 52U)
+/* Software available (ignored) bit: cached lines of the page to be flushed for the guest */
+#define EPT_FLUSH_PENDING_POS	53U
+#define EPT_FLUSH_PENDING	(1UL << EPT_FLUSH_PENDING_POS)
 #define EPT_VE			(1UL << 63U)
 /* EPT leaf entry bits (bit 52 - bit 63) should be maksed  when calculate PFN */
 #define EPT_PFN_HIGH_MASK	0xFFF0000000000000UL
@@ -138,6 +148,7 @@
 #define PML4E_PFN_MASK		0x0000FFFFFFFFF000UL
 #define PDPTE_PFN_MASK		0x0000FFFFFFFFF000UL
 #define PDE_PFN_MASK		0x0000FFFFFFFFF000UL
+#define PTE_PFN_MASK		0x0000FFFFFFFFF000UL
 /**
  * @brief Address space translation
  *
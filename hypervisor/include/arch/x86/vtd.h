@@ -597,6 +597,20 @@ int32_t move_pt_device(const struct iommu_domain *from_domain, struct iommu_doma
  */
 struct iommu_domain *create_iommu_domain(uint16_t vm_id, uint64_t translation_table, uint32_t addr_width);
 
+/**
+ * @brief Flush the IOTLB of the specific iommu domain.
+ *
+ * Invalidate the translations and the paging-structure caches of the domain
+ * on all IOMMUs, which are not ignored on the platform, and wait for the
+ * invalidation to complete.
+ *
+ * @param[in] domain iommu domain to flush
+ *
+ * @pre domain != NULL
+ *
+ */
+void iommu_flush_domain(const struct iommu_domain *domain);
+
 /**
  * @brief Destroy the specific iommu domain.
  *
@@ -233,6 +233,22 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param);
  */
 int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_gpa);
 
+/**
+ * @brief control the dirty page logging of a VM
+ *
+ * Enable or disable the logging of the guest pages written by the VM, or
+ * fetch and clear the dirty bitmap of a guest physical address range.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -32,6 +32,7 @@
 
 #include <spinlock.h>
 #include <pci.h>
+#include <list.h>
 
 
 struct pci_vbar {
@@ -56,9 +57,25 @@ struct pci_msi {
 	uint32_t  caplen;
 };
 
+/* MSI-X table page trap counters */
+struct msix_trap_stats {
+	uint64_t table_reads;
+	uint64_t table_writes;
+	uint64_t fast_writes;	/* mask/unmask done without an IRTE update */
+	uint64_t deferred;	/* address/data writes to masked vectors, remapped on unmask */
+	uint64_t remaps;	/* IRTE (re)programmed */
+	uint64_t other;		/* PBA and device registers sharing the table pages */
+};
+
 /* MSI-X capability structure */
 struct pci_msix {
 	struct msix_table_entry table_entries[CONFIG_MAX_MSIX_TABLE_NUM];
+	/* the IRTE matches table_entries[i].addr/data, unmask needs no remap */
+	bool remapped[CONFIG_MAX_MSIX_TABLE_NUM];
+	/* physical address/data written by the last remap, lost on a device reset */
+	uint64_t remapped_addr[CONFIG_MAX_MSIX_TABLE_NUM];
+	uint32_t remapped_data[CONFIG_MAX_MSIX_TABLE_NUM];
+	struct msix_trap_stats stats;
 	uint64_t  mmio_gpa;
 	uint64_t  mmio_hpa;
 	uint64_t  mmio_size;
@@ -123,6 +140,9 @@ struct pci_vdev {
 
 	/* For SOS, if the device is latterly assigned to a UOS, we use this field to track the new owner. */
 	struct pci_vdev *new_owner;
+
+	/* Link in the vdevs_hlist_heads bucket of its BDF */
+	struct list_head hlist;
 };
 
 union pci_cfg_addr_reg {
@@ -135,6 +155,9 @@ union pci_cfg_addr_reg {
 	} bits;
 };
 
+#define VDEV_LIST_HASHBITS	7U
+#define VDEV_LIST_HASHSIZE	(1U << VDEV_LIST_HASHBITS)
+
 struct acrn_vpci {
 	spinlock_t lock;
 	struct acrn_vm *vm;
@@ -142,6 +165,8 @@ struct acrn_vpci {
 	uint64_t pci_mmcfg_base;
 	uint32_t pci_vdev_cnt;
 	struct pci_vdev pci_vdevs[CONFIG_MAX_PCI_DEV_NUM];
+	/* pci_vdevs hashed by virtual BDF, for pci_find_vdev */
+	struct list_head vdevs_hlist_heads[VDEV_LIST_HASHSIZE];
 };
 
 extern const struct pci_vdev_ops vhostbridge_ops;
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2020 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef VRTC_H
+#define VRTC_H
+
+#include <types.h>
+#include <spinlock.h>
+#include <timer.h>
+
+#define RTC_NVRAM_SIZE		128U
+
+struct acrn_vm;
+
+struct acrn_vrtc {
+	struct acrn_vm *vm;
+	spinlock_t lock;
+
+	uint8_t addr;				/* CMOS RAM index latched from port 0x70 */
+	uint8_t nvram[RTC_NVRAM_SIZE];		/* status registers and CMOS RAM */
+
+	/*
+	 * Guest time is the host time snapshot plus the elapsed TSC plus
+	 * offset_sec. While RTCSB_HALT is set the time registers in nvram
+	 * hold the guest time and offset_sec is recomputed on release.
+	 */
+	int64_t offset_sec;
+
+	struct hv_timer periodic_timer;		/* periodic interrupt, RTCSA rate */
+	struct hv_timer update_timer;		/* 1Hz update-ended and alarm check */
+	bool periodic_armed;
+	bool update_armed;
+	uint16_t periodic_pcpu_id;		/* pCPU whose timer list holds an armed timer */
+	uint16_t update_pcpu_id;
+
+	/* guest RAM reported in the NVRAM memory size cells */
+	uint64_t lowmem_top;
+	uint64_t highmem_base;
+	uint64_t highmem_top;
+};
+
+void vrtc_init(struct acrn_vm *vm);
+void vrtc_reset(struct acrn_vm *vm);
+void vrtc_deinit(struct acrn_vm *vm);
+void vrtc_add_memory_region(struct acrn_vm *vm, uint64_t gpa, uint64_t size);
+void vrtc_sync_host_time(void);
+
+#endif /* VRTC_H */
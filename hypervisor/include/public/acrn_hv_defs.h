@@ -56,6 +56,7 @@
 #define HC_VM_GPA2HPA               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x01UL)
 #define HC_VM_SET_MEMORY_REGIONS    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x02UL)
 #define HC_VM_WRITE_PROTECT_PAGE    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x03UL)
+#define HC_VM_DIRTY_LOG             BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x04UL)
 
 /* PCI assignment*/
 #define HC_ID_PCI_BASE              0x50UL
@@ -174,6 +175,36 @@ struct wp_data {
 	uint64_t gpa;
 } __aligned(8);
 
+#define DIRTY_LOG_ENABLE		0U
+#define DIRTY_LOG_DISABLE		1U
+#define DIRTY_LOG_GET_AND_CLEAR		2U
+
+/**
+ * @brief Info to control the dirty page logging of a VM
+ *
+ * the parameter for HC_VM_DIRTY_LOG hypercall
+ */
+struct acrn_dirty_log {
+	/** DIRTY_LOG_ENABLE, DIRTY_LOG_DISABLE or DIRTY_LOG_GET_AND_CLEAR */
+	uint32_t cmd;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** DIRTY_LOG_GET_AND_CLEAR: first guest physical address of the
+	 *  range, aligned to 256KB (the pages of one 64-bit bitmap word)
+	 */
+	uint64_t gpa;
+
+	/** DIRTY_LOG_GET_AND_CLEAR: size of the range, multiple of 256KB */
+	uint64_t size;
+
+	/** DIRTY_LOG_GET_AND_CLEAR: SOS guest physical address of the
+	 *  bitmap, one bit per 4KB page of the range
+	 */
+	uint64_t bitmap_gpa;
+} __aligned(8);
+
 /**
  * Setup parameter for share buffer, used for HC_SETUP_SBUF hypercall
  */
@@ -57,7 +57,7 @@ def gen_sdc_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
-          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_HV_RTC)", file=config)
 
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
@@ -98,7 +98,7 @@ def gen_sdc2_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
-          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_HV_RTC)", file=config)
 
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
@@ -217,7 +217,7 @@ def gen_industry_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t(GUEST_FLAG_SECURE_WORLD_ENABLED | " +
           "GUEST_FLAG_LAPIC_PASSTHROUGH | \\", file=config)
-    print("\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+    print("\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_HV_RTC)", file=config)
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
     print("\t\t\t\t\tSOS_CONSOLE\t\\", file=config)
@@ -242,7 +242,7 @@ def gen_hybrid_header(vm_info, config):
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
-          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+          "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING | GUEST_FLAG_HV_RTC)", file=config)
 
     print("", file=config)
     scenario_vm_num(vm_info.load_order_cnt, config)
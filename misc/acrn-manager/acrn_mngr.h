@@ -27,6 +27,9 @@ header file.
 #define ACRN_DM_BASE_PATH	"/run/acrn"
 #define ACRN_DM_SOCK_PATH	"/run/acrn/mngr"
 
+/* set in its environment, acrn-dm waits for DM_CONTINUE before booting */
+#define ACRN_DM_WARM_ENV	"ACRN_DM_WARM"
+
 /* TODO: Revisit PARAM_LEN and see if size can be reduced */
 #define PARAM_LEN	256
 
@@ -46,7 +49,7 @@ struct mngr_msg {
 		/* ack of WAKEUP_REASON */
 		unsigned reason;
 
-		/* ack of DM_QUERY */
+		/* ack of DM_QUERY, DM_NOTIFY: vm_suspend_how or DM_STATE_WARM */
 		int state;
 
 		/* req of ACRND_TIMER */
@@ -98,17 +101,24 @@ enum dm_msgid {
 	DM_CONTINUE,		/* Unfreeze this virtual machine */
 	DM_QUERY,		/* Ask power state of this UOS */
 	DM_BLKRESCAN,		/* Rescan virtio-blk device for any changes in UOS */
+	DM_PRECOPY,		/* Pre-copy UOS RAM to a file or socket, then pause */
 	DM_MAX,
 };
 
 /* DM handled message req/ack pairs */
 
+/* state of a warm DM: ready to boot the VM on DM_CONTINUE */
+#define DM_STATE_WARM	0x100
+
 /* Acrnd handled message event types */
 enum acrnd_msgid {
 	/* DM -> Acrnd */
 	ACRND_TIMER = DM_MAX + 1,	/* DM request to setup a launch timer */
 	ACRND_REASON,		/* DM ask for updating wakeup reason */
-	DM_NOTIFY,		/* DM notify Acrnd that state is changed */
+	DM_NOTIFY,		/* DM notify Acrnd that state is changed: sent to
+				 * a DM, it acks with the state, then sends a
+				 * DM_NOTIFY each time the state changes on the
+				 * same connection until it is closed */
 
 	/* SOS-LCS ->Acrnd */
 	ACRND_STOP,		/* SOS-LCS request to Stop all UOS */
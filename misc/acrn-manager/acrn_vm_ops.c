@@ -12,7 +12,13 @@
 #include <limits.h>
 #include <pthread.h>
 #include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include "acrnctl.h"
 #include "acrn_mngr.h"
 #include "mevent.h"
@@ -25,6 +31,7 @@ const char *state_str[] = {
 	[VM_PAUSED] = "paused",
 	[VM_SUSPENDED] = "suspended",
 	[VM_UNTRACKED] = "untracked",
+	[VM_WARM] = "warm",
 };
 
 /* List head of all vm */
@@ -32,6 +39,10 @@ static pthread_mutex_t vmmngr_mutex = PTHREAD_MUTEX_INITIALIZER;
 struct vmmngr_list_struct vmmngr_head = { NULL };
 static unsigned long update_count = 0;
 
+/* set once acrnd tracks the VMs from events, see vmmngr_watch_start() */
+static int watching;
+static pthread_cond_t vmmngr_cond = PTHREAD_COND_INITIALIZER;
+
 struct vmmngr_struct *vmmngr_find(const char *name)
 {
 	struct vmmngr_struct *s;
@@ -42,6 +53,46 @@ struct vmmngr_struct *vmmngr_find(const char *name)
 	return NULL;
 }
 
+static struct vmmngr_struct *vmmngr_find_or_alloc(const char *name)
+{
+	struct vmmngr_struct *vm;
+
+	vm = vmmngr_find(name);
+	if (vm)
+		return vm;
+
+	vm = calloc(1, sizeof(*vm));
+	if (!vm) {
+		printf("%s: Failed to alloc mem for %s\n", __func__, name);
+		return NULL;
+	}
+	memcpy(vm->name, name, sizeof(vm->name) - 1);
+	vm->monitor_fd = -1;
+	LIST_INSERT_HEAD(&vmmngr_head, vm, list);
+
+	return vm;
+}
+
+/* vm state from the suspend mode a DM reports */
+static unsigned long dm_state_to_vm_state(int state)
+{
+	if (state < 0)
+		/* unsupport query */
+		return VM_STARTED;
+
+	switch (state) {
+	case VM_SUSPEND_NONE:
+		return VM_STARTED;
+	case VM_SUSPEND_SUSPEND:
+		return VM_SUSPENDED;
+	case DM_STATE_WARM:
+		return VM_WARM;
+	default:
+		fprintf(stderr, "Warnning: unknow vm state:0x%x\n", state);
+		return VM_STATE_UNKNOWN;
+	}
+}
+
 static int send_msg(const char *vmname, struct mngr_msg *req, struct mngr_msg *ack);
 
 static int query_state(const char *name)
@@ -138,36 +189,13 @@ static void _scan_alive_vm(void)
 			printf("%s: Truncate name as %s\n", __func__, name);
 		}
 
-		vm = vmmngr_find(name);
-
-		if (!vm) {
-			vm = calloc(1, sizeof(*vm));
-			if (!vm) {
-				printf("%s: Failed to alloc mem for %s\n", __func__, name);
-				continue;
-			}
-			memcpy(vm->name, name, sizeof(vm->name) - 1);
-			LIST_INSERT_HEAD(&vmmngr_head, vm, list);
-		}
+		vm = vmmngr_find_or_alloc(name);
+		if (!vm)
+			continue;
 
 		ret = query_state(name);
-
-		if (ret < 0)
-			/* unsupport query */
-			vm->state_tmp = VM_STARTED;
-		else
-			switch (ret) {
-			case VM_SUSPEND_NONE:
-				vm->state_tmp = VM_STARTED;
-				break;
-			case VM_SUSPEND_SUSPEND:
-				vm->state_tmp = VM_SUSPENDED;
-				break;
-			default:
-				fprintf(stderr, "Warnning: unknow vm state:0x%lx\n",
-										vm->state);
-				vm->state_tmp = VM_STATE_UNKNOWN;
-			}
+		vm->state_tmp = dm_state_to_vm_state(ret);
+		vm->pid = pid;
 		vm->update = update_count;
 	}
 
@@ -188,14 +216,13 @@ static inline int _get_vmname_suffix(const char *src,
 	if (!p || p - src == 0)
 		return -1;
 
-	strncpy(name, src, p - src);
+	snprintf(name, max_len_name, "%.*s", (int)(p - src), src);
 	if (p - src >= max_len_name) {
 		/* truncate name and go a head */
-		name[max_len_name - 1] = '\0';
 		printf("%s: Truncate name as %s\n", __func__, name);
 	}
 
-	strncpy(suffix, p + 1, max_len_suffix);
+	snprintf(suffix, max_len_suffix, "%s", p + 1);
 	if (strncmp(suffix, "sh", strlen("sh")))
 		return -1;
 
@@ -242,19 +269,13 @@ static void _scan_added_vm(void)
 		if (ret < 0)
 			continue;
 
-		vm = vmmngr_find(name);
-
-		if (!vm) {
-			vm = calloc(1, sizeof(*vm));
-			if (!vm) {
-				printf("%s: Failed to alloc mem for %s\n", __func__, name);
-				continue;
-			}
-			memcpy(vm->name, name, sizeof(vm->name) - 1);
-			LIST_INSERT_HEAD(&vmmngr_head, vm, list);
-		}
+		vm = vmmngr_find_or_alloc(name);
+		if (!vm)
+			continue;
 
 		vm->state_tmp = VM_CREATED;
+		vm->pid = 0;
+		vm->added = 1;
 		vm->update = update_count;
 	}
 
@@ -278,6 +299,10 @@ static void _remove_dead_vm(void)
 
 void vmmngr_update(void)
 {
+	/* the watcher keeps the list current */
+	if (watching)
+		return;
+
 	pthread_mutex_lock(&vmmngr_mutex);
 	update_count++;
 	_scan_added_vm();
@@ -286,6 +311,505 @@ void vmmngr_update(void)
 	pthread_mutex_unlock(&vmmngr_mutex);
 }
 
+void vmmngr_lock(void)
+{
+	pthread_mutex_lock(&vmmngr_mutex);
+}
+
+void vmmngr_unlock(void)
+{
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+/* connect to /run/acrn/mngr/[vmname].monitor.[pid].socket */
+static int dm_connect(const char *name, int pid, int retry)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path),
+		 ACRN_DM_SOCK_PATH "/%s.monitor.%d.socket", name, pid);
+
+	/* the socket shows up at bind(), the DM may not listen yet */
+	while (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		if (errno != ECONNREFUSED || retry-- <= 0) {
+			close(fd);
+			return -1;
+		}
+		usleep(10000);
+	}
+
+	return fd;
+}
+
+static int dm_write_req(int fd, unsigned msgid)
+{
+	struct mngr_msg req;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = msgid;
+	req.timestamp = time(NULL);
+
+	if (write(fd, &req, sizeof(req)) != sizeof(req))
+		return -1;
+	return 0;
+}
+
+/*
+ * acrnd VM watcher
+ *
+ * One thread waits on an epoll set holding an inotify fd, which reports
+ * the DM monitor sockets and the launch scripts showing up or going away,
+ * and a persistent connection to every running DM. On that connection the
+ * DM answers DM_QUERY, then pushes a DM_NOTIFY with its state each time it
+ * changes; the connection is closed when the DM exits. vmmngr_cond is
+ * broadcast after each change of the list.
+ */
+#define WATCH_CONNECT_RETRY	50	/* 10ms each */
+#define WATCH_MAX_EVENTS	16
+
+static int watch_epfd = -1;
+static int watch_inofd = -1;
+static int watch_sock_wd = -1;
+static int watch_conf_wd = -1;
+static pthread_t watch_tid;
+
+/* tell how long a DM launched by acrnd took to get up */
+static void watch_report_launch(struct vmmngr_struct *vm)
+{
+	struct timespec now;
+
+	if (!vm->launched.tv_sec ||
+	    (vm->state != VM_STARTED && vm->state != VM_WARM))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	printf("%s: %s %ld ms after launch\n", vm->name, state_str[vm->state],
+		(now.tv_sec - vm->launched.tv_sec) * 1000 +
+		(now.tv_nsec - vm->launched.tv_nsec) / 1000000);
+	vm->launched.tv_sec = 0;
+	vm->launched.tv_nsec = 0;
+}
+
+/* a vm without DM: stopped if it can be launched again, gone otherwise */
+static void watch_vm_down(struct vmmngr_struct *vm)
+{
+	if (vm->monitor_fd >= 0)
+		close(vm->monitor_fd);
+	vm->monitor_fd = -1;
+	vm->pid = 0;
+
+	if (vm->added) {
+		vm->state = VM_CREATED;
+		return;
+	}
+
+	LIST_REMOVE(vm, list);
+	printf("%s: Removed dead %s\n", __func__, vm->name);
+	free(vm);
+}
+
+static void watch_sock_added(const char *fname, int retry)
+{
+	struct vmmngr_struct *vm;
+	struct epoll_event ev;
+	char name[PATH_LEN] = {};
+	int pid, fd;
+
+	if (_get_vmname_pid(fname, name, sizeof(name), &pid) < 0)
+		return;
+	name[MAX_VMNAME_LEN - 1] = '\0';
+
+	fd = dm_connect(name, pid, retry);
+	if (fd < 0) {
+		printf("%s: Failed to connect to %s\n", __func__, fname);
+		return;
+	}
+
+	/* DM_QUERY for the current state, DM_NOTIFY to get the changes */
+	if (dm_write_req(fd, DM_QUERY) < 0 || dm_write_req(fd, DM_NOTIFY) < 0) {
+		printf("%s: Failed to subscribe to %s\n", __func__, fname);
+		close(fd);
+		return;
+	}
+
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = fd;
+	if (epoll_ctl(watch_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("Add DM to epoll");
+		close(fd);
+		return;
+	}
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	vm = vmmngr_find_or_alloc(name);
+	if (vm) {
+		/* a new DM of the same name replaces the old one */
+		if (vm->monitor_fd >= 0)
+			close(vm->monitor_fd);
+		vm->monitor_fd = fd;
+		vm->pid = pid;
+		/* until the DM_QUERY ack tells */
+		vm->state = VM_STATE_UNKNOWN;
+		pthread_cond_broadcast(&vmmngr_cond);
+	} else {
+		close(fd);
+	}
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+static void watch_conf_changed(const char *fname, int added)
+{
+	struct vmmngr_struct *vm;
+	char name[PATH_LEN] = {};
+	char suffix[PATH_LEN] = {};
+
+	if (strnlen(fname, PATH_LEN) >= PATH_LEN)
+		return;
+	if (_get_vmname_suffix(fname, name, sizeof(name),
+				suffix, sizeof(suffix)) < 0)
+		return;
+	name[MAX_VMNAME_LEN - 1] = '\0';
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	if (added) {
+		vm = vmmngr_find_or_alloc(name);
+		if (vm) {
+			vm->added = 1;
+			if (vm->monitor_fd < 0)
+				vm->state = VM_CREATED;
+		}
+	} else {
+		vm = vmmngr_find(name);
+		if (vm) {
+			vm->added = 0;
+			if (vm->monitor_fd < 0)
+				watch_vm_down(vm);
+		}
+	}
+	pthread_cond_broadcast(&vmmngr_cond);
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+static void watch_scan_dir(const char *path, int conf)
+{
+	DIR *dir;
+	struct dirent *entry;
+
+	dir = opendir(path);
+	if (!dir) {
+		printf("%s: Failed to open directory %s\n", __func__, path);
+		return;
+	}
+
+	while ((entry = readdir(dir))) {
+		if (conf)
+			watch_conf_changed(entry->d_name, 1);
+		else
+			watch_sock_added(entry->d_name, 0);
+	}
+
+	closedir(dir);
+}
+
+static void watch_dm_event(int fd)
+{
+	struct vmmngr_struct *vm, *found = NULL;
+	struct mngr_msg msg;
+	ssize_t len;
+
+	len = recv(fd, &msg, sizeof(msg), MSG_WAITALL);
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	LIST_FOREACH(vm, &vmmngr_head, list)
+		if (vm->monitor_fd == fd) {
+			found = vm;
+			break;
+		}
+
+	if (!found) {
+		/* replaced by a newer DM */
+		close(fd);
+	} else if (len != sizeof(msg) || msg.magic != MNGR_MSG_MAGIC) {
+		/* DM exited */
+		watch_vm_down(found);
+	} else if (msg.msgid == DM_QUERY || msg.msgid == DM_NOTIFY) {
+		found->state = dm_state_to_vm_state(msg.data.state);
+		if (found->state == VM_STARTED)
+			found->start_pending = 0;
+		watch_report_launch(found);
+	}
+	pthread_cond_broadcast(&vmmngr_cond);
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+static void watch_inotify_event(void)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+
+	len = read(watch_inofd, buf, sizeof(buf));
+	if (len <= 0)
+		return;
+
+	for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+		ev = (const struct inotify_event *)p;
+
+		if (ev->mask & IN_Q_OVERFLOW) {
+			/* events lost, look again */
+			watch_scan_dir(ACRN_CONF_PATH_ADD, 1);
+			watch_scan_dir(ACRN_DM_SOCK_PATH, 0);
+			continue;
+		}
+		if (ev->len == 0)
+			continue;
+
+		if (ev->wd == watch_sock_wd)
+			watch_sock_added(ev->name, WATCH_CONNECT_RETRY);
+		else if (ev->wd == watch_conf_wd)
+			watch_conf_changed(ev->name,
+				ev->mask & (IN_CREATE | IN_MOVED_TO));
+	}
+}
+
+static void *vmmngr_watch_func(void *arg)
+{
+	struct epoll_event ev[WATCH_MAX_EVENTS];
+	int i, n;
+
+	while (1) {
+		n = epoll_wait(watch_epfd, ev, WATCH_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Wait for vm events");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.fd == watch_inofd)
+				watch_inotify_event();
+			else
+				watch_dm_event(ev[i].data.fd);
+		}
+	}
+
+	return NULL;
+}
+
+int vmmngr_watch_start(void)
+{
+	struct epoll_event ev;
+
+	watch_inofd = inotify_init1(IN_CLOEXEC);
+	if (watch_inofd < 0) {
+		perror("Init inotify");
+		return -1;
+	}
+
+	watch_sock_wd = inotify_add_watch(watch_inofd, ACRN_DM_SOCK_PATH,
+					IN_CREATE);
+	if (watch_sock_wd < 0) {
+		perror("Watch " ACRN_DM_SOCK_PATH);
+		goto inotify_err;
+	}
+
+	watch_conf_wd = inotify_add_watch(watch_inofd, ACRN_CONF_PATH_ADD,
+				IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
+	if (watch_conf_wd < 0)
+		printf("%s: No %s, only running vms are tracked\n",
+			__func__, ACRN_CONF_PATH_ADD);
+
+	watch_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (watch_epfd < 0) {
+		perror("Create epoll");
+		goto inotify_err;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = watch_inofd;
+	if (epoll_ctl(watch_epfd, EPOLL_CTL_ADD, watch_inofd, &ev) < 0) {
+		perror("Add inotify to epoll");
+		goto epoll_err;
+	}
+
+	/* the watches are in place, nothing can be missed from here */
+	if (watch_conf_wd >= 0)
+		watch_scan_dir(ACRN_CONF_PATH_ADD, 1);
+	watch_scan_dir(ACRN_DM_SOCK_PATH, 0);
+
+	if (pthread_create(&watch_tid, NULL, vmmngr_watch_func, NULL)) {
+		perror("Create vm watcher");
+		goto epoll_err;
+	}
+	pthread_setname_np(watch_tid, "vmmngr_watch");
+	watching = 1;
+
+	return 0;
+
+ epoll_err:
+	close(watch_epfd);
+	watch_epfd = -1;
+ inotify_err:
+	close(watch_inofd);
+	watch_inofd = -1;
+	return -1;
+}
+
+int vmmngr_wait(int (*done)(void *arg), void *arg, unsigned timeout)
+{
+	struct timespec deadline;
+	unsigned long t = timeout;
+	int ret;
+
+	if (!watching) {
+		/* nothing tells us about changes, poll */
+		do {
+			vmmngr_update();
+			pthread_mutex_lock(&vmmngr_mutex);
+			ret = done(arg);
+			pthread_mutex_unlock(&vmmngr_mutex);
+			if (ret)
+				return ret;
+			sleep(1);
+		} while (t--);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout;
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	while (!(ret = done(arg))) {
+		if (pthread_cond_timedwait(&vmmngr_cond, &vmmngr_mutex,
+					   &deadline) == ETIMEDOUT) {
+			ret = done(arg);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&vmmngr_mutex);
+
+	return ret ? ret : -1;
+}
+
+struct vm_req {
+	char name[MAX_VMNAME_LEN];
+	int pid;
+};
+
+int vmmngr_send_all(struct mngr_msg *req, unsigned long states,
+		    unsigned timeout)
+{
+	struct vmmngr_struct *vm;
+	struct vm_req *vms = NULL;
+	struct pollfd *pfd = NULL;
+	struct mngr_msg ack;
+	struct timespec now, end;
+	int i, n = 0, pending = 0, failed = 0;
+	long ms;
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	LIST_FOREACH(vm, &vmmngr_head, list)
+		if (vm->pid > 0 && (states & VM_STATE_MASK(vm->state)))
+			n++;
+	if (n) {
+		vms = calloc(n, sizeof(*vms));
+		pfd = calloc(n, sizeof(*pfd));
+	}
+	if (!vms || !pfd) {
+		pthread_mutex_unlock(&vmmngr_mutex);
+		free(vms);
+		free(pfd);
+		return n ? n : 0;
+	}
+	i = 0;
+	LIST_FOREACH(vm, &vmmngr_head, list)
+		if (vm->pid > 0 && (states & VM_STATE_MASK(vm->state)) &&
+		    i < n) {
+			memcpy(vms[i].name, vm->name, sizeof(vms[i].name));
+			vms[i].pid = vm->pid;
+			i++;
+		}
+	n = i;
+	pthread_mutex_unlock(&vmmngr_mutex);
+
+	/* send all the requests first */
+	for (i = 0; i < n; i++) {
+		pfd[i].events = POLLIN;
+		pfd[i].fd = dm_connect(vms[i].name, vms[i].pid, 0);
+		if (pfd[i].fd >= 0 &&
+		    write(pfd[i].fd, req, sizeof(*req)) == sizeof(*req)) {
+			pending++;
+			continue;
+		}
+		printf("Unable to send msg to vm %s socket. It may have been shutdown\n",
+			vms[i].name);
+		if (pfd[i].fd >= 0)
+			close(pfd[i].fd);
+		pfd[i].fd = -1;
+		failed++;
+	}
+
+	/* then collect the acks in whatever order they come */
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout;
+	while (pending > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (end.tv_sec - now.tv_sec) * 1000 +
+			(end.tv_nsec - now.tv_nsec) / 1000000;
+		if (ms <= 0)
+			break;
+		if (poll(pfd, n, ms) <= 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (pfd[i].fd < 0 || !pfd[i].revents)
+				continue;
+			if (recv(pfd[i].fd, &ack, sizeof(ack), MSG_WAITALL)
+			    != sizeof(ack)) {
+				ack.msgid = req->msgid;
+				ack.data.err = -1;
+			} else if (ack.msgid != req->msgid) {
+				/* not our ack, keep waiting */
+				continue;
+			}
+			if (ack.data.err) {
+				printf("vm %s failed msg %u, errno(%d)\n",
+					vms[i].name, req->msgid, ack.data.err);
+				failed++;
+			}
+			close(pfd[i].fd);
+			pfd[i].fd = -1;
+			pending--;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (pfd[i].fd < 0)
+			continue;
+		printf("vm %s did not ack msg %u\n", vms[i].name, req->msgid);
+		close(pfd[i].fd);
+		failed++;
+	}
+
+	free(vms);
+	free(pfd);
+	return failed;
+}
+
 /* helper functions */
 int shell_cmd(const char *cmd, char *outbuf, int len)
 {
@@ -356,6 +880,31 @@ int list_vm()
 	return 0;
 }
 
+/* bind the warm DM of @vmname: it boots the VM at once */
+int start_warm_vm(const char *vmname)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	struct timespec t0, t1;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_CONTINUE;
+	req.timestamp = time(NULL);
+	ack.data.err = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (send_msg(vmname, &req, &ack) || ack.data.err) {
+		printf("Unable to start warm vm %s\n", vmname);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("%s: started from a warm DM in %ld ms\n", vmname,
+		(t1.tv_sec - t0.tv_sec) * 1000 +
+		(t1.tv_nsec - t0.tv_nsec) / 1000000);
+	return 0;
+}
+
 int start_vm(const char *vmname)
 {
 	char cmd[PATH_LEN + sizeof(ACRN_CONF_PATH_ADD) * 2 + MAX_VMNAME_LEN * 2];
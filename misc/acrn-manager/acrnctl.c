@@ -563,6 +563,9 @@ static int acrnctl_do_start(int argc, char *argv[])
 		return -1;
 	}
 
+	if (s->state == VM_WARM)
+		return start_warm_vm(argv[1]);
+
 	if (s->state != VM_CREATED) {
 		printf("can't start %s(%s)\n", argv[1], state_str[s->state]);
 		return -1;
@@ -7,6 +7,7 @@
 #define _ACRNCTL_H_
 
 #include <sys/queue.h>
+#include <time.h>
 #include "acrn_mngr.h"
 
 enum vm_state {
@@ -16,6 +17,7 @@ enum vm_state {
 	VM_PAUSED,		/* VM paused */
 	VM_SUSPENDED,		/* VM suspended */
 	VM_UNTRACKED,		/* VM not created by acrnctl, or its launch script can change vm name */
+	VM_WARM,		/* DM ready to boot the VM, waiting to be started */
 };
 
 extern const char *state_str[];
@@ -33,6 +35,11 @@ struct vmmngr_struct {
 	unsigned long state;
 	unsigned long state_tmp;
 	unsigned long update;   /* update count, remove a vm if no update for it */
+	int pid;		/* pid of the DM, 0 if not running */
+	int added;		/* has a launch script in ACRN_CONF_PATH_ADD */
+	int monitor_fd;		/* acrnd: connection to the DM monitor, or -1 */
+	struct timespec launched; /* acrnd: DM launched, not yet up */
+	int start_pending;	/* acrnd: start once the warm DM is up */
 	LIST_ENTRY(vmmngr_struct) list;
 };
 
@@ -45,6 +52,28 @@ int shell_cmd(const char *cmd, char *outbuf, int len);
  */
 void vmmngr_update(void);
 
+/* Keep the VM list up to date from DM state notifications and directory
+ * events instead of rescanning: once started, vmmngr_update() returns
+ * immediately. Walk vmmngr_head with vmmngr_lock() held.
+ */
+int vmmngr_watch_start(void);
+void vmmngr_lock(void);
+void vmmngr_unlock(void);
+
+/* wait until @done, called with the list locked, returns non-zero,
+ * at most @timeout seconds. Returns what @done returned, -1 on timeout.
+ */
+int vmmngr_wait(int (*done)(void *arg), void *arg, unsigned timeout);
+
+#define VM_STATE_MASK(state)	(1UL << (state))
+
+/* send @req to all the running VMs in one of @states at once, and wait
+ * for their acks at most @timeout seconds. Returns the number of VMs
+ * that failed or did not ack.
+ */
+int vmmngr_send_all(struct mngr_msg *req, unsigned long states,
+		    unsigned timeout);
+
 struct vmmngr_list_struct {
 	struct vmmngr_struct *lh_first;
 };
@@ -54,6 +83,7 @@ extern struct vmmngr_list_struct vmmngr_head;
 int list_vm(void);
 int stop_vm(const char *vmname, int force);
 int start_vm(const char *vmname);
+int start_warm_vm(const char *vmname);
 int pause_vm(const char *vmname);
 int continue_vm(const char *vmname);
 int suspend_vm(const char *vmname);
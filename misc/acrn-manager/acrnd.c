@@ -26,6 +26,7 @@
 #define HW_IOC_PATH		"/dev/cbc-early-signals"
 #define VMS_STOP_TIMEOUT	20U /* Time to wait VMs to stop */
 #define SOCK_TIMEOUT		2U
+#define WARM_RETRY		30U /* Time to wait a warm DM before launching another */
 
 /* acrnd worker timer */
 
@@ -48,6 +49,8 @@ static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t acrnd_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
 static unsigned int acrnd_stop_timeout;
 static unsigned char platform_has_hw_ioc;
+static int warm_pool;		/* keep a warm DM ready for each stopped vm */
+static int acrnd_stopping;	/* no more warm DMs until resumed, under vmmngr_lock */
 
 static int sigterm = 0; /* Exit acrnd when recevied SIGTERM and stop all vms */
 
@@ -134,6 +137,7 @@ unsigned get_sos_wakeup_reason(void);
 void acrnd_vm_timer_func(struct work_arg *arg)
 {
 	struct vmmngr_struct *vm;
+	unsigned long state;
 	pid_t pid;
 
 	if (!arg) {
@@ -142,23 +146,38 @@ void acrnd_vm_timer_func(struct work_arg *arg)
 	}
 
 	vmmngr_update();
+	vmmngr_lock();
 	vm = vmmngr_find(arg->name);
 	if (!vm) {
+		vmmngr_unlock();
 		printf("%s: Can't find %s\n", __func__, arg->name);
 		return;
 	}
+	state = vm->state;
+	if (state == VM_CREATED && warm_pool && vm->launched.tv_sec) {
+		/* its warm DM is on the way, start it once up */
+		vm->start_pending = 1;
+		vmmngr_unlock();
+		return;
+	}
+	if (state == VM_CREATED)
+		clock_gettime(CLOCK_MONOTONIC, &vm->launched);
+	vmmngr_unlock();
 
-	switch (vm->state) {
+	switch (state) {
 	case VM_CREATED:
 		pid = fork();
 		if (!pid)
-			acrnd_run_vm(vm->name);
+			acrnd_run_vm(arg->name);
+		break;
+	case VM_WARM:
+		start_warm_vm(arg->name);
 		break;
 	case VM_SUSPENDED:
 		resume_vm(arg->name, CBC_WK_RSN_RTC);
 		break;
 	default:
-		printf("%s: Unknown vm state %ld\n", __func__, vm->state);
+		printf("%s: Unknown vm state %ld\n", __func__, state);
 	}
 }
 
@@ -251,66 +270,152 @@ static void acrnd_run_vm(char *name)
 	exit(0);
 }
 
+static int wakeup_suspended_vms(unsigned wakeup_reason)
+{
+	struct mngr_msg req;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_RESUME;
+	req.timestamp = time(NULL);
+	req.data.reason = wakeup_reason;
+
+	vmmngr_update();
+
+	/* resume them all at once, not one socket timeout after another */
+	return vmmngr_send_all(&req, VM_STATE_MASK(VM_SUSPENDED),
+				SOCK_TIMEOUT) ? -1 : 0;
+}
+
 static int active_all_vms(void)
 {
 	struct vmmngr_struct *vm;
-	int ret = 0;
+	int suspended = 0;
 	pid_t pid;
 	unsigned reason = 0;
 
 	vmmngr_update();
 
+	vmmngr_lock();
 	LIST_FOREACH(vm, &vmmngr_head, list) {
 		switch (vm->state) {
 		case VM_CREATED:
+			if (warm_pool && vm->launched.tv_sec) {
+				/* its warm DM is on the way, start it once up */
+				vm->start_pending = 1;
+				break;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &vm->launched);
 			pid = fork();
 			if (!pid)
 				acrnd_run_vm(vm->name);
 			break;
+		case VM_WARM:
+			vm->start_pending = 1;
+			break;
 		case VM_SUSPENDED:
-			if (platform_has_hw_ioc) {
-				reason = get_sos_wakeup_reason();
-			}
-			ret += resume_vm(vm->name, reason);
+			suspended++;
 			break;
 		default:
 			printf("%s: Unkown vm state %ld\n", __func__, vm->state);
 		}
 	}
+	vmmngr_unlock();
 
-	return ret ? -1 : 0;
+	if (!suspended)
+		return 0;
+
+	if (platform_has_hw_ioc) {
+		reason = get_sos_wakeup_reason();
+	}
+	return wakeup_suspended_vms(reason);
 }
 
 static void stop_all_vms(void)
 {
-	struct vmmngr_struct *vm;
-	int err;
+	struct mngr_msg req;
+	int failed;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_STOP;
+	req.timestamp = time(NULL);
+	req.data.acrnd_stop.force = 0;
 
 	vmmngr_update();
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		err = stop_vm(vm->name, 0);
-		if (err != 0) {
-			fprintf(stderr, "Fail to send stop cmd to vm %s\n", vm->name);
-		} else {
-			printf("Send stop cmd to vm %s successfully\n", vm->name);
-		}
-	}
+	failed = vmmngr_send_all(&req, VM_STATE_MASK(VM_STARTED) |
+				VM_STATE_MASK(VM_SUSPENDED) |
+				VM_STATE_MASK(VM_PAUSED) |
+				VM_STATE_MASK(VM_WARM) |
+				VM_STATE_MASK(VM_STATE_UNKNOWN), SOCK_TIMEOUT);
+	if (failed)
+		fprintf(stderr, "Fail to send stop cmd to %d vm(s)\n", failed);
+	else
+		printf("Send stop cmd to all vms successfully\n");
 }
 
-static int wakeup_suspended_vms(unsigned wakeup_reason)
+static void acrnd_set_stopping(int stopping)
+{
+	vmmngr_lock();
+	acrnd_stopping = stopping;
+	vmmngr_unlock();
+}
+
+/*
+ * Warm pool: with -w, acrnd launches a DM in warm mode for each stopped
+ * vm. It sets up the VM as far as it can without running it, then waits;
+ * starting the VM is then one message to it instead of a full launch.
+ * A start asked while the warm DM is on its way waits for it.
+ */
+static void refill_warm_pool(void)
 {
 	struct vmmngr_struct *vm;
-	int ret = 0;
+	struct timespec now;
+	char name[MAX_VMNAME_LEN];
+	pid_t pid;
 
 	vmmngr_update();
 
-	LIST_FOREACH(vm, &vmmngr_head, list) {
-		if (vm->state == VM_SUSPENDED)
-			ret += resume_vm(vm->name, wakeup_reason);
+	/* start the warm vms that were asked for */
+	do {
+		name[0] = '\0';
+		vmmngr_lock();
+		LIST_FOREACH(vm, &vmmngr_head, list)
+			if (vm->state == VM_WARM && vm->start_pending) {
+				vm->start_pending = 0;
+				memcpy(name, vm->name, sizeof(name));
+				break;
+			}
+		vmmngr_unlock();
+
+		if (name[0])
+			start_warm_vm(name);
+	} while (name[0]);
+
+	if (!warm_pool)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	vmmngr_lock();
+	if (acrnd_stopping) {
+		vmmngr_unlock();
+		return;
 	}
+	LIST_FOREACH(vm, &vmmngr_head, list) {
+		if (vm->state != VM_CREATED || !vm->added)
+			continue;
+		if (vm->launched.tv_sec &&
+		    now.tv_sec - vm->launched.tv_sec < WARM_RETRY)
+			continue;
 
-	return ret ? -1 : 0;
+		vm->launched = now;
+		pid = fork();
+		if (!pid) {
+			setenv(ACRN_DM_WARM_ENV, "1", 1);
+			acrnd_run_vm(vm->name);
+		}
+	}
+	vmmngr_unlock();
 }
 
 static int acrnd_fd = -1;
@@ -353,7 +458,9 @@ static void handle_timer_req(struct mngr_msg *msg, int client_fd, void *param)
 	ack.data.err = -1;
 
 	vmmngr_update();
+	vmmngr_lock();
 	vm = vmmngr_find(msg->data.acrnd_timer.name);
+	vmmngr_unlock();
 	if (!vm) {
 		printf("%s: Can't find %s\n", __func__, msg->data.acrnd_timer.name);
 		goto reply_ack;
@@ -453,6 +560,7 @@ static int store_timer_list(void)
 	return ret;
 }
 
+/* called with the vm list locked */
 static int check_vms_status(unsigned int status)
 {
 	struct vmmngr_struct *s;
@@ -464,33 +572,33 @@ static int check_vms_status(unsigned int status)
 	return 0;
 }
 
-static int wait_for_stop(unsigned int timeout)
+static int vms_stopped(void *arg)
 {
-	unsigned long t = timeout;
+	if (check_vms_status(VM_CREATED) == 0)
+		return SHUTDOWN;
 
-	/*Let ospm stopping UOSs */
+	if (check_vms_status(VM_SUSPENDED) == 0)
+		return SUSPEND;
 
-	/* list and update the vm status */
-	do {
-		vmmngr_update();
+	return 0;
+}
 
-		printf("Waiting %lu seconds for all vms enter S3/S5 state\n", t);
+static int wait_for_stop(unsigned int timeout)
+{
+	int ret;
 
-		if (check_vms_status(VM_CREATED) == 0) {
-			printf("All vms have entered S5 state successfully\n");
-			return SHUTDOWN;
-		}
+	/*Let ospm stopping UOSs */
 
-		if (check_vms_status(VM_SUSPENDED) == 0) {
-			printf("All vms have entered S3 state successfully\n");
-			return SUSPEND;
-		}
+	/* woken up by each vm state change */
+	printf("Waiting %u seconds for all vms enter S3/S5 state\n", timeout);
+	ret = vmmngr_wait(vms_stopped, NULL, timeout);
 
-		sleep(1);
-	}
-	while (t--);
+	if (ret == SHUTDOWN)
+		printf("All vms have entered S5 state successfully\n");
+	else if (ret == SUSPEND)
+		printf("All vms have entered S3 state successfully\n");
 
-	return -1;
+	return ret;
 }
 
 static void* notify_stop_state(void *arg)
@@ -501,6 +609,13 @@ static void* notify_stop_state(void *arg)
 
 	req.magic = MNGR_MSG_MAGIC;
 
+	/* warm DMs only need to go away */
+	acrnd_set_stopping(1);
+	req.msgid = DM_STOP;
+	req.timestamp = time(NULL);
+	req.data.acrnd_stop.force = 0;
+	vmmngr_send_all(&req, VM_STATE_MASK(VM_WARM), SOCK_TIMEOUT);
+
 	rc = wait_for_stop(acrnd_stop_timeout);
 	if (rc < 0) {
 		fprintf(stderr, "Timeout(%u sec) to wait all vms enter S3/S5\n", acrnd_stop_timeout);
@@ -594,6 +709,8 @@ void handle_acrnd_resume(struct mngr_msg *msg, int client_fd, void *param)
 	ack.timestamp = msg->timestamp;
 	ack.data.err = -1;
 
+	acrnd_set_stopping(0);
+
 	/* acrnd get wakeup_reason from sos lcs */
 	if (platform_has_hw_ioc) {
 		wakeup_reason = get_sos_wakeup_reason();
@@ -675,18 +792,19 @@ static void sigterm_handler(int signo)
 	sigterm = 1;
 }
 
-static const char optString[] = "td:h";
+static const char optString[] = "td:hw";
 
 static void display_usage(void)
 {
 	printf("acrnd - Daemon for ACRN VM Management\n"
 #ifdef MNGR_DEBUG
-	       "[Usage] acrnd [-t] [-d delay] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-w] [-d delay] [-h]\n\n"
 #else
-	       "[Usage] acrnd [-t] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-w] [-h]\n\n"
 #endif
 	       "[Options]\n"
 	       "\t-t: print messages to stdout\n"
+	       "\t-w: keep a warm acrn-dm ready to start each stopped vm\n"
 #ifdef MNGR_DEBUG
 	       "\t-d: delay the autostarting of VMs, <0-60> in second\n"
 #endif
@@ -706,6 +824,9 @@ static int parse_opt(int argc, char *argv[])
 		case 't':
 			logfile = 0;
 			break;
+		case 'w':
+			warm_pool = 1;
+			break;
 #ifdef MNGR_DEBUG
 		case 'd':
 			delay = strtol(optarg, NULL, 10);
@@ -771,6 +892,10 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* track vm states from events, fall back to rescanning on failure */
+	if (vmmngr_watch_start())
+		printf("%s: Failed to watch vms, polling them\n", __func__);
+
 	if (init_vm()) {
 		printf("%s: Failed to init_vm\n", __func__);
 		return -1;
@@ -791,8 +916,10 @@ int main(int argc, char *argv[])
 	/* Last thing, run our timer works */
 	while (!sigterm) {
 		try_do_works();
+		refill_warm_pool();
 		sleep(1);
 	}
+	acrnd_set_stopping(1);
 
 	/*
 	 * Try to stop all the vms when receiving SIGTERM within VMS_STOP_TIMEOUT sec
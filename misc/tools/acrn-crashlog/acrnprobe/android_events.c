@@ -107,10 +107,15 @@ static char *next_vm_event(const char *cursor, const char *data,
 	return line_to_sync;
 }
 
-static int get_vms_history(const struct sender_t *sender)
+/**
+ * Bring the history_event of each vm up to date. The data partition stays
+ * open between the polls and only what the vm appended to its history since
+ * the last poll is read from it.
+ */
+static int get_vms_history(void)
 {
 	struct vm_t *vm;
-	unsigned long size;
+	unsigned long old_size;
 	int ret;
 	int id;
 
@@ -118,38 +123,44 @@ static int get_vms_history(const struct sender_t *sender)
 		if (!vm)
 			continue;
 
-		if (e2fs_open(loop_dev, &vm->datafs) == -1)
+		if (!vm->datafs &&
+		    e2fs_open_uncached(loop_dev, &vm->datafs) == -1)
 			continue;
 
-		if (e2fs_read_file_by_fpath(vm->datafs, android_histpath,
-					    (void **)&vm->history_data,
-					    &size) == -1) {
+		old_size = vm->history.size;
+		ret = e2fs_read_file_tail(vm->datafs, android_histpath,
+					  &vm->history);
+		if (ret == -1) {
 			LOGE("failed to get vm_history from (%s).\n", vm->name);
-			vm->history_data = NULL;
+			e2fs_free_file_tail(&vm->history);
+			memset(vm->history_scanned, 0,
+			       sizeof(vm->history_scanned));
+			vm->history_lines = 0;
 			e2fs_close(vm->datafs);
 			vm->datafs = NULL;
 			continue;
 		}
 
-		e2fs_close(vm->datafs);
-		vm->datafs = NULL;
-
-		if (!size) {
-			LOGE("empty vm_history from (%s).\n", vm->name);
-			vm->history_data = NULL;
+		if (ret == E2FS_TAIL_UNCHANGED)
 			continue;
-		}
 
-		/* warning large history file once */
-		if (size == vm->history_size[sender->id])
-			continue;
+		if (ret == E2FS_TAIL_REPLACED) {
+			memset(vm->history_scanned, 0,
+			       sizeof(vm->history_scanned));
+			vm->history_lines = 0;
+			old_size = 0;
+			if (!vm->history.size) {
+				LOGE("empty vm_history from (%s).\n",
+				     vm->name);
+				continue;
+			}
+		}
 
-		ret = strcnt(vm->history_data, '\n');
-		if (ret > VM_WARNING_LINES)
+		/* warning large history file once it changes */
+		vm->history_lines += strcnt(vm->history.data + old_size, '\n');
+		if (vm->history_lines > VM_WARNING_LINES)
 			LOGW("File too large, (%d) lines in (%s) of (%s)\n",
-			     ret, android_histpath, vm->name);
-
-		vm->history_size[sender->id] = size;
+			     vm->history_lines, android_histpath, vm->name);
 	}
 
 	return 0;
@@ -162,26 +173,33 @@ static int get_vms_history(const struct sender_t *sender)
  *         the corresponding process.
  *
  * The design reason is giving UOS some time to get log stored.
+ *
+ * @return the number of new vm events.
  */
-static void detect_new_events(struct sender_t *sender)
+static int detect_new_events(struct sender_t *sender)
 {
 	int id;
+	int count = 0;
 	struct vm_t *vm;
 
 	for_each_vm(id, vm, conf) {
 		char *data;
 		size_t data_size;
 		char *start;
+		char *end;
 		char *last_key;
 		char *line_to_sync;
 
-		if (!vm || !vm->history_data)
+		if (!vm || !vm->history.size)
 			continue;
 
-		data = vm->history_data;
-		data_size = vm->history_size[sender->id];
+		data = vm->history.data;
+		data_size = vm->history.size;
 		last_key = &vm->last_evt_detected[sender->id][0];
-		if (*last_key) {
+		if (vm->history_scanned[sender->id]) {
+			/* only the lines appended since the last poll */
+			start = data + vm->history_scanned[sender->id] - 1;
+		} else if (*last_key) {
 			start = strstr(data, last_key);
 			if (start == NULL) {
 				LOGW("no synced id (%s), sync from head\n",
@@ -234,9 +252,17 @@ static void detect_new_events(struct sender_t *sender)
 			if (vmrecord_new(&sender->vmrecord, vm->name,
 					  vmkey) == -1)
 				LOGE("failed to new vm record\n");
+			else
+				count++;
 		}
+
+		/* the line after the last '\n' may be still being written */
+		end = memrchr(data, '\n', data_size);
+		if (end)
+			vm->history_scanned[sender->id] = end - data + 1;
 	}
 
+	return count;
 }
 
 static char *next_record(const struct mm_file_t *file, const char *fstart,
@@ -248,12 +274,14 @@ static char *next_record(const struct mm_file_t *file, const char *fstart,
 	return get_line(tag, tlen, file->begin, file->size, fstart, len);
 }
 
-static void fire_detected_events(struct sender_t *sender,
+/* return the number of events still waiting to be synced */
+static int fire_detected_events(struct sender_t *sender,
 			int (*fn)(const char*, size_t, const struct vm_t *))
 {
 	struct mm_file_t *recos;
 	char *record;
 	size_t recolen;
+	int pending = 0;
 
 	pthread_mutex_lock(&sender->vmrecord.mtx);
 	recos = mmap_file(sender->vmrecord.path);
@@ -261,7 +289,7 @@ static void fire_detected_events(struct sender_t *sender,
 		LOGE("failed to mmap %s, %s\n", sender->vmrecord.path,
 						strerror(errno));
 		pthread_mutex_unlock(&sender->vmrecord.mtx);
-		return;
+		return 0;
 	}
 	if (!recos->size ||
 	    mm_count_lines(recos) < VMRECORD_HEAD_LINES) {
@@ -291,13 +319,14 @@ static void fire_detected_events(struct sender_t *sender,
 		}
 
 		vm = get_vm_by_name((const char *)vm_name);
-		if (!vm || !vm->history_data)
+		if (!vm || !vm->history.size) {
+			pending++;
 			continue;
+		}
 
 		hist_line = get_line(vmkey, strnlen(vmkey, sizeof(vmkey)),
-				     vm->history_data,
-				     vm->history_size[sender->id],
-				     vm->history_data, &len);
+				     vm->history.data, vm->history.size,
+				     vm->history.data, &len);
 		if (!hist_line) {
 			vmrecord_mark(&sender->vmrecord, vmkey,
 				      strnlen(vmkey, sizeof(vmkey)), NOT_FOUND);
@@ -308,11 +337,14 @@ static void fire_detected_events(struct sender_t *sender,
 		if (res == VMEVT_HANDLED)
 			vmrecord_mark(&sender->vmrecord, vmkey,
 				      strnlen(vmkey, sizeof(vmkey)), ON_GOING);
+		else
+			pending++;
 	}
 
 out:
 	unmap_file(recos);
 	pthread_mutex_unlock(&sender->vmrecord.mtx);
+	return pending;
 }
 
 /* This function only for initialization */
@@ -408,45 +440,40 @@ static char *setup_loop_dev(void)
  *
  * Note that: fn should return VMEVT_HANDLED to indicate event has been handled.
  *	      fn will be called in a time loop if it returns VMEVT_DEFER.
+ *
+ * @return the number of events found or still waiting for fn, 0 if there
+ *	   was nothing to do.
  */
-void refresh_vm_history(struct sender_t *sender,
+int refresh_vm_history(struct sender_t *sender,
 		int (*fn)(const char*, size_t, const struct vm_t *))
 {
-	struct vm_t *vm;
-	int id;
+	int count;
 
 	if (!sender)
-		return;
+		return 0;
 
 	if (!loop_dev) {
 		loop_dev = setup_loop_dev();
 		if (!loop_dev)
-			return;
+			return 0;
 		LOGI("setup loop dev successful\n");
 	}
 
 	if (vmrecord_gen_ifnot_exists(&sender->vmrecord) == -1) {
 		LOGE("failed to create vmrecord\n");
-		return;
+		return 0;
 	}
 
 	get_last_evt_detected(sender);
-	get_vms_history(sender);
+	get_vms_history();
 
 	/* read events from vmrecords and mark them as ongoing */
-	fire_detected_events(sender, fn);
+	count = fire_detected_events(sender, fn);
 
 	/* add events to vmrecords */
-	detect_new_events(sender);
+	count += detect_new_events(sender);
 
-	for_each_vm(id, vm, conf) {
-		if (!vm)
-			continue;
-		if (vm->history_data) {
-			free(vm->history_data);
-			vm->history_data = NULL;
-		}
-	}
+	return count;
 }
 
 int android_event_analyze(const char *msg, size_t len, char **result,
@@ -13,8 +13,8 @@
 #include <errno.h>
 #include <sys/inotify.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <time.h>
-#include <signal.h>
 #include "load_conf.h"
 #include "event_queue.h"
 #include "fsutils.h"
@@ -26,24 +26,49 @@
 #include "android_events.h"
 #include "crash_reclassify.h"
 
-#define POLLING_TIMER_SIG 0xCEAC
+/* the polling interval doubles while there is nothing to sync, up to */
+#define POLLING_BACKOFF_MAX 8
+/* log the loop counters every STATS_PERIOD seconds */
+#define STATS_PERIOD (60 * 60)
 
 static void channel_oneshot(struct channel_t *cnl);
 static void channel_polling(struct channel_t *cnl);
 static void channel_inotify(struct channel_t *cnl);
+static int receive_polling_events(struct channel_t *channel);
+static int receive_inotify_events(struct channel_t *channel);
+static int receive_heart_beat(struct channel_t *channel);
 
 /**
  * @brief structure containing implementation of each channel.
  *
  * This structure describes all channels, all channel_* functions would
- * called by main thread in order.
+ * called by main thread in order. The fd of each channel is then waited
+ * by a single epoll loop, which calls receive_fn when it is readable.
  */
 static struct channel_t channels[] = {
-	{"oneshot", -1, channel_oneshot},
-	{"polling", -1, channel_polling},
-	{"inotify", -1, channel_inotify},
+	{"oneshot", -1, channel_oneshot, NULL, 0},
+	{"polling", -1, channel_polling, receive_polling_events, 0},
+	{"inotify", -1, channel_inotify, receive_inotify_events, 0},
 };
 
+/* not a channel, it only wakes the loop up to feed the watchdog */
+static struct channel_t heart_beat_timer = {
+	"heartbeat", -1, NULL, receive_heart_beat, 0
+};
+
+/*
+ * Events detected by the epoll loop during one wakeup, handed to the event
+ * handler at once when the wakeup is processed.
+ */
+static struct event_list loop_events = TAILQ_HEAD_INITIALIZER(loop_events);
+
+static struct loop_stats {
+	unsigned long wakeups;
+	unsigned long events;
+	struct timespec start;
+	struct timespec cpu;
+} stats;
+
 #define for_each_channel(i, channel) \
 	for (i = 0; \
 	     (i < (int)ARRAY_SIZE(channels)) && (channel = &channels[i]); \
@@ -95,6 +120,62 @@ static struct event_t *create_event(enum event_type_t event_type,
 	return e;
 }
 
+static void detected_event(struct event_t *e)
+{
+	TAILQ_INSERT_TAIL(&loop_events, e, entries);
+	stats.events++;
+}
+
+/**
+ * Arm timerfd fd to expire once, in sec seconds.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int set_timer(int fd, uint32_t sec)
+{
+	struct itimerspec timer_val;
+
+	memset(&timer_val, 0, sizeof(struct itimerspec));
+	timer_val.it_value.tv_sec = sec;
+
+	if (timerfd_settime(fd, 0, &timer_val, NULL) == -1) {
+		LOGE("timerfd_settime failed, error (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int create_timer(uint32_t sec)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		LOGE("timerfd_create failed, error (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	if (set_timer(fd, sec) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* read out the expirations of a timerfd, 0 if it has not expired */
+static uint64_t read_timer(int fd)
+{
+	uint64_t expirations = 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) !=
+	    (ssize_t)sizeof(expirations))
+		return 0;
+
+	return expirations;
+}
+
 /**
  * Only check once when process startup
  *
@@ -171,11 +252,11 @@ static void channel_oneshot(struct channel_t *cnl)
 
 /* TODO: implement multiple polling jobs */
 static struct polling_job_t {
-	timer_t timerid;
-	uint32_t timer_val;
+	uint32_t timer_val;	/* configured interval in seconds */
+	uint32_t cur_val;	/* current interval, longer while idle */
 
 	enum event_type_t type;
-	void (*fn)(union sigval v);
+	int (*fn)(void);
 } vm_job;
 
 static int create_vm_event(const char *msg, size_t len, const struct vm_t *vm)
@@ -197,7 +278,7 @@ static int create_vm_event(const char *msg, size_t len, const struct vm_t *vm)
 
 	e = create_event(VM, "polling", (void *)vme, 0, NULL, 0);
 	if (e) {
-		event_enqueue(e);
+		detected_event(e);
 		return VMEVT_HANDLED;
 	}
 
@@ -207,51 +288,43 @@ static int create_vm_event(const char *msg, size_t len, const struct vm_t *vm)
 }
 
 /**
- * Callback thread of a polling job.
+ * Polling job of vms.
+ *
+ * @return the number of vm events found or waiting to be synced.
  */
-static void polling_vm(union sigval v __attribute__((unused)))
+static int polling_vm(void)
 {
-	refresh_vm_history(get_sender_by_name("crashlog"), create_vm_event);
+	return refresh_vm_history(get_sender_by_name("crashlog"),
+				  create_vm_event);
 }
 
 /**
- * Setup a timer with specific loop time. The callback fn will be performed
- * after timer expire.
+ * Run the polling job when its timer expires, and set the time of the next
+ * run. The interval is doubled each time the job has nothing to do, up to
+ * POLLING_BACKOFF_MAX times the configured one, and goes back to the
+ * configured one as soon as there is something to sync.
  *
- * @param pjob Polling_job filled by caller.
+ * @param channel Channel structure of polling.
  *
  * @return 0 if successful, or -1 if not.
  */
-static int create_polling_job(struct polling_job_t *pjob)
+static int receive_polling_events(struct channel_t *channel)
 {
-	struct sigevent sig_evt;
-	struct itimerspec timer_val;
-
-	memset(&sig_evt, 0, sizeof(struct sigevent));
-	sig_evt.sigev_value.sival_int = POLLING_TIMER_SIG;
-	sig_evt.sigev_notify = SIGEV_THREAD;
-	sig_evt.sigev_notify_function = pjob->fn;
+	if (!read_timer(channel->fd))
+		return 0;
 
-	if (timer_create(CLOCK_REALTIME, &sig_evt, &pjob->timerid) == -1) {
-		LOGE("timer_create failed.\n");
-		return -1;
-	}
-
-	memset(&timer_val, 0, sizeof(struct itimerspec));
-	timer_val.it_value.tv_sec = pjob->timer_val;
-	timer_val.it_interval.tv_sec = pjob->timer_val;
-
-	if (timer_settime(pjob->timerid, 0, &timer_val, NULL) == -1) {
-		LOGE("timer_settime failed.\n");
-		timer_delete(pjob->timerid);
-		return -1;
-	}
+	if (vm_job.fn() > 0)
+		vm_job.cur_val = vm_job.timer_val;
+	else if (vm_job.cur_val < vm_job.timer_val * POLLING_BACKOFF_MAX)
+		vm_job.cur_val = MIN(vm_job.cur_val * 2,
+				     vm_job.timer_val * POLLING_BACKOFF_MAX);
 
-	return 0;
+	return set_timer(channel->fd, vm_job.cur_val);
 }
 
 /**
- * Setup polling jobs. These jobs running with fixed time interval.
+ * Setup polling jobs. These jobs running with an interval between the
+ * configured one and POLLING_BACKOFF_MAX times it.
  *
  * @param cnl Structure of channel.
  */
@@ -288,12 +361,16 @@ static void channel_polling(struct channel_t *cnl)
 
 	}
 
+	if (!vm_job.timer_val)
+		return;
+
 	LOGD("start polling job with %ds\n", vm_job.timer_val);
 	vm_job.fn = polling_vm;
 	vm_job.type = VM;
-	if (create_polling_job(&vm_job) == -1) {
-		LOGE("failed to create polling job\n, error (%s)\n",
-		     strerror(errno));
+	vm_job.cur_val = vm_job.timer_val;
+	cnl->fd = create_timer(vm_job.timer_val);
+	if (cnl->fd < 0) {
+		LOGE("failed to create polling job\n");
 		exit(EXIT_FAILURE);
 	}
 }
@@ -316,7 +393,7 @@ static void channel_inotify(struct channel_t *cnl)
 	LOGD("initializing channel %s ...\n", cname);
 
 	/* use this func to get "return 0" from read */
-	inotify_fd = inotify_init1(IN_NONBLOCK);
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 	if (inotify_fd < 0) {
 		LOGE("inotify init fail, %s\n", strerror(errno));
 		return;
@@ -371,7 +448,9 @@ static void channel_inotify(struct channel_t *cnl)
 }
 
 /**
- * Handle inotify events, read out all events and enqueue.
+ * Handle inotify events, read out all events and enqueue. Each event is a
+ * separate crash (a rewritten trigger file is a new one), identical events
+ * in a row are already merged by the kernel.
  *
  * @param channel Channel structure of inotify.
  *
@@ -379,112 +458,168 @@ static void channel_inotify(struct channel_t *cnl)
  */
 static int receive_inotify_events(struct channel_t *channel)
 {
-	int len;
-	int read_left;
-	char buf[256];
+	ssize_t len;
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
 	char *p;
 	struct event_t *e;
 	struct inotify_event *ievent;
 	enum event_type_t event_type;
 	void *private;
 
-	read_left = 0;
 	while (1) {
-		len = read(channel->fd, (char *)&buf[read_left],
-			   (int)sizeof(buf) - read_left);
+		/* the kernel only returns entire events */
+		len = read(channel->fd, buf, sizeof(buf));
 		if (len < 0) {
 			if (errno == EAGAIN)
 				break;
+			if (errno == EINTR)
+				continue;
 			LOGE("read fail with (%d, %p, %d), error: %s\n",
-			     channel->fd, (char *)&buf[read_left],
-			     (int)sizeof(buf) - read_left, strerror(errno));
+			     channel->fd, buf, (int)sizeof(buf),
+			     strerror(errno));
 			return -1;
 		}
 		if (len == 0)
 			break;
 
-		for (p = buf; p < buf + read_left + len;) {
-			if (p + sizeof(struct inotify_event) >
-			    &buf[0] + len + read_left) {
-				/* we dont recv the entire inotify_event yet */
-				break;
-			}
-
-			/* then we can get len */
+		for (p = buf; p < buf + len;
+		     p += sizeof(struct inotify_event) + ievent->len) {
 			ievent = (struct inotify_event *)p;
-			if (p + sizeof(struct inotify_event) + ievent->len >
-						&buf[0] + len + read_left) {
-				/* we dont recv the entire
-				 * inotify_event + name
-				 */
-				break;
-			}
-			/* we have a entire event, send it... */
 			event_type = get_conf_by_wd(ievent->wd, &private);
 			if (event_type == UNKNOWN) {
 				LOGE("get a unknown event\n");
-			} else {
-				e = create_event(event_type, channel->name,
-						 private, channel->fd,
-						 ievent->name, ievent->len);
-				if (e)
-					event_enqueue(e);
+				continue;
 			}
-			/* next event start */
-			p += sizeof(struct inotify_event) + ievent->len;
+			e = create_event(event_type, channel->name,
+					 private, channel->fd,
+					 ievent->name, ievent->len);
+			if (e)
+				detected_event(e);
 		}
-		/* move the bytes that have been read out to the head of buf,
-		 * and let the rest of the buf do recv continually
-		 */
-		read_left = &buf[0] + len + read_left - p;
-		memmove(buf, p, read_left);
 	}
 
 	return 0;
 }
 
+static void log_loop_stats(void)
+{
+	struct timespec now, cpu;
+	char buf[128];
+	char *p = buf;
+	int id;
+	struct channel_t *channel;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec - stats.start.tv_sec < STATS_PERIOD)
+		return;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	for_each_channel(id, channel) {
+		if (channel->fd < 0)
+			continue;
+		p += snprintf(p, buf + sizeof(buf) - p, " %s %lu",
+			      channel->name, channel->wakeups);
+		channel->wakeups = 0;
+	}
+
+	LOGI("%lu wakeups (heartbeat %lu%s), %lu events, %ldms cpu in %lds\n",
+	     stats.wakeups, heart_beat_timer.wakeups, buf, stats.events,
+	     (cpu.tv_sec - stats.cpu.tv_sec) * 1000 +
+	     (cpu.tv_nsec - stats.cpu.tv_nsec) / 1000000,
+	     (long)(now.tv_sec - stats.start.tv_sec));
+
+	heart_beat_timer.wakeups = 0;
+	stats.wakeups = 0;
+	stats.events = 0;
+	stats.start = now;
+	stats.cpu = cpu;
+}
+
+/**
+ * Drain the heart beat timer, heart_beat does the rest.
+ *
+ * @param channel Timer of heart beat.
+ *
+ * @return 0.
+ */
+static int receive_heart_beat(struct channel_t *channel)
+{
+	read_timer(channel->fd);
+	return 0;
+}
+
 /**
- * Enqueue a HEART_BEAT event to event_queue.
+ * Enqueue a HEART_BEAT event to event_queue, at most every HEART_RATE / 2
+ * ms. It is called at each wakeup, the heart beat timer only wakes the loop
+ * up when nothing else did for HEART_RATE ms.
  */
 static void heart_beat(void)
 {
-	struct event_t *e = create_event(HEART_BEAT, NULL, NULL, 0, NULL, 0);
+	static struct timespec last;
+	struct timespec now;
+	struct event_t *e;
 
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ((now.tv_sec - last.tv_sec) * 1000 +
+	    (now.tv_nsec - last.tv_nsec) / 1000000 < HEART_RATE / 2)
+		return;
+
+	e = create_event(HEART_BEAT, NULL, NULL, 0, NULL, 0);
 	if (e)
-		event_enqueue(e);
+		TAILQ_INSERT_TAIL(&loop_events, e, entries);
+	last = now;
+	set_timer(heart_beat_timer.fd, HEART_RATE / 1000);
+
+	log_loop_stats();
+}
+
+static void epoll_add(int epfd, struct channel_t *channel)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = channel;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, channel->fd, &ev) < 0) {
+		LOGE("epoll_ctl failed, exiting\n");
+		exit(EXIT_FAILURE);
+	}
+	LOGD("add (%d) to epoll for (%s)\n", channel->fd, channel->name);
 }
 
 /**
  * Wait events asynchronously for all watch needed channels.
+ * This is the only thread detecting events: the timers of the polling jobs
+ * and of the heart beat are timerfds waited together with the inotify fd,
+ * and everything detected during one wakeup, heart beat included, is handed
+ * to the event handler at once.
  */
 static void *wait_events(void *unused __attribute__((unused)))
 {
 	int epfd;
 	int id;
-	int ret;
 	struct channel_t *channel;
 	struct epoll_event ev, *events;
 
-	epfd = epoll_create(MAXEVENTS + 1);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
 	if (epfd < 0) {
 		LOGE("epoll_create failed, exiting\n");
 		exit(EXIT_FAILURE);
 	}
 
-	ev.events = EPOLLIN | EPOLLET;
 	for_each_channel(id, channel) {
-		if (channel->fd <= 0)
+		if (channel->fd < 0)
 			continue;
 
-		ev.data.fd = channel->fd;
-		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, channel->fd, &ev);
-		if (ret < 0) {
-			LOGE("epoll_ctl failed, exiting\n");
-			exit(EXIT_FAILURE);
-		} else
-			LOGD("add (%d) to epoll for (%s)\n", channel->fd,
-			     channel->name);
+		epoll_add(epfd, channel);
+	}
+
+	heart_beat_timer.fd = create_timer(HEART_RATE / 1000);
+	if (heart_beat_timer.fd < 0) {
+		LOGE("failed to create heart beat timer, exiting\n");
+		exit(EXIT_FAILURE);
 	}
+	epoll_add(epfd, &heart_beat_timer);
 
 	events = calloc(MAXEVENTS, sizeof(ev));
 	if (events == NULL) {
@@ -492,27 +627,35 @@ static void *wait_events(void *unused __attribute__((unused)))
 		exit(EXIT_FAILURE);
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &stats.start);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stats.cpu);
 	while (1) {
 		int i;
 		int n;
 
-		n = epoll_wait(epfd, events, MAXEVENTS, HEART_RATE);
-		heart_beat();
+		n = epoll_wait(epfd, events, MAXEVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGE("epoll_wait failed, error (%s), exiting\n",
+			     strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		stats.wakeups++;
 		for (i = 0; i < n; i++) {
-			for_each_channel(id, channel)
-				if (channel->fd == events[i].data.fd) {
-					if (events[i].events & EPOLLERR ||
-					    !(events[i].events & EPOLLIN)) {
-						LOGE("error ev, channel:%s\n",
-						     channel->name);
-						continue;
-					}
-					/* Until now, we only have
-					 * inotify channel to wait
-					 */
-					receive_inotify_events(channel);
-				}
+			channel = events[i].data.ptr;
+			channel->wakeups++;
+			if (events[i].events & EPOLLERR ||
+			    !(events[i].events & EPOLLIN)) {
+				LOGE("error ev, channel:%s\n", channel->name);
+				continue;
+			}
+			channel->receive_fn(channel);
 		}
+
+		heart_beat();
+		event_enqueue_batch(&loop_events);
 	}
 }
 
@@ -18,50 +18,225 @@
 #include "log_sys.h"
 #include "crash_reclassify.h"
 
+/*
+ * All the content and mightcontent strings of the configured crashes are
+ * compiled by init_crash_reclassify() into one Aho-Corasick automaton. A
+ * trigger file is then scanned once, whatever the number of crashes and
+ * strings, into the set of strings it contains, and the conditions of
+ * every crash are checked against that set. The set is kept for the
+ * whole reclassification, so a file shared by several crashes of the tree
+ * is read and scanned only once.
+ *
+ * The trie is built with sibling lists, then turned into a full transition
+ * table, one lookup per byte of the file. Bytes that appear in no string
+ * share class 0, so a row only has as many entries as distinct bytes in
+ * the strings, plus one.
+ */
+struct ac_node {
+	int child;		/* first child */
+	int sibling;		/* next child of the parent */
+	int fail;		/* longest proper suffix in the trie */
+	int out;		/* next node on the fail chain ending a string */
+	int pattern;		/* string ending here, or -1 */
+	unsigned char c;
+};
+
+static struct ac_node *ac_nodes;
+static int ac_nnodes;
+static int ac_npatterns;
+static unsigned char ac_class[256];
+static int ac_nclass = 1;
+/*
+ * ac_next[row + class] is the row of the next node, row being
+ * node * ac_nclass, or ~row when a string ends at the next node.
+ */
+static int *ac_next;
+
+/* index in the scan result of each configured string, per crash id */
+static int content_pattern[CRASH_MAX][CONTENT_MAX];
+static int mightcontent_pattern[CRASH_MAX][EXPRESSION_MAX][CONTENT_MAX];
+
+static int ac_child(int node, unsigned char c)
+{
+	int n;
+
+	for (n = ac_nodes[node].child; n; n = ac_nodes[n].sibling)
+		if (ac_nodes[n].c == c)
+			return n;
+
+	return -1;
+}
+
+static int ac_new_node(int parent, unsigned char c)
+{
+	struct ac_node *nodes;
+	int n = ac_nnodes;
+
+	if (!(n & (n - 1))) {
+		nodes = realloc(ac_nodes, (size_t)n * 2 * sizeof(*nodes));
+		if (!nodes)
+			return -1;
+		ac_nodes = nodes;
+	}
+
+	memset(&ac_nodes[n], 0, sizeof(ac_nodes[n]));
+	ac_nodes[n].pattern = -1;
+	ac_nodes[n].c = c;
+	ac_nodes[n].sibling = ac_nodes[parent].child;
+	ac_nodes[parent].child = n;
+	ac_nnodes++;
+
+	if (!ac_class[c])
+		ac_class[c] = ac_nclass++;
+
+	return n;
+}
+
 /**
- * Check if file contains content or not.
- * This function couldn't use for binary file.
+ * Add a string to the automaton.
  *
- * @param file Starting address of file cache.
- * @param content String to be searched.
+ * @param str String to be searched.
  *
- * @return 1 if find the same string, or 0 if not.
+ * @return the index of the string in the scan result, the same for equal
+ *	   strings, or -1 if out of memory.
  */
-static int has_content(const char *file, const char *content)
+static int ac_add(const char *str)
 {
-	if (content && strstr(file, content))
-		return 1;
+	const unsigned char *p;
+	int node = 0;
+	int next;
+
+	for (p = (const unsigned char *)str; *p; p++) {
+		next = ac_child(node, *p);
+		if (next < 0) {
+			next = ac_new_node(node, *p);
+			if (next < 0)
+				return -1;
+		}
+		node = next;
+	}
+
+	if (ac_nodes[node].pattern < 0)
+		ac_nodes[node].pattern = ac_npatterns++;
+
+	return ac_nodes[node].pattern;
+}
+
+/*
+ * Set the fail and output links and fill the transition table, breadth
+ * first: the row of the fail node is always complete when it is copied.
+ */
+static int ac_link(void)
+{
+	int *queue;
+	int *row;
+	int head = 0;
+	int tail = 0;
+	int n, v, f;
+
+	queue = malloc(ac_nnodes * sizeof(*queue));
+	ac_next = calloc((size_t)ac_nnodes * ac_nclass, sizeof(*ac_next));
+	if (!queue || !ac_next) {
+		free(queue);
+		return -1;
+	}
+
+	queue[tail++] = 0;
+	while (head < tail) {
+		n = queue[head++];
+		row = &ac_next[n * ac_nclass];
+		f = ac_nodes[n].fail;
+		if (n) {
+			memcpy(row, &ac_next[f * ac_nclass],
+			       ac_nclass * sizeof(*row));
+			ac_nodes[n].out = ac_nodes[f].pattern >= 0 ?
+					  f : ac_nodes[f].out;
+		}
 
+		for (v = ac_nodes[n].child; v; v = ac_nodes[v].sibling) {
+			ac_nodes[v].fail = n ?
+				row[ac_class[ac_nodes[v].c]] : 0;
+			row[ac_class[ac_nodes[v].c]] = v;
+			queue[tail++] = v;
+		}
+	}
+
+	for (n = 0; n < ac_nnodes * ac_nclass; n++) {
+		v = ac_next[n];
+		ac_next[n] = v * ac_nclass;
+		if (v && (ac_nodes[v].pattern >= 0 || ac_nodes[v].out))
+			ac_next[n] = ~ac_next[n];
+	}
+
+	free(queue);
 	return 0;
 }
 
+/**
+ * Find which configured strings the file contains, as strstr would: up to
+ * the first '\0'.
+ *
+ * @param file Starting address of file cache.
+ * @param[out] found found[i] is set to 1 if string i is in the file.
+ */
+static void ac_scan(const char *file, unsigned char *found)
+{
+	const struct ac_node *nodes = ac_nodes;
+	const int *next = ac_next;
+	const int nclass = ac_nclass;
+	const unsigned char *p;
+	int left = ac_npatterns;
+	int row = 0;
+	int m;
+
+	memset(found, 0, ac_npatterns);
+
+	/* the empty string is everywhere */
+	if (nodes[0].pattern >= 0) {
+		found[nodes[0].pattern] = 1;
+		left--;
+	}
+
+	for (p = (const unsigned char *)file; *p && left; p++) {
+		row = next[row + ac_class[*p]];
+		if (row >= 0)
+			continue;
+
+		/*
+		 * Report the strings ending here. When one was already
+		 * reported, so were all the ones on its output chain.
+		 */
+		row = ~row;
+		m = row / nclass;
+		if (nodes[m].pattern < 0)
+			m = nodes[m].out;
+		for (; m && !found[nodes[m].pattern]; m = nodes[m].out) {
+			found[nodes[m].pattern] = 1;
+			left--;
+		}
+	}
+}
+
 /**
  * Check if file contains all configured contents or not.
- * This function couldn't use for binary file.
  *
  * @param crash Crash need checking.
- * @param file Starting address of file cache.
+ * @param found Strings found in the file, see ac_scan.
  *
  * @return 1 if all configured strings were found, or 0 if not.
  */
 static int crash_has_all_contents(const struct crash_t *crash,
-				const char *file)
+				const unsigned char *found)
 {
 	int id;
-	int ret = 1;
 	const char *content;
 
 	for_each_content_crash(id, content, crash) {
-		if (!content)
-			continue;
-
-		if (!has_content(file, content)) {
-			ret = 0;
-			break;
-		}
+		if (!found[content_pattern[crash->id][id]])
+			return 0;
 	}
 
-	return ret;
+	return 1;
 }
 
 /**
@@ -71,17 +246,14 @@ static int crash_has_all_contents(const struct crash_t *crash,
  * r_mc[exp] = has_content(mc[exp][0]) || has_content(mc[exp][1]) || ...
  * result = r_mc[0] && r_mc[1] && ...
  *
- * This function couldn't use for binary file.
- *
  * @param crash Crash need checking.
- * @param file Starting address of file cache.
+ * @param found Strings found in the file, see ac_scan.
  *
  * @return 1 if result is true, or 0 if false.
  */
 static int crash_has_mightcontents(const struct crash_t *crash,
-				const char *file)
+				const unsigned char *found)
 {
-	int ret = 1;
 	int ret_exp;
 	int expid, cntid;
 	const char * const *exp;
@@ -96,33 +268,109 @@ static int crash_has_mightcontents(const struct crash_t *crash,
 			if (!content)
 				continue;
 
-			if (has_content(file, content)) {
+			if (found[mightcontent_pattern[crash->id][expid][cntid]]) {
 				ret_exp = 1;
 				break;
 			}
 		}
-		if (ret_exp == 0) {
-			ret = 0;
-			break;
-		}
+		if (ret_exp == 0)
+			return 0;
 	}
 
-	return ret;
+	return 1;
 }
 
 /**
  * Judge the type of crash, according to configured content/mightcontent.
- * This function couldn't use for binary file.
  *
  * @param crash Crash need checking.
- * @param file Starting address of file cache.
+ * @param found Strings found in the file, see ac_scan.
  *
  * @return 1 if file matches these strings configured in crash, or 0 if not.
  */
-static int crash_match_content(const struct crash_t *crash, const char *file)
+static int crash_match_content(const struct crash_t *crash,
+				const unsigned char *found)
 {
-	return crash_has_all_contents(crash, file) &&
-		crash_has_mightcontents(crash, file);
+	return crash_has_all_contents(crash, found) &&
+		crash_has_mightcontents(crash, found);
+}
+
+/* files scanned during one reclassification */
+struct scanned_file {
+	char *path;
+	unsigned char *found;	/* NULL if empty or unreadable */
+};
+
+struct scan_cache {
+	struct scanned_file *files;
+	int count;
+};
+
+static void scan_cache_free(struct scan_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->count; i++) {
+		free(cache->files[i].path);
+		free(cache->files[i].found);
+	}
+	free(cache->files);
+	cache->files = NULL;
+	cache->count = 0;
+}
+
+/**
+ * Get the strings found in a file, scanning it if not done yet.
+ * This function couldn't use for binary file.
+ *
+ * @param cache Files already scanned.
+ * @param filename Path of the file.
+ *
+ * @return the scan result, or NULL if the file is empty or unreadable.
+ */
+static const unsigned char *scan_file(struct scan_cache *cache,
+					const char *filename)
+{
+	struct scanned_file *files;
+	unsigned char *found = NULL;
+	unsigned long size;
+	void *cnt;
+	int i;
+
+	for (i = 0; i < cache->count; i++)
+		if (!strcmp(cache->files[i].path, filename))
+			return cache->files[i].found;
+
+	if (read_file(filename, &size, &cnt) == -1) {
+		LOGE("read %s failed, error (%s)\n", filename, strerror(errno));
+	} else {
+		if (size) {
+			found = malloc(ac_npatterns ? ac_npatterns : 1);
+			if (found)
+				ac_scan(cnt, found);
+			else
+				LOGE("failed to malloc\n");
+		}
+		free(cnt);
+	}
+
+	files = realloc(cache->files, (cache->count + 1) * sizeof(*files));
+	if (!files) {
+		LOGE("failed to realloc\n");
+		free(found);
+		return NULL;
+	}
+	cache->files = files;
+	files[cache->count].path = strdup(filename);
+	if (!files[cache->count].path) {
+		LOGE("failed to strdup\n");
+		free(found);
+		return NULL;
+	}
+	files[cache->count].found = found;
+	cache->count++;
+
+	return found;
 }
 
 static int _get_data(const char *file, const struct crash_t *crash,
@@ -209,27 +457,10 @@ fail:
 	return -1;
 }
 
-static int crash_match_file(const struct crash_t *crash, const char *filename)
-{
-	size_t size;
-	void *cnt;
-
-	if (read_file(filename, &size, &cnt) == -1) {
-		LOGE("read %s failed, error (%s)\n", filename, strerror(errno));
-		return 0;
-	}
-	if (!size)
-		return 0;
-	if (crash_match_content(crash, cnt)) {
-		free(cnt);
-		return 1;
-	}
-	free(cnt);
-	return 0;
-}
-
-int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
+static int crash_match_files(const struct crash_t *crash,
+				const char *filefmt, struct scan_cache *cache)
 {
+	const unsigned char *found;
 	int count;
 	int i;
 	int ret = 0;
@@ -239,7 +470,8 @@ int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
 	if (count <= 0)
 		return ret;
 	for (i = 0; i < count; i++) {
-		if (crash_match_file(crash, files[i])) {
+		found = scan_file(cache, files[i]);
+		if (found && crash_match_content(crash, found)) {
 			ret = 1;
 			break;
 		}
@@ -250,8 +482,19 @@ int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
 	return ret;
 }
 
+int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
+{
+	struct scan_cache cache = { NULL, 0 };
+	int ret;
+
+	ret = crash_match_files(crash, filefmt, &cache);
+	scan_cache_free(&cache);
+	return ret;
+}
+
 static struct crash_t *crash_find_matched_child(const struct crash_t *crash,
-						const char *rtrfmt)
+						const char *rtrfmt,
+						struct scan_cache *cache)
 {
 	struct crash_t *child;
 	struct crash_t *matched_child = NULL;
@@ -269,7 +512,7 @@ static struct crash_t *crash_find_matched_child(const struct crash_t *crash,
 		else
 			trfile_fmt = child->trigger->path;
 
-		if (crash_match_filefmt(child, trfile_fmt)) {
+		if (crash_match_files(child, trfile_fmt, cache)) {
 			matched_child = child;
 			break;
 		}
@@ -299,6 +542,7 @@ static struct crash_t *crash_reclassify_by_content(const struct crash_t *rcrash,
 	int count;
 	const struct crash_t *crash;
 	const struct crash_t *ret_crash = rcrash;
+	struct scan_cache cache = { NULL, 0 };
 	const char *trfile_fmt;
 	char **trfiles;
 	void *content;
@@ -311,12 +555,13 @@ static struct crash_t *crash_reclassify_by_content(const struct crash_t *rcrash,
 	crash = rcrash;
 
 	while (1) {
-		crash = crash_find_matched_child(crash, rtrfile_fmt);
+		crash = crash_find_matched_child(crash, rtrfile_fmt, &cache);
 		if (!crash)
 			break;
 
 		ret_crash = crash;
 	}
+	scan_cache_free(&cache);
 
 	if (!strcmp(ret_crash->trigger->type, "dir"))
 		trfile_fmt = rtrfile_fmt;
@@ -356,16 +601,55 @@ free_files:
 /**
  * Initailize crash reclassify, we only got a root crash from channel,
  * sometimes, we need to get a more specific type.
+ * All configured contents and mightcontents are compiled here.
+ *
+ * @return 0 if successful, or -1 if not.
  */
-void init_crash_reclassify(void)
+int init_crash_reclassify(void)
 {
 	int id;
+	int expid, cntid;
 	struct crash_t *crash;
+	const char *content;
+	const char * const *exp;
+
+	ac_nodes = malloc(sizeof(*ac_nodes));
+	if (!ac_nodes)
+		goto nomem;
+	memset(ac_nodes, 0, sizeof(*ac_nodes));
+	ac_nodes[0].pattern = -1;
+	ac_nnodes = 1;
 
 	for_each_crash(id, crash, conf) {
 		if (!crash)
 			continue;
 
+		for_each_content_crash(cntid, content, crash) {
+			content_pattern[id][cntid] = ac_add(content);
+			if (content_pattern[id][cntid] < 0)
+				goto nomem;
+		}
+
+		for_each_expression_crash(expid, exp, crash) {
+			for_each_content_expression(cntid, content, exp) {
+				mightcontent_pattern[id][expid][cntid] =
+							ac_add(content);
+				if (mightcontent_pattern[id][expid][cntid] < 0)
+					goto nomem;
+			}
+		}
+
 		crash->reclassify = crash_reclassify_by_content;
 	}
+
+	if (ac_link() == -1)
+		goto nomem;
+
+	LOGI("crash reclassify: %d strings, %d nodes\n",
+	     ac_npatterns, ac_nnodes);
+	return 0;
+
+nomem:
+	LOGE("failed to compile crash contents, out of memory\n");
+	return -1;
 }
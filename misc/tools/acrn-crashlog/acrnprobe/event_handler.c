@@ -24,6 +24,36 @@
 
 static struct event_t *last_e;
 static int event_processing;
+/* events dequeued together, waiting for their turn in event_handle */
+static struct event_list event_batch = TAILQ_HEAD_INITIALIZER(event_batch);
+
+static void dump_unhandled_event(struct event_t *e)
+{
+	struct crash_t *crash;
+	struct info_t *info;
+
+	switch (e->event_type) {
+	case CRASH:
+		crash = (struct crash_t *)e->private;
+		LOGE("CRASH (%s, %s)\n", (char *)crash->name, e->path);
+		break;
+	case INFO:
+		info = (struct info_t *)e->private;
+		LOGE("INFO (%s)\n", (char *)info->name);
+		break;
+	case UPTIME:
+		LOGE("UPTIME\n");
+		break;
+	case HEART_BEAT:
+		LOGE("HEART_BEAT\n");
+		break;
+	case REBOOT:
+		LOGE("REBOOT\n");
+		break;
+	default:
+		LOGE("error event type %d\n", e->event_type);
+	}
+}
 
 /**
  * Handle watchdog expire.
@@ -33,8 +63,6 @@ static int event_processing;
 static void wdt_timeout(int signal)
 {
 	struct event_t *e;
-	struct crash_t *crash;
-	struct info_t *info;
 	int count;
 
 	if (signal == SIGALRM) {
@@ -48,31 +76,18 @@ static void wdt_timeout(int signal)
 		}
 
 		count = events_count();
+		TAILQ_FOREACH(e, &event_batch, entries)
+			count++;
 		LOGE("total %d unhandled events :\n", count);
 
+		while ((e = TAILQ_FIRST(&event_batch))) {
+			TAILQ_REMOVE(&event_batch, e, entries);
+			dump_unhandled_event(e);
+			free(e);
+		}
+		count = events_count();
 		while (count-- && (e = event_dequeue())) {
-			switch (e->event_type) {
-			case CRASH:
-				crash = (struct crash_t *)e->private;
-				LOGE("CRASH (%s, %s)\n", (char *)crash->name,
-				     e->path);
-				break;
-			case INFO:
-				info = (struct info_t *)e->private;
-				LOGE("INFO (%s)\n", (char *)info->name);
-				break;
-			case UPTIME:
-				LOGE("UPTIME\n");
-				break;
-			case HEART_BEAT:
-				LOGE("HEART_BEAT\n");
-				break;
-			case REBOOT:
-				LOGE("REBOOT\n");
-				break;
-			default:
-				LOGE("error event type %d\n", e->event_type);
-			}
+			dump_unhandled_event(e);
 			free(e);
 		}
 
@@ -138,58 +153,66 @@ static void *event_handle(void *unused __attribute__((unused)))
 	struct event_t *e;
 	struct vm_event_t *vme;
 
-	while ((e = event_dequeue())) {
-		/* here we only handle internal event */
-		if (e->event_type == HEART_BEAT) {
-			watchdog_fed(WDT_TIMEOUT);
-			free(e);
-			continue;
-		}
+	/* take all the queued events at once, the queue lock is taken once
+	 * per burst instead of once per event
+	 */
+	while (event_dequeue_batch(&event_batch) > 0) {
+		while ((e = TAILQ_FIRST(&event_batch))) {
+			TAILQ_REMOVE(&event_batch, e, entries);
+
+			/* here we only handle internal event */
+			if (e->event_type == HEART_BEAT) {
+				watchdog_fed(WDT_TIMEOUT);
+				free(e);
+				continue;
+			}
 
-		/* last_e is allocated for debug purpose, the information
-		 * will be dumped if watchdog expire.
-		 */
-		last_e = malloc(sizeof(*e) + e->len);
-		if (last_e == NULL) {
-			LOGE("malloc failed, error (%s)\n", strerror(errno));
-			exit(EXIT_FAILURE);
-		}
-		event_processing = 1;
-		memcpy(last_e, e, sizeof(*e) + e->len);
+			/* last_e is allocated for debug purpose, the
+			 * information will be dumped if watchdog expire.
+			 */
+			last_e = malloc(sizeof(*e) + e->len);
+			if (last_e == NULL) {
+				LOGE("malloc failed, error (%s)\n",
+				     strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			event_processing = 1;
+			memcpy(last_e, e, sizeof(*e) + e->len);
 
-		for_each_sender(id, sender, conf) {
-			if (!sender)
-				continue;
+			for_each_sender(id, sender, conf) {
+				if (!sender)
+					continue;
 
-			if (sender->send)
-				sender->send(e);
-		}
+				if (sender->send)
+					sender->send(e);
+			}
 
-		if (e->event_type == REBOOT) {
-			char reason[REBOOT_REASON_SIZE];
+			if (e->event_type == REBOOT) {
+				char reason[REBOOT_REASON_SIZE];
 
-			read_startupreason(reason, sizeof(reason));
-			if (!strcmp(reason, "WARM") ||
-			    !strcmp(reason, "WATCHDOG"))
-				if (exec_out2file(NULL, "reboot") == -1)
-					break;
-		}
+				read_startupreason(reason, sizeof(reason));
+				if (!strcmp(reason, "WARM") ||
+				    !strcmp(reason, "WATCHDOG"))
+					if (exec_out2file(NULL, "reboot") == -1)
+						goto out;
+			}
 
-		if (e->event_type == VM) {
-			vme = (struct vm_event_t *)e->private;
-			if (vme && vme->vm_msg)
-				free(vme->vm_msg);
-			if (vme)
-				free(vme);
+			if (e->event_type == VM) {
+				vme = (struct vm_event_t *)e->private;
+				if (vme && vme->vm_msg)
+					free(vme->vm_msg);
+				if (vme)
+					free(vme);
+			}
+			if ((e->dir))
+				free(e->dir);
+			free(e);
+			event_processing = 0;
+			free(last_e);
 		}
-		if ((e->dir))
-			free(e->dir);
-		free(e);
-		event_processing = 0;
-		free(last_e);
-
 	}
 
+out:
 	LOGE("failed to reboot system, %s exit\n", __func__);
 	return NULL;
 }
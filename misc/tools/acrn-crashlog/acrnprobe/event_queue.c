@@ -14,7 +14,7 @@ const char *etype_str[] = {"CRASH", "INFO", "UPTIME", "HEART_BEAT",
 
 static pthread_mutex_t eq_mtx = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t pcond = PTHREAD_COND_INITIALIZER;
-TAILQ_HEAD(, event_t) event_q;
+struct event_list event_q;
 
 /**
  * Enqueue an event to event_queue.
@@ -31,6 +31,23 @@ void event_enqueue(struct event_t *event)
 	pthread_mutex_unlock(&eq_mtx);
 }
 
+/**
+ * Enqueue a batch of events to event_queue at once, with a single wakeup
+ * of the event handler.
+ *
+ * @param events Events to process, the list is empty on return.
+ */
+void event_enqueue_batch(struct event_list *events)
+{
+	if (TAILQ_EMPTY(events))
+		return;
+
+	pthread_mutex_lock(&eq_mtx);
+	TAILQ_CONCAT(&event_q, events, entries);
+	pthread_cond_signal(&pcond);
+	pthread_mutex_unlock(&eq_mtx);
+}
+
 /**
  * Count the number of events in event_queue.
  *
@@ -69,6 +86,32 @@ struct event_t *event_dequeue(void)
 	return e;
 }
 
+/**
+ * Dequeue all the events of event_queue at once, waiting for one if it is
+ * empty.
+ *
+ * @param[out] events List the events are appended to.
+ *
+ * @return the number of dequeued events.
+ */
+int event_dequeue_batch(struct event_list *events)
+{
+	struct event_t *e;
+	int count = 0;
+
+	pthread_mutex_lock(&eq_mtx);
+	while (TAILQ_EMPTY(&event_q))
+		pthread_cond_wait(&pcond, &eq_mtx);
+	TAILQ_FOREACH(e, &event_q, entries) {
+		LOGD("dequeue %d, (%d)%s\n", e->event_type, e->len, e->path);
+		count++;
+	}
+	TAILQ_CONCAT(events, &event_q, entries);
+	pthread_mutex_unlock(&eq_mtx);
+
+	return count;
+}
+
 /**
  * Initailize event_queue.
  */
@@ -39,7 +39,7 @@ struct vm_event_t {
 #define ANDROID_TYPE_FMT "%[[A-Z0-9_:-]{3,16}]" IGN_SPACES
 #define ANDROID_LINE_REST_FMT "%[[^\n]*]" IGN_RESTS
 
-void refresh_vm_history(struct sender_t *sender,
+int refresh_vm_history(struct sender_t *sender,
 			int (*fn)(const char*, size_t, const struct vm_t *));
 int android_event_analyze(const char *msg, size_t len, char **result,
 			size_t *rsize);
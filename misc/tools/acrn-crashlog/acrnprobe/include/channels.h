@@ -15,6 +15,8 @@ struct channel_t {
 	char *name;
 	int fd;
 	void (*channel_fn)(struct channel_t *);
+	int (*receive_fn)(struct channel_t *);
+	unsigned long wakeups;
 };
 extern int create_detached_thread(pthread_t *pid,
 				void *(*fn)(void *), void *arg);
@@ -5,4 +5,4 @@
 
 extern int crash_match_filefmt(const struct crash_t *crash,
 				const char *filefmt);
-extern void init_crash_reclassify(void);
+extern int init_crash_reclassify(void);
@@ -36,9 +36,13 @@ struct event_t {
 	char path[0]; /* keep this at tail*/
 };
 
+TAILQ_HEAD(event_list, event_t);
+
 void event_enqueue(struct event_t *event);
+void event_enqueue_batch(struct event_list *events);
 int events_count(void);
 struct event_t *event_dequeue(void);
+int event_dequeue_batch(struct event_list *events);
 void init_event_queue(void);
 
 #endif
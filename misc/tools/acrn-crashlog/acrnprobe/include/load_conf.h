@@ -12,6 +12,7 @@
 #include "event_queue.h"
 #include "probeutils.h"
 #include "vmrecord.h"
+#include "loop.h"
 
 #define CONTENT_MAX 10
 #define EXPRESSION_MAX 5
@@ -46,8 +47,10 @@ struct vm_t {
 	size_t		syncevent_len[VM_EVENT_TYPE_MAX];
 
 	ext2_filsys	datafs;
-	unsigned long	history_size[SENDER_MAX];
-	char		*history_data;
+	struct e2fs_file_tail history;
+	int		history_lines;
+	/* end of the lines scanned for new events, 0 if none */
+	size_t		history_scanned[SENDER_MAX];
 	char		last_evt_detected[SENDER_MAX][SHORT_KEY_LENGTH + 1];
 };
 
@@ -3,8 +3,26 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+#ifndef __LOOP_H__
+#define __LOOP_H__
+
 #include <ext2fs/ext2fs.h>
 
+/* A file read incrementally, see e2fs_read_file_tail */
+struct e2fs_file_tail {
+	ext2_ino_t	ino;
+	__u32		generation;
+	__u32		mtime;
+	unsigned long	size;	/* bytes in data */
+	char		*data;	/* '\0' terminated */
+};
+
+enum e2fs_tail_state {
+	E2FS_TAIL_UNCHANGED,
+	E2FS_TAIL_APPENDED,	/* data grew, what was there is unchanged */
+	E2FS_TAIL_REPLACED,	/* data was read again from the start */
+};
+
 int loopdev_num_get_free(void);
 int loopdev_set_img_par(const char *loopdev, const char *img_path,
 			const char *parname);
@@ -15,5 +33,11 @@ int e2fs_read_file_by_fpath(ext2_filsys fs, const char *in_fp,
 			 void **out_data, unsigned long *size);
 int e2fs_dump_dir_by_dpath(ext2_filsys fs, const char *in_dp,
 			const char *out_dp, int *count);
+int e2fs_read_file_tail(ext2_filsys fs, const char *in_fp,
+			struct e2fs_file_tail *tail);
+void e2fs_free_file_tail(struct e2fs_file_tail *tail);
 int e2fs_open(const char *dev, ext2_filsys *outfs);
+int e2fs_open_uncached(const char *dev, ext2_filsys *outfs);
 void e2fs_close(ext2_filsys fs);
+
+#endif
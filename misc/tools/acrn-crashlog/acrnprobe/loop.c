@@ -15,16 +15,45 @@
 #include <errno.h>
 #include <utime.h>
 #include <string.h>
+#include <pthread.h>
 #include <blkid/blkid.h>
 #include <ext2fs/ext2fs.h>
 #include "fsutils.h"
+#include "loop.h"
 #include "log_sys.h"
 
 #define DEV_LOOP_CTL "/dev/loop-control"
 
+/* largest single read from the device when dumping a file */
+#define DUMP_CHUNK	(1024 * 1024)
+#define DUMP_WORKERS	4
+
+/* blocks contiguous both in the file and on the device */
+struct dump_run {
+	blk64_t lblk;
+	blk64_t pblk;
+	blk64_t len;
+};
+
+/*
+ * A file or directory to create. The runs of a file are resolved through
+ * libext2fs, which is not thread safe, the data is then copied with plain
+ * preads on the device, which can run in parallel.
+ */
+struct dump_file {
+	char *path;
+	struct ext2_inode inode;
+	struct dump_run *runs;
+	int nruns;
+};
+
 struct walking_inode_data {
+	ext2_filsys fs;
 	const char *current_out_native_dirpath;
 	int dumped_count;
+	/* files to copy and directories to align, children first */
+	struct dump_file *files;
+	int nfiles;
 };
 
 static int get_par_startaddr_from_img(const char *img,
@@ -311,7 +340,8 @@ static int e2fs_read_inode_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
 	return 0;
 }
 
-static int e2fs_dump_file_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
+/* copy a file block by block through libext2fs */
+static int e2fs_copy_file_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
 					const char *out_fp)
 {
 	errcode_t res;
@@ -386,6 +416,187 @@ static int e2fs_dump_file_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
 	return ret;
 }
 
+/**
+ * Get the data blocks of an extent mapped file. Uninitialized extents are
+ * left out, they read as zeroes like holes.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int e2fs_get_runs_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
+					struct dump_file *file)
+{
+	ext2_extent_handle_t handle;
+	struct ext2fs_extent extent;
+	struct dump_run *runs = NULL;
+	struct dump_run *new;
+	struct dump_run *last;
+	int nruns = 0;
+	int op = EXT2_EXTENT_ROOT;
+	errcode_t res;
+
+	res = ext2fs_extent_open2(fs, ino, &file->inode, &handle);
+	if (res) {
+		LOGE("ext2fs failed to open extents, ino (%d), error (%s)\n",
+		     ino, error_message(res));
+		return -1;
+	}
+
+	while (1) {
+		res = ext2fs_extent_get(handle, op, &extent);
+		op = EXT2_EXTENT_NEXT;
+		if (res == EXT2_ET_EXTENT_NO_NEXT ||
+		    res == EXT2_ET_NO_CURRENT_NODE)
+			break;
+		if (res) {
+			LOGE("ext2fs failed to get extent, ino (%d), error (%s)\n",
+			     ino, error_message(res));
+			goto err;
+		}
+
+		if (!(extent.e_flags & EXT2_EXTENT_FLAGS_LEAF) ||
+		    (extent.e_flags & EXT2_EXTENT_FLAGS_UNINIT) ||
+		    !extent.e_len)
+			continue;
+
+		last = nruns ? &runs[nruns - 1] : NULL;
+		if (last && last->lblk + last->len == extent.e_lblk &&
+		    last->pblk + last->len == extent.e_pblk) {
+			last->len += extent.e_len;
+			continue;
+		}
+
+		if (!(nruns & (nruns - 1))) {
+			new = realloc(runs, (nruns ? nruns * 2 : 1) *
+					    sizeof(*runs));
+			if (!new) {
+				LOGE("out of memory\n");
+				goto err;
+			}
+			runs = new;
+		}
+		runs[nruns].lblk = extent.e_lblk;
+		runs[nruns].pblk = extent.e_pblk;
+		runs[nruns].len = extent.e_len;
+		nruns++;
+	}
+
+	ext2fs_extent_free(handle);
+	file->runs = runs;
+	file->nruns = nruns;
+	return 0;
+err:
+	free(runs);
+	ext2fs_extent_free(handle);
+	return -1;
+}
+
+/* copy the runs of a file from the device, as large reads as possible */
+static int dump_file_runs(int devfd, unsigned int blocksize,
+			const struct dump_file *file)
+{
+	const __u64 size = EXT2_I_SIZE(&file->inode);
+	__u64 off, dev_off, len;
+	ssize_t rd, wr;
+	size_t n;
+	char *buf;
+	int ret = 0;
+	int fd;
+	int i;
+
+	fd = open(file->path, O_CREAT | O_WRONLY | O_TRUNC | O_LARGEFILE,
+		  0666);
+	if (fd == -1) {
+		LOGE("open (%s) failed, error (%s)\n", file->path,
+		     strerror(errno));
+		return -1;
+	}
+
+	buf = malloc(DUMP_CHUNK);
+	if (!buf) {
+		LOGE("out of memory\n");
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < file->nruns && !ret; i++) {
+		off = file->runs[i].lblk * blocksize;
+		dev_off = file->runs[i].pblk * blocksize;
+		len = file->runs[i].len * blocksize;
+		if (off >= size)
+			break;
+		len = MIN(len, size - off);
+
+		while (len) {
+			n = MIN(len, DUMP_CHUNK);
+			rd = pread(devfd, buf, n, dev_off);
+			if (rd == -1 && errno == EINTR)
+				continue;
+			if (rd <= 0) {
+				LOGE("failed to read (%s) from device, error (%s)\n",
+				     file->path, rd ? strerror(errno) : "EOF");
+				ret = -1;
+				break;
+			}
+			wr = pwrite(fd, buf, rd, off);
+			if (wr != rd) {
+				LOGE("failed to write file (%s), error (%s)\n",
+				     file->path, strerror(errno));
+				ret = -1;
+				break;
+			}
+			off += rd;
+			dev_off += rd;
+			len -= rd;
+		}
+	}
+
+	/* holes, uninitialized extents and the end of the file */
+	if (!ret && ftruncate(fd, size) == -1) {
+		LOGE("failed to truncate (%s), error (%s)\n", file->path,
+		     strerror(errno));
+		ret = -1;
+	}
+
+	align_props(fd, file->path, &file->inode);
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+static int e2fs_dump_file_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
+					const char *out_fp)
+{
+	struct dump_file file;
+	int devfd;
+	int ret;
+
+	if (!fs || !ino || !out_fp)
+		return -1;
+
+	memset(&file, 0, sizeof(file));
+	if (e2fs_read_inode_by_inodenum(fs, ino, &file.inode))
+		return -1;
+
+	if (!(file.inode.i_flags & EXT4_EXTENTS_FL) ||
+	    e2fs_get_runs_by_inodenum(fs, ino, &file) == -1)
+		return e2fs_copy_file_by_inodenum(fs, ino, out_fp);
+
+	devfd = open(fs->device_name, O_RDONLY | O_LARGEFILE);
+	if (devfd == -1) {
+		LOGW("failed to open (%s), error (%s)\n", fs->device_name,
+		     strerror(errno));
+		free(file.runs);
+		return e2fs_copy_file_by_inodenum(fs, ino, out_fp);
+	}
+
+	file.path = (char *)out_fp;
+	ret = dump_file_runs(devfd, fs->blocksize, &file);
+
+	close(devfd);
+	free(file.runs);
+	return ret;
+}
+
 int e2fs_dump_file_by_fpath(ext2_filsys fs, const char *in_fp,
 			const char *out_fp)
 {
@@ -484,7 +695,116 @@ int e2fs_read_file_by_fpath(ext2_filsys fs, const char *in_fp,
 	return e2fs_read_file_by_inodenum(fs, ino, out_data, size);
 }
 
-static int dump_inode_recursively_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
+void e2fs_free_file_tail(struct e2fs_file_tail *tail)
+{
+	if (!tail)
+		return;
+
+	free(tail->data);
+	memset(tail, 0, sizeof(*tail));
+}
+
+/**
+ * Bring a file read before up to date, reading only what was appended to
+ * it since. The file is read again from the start if it is another one
+ * (inode or generation changed), if it shrank, or if it was rewritten
+ * (same size, new mtime). fs should be opened by e2fs_open_uncached, so
+ * that what the guest changed since the last call is seen.
+ *
+ * @param fs Filesystem the file is in.
+ * @param in_fp Path of the file in fs.
+ * @param[in,out] tail Content and identity of the file at the last call,
+ *		   zeroed for the first call.
+ *
+ * @return an e2fs_tail_state if successful, or -1 if not. tail is left as
+ *	   it was in the failed case.
+ */
+int e2fs_read_file_tail(ext2_filsys fs, const char *in_fp,
+			struct e2fs_file_tail *tail)
+{
+	struct ext2_inode inode;
+	ext2_file_t e2_file;
+	ext2_ino_t ino;
+	errcode_t res;
+	__u64 from, off, size;
+	unsigned int got;
+	char *data;
+	int state = E2FS_TAIL_APPENDED;
+
+	if (!fs || !in_fp || !tail)
+		return -1;
+
+	/* the guest may have changed any inode since the last call */
+	ext2fs_flush_icache(fs);
+
+	if (e2fs_get_inodenum_by_fpath(fs, in_fp, &ino) ||
+	    e2fs_read_inode_by_inodenum(fs, ino, &inode))
+		return -1;
+
+	size = EXT2_I_SIZE(&inode);
+	if (ino == tail->ino && inode.i_generation == tail->generation &&
+	    size == tail->size && inode.i_mtime == tail->mtime)
+		return E2FS_TAIL_UNCHANGED;
+
+	from = tail->size;
+	if (ino != tail->ino || inode.i_generation != tail->generation ||
+	    size <= tail->size) {
+		from = 0;
+		state = E2FS_TAIL_REPLACED;
+	}
+
+	data = realloc(from ? tail->data : NULL, size + 1);
+	if (!data) {
+		LOGE("out of memory\n");
+		return -1;
+	}
+	if (from)
+		tail->data = data;
+
+	res = ext2fs_file_open2(fs, ino, &inode, 0, &e2_file);
+	if (res) {
+		LOGE("ext2fs failed to open file, ino (%d), error (%s)\n",
+		     ino, error_message(res));
+		goto err;
+	}
+
+	off = from;
+	res = ext2fs_file_llseek(e2_file, from, EXT2_SEEK_SET, NULL);
+	while (!res && off < size) {
+		res = ext2fs_file_read(e2_file, data + off,
+				       MIN(size - off, 1U << 30), &got);
+		if (!got)
+			break;
+		off += got;
+	}
+	/* ext2fs_file_close only failed in flush process */
+	ext2fs_file_close(e2_file);
+	if (res) {
+		LOGE("ext2fs failed to read (%u), error (%s)\n",
+		     ino, error_message(res));
+		goto err;
+	}
+
+	data[off] = '\0';
+	if (!from) {
+		free(tail->data);
+		tail->data = data;
+	}
+	tail->size = off;
+	tail->ino = ino;
+	tail->generation = inode.i_generation;
+	tail->mtime = inode.i_mtime;
+
+	return state;
+err:
+	if (from)
+		data[from] = '\0';
+	else
+		free(data);
+	return -1;
+}
+
+static int dump_inode_recursively_by_inodenum(ext2_ino_t ino,
 						struct walking_inode_data *data,
 						const char *fname);
 static int callback_for_subentries(struct ext2_dir_entry *dirent,
@@ -501,27 +821,44 @@ static int callback_for_subentries(struct ext2_dir_entry *dirent,
 	strncpy(fname, dirent->name, len);
 	fname[len] = 0;
 
-	return dump_inode_recursively_by_inodenum(NULL, dirent->inode,
-						  data, fname);
+	return dump_inode_recursively_by_inodenum(dirent->inode, data, fname);
 }
 
-static int dump_inode_recursively_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
+/* queue a file or directory, the path is owned by the queue from now */
+static int queue_dump_file(struct walking_inode_data *data, char *path,
+			const struct dump_file *file)
+{
+	struct dump_file *new;
+	const int n = data->nfiles;
+
+	if (!(n & (n - 1))) {
+		new = realloc(data->files, (n ? n * 2 : 1) * sizeof(*new));
+		if (!new) {
+			LOGE("out of memory, ");
+			return -1;
+		}
+		data->files = new;
+	}
+	data->files[n] = *file;
+	data->files[n].path = path;
+	data->nfiles++;
+	return 0;
+}
+
+static int dump_inode_recursively_by_inodenum(ext2_ino_t ino,
 						struct walking_inode_data *data,
 						const char *fname)
 {
 	int res;
 	char *out_fpath;
+	const char *parent;
 	errcode_t err;
-	static ext2_filsys fs_for_dump;
-	struct ext2_inode inode;
+	ext2_filsys fs = data ? data->fs : NULL;
+	struct dump_file file;
 
-	if (!ino || !data || !data->current_out_native_dirpath || !fname)
+	if (!ino || !fs || !data->current_out_native_dirpath || !fname)
 		goto abort;
 
-	/* caller is not callback_for_subentries */
-	if (fs)
-		fs_for_dump = fs;
-
 	if (!strcmp(fname, ".") || !strcmp(fname, ".."))
 		return 0;
 
@@ -532,21 +869,32 @@ static int dump_inode_recursively_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
 		goto abort;
 	}
 
-	res = e2fs_read_inode_by_inodenum(fs_for_dump, ino, &inode);
+	memset(&file, 0, sizeof(file));
+	res = e2fs_read_inode_by_inodenum(fs, ino, &file.inode);
 	if (res) {
 		LOGE("ext2fs failed to read inode, ");
 		goto abort_free;
 	}
 
-	if (LINUX_S_ISREG(inode.i_mode)) {
-		/* do dump for file */
-		res = e2fs_dump_file_by_inodenum(fs_for_dump, ino, out_fpath);
+	if (LINUX_S_ISREG(file.inode.i_mode)) {
+		/* extent mapped files are copied once the walk is done */
+		if ((file.inode.i_flags & EXT4_EXTENTS_FL) &&
+		    !e2fs_get_runs_by_inodenum(fs, ino, &file)) {
+			if (queue_dump_file(data, out_fpath, &file)) {
+				free(file.runs);
+				goto abort_free;
+			}
+			data->dumped_count++;
+			return 0;
+		}
+
+		res = e2fs_copy_file_by_inodenum(fs, ino, out_fpath);
 		if (res) {
 			LOGE("ext2fs failed to dump file, ");
 			goto abort_free;
 		}
 		data->dumped_count++;
-	} else if (LINUX_S_ISDIR(inode.i_mode)) {
+	} else if (LINUX_S_ISDIR(file.inode.i_mode)) {
 		/* mkdir for directory and dump the subentry */
 		res = mkdir(out_fpath, 0700);
 		if (res == -1 && errno != EEXIST) {
@@ -556,16 +904,21 @@ static int dump_inode_recursively_by_inodenum(ext2_filsys fs, ext2_ino_t ino,
 		}
 		data->dumped_count++;
 
+		parent = data->current_out_native_dirpath;
 		data->current_out_native_dirpath = out_fpath;
-		err = ext2fs_dir_iterate(fs_for_dump, ino, 0, 0,
+		err = ext2fs_dir_iterate(fs, ino, 0, 0,
 					 callback_for_subentries,
 					 (void *)data);
+		data->current_out_native_dirpath = parent;
 		if (err) {
 			LOGE("ext2fs failed to iterate dir, errno (%s), ",
 			     error_message(err));
 			goto abort_free;
 		}
-		align_props(-1, out_fpath, &inode);
+		/* its props are aligned after the files are created in it */
+		if (queue_dump_file(data, out_fpath, &file))
+			goto abort_free;
+		return 0;
 	}
 	/* else ignore the rest types, such as link, socket, fifo, ... */
 
@@ -579,6 +932,94 @@ abort:
 	return DIRENT_ABORT;
 }
 
+struct dump_queue {
+	struct walking_inode_data *data;
+	int devfd;
+	unsigned int blocksize;
+	int next;
+	int failed;
+	pthread_mutex_t mtx;
+};
+
+static void *dump_queue_worker(void *arg)
+{
+	struct dump_queue *q = (struct dump_queue *)arg;
+	struct dump_file *file;
+	int id;
+
+	while (1) {
+		pthread_mutex_lock(&q->mtx);
+		do {
+			id = q->next < q->data->nfiles ? q->next++ : -1;
+		} while (id >= 0 &&
+			 !LINUX_S_ISREG(q->data->files[id].inode.i_mode));
+		pthread_mutex_unlock(&q->mtx);
+		if (id < 0)
+			break;
+
+		file = &q->data->files[id];
+		if (dump_file_runs(q->devfd, q->blocksize, file)) {
+			pthread_mutex_lock(&q->mtx);
+			q->failed++;
+			pthread_mutex_unlock(&q->mtx);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Copy the queued files on up to DUMP_WORKERS threads, then align the
+ * props of the queued directories.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+static int dump_queued_files(ext2_filsys fs, struct walking_inode_data *data)
+{
+	pthread_t workers[DUMP_WORKERS - 1];
+	struct dump_queue q;
+	int nworkers = 0;
+	int i;
+
+	memset(&q, 0, sizeof(q));
+	q.data = data;
+	q.blocksize = fs->blocksize;
+	q.devfd = open(fs->device_name, O_RDONLY | O_LARGEFILE);
+	if (q.devfd == -1) {
+		LOGE("failed to open (%s), error (%s)\n", fs->device_name,
+		     strerror(errno));
+		return -1;
+	}
+	pthread_mutex_init(&q.mtx, NULL);
+
+	for (i = 0; i < MIN(data->nfiles, DUMP_WORKERS) - 1; i++) {
+		if (pthread_create(&workers[nworkers], NULL,
+				   dump_queue_worker, &q)) {
+			LOGW("failed to create dump worker, error (%s)\n",
+			     strerror(errno));
+			break;
+		}
+		nworkers++;
+	}
+	dump_queue_worker(&q);
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&q.mtx);
+	close(q.devfd);
+
+	for (i = 0; i < data->nfiles; i++)
+		if (LINUX_S_ISDIR(data->files[i].inode.i_mode))
+			align_props(-1, data->files[i].path,
+				    &data->files[i].inode);
+
+	if (q.failed) {
+		LOGE("failed to dump (%d) files\n", q.failed);
+		return -1;
+	}
+	return 0;
+}
+
 int e2fs_dump_dir_by_dpath(ext2_filsys fs, const char *in_dp,
 			const char *out_dp, int *count)
 {
@@ -586,6 +1027,8 @@ int e2fs_dump_dir_by_dpath(ext2_filsys fs, const char *in_dp,
 	struct walking_inode_data dump_needed;
 	const char *dname;
 	int res;
+	int ret = 0;
+	int i;
 
 	if (!fs || !in_dp || !count)
 		return -1;
@@ -606,16 +1049,27 @@ int e2fs_dump_dir_by_dpath(ext2_filsys fs, const char *in_dp,
 	else
 		dname = in_dp;
 
-	dump_needed.dumped_count = 0;
+	memset(&dump_needed, 0, sizeof(dump_needed));
+	dump_needed.fs = fs;
 	dump_needed.current_out_native_dirpath = out_dp;
-	res = dump_inode_recursively_by_inodenum(fs, ino, &dump_needed, dname);
-	*count = dump_needed.dumped_count;
+	res = dump_inode_recursively_by_inodenum(ino, &dump_needed, dname);
 	if (res) {
 		LOGE("ext2fs failed to dump dir\n");
-		return -1;
+		ret = -1;
 	}
 
-	return 0;
+	/* what was walked before an abort is still dumped */
+	if (dump_needed.nfiles && dump_queued_files(fs, &dump_needed))
+		ret = -1;
+	*count = dump_needed.dumped_count;
+
+	for (i = 0; i < dump_needed.nfiles; i++) {
+		free(dump_needed.files[i].path);
+		free(dump_needed.files[i].runs);
+	}
+	free(dump_needed.files);
+
+	return ret;
 }
 
 int e2fs_open(const char *dev, ext2_filsys *outfs)
@@ -637,6 +1091,42 @@ int e2fs_open(const char *dev, ext2_filsys *outfs)
 	return 0;
 }
 
+/**
+ * Open a filesystem which is changed under us, by the guest, to be read
+ * more than once. The data is read from the device (direct I/O) each time,
+ * it is never cached by the kernel nor by libext2fs, except the inodes
+ * which e2fs_read_file_tail drops itself.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+int e2fs_open_uncached(const char *dev, ext2_filsys *outfs)
+{
+	errcode_t res;
+
+	if (!dev || !outfs)
+		return -1;
+
+	add_error_table(&et_ext2_error_table);
+	res = ext2fs_open(dev, EXT2_FLAG_64BITS | EXT2_FLAG_DIRECT_IO, 0, 0,
+			  unix_io_manager, outfs);
+	if (res) {
+		LOGE("ext2fs fail to open (%s), error (%s)\n", dev,
+		     error_message(res));
+		return -1;
+	}
+
+	res = io_channel_set_options((*outfs)->io, "cache=off");
+	if (res) {
+		LOGE("ext2fs fail to disable cache of (%s), error (%s)\n",
+		     dev, error_message(res));
+		ext2fs_close(*outfs);
+		*outfs = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
 void e2fs_close(ext2_filsys fs)
 {
 	if (fs)
@@ -114,7 +114,10 @@ int main(int argc, char *argv[])
 	if (ret)
 		return -1;
 
-	init_crash_reclassify();
+	ret = init_crash_reclassify();
+	if (ret)
+		return -1;
+
 	ret = init_sender();
 	if (ret)
 		return -1;
@@ -27,6 +27,8 @@
 #include <limits.h>
 #include <openssl/sha.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "property.h"
 #include "fsutils.h"
 #include "history.h"
@@ -363,6 +365,60 @@ void generate_crashfile(const char *dir,
 	free(path);
 }
 
+/**
+ * Add lines to the crashfile in dir, before its "_END" mark.
+ *
+ * @param dir Where the crashfile is.
+ * @param lines Lines to add, each one ending with '\n'.
+ * @param len Length of lines.
+ *
+ * @return 0 if successful, or -1 if not.
+ */
+int crashfile_add_lines(const char *dir, const char *lines, size_t len)
+{
+	const char end[] = "_END\n";
+	const size_t elen = sizeof(end) - 1;
+	char buf[sizeof(end) - 1];
+	char *path;
+	off_t size;
+	int fd;
+	int ret = -1;
+
+	if (!dir || !lines || !len)
+		return -1;
+
+	if (asprintf(&path, "%s/crashfile", dir) == -1) {
+		LOGE("out of memory\n");
+		return -1;
+	}
+
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		LOGE("open (%s) failed, error (%s)\n", path, strerror(errno));
+		goto free_path;
+	}
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0)
+		goto close_fd;
+	if (size >= (off_t)elen && pread(fd, buf, elen, size - elen) ==
+	    (ssize_t)elen && !memcmp(buf, end, elen))
+		size -= elen;
+
+	if (pwrite(fd, lines, len, size) != (ssize_t)len ||
+	    pwrite(fd, end, elen, size + len) != (ssize_t)elen) {
+		LOGE("write (%s) failed, error (%s)\n", path, strerror(errno));
+		goto close_fd;
+	}
+	ret = 0;
+
+close_fd:
+	close(fd);
+free_path:
+	free(path);
+	return ret;
+}
+
 /**
  * Create a dir for log storage.
  *
@@ -12,6 +12,7 @@
 #include <sys/wait.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #include "fsutils.h"
 #include "strutils.h"
 #include "cmdutils.h"
@@ -112,48 +113,27 @@ static int cal_log_filepath(char **out, const struct log_t *log,
 	return asprintf(out, "%s/%s", desdir, filename);
 }
 
-/* get_log_file_* only used to copy regular file which can be mmaped */
+/* get_log_file_* only used to copy regular files */
 static void get_log_file_complete(const char *despath, const char *srcpath)
 {
 	const int ret = do_copy_tail(srcpath, despath, 0);
 
 	if (ret < 0) {
 		LOGE("copy (%s) failed, error (%s)\n", srcpath,
-		     strerror(errno));
+		     strerror(-ret));
 	}
 }
 
 static void get_log_file_tail(const char *despath, const char *srcpath,
 				const int lines)
 {
-	char *start;
-	int start_line;
-	int file_lines;
-	struct mm_file_t *mfile;
-	int ret;
-
-	mfile = mmap_file(srcpath);
-	if (!mfile) {
-		LOGE("mmap (%s) failed, error (%s)\n", srcpath,
-		     strerror(errno));
-		return;
-	}
-	file_lines = mm_count_lines(mfile);
-	if (file_lines <= 0) {
-		LOGW("get lines (%s, %d) failed\n", mfile->path, file_lines);
-		goto unmap;
-	}
-	start_line = MAX(file_lines - lines, 0) + 1;
-	start = mm_get_line(mfile, start_line);
-	ret = overwrite_file(despath, start);
-	if (ret < 0) {
-		LOGE("create file with (%s, %p) failed, error (%s)\n",
-		     despath, start, strerror(errno));
-		goto unmap;
-	}
+	const int ret = do_copy_tail_lines(srcpath, despath, lines);
 
-unmap:
-	unmap_file(mfile);
+	if (ret < 0)
+		LOGE("copy last %d lines of (%s) failed, error (%s)\n",
+		     lines, srcpath, strerror(-ret));
+	else if (!ret)
+		LOGW("no line in (%s)\n", srcpath);
 }
 
 static void get_log_file(const char *despath, const char *srcpath,
@@ -176,6 +156,7 @@ static void get_log_node(const char *despath, const char *nodepath,
 	}
 }
 
+/* runs on the log workers, exec_out2file forks and execs the command */
 static void get_log_cmd(const char *despath, const char *cmd)
 {
 	const int res = exec_out2file(despath, cmd);
@@ -369,6 +350,81 @@ static void crashlog_get_log(struct log_t *log, void *data)
 		LOGW("get (%s) spend %ds\n", log->name, spent);
 }
 
+/*
+ * The logs of an event are independent, collect them on a few threads so
+ * that a slow one (a command, a big file) does not hold back the others,
+ * which may be gone by then.
+ */
+#define LOG_WORKERS	4
+
+struct log_collect {
+	struct log_t * const *logs;
+	int count;
+	char *dir;
+	int next;			/* next log to collect */
+	unsigned long long spent[LOG_MAX];	/* ns spent on each log */
+	pthread_mutex_t mtx;
+};
+
+static void *log_collect_worker(void *arg)
+{
+	struct log_collect *lc = (struct log_collect *)arg;
+	unsigned long long start;
+	int id;
+
+	while (1) {
+		pthread_mutex_lock(&lc->mtx);
+		id = lc->next < lc->count ? lc->next++ : -1;
+		pthread_mutex_unlock(&lc->mtx);
+		if (id < 0)
+			break;
+
+		start = get_uptime();
+		lc->logs[id]->get(lc->logs[id], (void *)lc->dir);
+		lc->spent[id] = get_uptime() - start;
+	}
+
+	return NULL;
+}
+
+/**
+ * Collect logs into dir, on up to LOG_WORKERS threads including the
+ * caller's.
+ *
+ * @param logs Logs to collect, the array ends at the first NULL.
+ * @param dir Where to store the logs.
+ * @param[out] lc Time spent on each log.
+ */
+static void collect_logs(struct log_t * const *logs, char *dir,
+			struct log_collect *lc)
+{
+	pthread_t workers[LOG_WORKERS - 1];
+	int nworkers = 0;
+	int i;
+
+	memset(lc, 0, sizeof(*lc));
+	lc->logs = logs;
+	lc->dir = dir;
+	while (lc->count < LOG_MAX && logs[lc->count])
+		lc->count++;
+	pthread_mutex_init(&lc->mtx, NULL);
+
+	for (i = 0; i < MIN(lc->count, LOG_WORKERS) - 1; i++) {
+		if (pthread_create(&workers[nworkers], NULL,
+				   log_collect_worker, lc)) {
+			LOGW("failed to create log worker, error (%s)\n",
+			     strerror(errno));
+			break;
+		}
+		nworkers++;
+	}
+	log_collect_worker(lc);
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&lc->mtx);
+}
+
 #ifdef HAVE_TELEMETRICS_CLIENT
 static void telemd_send_crash(struct event_t *e, char *eventid)
 {
@@ -700,6 +756,11 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 	struct crash_t *crash = (struct crash_t *)e->private;
 	int id;
 	struct log_t *log;
+	struct log_collect lc;
+	char logtime[LOG_MAX * 64];
+	char *tail;
+	size_t len = 0;
+	int n;
 
 	hist_raise_event(etype_str[e->event_type], crash->name, e->dir, "",
 			 eid);
@@ -717,11 +778,19 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 			   SHORT_KEY_LENGTH, crash->name, crash->name_len,
 			   data0, d0len, data1, d1len, data2, d2len);
 
-	for_each_log_collect(id, log, crash) {
-		if (!log)
-			continue;
-		log->get(log, (void *)e->dir);
+	collect_logs(crash->log, e->dir, &lc);
+	for (id = 0; id < lc.count; id++) {
+		log = crash->log[id];
+		tail = logtime + len;
+		n = snprintf(tail, sizeof(logtime) - len, "LOGTIME=%s %llums\n",
+			     log->name, lc.spent[id] / 1000000ULL);
+		if (n < 0 || (size_t)n >= sizeof(logtime) - len)
+			break;
+		len += n;
 	}
+	if (len)
+		crashfile_add_lines(e->dir, logtime, len);
+
 	if (!strcmp(e->channel, "inotify")) {
 		/* get the trigger file */
 		char *src;
@@ -749,18 +818,13 @@ static void crashlog_send_crash(struct event_t *e, char *eid,
 
 static void crashlog_send_info(struct event_t *e, char *eid)
 {
-	int id;
 	struct info_t *info = (struct info_t *)e->private;
-	struct log_t *log;
+	struct log_collect lc;
 
 	hist_raise_event(etype_str[e->event_type], info->name, e->dir, "", eid);
 	if (!e->dir)
 		return;
-	for_each_log_collect(id, log, info) {
-		if (!log)
-			continue;
-		log->get(log, (void *)e->dir);
-	}
+	collect_logs(info->log, e->dir, &lc);
 }
 
 static void crashlog_send_uptime(void)
@@ -17,6 +17,9 @@
 #include "strutils.h"
 #include "log_sys.h"
 
+/* exit status of a child that could not run the command, as sh does */
+#define EXEC_FAILED	127
+
 /**
  * Execute a command described in an array of pointers to null-terminated
  * strings, and redirect the output to specified file. The file will be
@@ -33,7 +36,8 @@
  *	   retrieved, or it was killed/stopped by signal, the return value
  *	   is -1.
  *	   If all system calls succeed, then the return value is the
- *	   termination status of the child process used to execute command.
+ *	   termination status of the child process used to execute command,
+ *	   127 if the child could not open outfile or execute the command.
  */
 int execv_out2file(char * const argv[], const char *outfile)
 {
@@ -46,31 +50,24 @@ int execv_out2file(char * const argv[], const char *outfile)
 	}
 
 	if (pid == 0) {
-		int res;
-		int fd = -1;
-
+		int fd;
+
+		/*
+		 * The child must never return: it would carry on as a copy
+		 * of the caller, e.g. a log collecting worker of the sender.
+		 * Callers may be multi-threaded, so it doesn't log either,
+		 * the parent reports the exit status.
+		 */
 		if (outfile) {
 			fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0664);
-			if (fd < 0) {
-				LOGE("open error (%s)\n", strerror(errno));
-				return -1;
-			}
-			res = dup2(fd, STDOUT_FILENO);
-			if (res < 0) {
-				close(fd);
-				LOGE("dup2 error (%s)\n", strerror(errno));
-				return -1;
-			}
+			if (fd < 0)
+				_exit(EXEC_FAILED);
+			if (dup2(fd, STDOUT_FILENO) < 0)
+				_exit(EXEC_FAILED);
 		}
 
-		res = execvp(argv[0], argv);
-		if (res == -1) {
-			if (fd > 0)
-				close(fd);
-			LOGE("execvp (%s) failed, error (%s)\n", argv[0],
-			     strerror(errno));
-			return -1;
-		}
+		execvp(argv[0], argv);
+		_exit(EXEC_FAILED);
 	} else {
 		pid_t res;
 		int status;
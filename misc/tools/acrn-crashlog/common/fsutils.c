@@ -32,6 +32,7 @@
 #include <sys/vfs.h>
 #include <sys/wait.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <ftw.h>
 #include "fsutils.h"
 #include "cmdutils.h"
@@ -222,10 +223,88 @@ void unmap_file(struct mm_file_t *mfile)
 }
 
 /**
- * Copy the tail data from a file which supports mmap(2)-like operations
- * to new file.
+ * Copy a range of a file to the current position of another file. The data
+ * stays in the kernel (copy_file_range(2), or sendfile(2) where the file
+ * systems do not support it) unless neither is possible for this pair of
+ * files, then it goes through a read/write loop.
  *
- * @param src File path to copy, this file supports mmap(2)-like operations
+ * @param fsrc File descriptor to copy from.
+ * @param fdest File descriptor to copy to.
+ * @param offset Where to start in fsrc.
+ * @param len Bytes will copy at most, the copy stops at the end of fsrc.
+ *
+ * @return The number of bytes copied if successful, or a negative
+ *	   errno-style value if not.
+ */
+static ssize_t copy_fd_range(int fsrc, int fdest, off_t offset, size_t len)
+{
+	char buffer[CPBUFFERSIZE];
+	enum { COPY_RANGE, SENDFILE, READ_WRITE } mode = COPY_RANGE;
+	const size_t max_chunk = 1UL << 30;
+	size_t done = 0;
+	size_t chunk;
+	ssize_t n;
+	ssize_t w;
+
+	while (done < len) {
+		chunk = MIN(len - done, max_chunk);
+		if (mode == COPY_RANGE) {
+			n = copy_file_range(fsrc, &offset, fdest, NULL,
+					    chunk, 0);
+		} else if (mode == SENDFILE) {
+			n = sendfile(fdest, fsrc, &offset, chunk);
+		} else {
+			n = pread(fsrc, buffer, MIN(chunk, CPBUFFERSIZE),
+				  offset);
+			for (w = 0; n > 0 && w < n; ) {
+				ssize_t res = write(fdest, buffer + w, n - w);
+
+				if (res < 0) {
+					if (errno == EINTR)
+						continue;
+					return -errno;
+				}
+				w += res;
+			}
+			if (n > 0)
+				offset += n;
+		}
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* not supported for these files, try the next way */
+			if (mode != READ_WRITE &&
+			    (errno == EXDEV || errno == EINVAL ||
+			     errno == ENOSYS || errno == EOPNOTSUPP ||
+			     errno == EBADF)) {
+				mode++;
+				continue;
+			}
+			return -errno;
+		}
+
+		if (n == 0) {
+			/*
+			 * Some pseudo files report nothing to the in-kernel
+			 * copies, make sure with a plain read.
+			 */
+			if (!done && mode != READ_WRITE) {
+				mode = READ_WRITE;
+				continue;
+			}
+			break;
+		}
+		done += n;
+	}
+
+	return done;
+}
+
+/**
+ * Copy the tail data from a file to new file.
+ *
+ * @param src File path to copy, this file must support lseek(2)
  *            (i.e., it cannot be a socket).
  * @param dest New file path to generate.
  * @param limit Size of data, if limit equals 0, this function
@@ -236,7 +315,7 @@ void unmap_file(struct mm_file_t *mfile)
  */
 int do_copy_tail(const char *src, const char *dest, int limit)
 {
-	int rc = 0;
+	ssize_t rc = 0;
 	int fsrc = -1, fdest = -1;
 	struct stat info;
 	off_t offset = 0;
@@ -244,17 +323,21 @@ int do_copy_tail(const char *src, const char *dest, int limit)
 	if (src == NULL || dest == NULL)
 		return -EINVAL;
 
-	if (stat(src, &info) < 0)
-		return -errno;
-
 	fsrc = open(src, O_RDONLY);
 	if (fsrc < 0)
 		return -errno;
 
+	if (fstat(fsrc, &info) < 0) {
+		rc = -errno;
+		close(fsrc);
+		return rc;
+	}
+
 	fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660);
 	if (fdest < 0) {
+		rc = -errno;
 		close(fsrc);
-		return -errno;
+		return rc;
 	}
 
 	if ((limit == 0) || (info.st_size < limit))
@@ -263,12 +346,95 @@ int do_copy_tail(const char *src, const char *dest, int limit)
 	if (info.st_size > limit)
 		offset = info.st_size - limit;
 
-	rc = sendfile(fdest, fsrc, &offset, limit);
+	rc = copy_fd_range(fsrc, fdest, offset, limit);
 
 	close(fsrc);
 	close(fdest);
 
-	return rc == -1 ? -errno : rc;
+	return rc;
+}
+
+/**
+ * Copy the last lines of a file to new file. The file is searched from
+ * its end, only the part holding these lines is read.
+ *
+ * @param src File path to copy, this file must support lseek(2).
+ * @param dest New file path to generate.
+ * @param lines Number of lines to copy.
+ *
+ * @return The number of bytes written to new file if successful, 0 if src
+ *	   has no line (dest is not created then), or a negative errno-style
+ *	   value if not.
+ */
+int do_copy_tail_lines(const char *src, const char *dest, int lines)
+{
+	char buffer[CPBUFFERSIZE];
+	ssize_t rc = 0;
+	int fsrc, fdest;
+	struct stat info;
+	off_t pos;
+	off_t start = 0;
+	size_t chunk;
+	int found = 0;
+	int i;
+
+	if (src == NULL || dest == NULL || lines <= 0)
+		return -EINVAL;
+
+	fsrc = open(src, O_RDONLY);
+	if (fsrc < 0)
+		return -errno;
+
+	if (fstat(fsrc, &info) < 0) {
+		rc = -errno;
+		goto close_src;
+	}
+
+	/*
+	 * The last lines start after the (lines + 1)th '\n' from the end,
+	 * counting the one ending the file if any.
+	 */
+	for (pos = info.st_size; pos > 0 && found <= lines; ) {
+		chunk = MIN((size_t)pos, CPBUFFERSIZE);
+		pos -= chunk;
+		rc = pread(fsrc, buffer, chunk, pos);
+		if (rc < 0) {
+			if (errno == EINTR) {
+				pos += chunk;
+				continue;
+			}
+			rc = -errno;
+			goto close_src;
+		}
+		if ((size_t)rc != chunk) {
+			/* the file shrank under us */
+			rc = -EAGAIN;
+			goto close_src;
+		}
+		for (i = chunk - 1; i >= 0; i--) {
+			if (buffer[i] == '\n' && ++found > lines) {
+				start = pos + i + 1;
+				break;
+			}
+		}
+	}
+	if (!found) {
+		rc = 0;
+		goto close_src;
+	}
+
+	fdest = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	if (fdest < 0) {
+		rc = -errno;
+		goto close_src;
+	}
+
+	rc = copy_fd_range(fsrc, fdest, start, info.st_size - start);
+	close(fdest);
+
+close_src:
+	close(fsrc);
+	return rc;
 }
 
 /**
@@ -524,7 +690,8 @@ int file_update_int(const char *filename, unsigned int current,
 }
 
 /**
- * Copy file in a read/write loop.
+ * Copy file, in the kernel if src is a regular file, or in a read/write
+ * loop (device nodes, pipes).
  *
  * @param src Path of source file.
  * @param dest Path of destin file.
@@ -542,6 +709,7 @@ int do_copy_limit(const char *src, const char *des, size_t limitsize)
 	size_t rbsize = CPBUFFERSIZE;
 	ssize_t r_count;
 	ssize_t w_count;
+	struct stat info;
 
 	if (src == NULL || des == NULL)
 		return -1;
@@ -561,6 +729,16 @@ int do_copy_limit(const char *src, const char *des, size_t limitsize)
 		return -1;
 	}
 
+	if (!fstat(fd1, &info) && S_ISREG(info.st_mode)) {
+		r_count = copy_fd_range(fd1, fd2, 0,
+					limitsize > 0 ? limitsize : SIZE_MAX);
+		if (r_count < 0) {
+			LOGE("copy failed, err:%s\n", strerror(-r_count));
+			rc = -1;
+		}
+		goto close;
+	}
+
 	/* Start copy loop */
 	while (1) {
 		if (limitsize > 0) {
@@ -601,6 +779,7 @@ int do_copy_limit(const char *src, const char *des, size_t limitsize)
 		dsize += w_count;
 	}
 
+close:
 	if (fd1 >= 0)
 		close(fd1);
 	if (fd2 >= 0)
@@ -95,6 +95,7 @@ int mm_count_lines(struct mm_file_t *mfile);
 struct mm_file_t *mmap_file(const char *path);
 void unmap_file(struct mm_file_t *mfile);
 int do_copy_tail(const char *src, const char *dest, int limit);
+int do_copy_tail_lines(const char *src, const char *dest, int lines);
 int do_mv(char *src, char *dest);
 ssize_t append_file(const char *filename, const char *text, size_t tlen);
 int replace_file_head(char *filename, char *text);
@@ -9,6 +9,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
 #include "log_sys.h"
 #include "crash_dump.h"
 #include "cmdutils.h"
@@ -22,7 +32,13 @@
 #define GET_OPEN_FILES "/proc/%d/fd"
 #define DEBUGGER_SIGNAL (__SIGRTMIN + 3)
 #define DUMP_FILE "/tmp/core"
+/* compressed cores are kept next to their usercrash file, as cores/xx.zst */
+#define CORE_DIR "cores"
 #define BUFFER_SIZE 8196
+/* largest chunk moved from the core pipe, or compressed, at once */
+#define CORE_CHUNK (1024 * 1024)
+/* fastest level, cores compress well anyway */
+#define CORE_ZSTD_LEVEL 1
 #define LINK_LEN 512
 #define TID "Tgid:"
 /* 128 means the length of the DUMP_FILE */
@@ -79,39 +95,282 @@ static const char *get_signame(int sig)
 	}
 }
 
+/*
+ * The core is captured from the pipe to DUMP_FILE, for gdb. The crashing
+ * process is only released by the kernel once all of it is read, so it is
+ * moved with splice, without going through user space. When built with
+ * libzstd, a thread compresses the core while it is captured, and goes on
+ * while gdb runs; the compressed core is kept with the usercrash file.
+ */
+struct core_capture {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	off_t captured;		/* bytes in DUMP_FILE so far */
+	int done;		/* no more bytes to come */
+	unsigned long capture_ms;
+	unsigned long gdb_ms;
+#ifdef HAVE_LIBZSTD
+	pthread_t tid;
+	int compressing;
+	char zpath[PATH_MAX];
+	off_t compressed;	/* bytes in zpath */
+	unsigned long compress_ms;
+	int zret;
+#endif
+};
+
+static unsigned long ms_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void core_captured(struct core_capture *cc, off_t captured, int done)
+{
+	pthread_mutex_lock(&cc->mtx);
+	cc->captured = captured;
+	cc->done = done;
+	pthread_cond_signal(&cc->cond);
+	pthread_mutex_unlock(&cc->mtx);
+}
+
+#ifdef HAVE_LIBZSTD
+static int compress_core_chunks(struct core_capture *cc, int in_fd,
+				int out_fd, ZSTD_CCtx *cctx)
+{
+	char *in_buf;
+	char *out_buf;
+	size_t out_size = ZSTD_CStreamOutSize();
+	off_t pos = 0;
+	off_t avail;
+	int done;
+	ssize_t len;
+	size_t ret;
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	ZSTD_EndDirective mode;
+
+	in_buf = malloc(CORE_CHUNK);
+	out_buf = malloc(out_size);
+	if (!in_buf || !out_buf) {
+		LOGE("out of memory\n");
+		goto err;
+	}
+
+	do {
+		pthread_mutex_lock(&cc->mtx);
+		while (!cc->done && cc->captured == pos)
+			pthread_cond_wait(&cc->cond, &cc->mtx);
+		avail = cc->captured - pos;
+		done = cc->done;
+		pthread_mutex_unlock(&cc->mtx);
+
+		len = 0;
+		if (avail) {
+			len = pread(in_fd, in_buf, MIN(avail, CORE_CHUNK), pos);
+			if (len <= 0) {
+				LOGE("read core failed, error (%s)\n",
+				     strerror(errno));
+				goto err;
+			}
+			pos += len;
+		}
+
+		/* the frame is ended once all of the core was compressed */
+		mode = (done && avail == len) ? ZSTD_e_end : ZSTD_e_continue;
+		in.src = in_buf;
+		in.size = len;
+		in.pos = 0;
+		do {
+			out.dst = out_buf;
+			out.size = out_size;
+			out.pos = 0;
+			ret = ZSTD_compressStream2(cctx, &out, &in, mode);
+			if (ZSTD_isError(ret)) {
+				LOGE("compress core failed, error (%s)\n",
+				     ZSTD_getErrorName(ret));
+				goto err;
+			}
+			if (write(out_fd, out_buf, out.pos) !=
+			    (ssize_t)out.pos) {
+				LOGE("write compressed core failed\n");
+				goto err;
+			}
+			cc->compressed += out.pos;
+		} while (mode == ZSTD_e_end ? ret : in.pos < in.size);
+	} while (mode != ZSTD_e_end);
+
+	free(in_buf);
+	free(out_buf);
+	return 0;
+err:
+	free(in_buf);
+	free(out_buf);
+	return -1;
+}
+
+static void *compress_core(void *arg)
+{
+	struct core_capture *cc = arg;
+	struct timespec start;
+	ZSTD_CCtx *cctx;
+	int in_fd;
+	int out_fd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cc->zret = -1;
+	/* DUMP_FILE is created before this thread starts */
+	in_fd = open(DUMP_FILE, O_RDONLY);
+	if (in_fd == -1) {
+		LOGE("open core failed, error (%s)\n", strerror(errno));
+		return NULL;
+	}
+	out_fd = open(cc->zpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd == -1) {
+		LOGE("create %s failed, error (%s)\n", cc->zpath,
+		     strerror(errno));
+		close(in_fd);
+		return NULL;
+	}
+
+	cctx = ZSTD_createCCtx();
+	if (cctx) {
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+				       CORE_ZSTD_LEVEL);
+		cc->zret = compress_core_chunks(cc, in_fd, out_fd, cctx);
+		ZSTD_freeCCtx(cctx);
+	}
+	close(in_fd);
+	close(out_fd);
+	cc->compress_ms = ms_since(&start);
+	if (cc->zret)
+		unlink(cc->zpath);
+	return NULL;
+}
+
+/**
+ * Start compressing the core into CORE_DIR, next to the usercrash file
+ * out_fd is, while it is captured.
+ */
+static void start_compress_core(struct core_capture *cc, int out_fd)
+{
+	char link[32];
+	char path[PATH_MAX];
+	char name[PATH_MAX];
+	char dir[PATH_MAX];
+	ssize_t len;
+	int ret;
+
+	ret = snprintf(link, sizeof(link), "/proc/self/fd/%d", out_fd);
+	if (s_not_expect(ret, sizeof(link)))
+		return;
+	len = readlink(link, path, sizeof(path) - 1);
+	if (len <= 0)
+		return;
+	path[len] = '\0';
+	memcpy(name, path, len + 1);
+
+	ret = snprintf(dir, sizeof(dir), "%s/" CORE_DIR, dirname(path));
+	if (s_not_expect(ret, sizeof(dir)))
+		return;
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+		LOGE("create %s failed, error (%s)\n", dir, strerror(errno));
+		return;
+	}
+	ret = snprintf(cc->zpath, sizeof(cc->zpath), "%s/%s.zst", dir,
+		       basename(name));
+	if (s_not_expect(ret, sizeof(cc->zpath)))
+		return;
+
+	if (pthread_create(&cc->tid, NULL, compress_core, cc)) {
+		LOGE("create compress thread failed\n");
+		return;
+	}
+	cc->compressing = 1;
+}
+#endif
+
 /**
- * Save core dump to file.
- * @filename: core dump file name
+ * Capture the core dump from stdin to DUMP_FILE.
+ * @cc: progress of the capture, for the compress thread
+ * @out_fd: usercrash file fd
  * return 0 on success, or -1 on error
  */
-static int save_coredump(const char *filename)
+static int capture_coredump(struct core_capture *cc, int out_fd)
 {
-	size_t read_len;
-	size_t write_len;
-	char input_buffer[BUFFER_SIZE];
-	FILE *dump_file;
-
-	/* open dump file in write and binary mode */
-	dump_file = fopen(filename, "wb");
-	if (dump_file == NULL) {
-		LOGE("fopen core file failed\n");
+	int dump_fd;
+	ssize_t len;
+	off_t captured = 0;
+	int use_splice = 1;
+	char buf[BUFFER_SIZE];
+	struct timespec start;
+	int ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dump_fd = open(DUMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (dump_fd == -1) {
+		LOGE("open core file failed, error (%s)\n", strerror(errno));
+		core_captured(cc, 0, 1);
 		return -1;
 	}
-	/* Read from STDIN and write to dump file */
+#ifdef HAVE_LIBZSTD
+	start_compress_core(cc, out_fd);
+#else
+	(void)out_fd;
+#endif
+
 	while (1) {
-		read_len = fread(input_buffer, 1, BUFFER_SIZE, stdin);
-		if (read_len == 0)
+		if (use_splice) {
+			len = splice(STDIN_FILENO, NULL, dump_fd, NULL,
+				     CORE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+			/* stdin is not a pipe */
+			if (len == -1 && errno == EINVAL && !captured) {
+				use_splice = 0;
+				continue;
+			}
+		} else {
+			len = read(STDIN_FILENO, buf, sizeof(buf));
+			if (len > 0 && write(dump_fd, buf, len) != len)
+				len = -1;
+		}
+		if (len == -1 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			if (len == -1) {
+				LOGE("capture core failed, error (%s)\n",
+				     strerror(errno));
+				ret = -1;
+			}
 			break;
-		write_len = fwrite(input_buffer, 1, read_len, dump_file);
-		if (write_len == 0) {
-			LOGE("fwrite error\n");
-			fclose(dump_file);
-			return -1;
 		}
+		captured += len;
+		core_captured(cc, captured, 0);
 	}
 
-	fclose(dump_file);
-	return 0;
+	close(dump_fd);
+	cc->capture_ms = ms_since(&start);
+	core_captured(cc, captured, 1);
+	return ret;
+}
+
+static void end_capture(struct core_capture *cc, int fd)
+{
+	loginfo(fd, "\nCore:\n\n");
+	loginfo(fd, "captured %lld bytes in %lums\n",
+		(long long)cc->captured, cc->capture_ms);
+	if (cc->gdb_ms)
+		loginfo(fd, "backtrace in %lums\n", cc->gdb_ms);
+#ifdef HAVE_LIBZSTD
+	if (!cc->compressing)
+		return;
+	pthread_join(cc->tid, NULL);
+	if (!cc->zret)
+		loginfo(fd, "compressed to %lld bytes in %lums, %s\n",
+			(long long)cc->compressed, cc->compress_ms, cc->zpath);
+#endif
 }
 
 static int get_backtrace(int pid, int fd, int sig, const char *comm)
@@ -120,36 +379,51 @@ static int get_backtrace(int pid, int fd, int sig, const char *comm)
 	char format[FORMAT_LENGTH];
 	size_t len, ret;
 	int flen;
+	struct core_capture cc = {
+		.mtx = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	struct timespec start;
+	int res = 0;
 
-	loginfo(fd, "\nBackTrace:\n\n");
 	memset(format, 0, sizeof(format));
 	if (sig == DEBUGGER_SIGNAL) {
 		flen = snprintf(format, sizeof(format), "-p %d", pid);
 	} else {
 		flen = snprintf(format, sizeof(format), "%s %s", comm,
 				DUMP_FILE);
-		if (save_coredump(DUMP_FILE) == -1) {
+		if (capture_coredump(&cc, fd) == -1) {
 			LOGE("save core file failed\n");
-			return -1;
+			res = -1;
+			goto out;
 		}
 	}
 	if (s_not_expect(flen, sizeof(format))) {
 		LOGE("failed to generate format\n");
-		return -1;
+		res = -1;
+		goto out;
 	}
+	loginfo(fd, "\nBackTrace:\n\n");
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	len = exec_out2mem(&membkt, GET_GDB_INFO, format);
 	if (len <= 0) {
 		LOGE("get gdb info failed\n");
-		return -1;
+		res = -1;
+		goto out;
 	}
 	ret = write(fd, membkt, len);
 	free(membkt);
 	if (ret != len) {
 		LOGE("write file failed\n");
-		return -1;
+		res = -1;
+		goto out;
 	}
-	return 0;
+	cc.gdb_ms = ms_since(&start);
 
+out:
+	if (sig != DEBUGGER_SIGNAL)
+		end_capture(&cc, fd);
+	return res;
 }
 
 /**
@@ -175,6 +175,7 @@ static int get_usercrash(struct crash_node *crash)
 	int result;
 	int len;
 	char file_name[FILE_PATH_LEN_MAX];
+	char core_name[FILE_PATH_LEN_MAX];
 
 	memset(file_name, 0, FILE_PATH_LEN_MAX);
 	len = snprintf(file_name, sizeof(file_name), "%s/usercrash_%02d",
@@ -188,6 +189,14 @@ static int get_usercrash(struct crash_node *crash)
 		LOGE("failed to unlink usercrash at %s\n", file_name);
 		return -1;
 	}
+	/* and the compressed core of the previous crash, see crash_dump.c */
+	len = snprintf(core_name, sizeof(core_name),
+		       "%s/cores/usercrash_%02d.zst", usercrash_directory,
+		       next_usercrash);
+	if (!s_not_expect(len, sizeof(core_name)) &&
+	    unlink(core_name) != 0 && errno != ENOENT)
+		LOGE("failed to unlink core at %s\n", core_name);
+
 	result = open(file_name, O_CREAT | O_WRONLY, 0644);
 	if (result == -1) {
 		LOGE("failed to create usercrash at %s\n", file_name);
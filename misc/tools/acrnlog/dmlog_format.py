@@ -0,0 +1,123 @@
+#!/usr/bin/python3
+# -*- coding: UTF-8 -*-
+#
+# Copyright (C) 2020 Intel Corporation.
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+"""Format the binary disk log of acrn-dm (--logger_setting disk,level=<n>,format=bin)
+
+Usage: dmlog_format.py <log_file> [<log_file> ...]
+
+Every record holds the printf format string and its arguments as logged by
+acrn-dm. They are formatted here and printed as the text disk log would be:
+"[<seconds>.<usecs>] <message>".
+"""
+
+import re
+import struct
+import sys
+
+MAGIC = b"ACRNDMLG"
+VERSION = 1
+HEADER = struct.Struct("<8sII")
+RECORD = struct.Struct("<IIQ")
+
+# flags, width, precision, length modifier, conversion
+SPEC = re.compile(r"%([-+ #0']*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|L|q|j|z|t)?([diouxXeEfFgGcsp%])")
+
+
+def read_args(data, off, end):
+    args = []
+    while off < end:
+        tag = data[off:off + 1]
+        off += 1
+        if tag == b"i":
+            args.append(struct.unpack_from("<q", data, off)[0])
+            off += 8
+        elif tag == b"u":
+            args.append(struct.unpack_from("<Q", data, off)[0])
+            off += 8
+        elif tag == b"f":
+            args.append(struct.unpack_from("<d", data, off)[0])
+            off += 8
+        elif tag == b"s":
+            slen = struct.unpack_from("<I", data, off)[0]
+            off += 4
+            args.append(data[off:off + slen].decode("utf-8", "replace"))
+            off += slen
+        else:
+            raise ValueError("unknown argument tag %r" % tag)
+    return args
+
+
+def format_msg(fmt, args):
+    out = []
+    pos = 0
+    args = iter(args)
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, prec, _, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        if width == "*":
+            width = str(next(args))
+        if prec == "*":
+            prec = str(next(args))
+        spec = "%" + flags.replace("'", "") + (width or "")
+        if prec is not None:
+            spec += "." + prec
+        val = next(args)
+        if conv == "p":
+            out.append((spec + "s") % hex(val))
+        elif conv == "c":
+            out.append((spec + "c") % chr(val))
+        elif conv == "u":
+            out.append((spec + "d") % val)
+        else:
+            out.append((spec + conv) % val)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, _ = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION:
+        sys.stderr.write("%s: not an acrn-dm binary log\n" % path)
+        return 1
+
+    off = HEADER.size
+    while off + RECORD.size <= len(data):
+        rlen, fmt_len, ts = RECORD.unpack_from(data, off)
+        if rlen < RECORD.size + fmt_len or off + rlen > len(data):
+            sys.stderr.write("%s: truncated record at %d\n" % (path, off))
+            return 1
+        fmt_off = off + RECORD.size
+        fmt = data[fmt_off:fmt_off + fmt_len - 1].decode("utf-8", "replace")
+        try:
+            msg = format_msg(fmt, read_args(data, fmt_off + fmt_len, off + rlen))
+        except (ValueError, TypeError, StopIteration, struct.error) as e:
+            msg = "<bad record: %s> %s\n" % (e, fmt)
+        sys.stdout.write("[%5lu.%06lu] %s" % (ts // 1000000000, ts % 1000000000 // 1000, msg))
+        off += rlen
+    return 0
+
+
+def main():
+    if len(sys.argv) < 2 or sys.argv[1] in ("-h", "--help"):
+        print(__doc__)
+        return 1
+
+    ret = 0
+    for path in sys.argv[1:]:
+        ret |= dump(path)
+    return ret
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -30,6 +30,7 @@ LIST_EVENTS = {
     'VMEXIT_EPT_VIOLATION':        VMEXIT_ENTRY + 0x00000030,
     'VMEXIT_EPT_MISCONFIGURATION': VMEXIT_ENTRY + 0x00000031,
     'VMEXIT_RDTSCP':               VMEXIT_ENTRY + 0x00000033,
+    'VMEXIT_WBINVD':               VMEXIT_ENTRY + 0x00000036,
     'VMEXIT_APICV_WRITE':          VMEXIT_ENTRY + 0x00000038,
     'VMEXIT_APICV_ACCESS':         VMEXIT_ENTRY + 0x00000039,
     'VMEXIT_APICV_VIRT_EOI':       VMEXIT_ENTRY + 0x0000003A,
@@ -52,6 +53,7 @@ NR_EXITS = {
     'VMEXIT_EPT_VIOLATION': 0,
     'VMEXIT_EPT_MISCONFIGURATION': 0,
     'VMEXIT_RDTSCP': 0,
+    'VMEXIT_WBINVD': 0,
     'VMEXIT_APICV_WRITE': 0,
     'VMEXIT_UNHANDLED': 0
 }
@@ -72,6 +74,7 @@ TIME_IN_EXIT = {
     'VMEXIT_EPT_VIOLATION': 0,
     'VMEXIT_EPT_MISCONFIGURATION': 0,
     'VMEXIT_RDTSCP': 0,
+    'VMEXIT_WBINVD': 0,
     'VMEXIT_APICV_WRITE': 0,
     'VMEXIT_UNHANDLED': 0
 }